@@ -1,5 +1,6 @@
 #include"as.h"
 #include"hitem.h"
+#include"cputimer.h"
 
 /**
 * @brief trace a ray in the bvh acceleration struct
@@ -9,21 +10,20 @@
 * @return true : found a hit
 */
 bool AccelStruct::traceRayInAccel(const Ray& ray,int32_t node_idx,IntersectRecord& inst,bool is_tlas)const{
-   assert(node_idx>=0&&node_idx<tree_->size());
+   assert(node_idx>=0&&size_t(node_idx)<tree_->size());
+   const BVHnode& node=(*tree_)[node_idx];
     // optimize direction: put box hit test outside as a sort of guidance
-   if(!tree_->at(node_idx).anyHit(ray))
+   if(!node.anyHit(ray))
        return false;
-    
-    auto right=tree_->at(node_idx).right;
-    auto left=tree_->at(node_idx).left;
 
     // reach leaf node, go down to next level
-    if(left==-1&&right==-1){
+    if(node.isLeaf()){
 
         inst.bvhnode_idx_=node_idx;
         return traceRayInDetail(ray,inst);
     }
-    assert(left!=-1&&right!=-1);
+    int32_t left=node.left();
+    int32_t right=node.right();
 
     IntersectRecord left_hit,right_hit;
 
@@ -62,41 +62,148 @@ bool AccelStruct::traceRayInAccel(const Ray& ray,int32_t node_idx,IntersectRecor
  * @return true : do get a hit
  */
 bool BLAS::traceRayInDetail(const Ray& ray,IntersectRecord& inst)const{
+    const BVHnode& node=(*tree_)[inst.bvhnode_idx_];
+    return intersectPrimitives(ray,node.offset,node.primitive_num,inst);
+}
+
+bool BLAS::intersectPrimitives(const Ray& ray,uint32_t start,uint32_t num,IntersectRecord& inst)const{
 
     bool hitted=false;
 
-    int id=inst.bvhnode_idx_;
-    BVHnode& node=tree_->at(id);
     auto& vertices=object_->getVertices();
     auto& indices=object_->getIndices();
 
     // check all the primitives inside
-    for(int i=0;i<node.primitive_num;++i){
+    for(uint32_t i=0;i<num;++i){
         // construct Hitem
         std::vector<const Vertex*> temp;
-        auto idx=primitives_indices_->at(node.prmitive_start+i);
+        auto idx=(*primitives_indices_)[start+i];
         for(int j=0;j<3;++j){
             temp.push_back(&vertices[indices[idx*3+j]]);
         }
         Htriangle tri(temp[0],temp[1],temp[2],object_->getFaceMtl(idx));
 
-        // record the nearest hit
-        if(tri.rayIntersect(ray,inst))
+        // record the nearest hit, the record only changes for a nearer one
+        float nearest=inst.t_;
+        if(tri.rayIntersect(ray,inst)){
+            if(inst.t_<nearest)
+                inst.primitive_idx_=idx;
             hitted=true;
+        }
     }
 
     return hitted;
 
 }
 
+bool BLAS::traceRayInQuantized(const Ray& ray,IntersectRecord& inst)const{
+    const BVHnode& root=(*tree_)[0];
+    if(!root.anyHit(ray))
+        return false;
+    // a mesh of a single leaf has no quantized node
+    if(qtree_->empty())
+        return intersectPrimitives(ray,root.offset,root.primitive_num,inst);
+    return traceRayInQuantized(ray,QBVHray(ray),0,QBVHframe(root.bbox),inst);
+}
+
+/**
+ * @brief go down the quantized node `node_idx` whose box is `frame`, the hit test of its box has been passed.
+ *        Unlike `traceRayInAccel` all the leaves write the nearest hit into the same record.
+ */
+bool BLAS::traceRayInQuantized(const Ray& ray,const QBVHray& qray,uint32_t node_idx,const QBVHframe& frame,
+                               IntersectRecord& inst)const{
+    const QBVHnode& node=(*qtree_)[node_idx];
+    QBVHframe children;
+    decodeChildren(node,frame,children);
+    int hit=hitChildren(children,qray);
+
+    bool hitted=false;
+    for(int c=0;c<2;++c){
+        if(!(hit&(1<<c)))
+            continue;
+        if(node.isLeaf(c))
+            hitted|=intersectPrimitives(ray,node.child[c],node.primitive_num[c],inst);
+        else
+            hitted|=traceRayInQuantized(ray,qray,node.child[c],children.child(c),inst);
+    }
+    return hitted;
+}
+
+void BLAS::compress(bool report){
+    auto qtree=std::make_unique<std::vector<QBVHnode>>();
+    if(!quantizeBVH(*tree_,*qtree)){
+        std::cerr<<"BLAS::compress: a leaf has more than 255 primitives, the tree is left uncompressed"<<std::endl;
+        return;
+    }
+    qtree_=std::move(qtree);
+    if(report)
+        reportCompression();
+
+    // the rays only need the root box, and the primitives all in one leaf if the root is one
+    if(primitives_indices_->empty())
+        return;
+    BVHnode root=(*tree_)[0];
+    root.offset=0;
+    root.primitive_num=(uint32_t)primitives_indices_->size();
+    tree_=std::make_unique<std::vector<BVHnode>>(1,root);
+}
+
+void BLAS::reportCompression()const{
+    if(!qtree_)
+        return;
+    // rays from a sphere around the mesh toward points of its box, the same ones through both trees
+    constexpr int RAY_NUM=1<<14;
+    const AABB3d& box=(*tree_)[0].bbox;
+    glm::vec3 center=0.5f*(box.min+box.max);
+    float radius=glm::length(box.max-box.min);
+    PCGRandom rng(0);
+    std::vector<Ray> rays;
+    rays.reserve(RAY_NUM);
+    for(int i=0;i<RAY_NUM;++i){
+        float z=1.f-2.f*rng.nextFloat();
+        float phi=2.f*srender::PI*rng.nextFloat();
+        float r=std::sqrt(std::max(0.f,1.f-z*z));
+        glm::vec3 origin=center+radius*glm::vec3(r*std::cos(phi),r*std::sin(phi),z);
+        glm::vec3 target=box.min+(box.max-box.min)*glm::vec3(rng.nextFloat(),rng.nextFloat(),rng.nextFloat());
+        rays.emplace_back(origin,target-origin);
+    }
+
+    CPUTimer timer;
+    std::vector<float> full_t(RAY_NUM);
+    timer.start("Full");
+    for(int i=0;i<RAY_NUM;++i){
+        IntersectRecord rec;
+        full_t[i]=traceRayInAccel(rays[i],0,rec,false)?rec.t_:-1.f;
+    }
+    timer.stop("Full");
+    int differ=0;
+    timer.start("Quantized");
+    for(int i=0;i<RAY_NUM;++i){
+        IntersectRecord rec;
+        float t=traceRayInQuantized(rays[i],rec)?rec.t_:-1.f;
+        differ+=t!=full_t[i];
+    }
+    timer.stop("Quantized");
+
+    auto rate=[&](const std::string& name){
+        return RAY_NUM/std::max(timer.getElapsedTime(name),1e-6f);
+    };
+    std::cout<<"BLAS of "<<object_->getFaceNum()<<" faces: full tree "<<tree_->size()*sizeof(BVHnode)/1024.f<<" KB, "
+             <<rate("Full")<<" rays/s; quantized "<<(qtree_->size()*sizeof(QBVHnode)+sizeof(AABB3d))/1024.f<<" KB, "
+             <<rate("Quantized")<<" rays/s; primitive indices "<<primitives_indices_->size()*sizeof(uint32_t)/1024.f
+             <<" KB either way"<<std::endl;
+    if(differ)
+        std::cerr<<"BLAS::reportCompression: "<<differ<<" of "<<RAY_NUM<<" rays hit elsewhere in the quantized tree"<<std::endl;
+}
+
 /**
  * @brief tranform ray into instance's model world, and continue to trace ray in blas.
  * 
  */
 bool TLAS::traceRayInDetail(const Ray& ray,IntersectRecord& inst)const{
     // find asinstance
-    auto& node=tree_->at(inst.bvhnode_idx_);
-    auto& instance=*all_instances_.at(node.prmitive_start);
+    auto& node=(*tree_)[inst.bvhnode_idx_];
+    auto& instance=*all_instances_[node.offset];
 
     // transform ray into model's space
     auto mat_inv=instance.inv_modle_;
@@ -105,11 +212,13 @@ bool TLAS::traceRayInDetail(const Ray& ray,IntersectRecord& inst)const{
     Ray mray(morigin,mdir);
 
     // dive into blas
-    if(instance.blas_->traceRayInAccel(mray,0,inst,false)){
+    if(instance.blas_->traceRay(mray,inst)){
         // transform intersect record back to world space.
         inst.pos_=instance.modle_*glm::vec4(inst.pos_,1.0);
         inst.normal_=glm::normalize(glm::vec3(glm::transpose(mat_inv)*glm::vec4(inst.normal_,0.0)));
+        inst.geo_normal_=glm::normalize(glm::vec3(glm::transpose(mat_inv)*glm::vec4(inst.geo_normal_,0.0)));
         inst.t_=glm::length(inst.pos_-ray.origin_);
+        inst.instance_idx_=node.offset;
         
         return true;
     }
@@ -117,8 +226,35 @@ bool TLAS::traceRayInDetail(const Ray& ray,IntersectRecord& inst)const{
     return false;
 }
 
+bool TLAS::traceRayInFace(const Ray& ray,uint32_t inst_idx,uint32_t face_idx,IntersectRecord& inst)const{
+    auto& instance=*all_instances_.at(inst_idx);
+    auto& object=instance.blas_->object_;
+    auto& vertices=object->getVertices();
+    auto& indices=object->getIndices();
+
+    // transform ray into model's space
+    auto mat_inv=instance.inv_modle_;
+    auto morigin=mat_inv*glm::vec4(ray.origin_,1.0);
+    auto mdir=mat_inv*glm::vec4(ray.dir_,0.0);
+    Ray mray(morigin,mdir);
+
+    Htriangle tri(&vertices[indices[face_idx*3+0]],&vertices[indices[face_idx*3+1]],&vertices[indices[face_idx*3+2]],object->getFaceMtl(face_idx));
+    if(!tri.rayIntersect(mray,inst))
+        return false;
+
+    // transform intersect record back to world space, the same way as `traceRayInDetail`
+    inst.pos_=instance.modle_*glm::vec4(inst.pos_,1.0);
+    inst.normal_=glm::normalize(glm::vec3(glm::transpose(mat_inv)*glm::vec4(inst.normal_,0.0)));
+    inst.geo_normal_=glm::normalize(glm::vec3(glm::transpose(mat_inv)*glm::vec4(inst.geo_normal_,0.0)));
+    inst.t_=glm::length(inst.pos_-ray.origin_);
+    inst.instance_idx_=inst_idx;
+    inst.primitive_idx_=face_idx;
+
+    return ray.acceptT(inst.t_);
+}
+
 ASInstance::ASInstance(std::shared_ptr<BLAS>blas,const glm::mat4& mat,ShaderType shader):blas_(blas),modle_(mat),shader_(shader){
-    AABB3d rootBox=blas_->tree_->at(0).bbox;
+    AABB3d rootBox=(*blas_->tree_)[0].bbox;
     worldBBox_=rootBox.transform(modle_);
 
     inv_modle_=glm::inverse(modle_);
@@ -128,10 +264,16 @@ ASInstance::ASInstance(std::shared_ptr<BLAS>blas,const glm::mat4& mat,ShaderType
     blas_sboxes_=std::make_unique<std::vector<AABB3d>>(blas_->tree_->size());
 }
 
+// keep the capacity of the per-frame buffers, only their contents are refreshed
 void ASInstance::refreshVertices(){
-    vertices_=std::make_unique<std::vector<Vertex>>();
-    primitives_buffer_=std::make_unique<std::vector<PrimitiveHolder>>();
-    blas_sboxes_=std::make_unique<std::vector<AABB3d>>(blas_->tree_->size());
+    vertices_->clear();
+    primitives_buffer_->clear();
+    blas_sboxes_->assign(blas_->tree_->size(),AABB3d());
+    // the BLAS may have been rebuilt with another leaf size
+    if(leaf_visible_.size()!=blas_->tree_->size()){
+        leaf_visible_.assign(blas_->tree_->size(),0);
+        leaf_visible_prev_.assign(blas_->tree_->size(),0);
+    }
 }
 
 void ASInstance::BLASupdateSBox(){
@@ -142,17 +284,16 @@ void ASInstance::BLASupdateSBox(){
 
 void ASInstance::updateScreenBox(int32_t node_idx,std::vector<BVHnode>&blas_tree,std::vector<uint32_t>& primitive_indices){
 
-    int32_t left_idx=blas_tree[node_idx].left;
-    int32_t right_idx=blas_tree[node_idx].right;
+    const BVHnode& node=blas_tree[node_idx];
 
     auto& sbox=blas_sboxes_->at(node_idx);
     sbox.reset();
 
-    if(left_idx==-1&&right_idx==-1){
+    if(node.isLeaf()){
 
-        int st_primitive=blas_tree[node_idx].prmitive_start;
+        int st_primitive=node.offset;
 
-        for(int i=0;i<blas_tree[node_idx].primitive_num;++i){
+        for(uint32_t i=0;i<node.primitive_num;++i){
 
             uint32_t idx=primitive_indices[st_primitive+i];
 
@@ -168,12 +309,10 @@ void ASInstance::updateScreenBox(int32_t node_idx,std::vector<BVHnode>&blas_tree
         return;
     }
 
-    if(left_idx!=-1){
-        updateScreenBox(left_idx,blas_tree,primitive_indices);
-    }
-    if(right_idx!=-1){
-        updateScreenBox(right_idx,blas_tree,primitive_indices);
-    }
+    int32_t left_idx=node.left();
+    int32_t right_idx=node.right();
+    updateScreenBox(left_idx,blas_tree,primitive_indices);
+    updateScreenBox(right_idx,blas_tree,primitive_indices);
 
     sbox.expand(blas_sboxes_->at(left_idx));
     sbox.expand(blas_sboxes_->at(right_idx));
@@ -195,7 +334,7 @@ void TLAS::buildTLAS(){
         // TO:   bvhnodeIdx-->all_instances_
         assert(element_indices_.size()==all_instances_.size());
         std::vector<std::shared_ptr<ASInstance>> temp;
-        for(int i=0;i<element_indices_.size();++i){
+        for(size_t i=0;i<element_indices_.size();++i){
             temp.emplace_back(all_instances_[element_indices_[i]]);
         }
         all_instances_=temp;
@@ -215,23 +354,20 @@ void TLAS::TLASupdateSBox(){
 
 void TLAS::updateScreenBox(int32_t node_idx){
     
-    int32_t left_idx=tree_->at(node_idx).left;
-    int32_t right_idx=tree_->at(node_idx).right;
+    const BVHnode& node=(*tree_)[node_idx];
     auto& sbox=tlas_sboxes_->at(node_idx);
 
-    if(left_idx==-1&&right_idx==-1){
-        int st=tree_->at(node_idx).prmitive_start;
+    if(node.isLeaf()){
+        int st=node.offset;
         auto& instance=*all_instances_.at(st);
         sbox=instance.blas_sboxes_->at(0);
         return;
     }
 
-    if(left_idx!=-1){
-        updateScreenBox(left_idx);
-    }
-    if(right_idx!=-1){
-        updateScreenBox(right_idx);
-    }
+    int32_t left_idx=node.left();
+    int32_t right_idx=node.right();
+    updateScreenBox(left_idx);
+    updateScreenBox(right_idx);
 
     sbox.reset();
     sbox.expand(tlas_sboxes_->at(left_idx));
@@ -2,6 +2,7 @@
 #include "common/common_include.h"
 #include "common/utils.h"
 #include "bvhbuilder.h"
+#include"qbvh.h"
 #include"softrender/shader.h"
 #include"pathtracer/hitem.h"
 
@@ -22,20 +23,51 @@ class BLAS:public AccelStruct
 {
 public:
     BLAS()=delete;
-    BLAS(std::shared_ptr<ObjectDesc> obj,uint32_t leaf_size){
+    /**
+     * @param compressed quantize the tree(`QBVHnode`), which rays trace instead. Only the root of the full tree is
+     *        kept, as a leaf of all the primitives that the rasterizer draws at once. A tree with leaves too large to
+     *        quantize stays uncompressed.
+     * @param report see `reportCompression`
+     */
+    BLAS(std::shared_ptr<ObjectDesc> obj,uint32_t leaf_size,bool compressed=false,bool report=false){
         // bind object
         object_ = obj;
         // build its bvh
         BVHbuilder builder(obj,leaf_size);
         tree_=builder.moveNodes();
         primitives_indices_=std::make_unique<std::vector<uint32_t>>(std::move(builder.getPridices()));
+        if(compressed)
+            compress(report);
     }
     bool traceRayInDetail(const Ray& ray,IntersectRecord& inst)const override;
 
+    // trace a ray in model space through the quantized tree if there is one, the full one otherwise
+    bool traceRay(const Ray& ray,IntersectRecord& inst)const{
+        return qtree_?traceRayInQuantized(ray,inst):traceRayInAccel(ray,0,inst,false);
+    }
+    bool traceRayInQuantized(const Ray& ray,IntersectRecord& inst)const;
+
+    bool isCompressed()const{ return qtree_!=nullptr; }
+
+private:
+    void compress(bool report);
+
+    /**
+     * @brief print the memory of the full and the quantized tree and how many random rays through the mesh each
+     *        traces per second, to tell whether compressing it is worth it. Needs both trees.
+     */
+    void reportCompression()const;
+
+    // the nearest hit among the primitives [start,start+num) of `primitives_indices_`
+    bool intersectPrimitives(const Ray& ray,uint32_t start,uint32_t num,IntersectRecord& inst)const;
+    bool traceRayInQuantized(const Ray& ray,const QBVHray& qray,uint32_t node_idx,const QBVHframe& frame,
+                             IntersectRecord& inst)const;
+
     
 public:
     std::shared_ptr<ObjectDesc> object_;
     std::unique_ptr<std::vector<uint32_t>> primitives_indices_;     // BVHnode-->primitives_indices_-->object_'s face/primitive
+    std::unique_ptr<std::vector<QBVHnode>> qtree_;                  // nullptr unless compressed
 };
 
 struct PrimitiveHolder{         // because of the neccessity of clipping, each frame updates all the primitives of the instance.
@@ -44,6 +76,7 @@ struct PrimitiveHolder{         // because of the neccessity of clipping, each f
     int32_t vertex_start_pos_;  // point to vertices_
     int32_t vertex_num_;        // specify the range starting from vertex_start_pos_
 
+    PrimitiveHolder(){}
     PrimitiveHolder(ClipFlag cf, int32_t mtl, int32_t startpos, int32_t num)
     : clipflag_(cf),
         mtlidx_(mtl),
@@ -71,6 +104,9 @@ public:
     std::unique_ptr<std::vector<Vertex>> vertices_;
     std::unique_ptr<std::vector<PrimitiveHolder>> primitives_buffer_;
     std::unique_ptr<std::vector<AABB3d>> blas_sboxes_;
+    // per BLAS node: leaves that passed the HZB test in the current / previous frame(two-pass occlusion culling)
+    std::vector<uint8_t> leaf_visible_;
+    std::vector<uint8_t> leaf_visible_prev_;
 
     glm::mat4 modle_;
     glm::mat4 inv_modle_;
@@ -91,6 +127,13 @@ public:
 
     bool traceRayInDetail(const Ray& ray,IntersectRecord& inst)const override;
 
+    /**
+     * @brief intersect a ray with one known face of an instance, without any traversal.
+     * @param inst_idx : index in `all_instances_`
+     * @param face_idx : index of the face in the instance's object
+     */
+    bool traceRayInFace(const Ray& ray,uint32_t inst_idx,uint32_t face_idx,IntersectRecord& inst)const;
+
 public:
     std::vector<std::shared_ptr<ASInstance>> all_instances_;    // BVHnode-->isntances
     std::unique_ptr<std::vector<AABB3d>> tlas_sboxes_;  
@@ -1,5 +1,6 @@
 #include"bvhbuilder.h"
 #include"as.h"
+#include"profiler.h"
 
 /**
  * @brief the ray has an intersection with the aabb box only when tmin<tmax && tmax>0
@@ -40,6 +41,7 @@ bool BVHnode::anyHit(const Ray& ray)const{
 
 
 BVHbuilder::BVHbuilder(std::shared_ptr<ObjectDesc> obj,uint32_t leaf_size):nodes_(std::make_unique<std::vector<BVHnode>>()){
+    PROFILE_ZONE("Build BLAS");
     if(obj->getPrimitiveType()!=PrimitiveType::MESH){
         std::cerr<<"BVHbuilder:obj->getPrimitiveType()!=PrimitiveType::MESH!\n";
         exit(-1);
@@ -53,7 +55,7 @@ BVHbuilder::BVHbuilder(std::shared_ptr<ObjectDesc> obj,uint32_t leaf_size):nodes
         std::cerr<<"BVHbuilder:facenum<=0!\n";
         exit(-1);
     }
-    nodes_->reserve(2*facenum);          // reserve enough space to avoid frequent capacity expansion, which is super vital here!!
+    nodes_->reserve(2*facenum);          // reserve enough space to avoid frequent capacity expansion
     pridices_.resize(facenum);
     for(int i=0;i<facenum;++i){
         pridices_[i]=i;
@@ -61,11 +63,13 @@ BVHbuilder::BVHbuilder(std::shared_ptr<ObjectDesc> obj,uint32_t leaf_size):nodes
         priboxes_.emplace_back(box);
     }
 
-    buildBVH(0,facenum-1);
+    nodes_->emplace_back();
+    buildBVH(0,0,facenum-1);
 }
 
 // building bvh tree for TLAS
 BVHbuilder::BVHbuilder(const std::vector<std::shared_ptr<ASInstance>>& instances):nodes_(std::make_unique<std::vector<BVHnode>>()){
+    PROFILE_ZONE("Build TLAS");
     leaf_size_=1;
     int num=instances.size();
     if(num<=0){
@@ -79,35 +83,29 @@ BVHbuilder::BVHbuilder(const std::vector<std::shared_ptr<ASInstance>>& instances
         priboxes_.emplace_back(instances[i]->worldBBox_);
     }
 
-    buildBVH(0,num-1);
+    nodes_->emplace_back();
+    buildBVH(0,0,num-1);
 }
 
 // building implemention
-int BVHbuilder::buildBVH(uint32_t start,uint32_t end,BVHType type){
-    if(start>end) 
-        return -1;
-
-    // set current node
-    nodes_->emplace_back();
-    int nodeidx=nodes_->size()-1;
-    auto& current=nodes_->at(nodeidx);
-    current.primitive_num=end-start+1;
-    current.prmitive_start=start;
-    current.left=current.right=-1;
-    
-    for(int i=start;i<=end;++i){
-        current.bbox.expand(priboxes_[pridices_[i]]);
+void BVHbuilder::buildBVH(uint32_t node_idx,uint32_t start,uint32_t end,BVHType type){
+    // set current node, as a leaf until it is split. The vector may grow below, it is only reached by index
+    AABB3d bbox;
+    for(uint32_t i=start;i<=end;++i){
+        bbox.expand(priboxes_[pridices_[i]]);
     }
-    current.bbox.enlargeEpsilon(srender::AABBOX_EPS);  // enlarge aabb box a little bit to avoid floating-error
-
+    bbox.enlargeEpsilon(srender::AABBOX_EPS);  // enlarge aabb box a little bit to avoid floating-error
+    (*nodes_)[node_idx].bbox=bbox;
+    (*nodes_)[node_idx].offset=start;
+    (*nodes_)[node_idx].primitive_num=end-start+1;
 
     // leaf?
     if(end-start+1<=leaf_size_)
-        return nodeidx;
+        return;
 
-    int lenx=current.bbox.length(0);
-    int leny=current.bbox.length(1);
-    int lenz=current.bbox.length(2);
+    int lenx=bbox.length(0);
+    int leny=bbox.length(1);
+    int lenz=bbox.length(2);
     int axis=0;
     if(leny>lenx&&leny>lenz) axis=1;
     else if(lenz>lenx&&lenz>leny) axis=2;
@@ -125,7 +123,7 @@ int BVHbuilder::buildBVH(uint32_t start,uint32_t end,BVHType type){
         // ============================
         // 1. find the best partition axis 
         // ============================
-        const float parentArea = current.bbox.boxSurfaceArea();
+        const float parentArea = bbox.boxSurfaceArea();
         float bestCost   = srender::MAXFLOAT;
         int   bestAxis   = -1;
         int   bestOffset = -1;
@@ -181,7 +179,7 @@ int BVHbuilder::buildBVH(uint32_t start,uint32_t end,BVHType type){
 
         // if fail to find a good partion ( many boxes with Overlapping centers ), regard them as one node
         if (bestAxis < 0) {
-            return nodeidx;
+            return;
         }
 
         // ============================
@@ -205,12 +203,14 @@ int BVHbuilder::buildBVH(uint32_t start,uint32_t end,BVHType type){
     }
 
 
-    // recursive 
-    current.right=buildBVH(splitIdx+1,end);
-    current.left=buildBVH(start,splitIdx);
-
-
-    return nodeidx;
+    // recursive: both children side by side, each subtree after them
+    uint32_t left=nodes_->size();
+    nodes_->emplace_back();
+    nodes_->emplace_back();
+    (*nodes_)[node_idx].offset=left;
+    (*nodes_)[node_idx].primitive_num=0;
+    buildBVH(left,start,splitIdx);
+    buildBVH(left+1,splitIdx+1,end);
 }
 
 bool BVHbuilder::cmp(uint32_t a, uint32_t b,int axis){
@@ -8,28 +8,28 @@
 // forward declair
 class ASInstance;
 
-struct BVHnode:public Hitem
+/**
+ * @brief a node of the tree in 32 bytes, two to a cache line, with no vtable: its box, then either the first of its
+ *        two children, which the builder places side by side, or the range of its primitives.
+ *        A leaf has at least one primitive, an inner node none.
+ */
+struct alignas(32) BVHnode
 {
-    int left;
-    int right;
-
     AABB3d bbox;    // box in world or local space, pre-calculated when obj file is loaded.
 
-    // specify which elements do this node control.
-    unsigned int prmitive_start;
-    unsigned int primitive_num ;
+    uint32_t offset=0;          // inner node: index of the left child, the right one follows it; leaf: first primitive
+    uint32_t primitive_num=0;   // 0 for an inner node
 
-    BVHnode():left(-1),right(-1),prmitive_start(0),primitive_num(0){}
+    bool isLeaf()const{ return primitive_num>0; }
+    uint32_t left()const{ return offset; }
+    uint32_t right()const{ return offset+1; }
 
     /**
      * @brief the ray has an intersection with the aabb box only when tmin<tmax && tmax>0
      */
-    bool anyHit(const Ray& ray)const override;
-
-    bool rayIntersect(const Ray& ray,IntersectRecord& inst)const override{
-        return anyHit(ray);
-    }
+    bool anyHit(const Ray& ray)const;
 };
+static_assert(sizeof(BVHnode)==32,"BVHnode is expected to take half a cache line");
 
 
 class BVHbuilder
@@ -48,8 +48,8 @@ public:
     // building bvh tree for TLAS
     BVHbuilder(const std::vector<std::shared_ptr<ASInstance>>& instances);
 
-    // building implemention
-    int buildBVH(uint32_t start,uint32_t end, BVHType type=BVHType::SAH);
+    // building implemention: fill the node `node_idx` with the primitives [start..end], and its subtree after it
+    void buildBVH(uint32_t node_idx,uint32_t start,uint32_t end, BVHType type=BVHType::SAH);
     bool cmp(uint32_t a, uint32_t b,int axis);
 
     std::unique_ptr<std::vector<BVHnode>> moveNodes(){ return std::move(nodes_); }
@@ -211,9 +211,12 @@ const bool Camera::needUpdateView(){
 }
 
 
-std::shared_ptr<Film> Camera::getNewFilm()const{
+std::shared_ptr<Film> Camera::getNewFilm(int pixel_scale)const{
 	auto film=std::make_shared<Film>();
-	film->resolution_=glm::vec2(this->image_width_,this->image_height_);
+	pixel_scale=std::max(pixel_scale,1);
+	film->pixel_scale_=pixel_scale;
+	film->image_size_=glm::ivec2(this->image_width_,this->image_height_);
+	film->resolution_=glm::vec2((this->image_width_+pixel_scale-1)/pixel_scale,(this->image_height_+pixel_scale-1)/pixel_scale);
 
 	assert(abs(glm::length(this->front_)-1.0)<1e-5);
 	assert(abs(glm::length(this->up_)-1.0)<=1e-5);
@@ -222,12 +225,13 @@ std::shared_ptr<Film> Camera::getNewFilm()const{
 					+this->near_flat_z_*this->front_
 					+this->half_near_height_*this->up_
 					-this->half_near_width_*this->right_;
-	float coef=this->half_near_width_*2.0/this->image_width_;
+	float coef=this->half_near_width_*2.0/this->image_width_*pixel_scale;
 	film->deltaX_=coef*this->right_;
-	coef=this->half_near_height_*2.0/this->image_height_;
+	coef=this->half_near_height_*2.0/this->image_height_*pixel_scale;
 	film->deltaY_=-coef*this->up_;
 	film->camera_pos_=position_;
 	film->camera_front_=front_;
+	film->mat_vp_=getPerspectiveMatrix()*getViewMatrix();
 
 	return std::move(film);
 }
\ No newline at end of file
@@ -22,7 +22,8 @@ public:
 	void setFrustrum(float fov,float near,float far);
 	void setViewport(uint32_t width,float ratio);
     void setCameraPos(glm::vec3 pos,glm::vec3 lookat,glm::vec3 right);
-	std::shared_ptr<Film> getNewFilm() const;
+	// pixel_scale>1: a coarse film whose pixels cover pixel_scale*pixel_scale pixels of the image
+	std::shared_ptr<Film> getNewFilm(int pixel_scale=1) const;
 
     glm::mat4 getViewMatrix()const;
 	glm::mat4 getPerspectiveMatrix()const;
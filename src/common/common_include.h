@@ -18,6 +18,7 @@
 #include <stdexcept>
 
 #define TIME_RECORD // a switch of time recording
+#define PROFILE_RECORD // a switch of the scoped profiler, see profiler.h
 // #define THREAD_SAFTY_CHECK
 // #define DEBUG_MODE
 
@@ -30,6 +31,8 @@ constexpr float AABBOX_EPS=0.001;
 constexpr int INF = 2147483647;
 constexpr float NEAR_Z=-1;
 constexpr float FAR_Z=1;
+// half extent of the guard band in NDC units, triangles inside it are rasterized without clipping
+constexpr float GUARD_BAND=4.0f;
 constexpr float MAXFLOAT=std::numeric_limits<float>::max();
 constexpr float MINFLOAT=std::numeric_limits<float>::min();
 constexpr float PI=3.14159265358979323846;
@@ -70,6 +70,8 @@ enum class RasterizeType{
     Bvh_hzb     =1<<1,
     Easy_hzb    =1<<2,
     Scan_convert=1<<3,
+    Edge_function=1<<4,
+    Visibility_buffer=1<<5,
 };
 
 
@@ -99,4 +101,43 @@ inline BSDFType operator&(const BSDFType& s1,const BSDFType& s2){
 }
 inline BSDFType operator^(const BSDFType& s1,const BSDFType& s2){
     return (BSDFType)((int)(s1)^(int)(s2));
-}
\ No newline at end of file
+}
+
+/**
+ * @brief how the film estimates the radiance of its camera rays
+ * 
+ */
+enum class IntegratorType{
+    PathTracing,
+    PhotonCaustics,     // path tracing, with the caustics taken from a photon map at the diffuse hits
+    PhotonFinalGather,  // photon map density estimated at the ends of gather rays from the first diffuse hit
+    Bidirectional,      // camera and light subpaths joined by all the strategies, weighted by MIS
+    Metropolis,         // Markov chains over the primary samples of the path tracer(PSSMLT)
+};
+
+/**
+ * @brief float output channels(AOVs) of the path tracer, requested as a bit mask
+ * 
+ */
+enum class AOVType{
+    None        = 0,
+    Color       = 1<<0,     // linear radiance
+    Direct      = 1<<1,     // emission and direct light at the first hit
+    Indirect    = 1<<2,     // the rest of the radiance
+    Albedo      = 1<<3,
+    Normal      = 1<<4,
+    Depth       = 1<<5,     // distance from the camera
+    InstanceId  = 1<<6,     // -1 where the camera ray misses
+    PrimitiveId = 1<<7,
+    SampleCount = 1<<8,
+    Time        = 1<<9,     // microseconds spent on the pixel
+
+    ALL         = (1<<10)-1,
+};
+
+inline AOVType operator|(const AOVType& s1,const AOVType& s2){
+    return (AOVType)((int)(s1)|(int)(s2));
+}
+inline AOVType operator&(const AOVType& s1,const AOVType& s2){
+    return (AOVType)((int)(s1)&(int)(s2));
+}
@@ -57,3 +57,55 @@ void Material::initEmissionType(MtlType type,const glm::vec3& radiance ){
         radiance_rgb_=radiance;
     }
 }
+
+/**
+ * @brief a Lambert lobe for the diffuse part, a Blinn-Phong lobe for the specular one, or a perfect mirror if the
+ *        material is specular only; Lambert if it is neither. Lobes are picked with fixed probabilities
+ *        (diffuse 0.5, glossy 0.5, mirror 0.7) and weighted by the sum of their reflectance.
+ */
+void Material::compileBSDF(){
+    BSDFDesc desc;
+    float prob[BSDFDesc::MAX_LOBE_NUM];
+    auto addLobe=[&](BSDFType type,const glm::vec3& color,float p){
+        BSDFLobe& lobe=desc.lobes_[desc.lobe_num_];
+        lobe.type_=type;
+        lobe.color_=color;
+        lobe.shininess_=shininess_;
+        lobe.textured_=type==BSDFType::LambertReflection&&dif_texture_;
+        prob[desc.lobe_num_++]=p;
+    };
+
+    bool diffuse=(bool)(type_&MtlType::Diffuse);
+    bool specular=(bool)(type_&MtlType::Specular);
+    if(specular&&!diffuse){
+        // .mtl files have no mirror model, a material with a specular color only stands for one
+        addLobe(BSDFType::PerfectReflection,specular_,0.7f);
+    }
+    else{
+        // a diffuse material, with the highlight of its specular part if any; a material with neither is diffuse
+        addLobe(BSDFType::LambertReflection,diffuse_,0.5f);
+        if(specular)
+            addLobe(BSDFType::BlinnPhongSpecular,specular_,0.5f);
+    }
+
+    float total_prob=0.f;
+    for(int i=0;i<desc.lobe_num_;++i){
+        desc.cdf_[i+1]=desc.cdf_[i]+prob[i];
+        total_prob=desc.cdf_[i+1];
+    }
+    for(int i=0;i<desc.lobe_num_;++i)
+        desc.cdf_[i+1]/=total_prob;
+
+    float total_weight=0.f;
+    for(int i=0;i<desc.lobe_num_;++i){
+        const glm::vec3& c=desc.lobes_[i].color_;
+        total_weight+=c[0]+c[1]+c[2];
+    }
+    for(int i=0;i<desc.lobe_num_;++i){
+        const glm::vec3& c=desc.lobes_[i].color_;
+        float share=total_weight>0.f?(c[0]+c[1]+c[2])/total_weight:0.f;
+        desc.scale_[i]=desc.lobe_num_>1?share/(desc.cdf_[i+1]-desc.cdf_[i]):1.f;
+    }
+
+    bsdf_desc_=desc;
+}
@@ -1,6 +1,7 @@
 #pragma once
 #include"common/common_include.h"
 #include"texture.h"
+#include"enumtypes.h"
 
 enum class MltMember{
     Ambient,
@@ -37,6 +38,58 @@ inline MtlType operator^(const MtlType& s1,const MtlType& s2){
     return (MtlType)((int)(s1)^(int)(s2));
 }
 
+/**
+ * @brief one scattering lobe of a compiled material
+ */
+struct BSDFLobe{
+    BSDFType type_=BSDFType::EMPTY;
+    glm::vec3 color_=glm::vec3(0.f);    // reflectance: Kd of a Lambert lobe, Ks otherwise
+    float shininess_=0.f;               // exponent of a Blinn-Phong lobe
+    bool textured_=false;               // the diffuse texture replaces `color_` at each hit
+};
+
+/**
+ * @brief the scattering model of a material, compiled once at load: the lobes, the cdf to pick one of them and,
+ *        unless a lobe is textured, the factor that scales the picked lobe by its share of the reflectance over
+ *        the probability of picking it. Immutable afterwards, so that hits only read it.
+ */
+struct BSDFDesc{
+    static constexpr int MAX_LOBE_NUM=2;
+
+    BSDFLobe lobes_[MAX_LOBE_NUM];
+    int lobe_num_=0;
+    float cdf_[MAX_LOBE_NUM+1]={0.f};   // cdf_[i+1]-cdf_[i] is the probability of picking lobe i
+    float scale_[MAX_LOBE_NUM]={0.f};   // only valid if no lobe is textured
+
+    bool isTextured()const{ return lobe_num_>1&&(lobes_[0].textured_||lobes_[1].textured_); }
+
+    // only perfect mirrors: light arriving at it has no density to estimate
+    bool isDelta()const{
+        for(int i=0;i<lobe_num_;++i){
+            if(lobes_[i].type_!=BSDFType::PerfectReflection)
+                return false;
+        }
+        return true;
+    }
+
+    // only Lambert lobes: the reflected light does not depend on the view
+    bool isDiffuse()const{
+        for(int i=0;i<lobe_num_;++i){
+            if(lobes_[i].type_!=BSDFType::LambertReflection)
+                return false;
+        }
+        return lobe_num_>0;
+    }
+
+    // the lobe picked by u in [0,1)
+    int selectLobe(float u)const{
+        int i=0;
+        while(i+1<lobe_num_&&cdf_[i+1]<u)
+            ++i;
+        return i;
+    }
+};
+
 class Material{
 public:
     // init type as non-emissive
@@ -52,6 +105,9 @@ public:
     // initialize emission type if any and Specify which type of emitter it is and its radiance
     void initEmissionType(MtlType type,const glm::vec3& radiance );
 
+    // build `bsdf_desc_` from the scattering type, once the material is loaded
+    void compileBSDF();
+
     std::shared_ptr<Texture> getTexture(MltMember mtype)const;
     glm::vec3 getAmbient()const{ return ambient_; }
     glm::vec3 getDiffuse()const{ return diffuse_; }
@@ -96,6 +152,8 @@ public:
 
     // only available for emissive light
     glm::vec3 radiance_rgb_;    
+
+    BSDFDesc bsdf_desc_;
     
 
 };
@@ -3,6 +3,7 @@
 #include<glm/gtx/hash.hpp>
 #include"algorithm"
 #include"utils.h"
+#include"profiler.h"
 #define TINYOBJLOADER_IMPLEMENTATION
 #include "tiny_obj_loader.h"
 
@@ -97,6 +98,7 @@ void Mesh::initObject(const tinyobj::ObjReader& reader,std::string filepath,bool
         if(m.specular_texname.size())    mptr->setTexture(MltMember::Specular,prefix+m.specular_texname);
 
         mptr->initScattringType();  
+        mptr->compileBSDF();
 
         mtls_.push_back(mptr);
     }
@@ -122,6 +124,22 @@ void Mesh::initObject(const tinyobj::ObjReader& reader,std::string filepath,bool
         v.norm_=glm::normalize(v.norm_);
     }
     has_normal_=true;
+
+    buildStreams();
+}
+
+void ObjectDesc::buildStreams(){
+    size_t n=vertices_.size();
+    for(auto* s:{&streams_.px,&streams_.py,&streams_.pz,&streams_.nx,&streams_.ny,&streams_.nz})
+        s->resize(n);
+    for(size_t i=0;i<n;++i){
+        streams_.px[i]=vertices_[i].pos_.x;
+        streams_.py[i]=vertices_[i].pos_.y;
+        streams_.pz[i]=vertices_[i].pos_.z;
+        streams_.nx[i]=vertices_[i].norm_.x;
+        streams_.ny[i]=vertices_[i].norm_.y;
+        streams_.nz[i]=vertices_[i].norm_.z;
+    }
 }
 
 
@@ -182,6 +200,7 @@ void Line::printInfo() const {
  * @param inputfile : relative searching route to obj file.
  */
 void ObjLoader::readObjFile(std::string inputfile){
+    PROFILE_ZONE("Parse Obj File");
 
     if(inputfile.empty())
         inputfile=filename_;
@@ -215,6 +234,7 @@ void ObjLoader::readObjFile(std::string inputfile){
  * 
  */
 void ObjLoader::setObject(std::string filepath){
+    PROFILE_ZONE("Build Mesh");
     auto mesh = std::make_unique<Mesh>();   // instance of the derived class
     mesh->initObject(reader_,filepath,flip_normals_,back_culling_);
 
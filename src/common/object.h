@@ -17,6 +17,12 @@ enum class PrimitiveType{
 // forward declair
 enum class ShaderType;
 
+// model-space positions and normals in SoA layout, so the vertex shader can transform 8 vertices at a time
+struct VertexStreams{
+    std::vector<float> px,py,pz;
+    std::vector<float> nx,ny,nz;
+};
+
 
 // the base class for all kinds of objects to be rendered
 class ObjectDesc{
@@ -31,6 +37,9 @@ public:
     const std::vector<Vertex>& getconstVertices() const { return vertices_;}
     std::vector<glm::vec3>& getFaceNorms() { return face_normals_;}
     const std::vector<uint32_t>& getIndices()const {return indices_;}
+    const VertexStreams& getStreams()const{ return streams_; }
+    // call it once `vertices_` is final
+    void buildStreams();
     const std::vector<std::shared_ptr<Material>>& getMtls()const{ return mtls_; }
     const std::vector<int>& getMtlIdx()const{ return mtlidx_; }
     const std::shared_ptr<Material> getFaceMtl(uint32_t face_idx){
@@ -62,6 +71,8 @@ protected:
 
     // all the information of vertices
     std::vector<Vertex> vertices_;  
+    // copy of pos_ and norm_ of `vertices_`
+    VertexStreams streams_;
     // contains indices to `vertices_`,and every three consecutive vertices/indices constitude a face
     std::vector<uint32_t> indices_;
     // the Normalized normal for all faces, only availabel for MESH
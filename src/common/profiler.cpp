@@ -0,0 +1,129 @@
+#include"profiler.h"
+#include<fstream>
+#include<cstdio>
+
+std::atomic<bool> Profiler::enabled_{true};
+std::atomic<uint64_t> Profiler::clear_ns_{0};
+thread_local ProfileRing* Profiler::t_ring_=nullptr;
+std::mutex Profiler::mutex_;
+std::vector<std::shared_ptr<ProfileRing>> Profiler::rings_;
+
+namespace{
+// hands the ring of an exiting thread back to the profiler
+struct RingRetirer{
+    std::shared_ptr<ProfileRing> ring;
+    std::mutex* mutex=nullptr;
+    ~RingRetirer(){
+        if(ring){
+            std::lock_guard<std::mutex> lock(*mutex);
+            ring->retired_=true;
+        }
+    }
+};
+thread_local RingRetirer t_retirer;
+
+// json strings of the zone and thread names, only quotes and backslashes need escaping
+std::string escapeJson(const char* s){
+    std::string out;
+    for(;*s;++s){
+        if(*s=='"'||*s=='\\')
+            out+='\\';
+        out+=*s;
+    }
+    return out;
+}
+}
+
+void ProfileRing::collect(std::vector<Event>& out,uint64_t since_ns)const{
+    uint64_t end=head_.load(std::memory_order_acquire);
+    uint64_t begin=end>CAPACITY?end-CAPACITY:0;
+
+    size_t first=out.size();
+    for(uint64_t i=begin;i<end;++i){
+        const Slot& slot=slots_[i&(CAPACITY-1)];
+        out.push_back({slot.name.load(std::memory_order_relaxed),
+                       slot.begin_ns.load(std::memory_order_relaxed),
+                       slot.end_ns.load(std::memory_order_relaxed)});
+    }
+
+    // the owner kept writing while copying: slots from `begin` on may hold newer, half written events
+    std::atomic_thread_fence(std::memory_order_acquire);
+    uint64_t now_head=head_.load(std::memory_order_relaxed);
+    uint64_t valid_begin=now_head>=CAPACITY?now_head-CAPACITY+1:0;
+    size_t skip=valid_begin>begin?size_t(valid_begin-begin):0;
+
+    auto it=out.begin()+first;
+    out.erase(it,it+std::min(skip,out.size()-first));
+    out.erase(std::remove_if(out.begin()+first,out.end(),[&](const Event& e){ return e.end_ns<since_ns; }),out.end());
+}
+
+ProfileRing& Profiler::registerThread(){
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    std::shared_ptr<ProfileRing> ring;
+    for(auto& r:rings_){
+        if(r->retired_){
+            ring=r;
+            break;
+        }
+    }
+    if(!ring){
+        ring=std::make_shared<ProfileRing>();
+        ring->tid_=(uint32_t)rings_.size();
+        ring->thread_name_="thread "+std::to_string(ring->tid_);
+        rings_.push_back(ring);
+    }
+    ring->retired_=false;
+
+    t_retirer.ring=ring;
+    t_retirer.mutex=&mutex_;
+    t_ring_=ring.get();
+    return *ring;
+}
+
+void Profiler::setThreadName(const std::string& name){
+    ProfileRing& ring=localRing();
+    std::lock_guard<std::mutex> lock(mutex_);
+    ring.thread_name_=name;
+}
+
+int Profiler::dumpChromeTrace(const std::string& filename){
+    std::ofstream file(filename);
+    if(!file.is_open()){
+        std::cerr<<"Profiler::dumpChromeTrace: can not open "<<filename<<std::endl;
+        return -1;
+    }
+
+    std::vector<std::pair<uint32_t,std::string>> threads;
+    std::vector<std::pair<uint32_t,std::vector<ProfileRing::Event>>> events;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        uint64_t since_ns=clear_ns_.load(std::memory_order_relaxed);
+        for(auto& ring:rings_){
+            threads.emplace_back(ring->tid_,ring->thread_name_);
+            events.emplace_back(ring->tid_,std::vector<ProfileRing::Event>());
+            ring->collect(events.back().second,since_ns);
+        }
+    }
+
+    // timestamps and durations are in microseconds
+    int num=0;
+    char buf[64];
+    file<<"{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n";
+    for(auto& [tid,name]:threads){
+        file<<"{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":"<<tid
+            <<",\"args\":{\"name\":\""<<escapeJson(name.c_str())<<"\"}},\n";
+    }
+    for(auto& [tid,list]:events){
+        for(auto& e:list){
+            std::snprintf(buf,sizeof(buf),"\"ts\":%.3f,\"dur\":%.3f",e.begin_ns/1000.0,(e.end_ns-e.begin_ns)/1000.0);
+            file<<"{\"name\":\""<<escapeJson(e.name)<<"\",\"ph\":\"X\",\"pid\":0,\"tid\":"<<tid<<","<<buf<<"},\n";
+            ++num;
+        }
+    }
+    // a trailing metadata event keeps the list free of a dangling comma
+    file<<"{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":0,\"args\":{\"name\":\"PathLume\"}}\n]}\n";
+
+    std::cout<<"Profiler: "<<num<<" events written to "<<filename<<std::endl;
+    return num;
+}
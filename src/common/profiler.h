@@ -0,0 +1,126 @@
+/* a scoped profiler cheap enough to stay on, its events can be dumped as a chrome trace */
+#pragma once
+#include"common_include.h"
+#include<atomic>
+#include<chrono>
+#include<mutex>
+
+/**
+ * @brief events of one thread, written only by that thread.
+ *        The ring keeps the latest CAPACITY events, older ones are overwritten.
+ *        Readers never block the writer: they copy the ring and drop the slots overwritten meanwhile.
+ */
+class ProfileRing{
+public:
+    static constexpr uint64_t CAPACITY=1<<16;
+
+    struct Event{
+        const char* name;
+        uint64_t begin_ns;
+        uint64_t end_ns;
+    };
+
+    inline void push(const char* name,uint64_t begin_ns,uint64_t end_ns){
+        uint64_t h=head_.load(std::memory_order_relaxed);
+        Slot& slot=slots_[h&(CAPACITY-1)];
+        slot.name.store(name,std::memory_order_relaxed);
+        slot.begin_ns.store(begin_ns,std::memory_order_relaxed);
+        slot.end_ns.store(end_ns,std::memory_order_relaxed);
+        head_.store(h+1,std::memory_order_release);
+    }
+
+    // append the events still in the ring that end after `since_ns` to `out`, oldest first
+    void collect(std::vector<Event>& out,uint64_t since_ns)const;
+
+public:
+    uint32_t tid_=0;
+    std::string thread_name_;
+    bool retired_=false;        // the owner thread has exited, the ring may be handed to a new thread
+
+private:
+    struct Slot{
+        std::atomic<const char*> name{nullptr};
+        std::atomic<uint64_t> begin_ns{0};
+        std::atomic<uint64_t> end_ns{0};
+    };
+    Slot slots_[CAPACITY];
+    std::atomic<uint64_t> head_{0};
+};
+
+/**
+ * @brief owns the rings of all threads that recorded an event.
+ *        The mutex is only taken when a thread records its first event and while dumping.
+ */
+class Profiler{
+public:
+    static inline bool isEnabled(){ return enabled_.load(std::memory_order_relaxed); }
+    static void setEnabled(bool enable){ enabled_.store(enable,std::memory_order_relaxed); }
+
+    // nanoseconds since the first call
+    static inline uint64_t now(){
+        static const auto epoch=std::chrono::steady_clock::now();
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now()-epoch).count();
+    }
+
+    static inline ProfileRing& localRing(){
+        return t_ring_?*t_ring_:registerThread();
+    }
+
+    // name the lane of the calling thread in the trace
+    static void setThreadName(const std::string& name);
+
+    /**
+     * @brief write the recorded events as chrome trace json (chrome://tracing or ui.perfetto.dev).
+     * @return number of events written, -1 if the file can not be opened
+     */
+    static int dumpChromeTrace(const std::string& filename);
+
+    // forget the events recorded so far
+    static void clear(){ clear_ns_.store(now(),std::memory_order_relaxed); }
+
+private:
+    static ProfileRing& registerThread();
+
+private:
+    static std::atomic<bool> enabled_;
+    static std::atomic<uint64_t> clear_ns_;
+    static thread_local ProfileRing* t_ring_;
+    static std::mutex mutex_;
+    static std::vector<std::shared_ptr<ProfileRing>> rings_;
+};
+
+/**
+ * @brief records [construction,destruction) of itself as one event.
+ *        Zone names must be string literals: only the pointer is stored.
+ */
+class ProfileZone{
+public:
+    template<size_t N>
+    explicit ProfileZone(const char (&name)[N]){
+        if(Profiler::isEnabled()){
+            name_=name;
+            begin_ns_=Profiler::now();
+        }
+    }
+    ~ProfileZone(){
+        if(name_)
+            Profiler::localRing().push(name_,begin_ns_,Profiler::now());
+    }
+
+    ProfileZone(const ProfileZone&)=delete;
+    ProfileZone& operator=(const ProfileZone&)=delete;
+
+private:
+    const char* name_=nullptr;
+    uint64_t begin_ns_=0;
+};
+
+#ifdef PROFILE_RECORD
+#define PROFILE_CONCAT_IMPL(a,b) a##b
+#define PROFILE_CONCAT(a,b) PROFILE_CONCAT_IMPL(a,b)
+#define PROFILE_ZONE(name) ProfileZone PROFILE_CONCAT(profile_zone_,__LINE__)(name)
+#define PROFILE_THREAD(name) Profiler::setThreadName(name)
+#else
+#define PROFILE_ZONE(name)
+#define PROFILE_THREAD(name)
+#endif
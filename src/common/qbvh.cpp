@@ -0,0 +1,80 @@
+#include"qbvh.h"
+#include"profiler.h"
+
+namespace{
+
+// fill the node for the inner node `node_idx` of `tree`, whose decoded box is `frame`, and its subtree after it
+uint32_t quantizeNode(const std::vector<BVHnode>& tree,uint32_t node_idx,const QBVHframe& frame,
+                      std::vector<QBVHnode>& nodes){
+    uint32_t qidx=nodes.size();
+    nodes.emplace_back();
+    QBVHnode qnode=QBVHnode();
+
+    // a first guess of the steps in from the corners of the frame, each lane being an axis of a child
+    glm::vec3 child_min[2],child_max[2];
+    for(int c=0;c<2;++c){
+        const BVHnode& child=tree[tree[node_idx].offset+c];
+        child_min[c]=child.bbox.min;
+        child_max[c]=child.bbox.max;
+        for(int a=0;a<3;++a){
+            int lane=2*a+c;
+            float step=(frame.hi[lane]-frame.lo[lane])*(1.f/255.f);
+            if(step<=0.f)
+                continue;
+            float qlo=std::floor((child_min[c][a]-frame.lo[lane])/step);
+            float qhi=std::floor((frame.hi[lane]-child_max[c][a])/step);
+            qnode.bounds[lane]=(uint8_t)std::clamp(qlo,0.f,255.f);
+            qnode.bounds[6+lane]=(uint8_t)std::clamp(qhi,0.f,255.f);
+        }
+    }
+
+    // then outward until the decoded boxes hold the children, at the worst up to the corners of the frame
+    QBVHframe children;
+    for(bool holds=false;!holds;){
+        decodeChildren(qnode,frame,children);
+        holds=true;
+        for(int c=0;c<2;++c){
+            for(int a=0;a<3;++a){
+                int lane=2*a+c;
+                if(children.lo[lane]>child_min[c][a]&&qnode.bounds[lane]>0){
+                    --qnode.bounds[lane];
+                    holds=false;
+                }
+                if(children.hi[lane]<child_max[c][a]&&qnode.bounds[6+lane]>0){
+                    --qnode.bounds[6+lane];
+                    holds=false;
+                }
+            }
+        }
+    }
+
+    for(int c=0;c<2;++c){
+        const BVHnode& child=tree[tree[node_idx].offset+c];
+        if(child.isLeaf()){
+            qnode.child[c]=child.offset;
+            qnode.primitive_num[c]=child.primitive_num;
+        }
+        else
+            qnode.child[c]=quantizeNode(tree,tree[node_idx].offset+c,children.child(c),nodes);
+    }
+    nodes[qidx]=qnode;
+    return qidx;
+}
+
+}   // namespace
+
+bool quantizeBVH(const std::vector<BVHnode>& tree,std::vector<QBVHnode>& nodes){
+    PROFILE_ZONE("Quantize BLAS");
+    nodes.clear();
+    if(tree.empty()||tree[0].isLeaf())
+        return true;
+    // a leaf of the SAH builder may go over what a quantized child can count
+    for(const BVHnode& node:tree){
+        if(node.primitive_num>255)
+            return false;
+    }
+    // one node for each inner node of the tree
+    nodes.reserve(tree.size()/2);
+    quantizeNode(tree,0,QBVHframe(tree[0].bbox),nodes);
+    return true;
+}
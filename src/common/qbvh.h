@@ -0,0 +1,135 @@
+/* quantized BVH: the nodes of a BLAS with 8-bit child boxes, for meshes whose full tree takes too much memory */
+#pragma once
+#include"common/common_include.h"
+#include"common/AABB.h"
+#include"bvhbuilder.h"
+#include"pathtracer/ray.h"
+#ifdef __AVX2__
+#include<immintrin.h>
+#endif
+
+/**
+ * @brief the two children of an inner node of a BVH in 24 bytes: their boxes in 8-bit steps of 1/255 of the box of
+ *        the node, the lower corners counted up from its lower corner and the upper ones down from its upper corner,
+ *        rounded outward so that a child box holds all it did. Then for each child either the index of its node or,
+ *        for a leaf, its first primitive and their number.
+ *        Only the root box is kept in floats, the boxes are decoded from that of the parent on the way down.
+ */
+struct QBVHnode{
+    uint8_t bounds[12];         // lower corners x0 x1 y0 y1 z0 z1, then upper corners the same way
+    uint32_t child[2];          // inner child: its node; leaf: its first primitive
+    uint8_t primitive_num[2];   // 0 for an inner child
+
+    bool isLeaf(int c)const{ return primitive_num[c]>0; }
+};
+static_assert(sizeof(QBVHnode)==24,"QBVHnode is expected to take 24 bytes");
+
+/**
+ * @brief boxes in the lanes the decoding works on: x x y y z z, then two unused lanes which stay 0. A node's own box
+ *        fills both lanes of an axis, the decoded boxes of its children take one each(x0 x1 y0 y1 z0 z1).
+ */
+struct alignas(32) QBVHframe{
+    float lo[8]={0.f};
+    float hi[8]={0.f};
+
+    QBVHframe(){}
+    explicit QBVHframe(const AABB3d& box){
+        for(int a=0;a<3;++a){
+            lo[2*a]=lo[2*a+1]=box.min[a];
+            hi[2*a]=hi[2*a+1]=box.max[a];
+        }
+    }
+
+    // the frame of child `c` out of the decoded boxes of both children
+    QBVHframe child(int c)const{
+        QBVHframe frame;
+        for(int a=0;a<3;++a){
+            frame.lo[2*a]=frame.lo[2*a+1]=lo[2*a+c];
+            frame.hi[2*a]=frame.hi[2*a+1]=hi[2*a+c];
+        }
+        return frame;
+    }
+};
+
+// a ray in the lanes of `QBVHframe`, the unused ones 0
+struct alignas(32) QBVHray{
+    float origin[8]={0.f};
+    float inv_dir[8]={0.f};
+
+    explicit QBVHray(const Ray& ray){
+        for(int a=0;a<3;++a){
+            origin[2*a]=origin[2*a+1]=ray.origin_[a];
+            inv_dir[2*a]=inv_dir[2*a+1]=ray.inv_dir_[a];
+        }
+    }
+};
+
+/**
+ * @brief decode the boxes of the two children of `node`, whose own box is `frame`.
+ *        The builder decodes with it as well, so that the boxes it checks are those the traversal sees bit for bit.
+ */
+inline void decodeChildren(const QBVHnode& node,const QBVHframe& frame,QBVHframe& children){
+#ifdef __AVX2__
+    // 16 bytes from the start of the node: the lower corners in the first 6, the upper ones in the next 6
+    __m128i bytes=_mm_loadu_si128((const __m128i*)node.bounds);
+    __m256 qlo=_mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(bytes));
+    __m256 qhi=_mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_srli_si128(bytes,6)));
+    __m256 lo=_mm256_load_ps(frame.lo);
+    __m256 hi=_mm256_load_ps(frame.hi);
+    // the unused lanes have a step of 0, whatever bytes they read
+    __m256 step=_mm256_mul_ps(_mm256_sub_ps(hi,lo),_mm256_set1_ps(1.f/255.f));
+    _mm256_store_ps(children.lo,_mm256_add_ps(lo,_mm256_mul_ps(qlo,step)));
+    _mm256_store_ps(children.hi,_mm256_sub_ps(hi,_mm256_mul_ps(qhi,step)));
+#else
+    for(int i=0;i<6;++i){
+        float step=(frame.hi[i]-frame.lo[i])*(1.f/255.f);
+        children.lo[i]=frame.lo[i]+float(node.bounds[i])*step;
+        children.hi[i]=frame.hi[i]-float(node.bounds[6+i])*step;
+    }
+#endif
+}
+
+/**
+ * @brief slab test of the decoded boxes of both children, the same as `BVHnode::anyHit` but for rays lying in a
+ *        face of a box
+ * @return bit c set if the ray hits the box of child c
+ */
+inline int hitChildren(const QBVHframe& children,const QBVHray& ray){
+#ifdef __AVX2__
+    __m256 origin=_mm256_load_ps(ray.origin);
+    __m256 inv_dir=_mm256_load_ps(ray.inv_dir);
+    __m256 t0=_mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(children.lo),origin),inv_dir);
+    __m256 t1=_mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(children.hi),origin),inv_dir);
+    // the unused lanes give a near distance of 0, which also drops the part of the interval behind the ray,
+    // and no far distance
+    __m256 tnear=_mm256_min_ps(t0,t1);
+    __m256 tfar=_mm256_blend_ps(_mm256_max_ps(t0,t1),_mm256_set1_ps(srender::MAXFLOAT),0xC0);
+    // lanes [x0 x1 y0 y1 | z0 z1 - -]: fold the halves, then y onto x
+    __m128 n=_mm_max_ps(_mm256_castps256_ps128(tnear),_mm256_extractf128_ps(tnear,1));
+    __m128 f=_mm_min_ps(_mm256_castps256_ps128(tfar),_mm256_extractf128_ps(tfar,1));
+    n=_mm_max_ps(n,_mm_movehl_ps(n,n));
+    f=_mm_min_ps(f,_mm_movehl_ps(f,f));
+    return _mm_movemask_ps(_mm_cmple_ps(n,f))&3;
+#else
+    int mask=0;
+    for(int c=0;c<2;++c){
+        float tnear=0.f,tfar=srender::MAXFLOAT;
+        for(int a=0;a<3;++a){
+            float t0=(children.lo[2*a+c]-ray.origin[2*a+c])*ray.inv_dir[2*a+c];
+            float t1=(children.hi[2*a+c]-ray.origin[2*a+c])*ray.inv_dir[2*a+c];
+            tnear=std::max(tnear,std::min(t0,t1));
+            tfar=std::min(tfar,std::max(t0,t1));
+        }
+        if(tnear<=tfar)
+            mask|=1<<c;
+    }
+    return mask;
+#endif
+}
+
+/**
+ * @brief the quantized nodes of a tree built by `BVHbuilder`, in preorder from its root. Empty if the root is a leaf,
+ *        the root box and the primitive indices of the tree go on as they were.
+ * @return false if a leaf has more than 255 primitives, which a node can not count
+ */
+bool quantizeBVH(const std::vector<BVHnode>& tree,std::vector<QBVHnode>& nodes);
@@ -1,14 +1,17 @@
 #include"scene_loader.h"
+#include"profiler.h"
 
 
 // create BLAS for obj if it hasn't been built.
-void Scene::addObjInstance(std::string filename, glm::mat4& model,ShaderType shader,bool flipn,bool backculling){
+void Scene::addObjInstance(std::string filename, glm::mat4& model,ShaderType shader,bool flipn,bool backculling,
+                           bool compress_bvh){
+    PROFILE_ZONE("Add Obj Instance");
     if(blas_map_.find(filename)==blas_map_.end()){
         // read from objfile
         ObjLoader objloader(filename,flipn,backculling);
         std::shared_ptr<ObjectDesc> obj=std::move(objloader.getObjects());
         // create blas
-        blas_map_[filename]=std::make_shared<BLAS>(obj,leaf_num_);
+        blas_map_[filename]=std::make_shared<BLAS>(obj,leaf_num_,compress_bvh||compress_all_,report_bvh_);
 
         objloader.updateNums(vertex_num_,face_num_);
         std::cout<<"Current vertex num: "<<vertex_num_<<std::endl;
@@ -29,9 +32,10 @@ void Scene::clearScene(){
 
 // when leaf_num is changed, blas should be rebuilt.
 void Scene::rebuildBLAS(){
+    PROFILE_ZONE("Rebuild BLAS");
     for(auto& inst:tlas_->all_instances_){
         auto object=inst->blas_->object_;
-        inst->blas_=std::make_shared<BLAS>(object,leaf_num_);
+        inst->blas_=std::make_shared<BLAS>(object,leaf_num_,inst->blas_->isCompressed());
     }
 }
 
@@ -50,6 +54,14 @@ void Scene::findAllEmitters(){
         for(int face=0;face<obj->getFaceNum();++face){
             auto mtl=obj->getFaceMtl(face);
             if(mtl&&mtl->isEmissive()){
+                // world positions and normals are otherwise left by the vertex shader, a render without rasterizing
+                // has none
+                glm::mat4 normal_mat=glm::transpose(inst->inv_modle_);
+                for(int k=0;k<3;++k){
+                    Vertex& v=obj->getOneVertex(face,k);
+                    v.w_pos_=inst->modle_*glm::vec4(v.pos_,1.f);
+                    v.w_norm_=glm::normalize(glm::vec3(normal_mat*glm::vec4(v.norm_,0.f)));
+                }
                 emits_.addEmitter(&obj->getOneVertex(face,0),&obj->getOneVertex(face,1),&obj->getOneVertex(face,2),
                                     inst->modle_*glm::vec4(facenormal[face],0),
                                     mtl->radiance_rgb_);
@@ -57,12 +69,60 @@ void Scene::findAllEmitters(){
         }
     }
     emits_.setPreSum();
+
+    if(!env_||env_->getWeight()<=0.f)
+        env_prob_=0.f;
+    else
+        env_prob_=emits_.empty()?1.f:0.5f;
+}
+
+// whether a material of the scene has a lobe of `type` in its compiled bsdf
+bool Scene::hasLobe(BSDFType type)const{
+    for(auto& inst:tlas_->all_instances_){
+        for(auto& mtl:inst->blas_->object_->getMtls()){
+            const BSDFDesc& desc=mtl->bsdf_desc_;
+            for(int i=0;i<desc.lobe_num_;++i){
+                if(desc.lobes_[i].type_==type)
+                    return true;
+            }
+        }
+    }
+    return false;
+}
+
+void Scene::setEnvironmentMap(const std::string& filename,float intensity,float rotation){
+    std::string source=filename+"|"+std::to_string(intensity)+"|"+std::to_string(rotation);
+    if(source==env_source_)
+        return;
+    env_source_=source;
+    env_=nullptr;
+    if(filename.empty())
+        return;
+
+    auto env=std::make_shared<EnvironmentEmitter>();
+    if(env->load(filename,intensity,rotation))
+        env_=env;
 }
 void Scene::sampleEmitters(const glm::vec3& src_pos,LightSampleRecord& lsRec,Sampler& sampler)const{
 
     float u0=sampler.getSample1D();         // sample a triangle
     glm::vec2 u12=sampler.getSample2D();    // sample a point inside the triangle
-    emits_.sampleLight(src_pos,lsRec,u0,u12.x,u12.y);
+
+    // pick the kind of light with u0, then reuse what is left of it
+    if(u0<env_prob_){
+        env_->sampleLight(src_pos,lsRec,u12.x,u12.y);
+        lsRec.pdf_*=env_prob_;
+        lsRec.value_/=env_prob_;
+        return;
+    }
+    if(env_prob_>0.f){
+        u0=(u0-env_prob_)/(1.f-env_prob_);
+        emits_.sampleLight(src_pos,lsRec,u0,u12.x,u12.y);
+        lsRec.pdf_*=1.f-env_prob_;
+        lsRec.value_/=1.f-env_prob_;
+    }
+    else
+        emits_.sampleLight(src_pos,lsRec,u0,u12.x,u12.y);
 
     lsRec.pdf_=std::clamp(lsRec.pdf_,0.00001f,10000.f);
 
@@ -70,7 +130,7 @@ void Scene::sampleEmitters(const glm::vec3& src_pos,LightSampleRecord& lsRec,Sam
 }
 
 float Scene::getLightPDF(const Ray& ray,const IntersectRecord& inst)const{
-    float pdf=emits_.getSamplePDF(ray,inst);
+    float pdf=emits_.getSamplePDF(ray,inst)*(1.f-env_prob_);
 
     // For numerical stability
     pdf=std::clamp(pdf,1e-3f,srender::MAXPDFVALUE);
@@ -78,6 +138,12 @@ float Scene::getLightPDF(const Ray& ray,const IntersectRecord& inst)const{
     return pdf;
 }
 
+float Scene::getLightPDF(const Ray& ray)const{
+    if(env_prob_<=0.f)
+        return 0.f;
+    return env_->getSamplePDF(ray.dir_)*env_prob_;
+}
+
 
 
 /**
@@ -85,6 +151,10 @@ float Scene::getLightPDF(const Ray& ray,const IntersectRecord& inst)const{
  * 
  * @return greatest length of this box
  */
+AABB3d Scene::getSceneBound()const{
+    return tlas_->tree_->at(0).bbox;
+}
+
 float Scene::getSceneScale()const {
     auto maxbox=tlas_->tree_->at(0).bbox;
     float maxsize=0;
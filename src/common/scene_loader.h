@@ -22,9 +22,16 @@ public:
     }
 
     void setBVHsize(uint32_t leaf_num){leaf_num_=leaf_num;}
+    // quantize the trees of all the BLAS built from now on, not only those asked for; `report` benchmarks each one
+    // that is compressed against its full tree
+    void setBVHCompression(bool compressed,bool report=false){compress_all_=compressed;report_bvh_=report;}
 
-    // create BLAS for obj if it hasn't been built.
-    void addObjInstance(std::string filename, glm::mat4& model,ShaderType shader,bool flipn=false,bool backculling=true);
+    /**
+     * @brief create BLAS for obj if it hasn't been built.
+     * @param compress_bvh quantize its tree(see `QBVHnode`), for a mesh whose full tree takes too much memory
+     */
+    void addObjInstance(std::string filename, glm::mat4& model,ShaderType shader,bool flipn=false,bool backculling=true,
+                        bool compress_bvh=false);
 
     void buildTLAS(){
         tlas_->buildTLAS();
@@ -63,6 +70,12 @@ public:
      */
     float getSceneScale()const;
 
+    // box of the whole scene, that of the top tlas node
+    AABB3d getSceneBound()const;
+
+
+    // whether a material of the scene has a lobe of `type` in its compiled bsdf
+    bool hasLobe(BSDFType type)const;
 
     /*-----------------------------------------------------------*/
     /*                     control the emitters                  */
@@ -82,6 +95,37 @@ public:
      */
     float getLightPDF(const Ray& ray,const IntersectRecord& inst)const;
 
+    /**
+     * @brief pdf of sampling the direction of `ray` that escaped the scene, i.e. of the environment map
+     */
+    float getLightPDF(const Ray& ray)const;
+
+    /**
+     * @brief start a light path from the emitters, see `Emitters::sampleEmission`; the environment map emits none
+     */
+    bool sampleEmission(Sampler& sampler,EmissionRecord& rec)const{
+        float u0=sampler.getSample1D();
+        glm::vec2 u_pos=sampler.getSample2D();
+        glm::vec2 u_dir=sampler.getSample2D();
+        return emits_.sampleEmission(u0,u_pos,u_dir,rec);
+    }
+    // pdf over the area of `sampleEmission` starting at an emitter of radiance `radiance`
+    float getEmissionPDF(const glm::vec3& radiance)const{ return emits_.getPositionPDF(radiance); }
+
+    /**
+     * @brief light the scene with a lat-long map, reloaded only if an argument changed; an empty filename removes it.
+     *        With triangle emitters as well, either kind of light is sampled with probability 1/2.
+     */
+    void setEnvironmentMap(const std::string& filename,float intensity=1.f,float rotation=0.f);
+    bool hasEnvironment()const{ return env_!=nullptr; }
+
+    /**
+     * @brief radiance of a ray that escaped the scene
+     */
+    glm::vec3 getEnvironment(const glm::vec3& dir)const{
+        return env_?env_->eval(dir):glm::vec3(0.f);
+    }
+
     
 private:
     
@@ -89,6 +133,8 @@ private:
     std::unique_ptr<TLAS> tlas_;            // TLAS->AS->BLAS->objectdesc
     std::unordered_map<std::string,std::shared_ptr<BLAS> > blas_map_;    
     int leaf_num_=4;
+    bool compress_all_=false;
+    bool report_bvh_=false;
     int vertex_num_;
     int face_num_;
 
@@ -97,6 +143,9 @@ private:
 
     // Take charge of ALL the tangible lights in the scene
     Emitters emits_;
+    std::shared_ptr<EnvironmentEmitter> env_;
+    std::string env_source_;    // the arguments `env_` was loaded with
+    float env_prob_=0.f;        // probability of sampling `env_` rather than `emits_`
 
 };
 
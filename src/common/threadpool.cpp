@@ -0,0 +1,108 @@
+#include"threadpool.h"
+#include"profiler.h"
+#include<algorithm>
+
+namespace{
+// set inside pool jobs so that nested parallel loops fall back to serial execution
+thread_local bool g_inside_job=false;
+}
+
+ThreadPool::ThreadPool(unsigned worker_num){
+    if(worker_num==0){
+        unsigned hc=std::thread::hardware_concurrency();
+        worker_num=hc>1?hc-1:0;
+    }
+    workers_.reserve(worker_num);
+    for(unsigned i=0;i<worker_num;++i)
+        workers_.emplace_back(&ThreadPool::workerLoop,this);
+}
+
+ThreadPool::~ThreadPool(){
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stop_=true;
+    }
+    wake_cv_.notify_all();
+    for(auto& t:workers_)
+        t.join();
+}
+
+ThreadPool& ThreadPool::global(){
+    static ThreadPool pool;
+    return pool;
+}
+
+void ThreadPool::runTasks(){
+    g_inside_job=true;
+    size_t idx;
+    while((idx=next_task_.fetch_add(1))<job_size_){
+        (*job_)(idx);
+        finished_task_.fetch_add(1);
+    }
+    g_inside_job=false;
+}
+
+void ThreadPool::workerLoop(){
+    PROFILE_THREAD("Pool Worker");
+    uint64_t seen=0;
+    while(true){
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            wake_cv_.wait(lock,[&]{ return stop_||generation_!=seen; });
+            if(stop_)
+                return;
+            seen=generation_;
+            ++active_workers_;
+        }
+        runTasks();
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            --active_workers_;
+        }
+        done_cv_.notify_all();
+    }
+}
+
+void ThreadPool::parallelFor(size_t task_num,const std::function<void(size_t)>& func){
+    if(task_num==0)
+        return;
+    if(g_inside_job||workers_.empty()||task_num==1){
+        for(size_t i=0;i<task_num;++i)
+            func(i);
+        return;
+    }
+
+    std::lock_guard<std::mutex> job_lock(job_mutex_);
+    {
+        // a worker woken late by the previous job may still be on its way out
+        std::unique_lock<std::mutex> lock(mutex_);
+        done_cv_.wait(lock,[&]{ return active_workers_==0; });
+        job_=&func;
+        job_size_=task_num;
+        next_task_=0;
+        finished_task_=0;
+        ++generation_;
+    }
+    wake_cv_.notify_all();
+
+    runTasks();
+
+    // wait for the tasks still running and for every worker to leave the job before it is destroyed
+    std::unique_lock<std::mutex> lock(mutex_);
+    done_cv_.wait(lock,[&]{ return finished_task_.load()==job_size_&&active_workers_==0; });
+    job_=nullptr;
+}
+
+void ThreadPool::parallelRange(size_t n,size_t grain,const std::function<void(size_t,size_t)>& func){
+    if(n==0)
+        return;
+    grain=std::max<size_t>(grain,1);
+    size_t task_num=std::min<size_t>((n+grain-1)/grain,(size_t)size()*4);
+    size_t chunk=(n+task_num-1)/task_num;
+    task_num=(n+chunk-1)/chunk;
+    parallelFor(task_num,[&](size_t t){
+        size_t begin=t*chunk;
+        size_t end=std::min(n,begin+chunk);
+        func(begin,end);
+    });
+}
@@ -0,0 +1,60 @@
+/* a small persistent thread pool for data-parallel loops */
+#pragma once
+#include<thread>
+#include<mutex>
+#include<condition_variable>
+#include<atomic>
+#include<functional>
+#include<vector>
+
+/**
+ * @brief Workers are created once and sleep between jobs, so per-frame stages (geometry phase, deferred
+ *        shading, ...) can be split across cores without paying for thread creation every frame.
+ *        Only one `parallelFor` runs at a time; a nested call from inside a job runs serially on the caller.
+ */
+class ThreadPool{
+public:
+    // worker_num==0: use hardware_concurrency()-1 workers, the calling thread is the last worker
+    explicit ThreadPool(unsigned worker_num=0);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&)=delete;
+    ThreadPool& operator=(const ThreadPool&)=delete;
+
+    // the shared pool used by the render pipeline
+    static ThreadPool& global();
+
+    // number of threads taking part in a job, including the caller
+    unsigned size()const{ return (unsigned)workers_.size()+1; }
+
+    /**
+     * @brief split [0,task_num) into tasks and run func(task_idx) for each of them, blocks until all are done.
+     *        Tasks are handed out dynamically, so a task index says nothing about the executing thread.
+     */
+    void parallelFor(size_t task_num,const std::function<void(size_t)>& func);
+
+    /**
+     * @brief run func(begin,end) over [0,n) in contiguous ranges of at least `grain` elements.
+     */
+    void parallelRange(size_t n,size_t grain,const std::function<void(size_t,size_t)>& func);
+
+private:
+    void workerLoop();
+    void runTasks();
+
+private:
+    std::vector<std::thread> workers_;
+
+    std::mutex job_mutex_;              // serializes callers of parallelFor
+    std::mutex mutex_;
+    std::condition_variable wake_cv_;
+    std::condition_variable done_cv_;
+
+    const std::function<void(size_t)>* job_=nullptr;
+    size_t job_size_=0;
+    uint64_t generation_=0;
+    std::atomic<size_t> next_task_{0};
+    std::atomic<size_t> finished_task_{0};
+    unsigned active_workers_=0;
+    bool stop_=false;
+};
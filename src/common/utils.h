@@ -3,6 +3,7 @@
 #include"common_include.h"
 #include"AABB.h"
 #include <fstream>
+#include <atomic>
 
 
 // some small functions
@@ -66,6 +67,12 @@ inline glm::vec3 srgbToLinear(const glm::vec3& srgb) {
     return linear;
 }
 
+// std::atomic<float> has no fetch_add before c++20
+inline void atomicAdd(std::atomic<float>& target,float value){
+    float old=target.load(std::memory_order_relaxed);
+    while(!target.compare_exchange_weak(old,old+value,std::memory_order_relaxed));
+}
+
 }
 
 std::ostream& operator<<(std::ostream& os, const AABB3d& aabb);
@@ -1,16 +1,24 @@
 #include<iostream>
 #include"window.h"
 #include"render.h"
+#include"headless.h"
 
  // initialize static member for Window
 ImGuiIO* Window::io=nullptr;                      
 
-int main(void) {
+int main(int argc,char** argv) {
 
     try{
         // define my render
         Render render;
         auto& camera=render.getCamera();
+
+        // render from the command line, see `HeadlessOption`
+        HeadlessOption headless;
+        if(!parseHeadlessArgs(argc,argv,headless))
+            return -1;
+        if(headless.enabled_)
+            return runHeadless(render,headless);
         
         // init and loop
         render.pipelineInit();
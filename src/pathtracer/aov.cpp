@@ -0,0 +1,201 @@
+#include"aov.h"
+#include<fstream>
+
+void AOVBuffer::init(int width,int height,AOVType mask){
+    width_=width;
+    height_=height;
+    mask_=mask&AOVType::ALL;
+    planes_.clear();
+    for(int i=0;i<CHANNEL_NUM;++i){
+        AOVType type=AOVType(1<<i);
+        first_plane_[i]=has(type)?(int)planes_.size():-1;
+        if(has(type))
+            planes_.resize(planes_.size()+getComponentNum(type),std::vector<float>(size_t(width)*height,0.f));
+    }
+}
+
+float* AOVBuffer::plane(AOVType type,int c){
+    return has(type)?planes_[first_plane_[channelIndex(type)]+c].data():nullptr;
+}
+
+const float* AOVBuffer::plane(AOVType type,int c)const{
+    return has(type)?planes_[first_plane_[channelIndex(type)]+c].data():nullptr;
+}
+
+bool AOVBuffer::merge(const AOVBuffer& other){
+    const AOVType need=AOVType::Color|AOVType::SampleCount;
+    if((mask_&need)!=need||(other.mask_&need)!=need||other.width_!=width_||other.height_!=height_)
+        return false;
+
+    float* count=plane(AOVType::SampleCount);
+    const float* other_count=other.plane(AOVType::SampleCount);
+    float* color[3];
+    const float* other_color[3];
+    for(int c=0;c<3;++c){
+        color[c]=plane(AOVType::Color,c);
+        other_color[c]=other.plane(AOVType::Color,c);
+    }
+
+    size_t num=size_t(width_)*height_;
+    // the other channels both have, by the counts before they add up
+    for(int k=0;k<CHANNEL_NUM;++k){
+        AOVType type=AOVType(1<<k);
+        if(type==AOVType::Color||type==AOVType::SampleCount||!has(type)||!other.has(type))
+            continue;
+        bool id=type==AOVType::InstanceId||type==AOVType::PrimitiveId;
+        for(int c=0;c<getComponentNum(type);++c){
+            float* value=plane(type,c);
+            const float* other_value=other.plane(type,c);
+            for(size_t i=0;i<num;++i){
+                float m=other_count[i],n=count[i];
+                if(m<=0.f)
+                    continue;
+                if(n<=0.f)
+                    value[i]=other_value[i];
+                else if(type==AOVType::Time)
+                    value[i]+=other_value[i];
+                else if(!id)    // ids keep the first contributor's
+                    value[i]=(value[i]*n+other_value[i]*m)/(n+m);
+            }
+        }
+    }
+    for(size_t i=0;i<num;++i){
+        float m=other_count[i];
+        if(m<=0.f)
+            continue;
+        float n=count[i];
+        for(int c=0;c<3;++c)
+            color[c][i]=n>0.f?(color[c][i]*n+other_color[c][i]*m)/(n+m):other_color[c][i];
+        count[i]=n+m;
+    }
+    return true;
+}
+
+int AOVBuffer::save(const std::string& prefix,AOVType mask)const{
+    int num=0;
+    for(int i=0;i<CHANNEL_NUM;++i){
+        AOVType type=AOVType(1<<i);
+        if((bool)(mask&type)&&has(type)&&savePFM(type,prefix+"_"+getName(type)+".pfm"))
+            ++num;
+    }
+    return num;
+}
+
+bool AOVBuffer::load(const std::string& prefix,AOVType mask){
+    mask=mask&AOVType::ALL;
+    bool sized=false;
+    for(int i=0;i<CHANNEL_NUM;++i){
+        AOVType type=AOVType(1<<i);
+        if(!(bool)(mask&type))
+            continue;
+        std::string filename=prefix+"_"+getName(type)+".pfm";
+        if(!sized){
+            // the header of the first file gives the size
+            std::ifstream file(filename,std::ios::binary);
+            std::string magic;
+            int width=0,height=0;
+            if(!(file>>magic>>width>>height)||width<=0||height<=0){
+                std::cerr<<"AOVBuffer::load: can not read "<<filename<<std::endl;
+                return false;
+            }
+            init(width,height,mask);
+            sized=true;
+        }
+        if(!loadPFM(type,filename))
+            return false;
+    }
+    return sized;
+}
+
+const char* AOVBuffer::getName(AOVType type){
+    switch(type){
+        case AOVType::Color:        return "color";
+        case AOVType::Direct:       return "direct";
+        case AOVType::Indirect:     return "indirect";
+        case AOVType::Albedo:       return "albedo";
+        case AOVType::Normal:       return "normal";
+        case AOVType::Depth:        return "depth";
+        case AOVType::InstanceId:   return "instance_id";
+        case AOVType::PrimitiveId:  return "primitive_id";
+        case AOVType::SampleCount:  return "sample_count";
+        case AOVType::Time:         return "time";
+        default:                    return "unknown";
+    }
+}
+
+int AOVBuffer::getComponentNum(AOVType type){
+    switch(type){
+        case AOVType::Color:
+        case AOVType::Direct:
+        case AOVType::Indirect:
+        case AOVType::Albedo:
+        case AOVType::Normal:
+            return 3;
+        default:
+            return 1;
+    }
+}
+
+/**
+ * @brief pfm: a text header("PF" for rgb, "Pf" for grey, the size, a negative scale for little endian)
+ *        followed by the raw floats, bottom row first. Floats keep the ids exact up to 2^24.
+ */
+bool AOVBuffer::savePFM(AOVType type,const std::string& filename)const{
+    std::ofstream file(filename,std::ios::binary);
+    if(!file.is_open()){
+        std::cerr<<"AOVBuffer::savePFM: can not open "<<filename<<std::endl;
+        return false;
+    }
+
+    int comp=getComponentNum(type);
+    const float* src[3];
+    for(int c=0;c<comp;++c)
+        src[c]=plane(type,c);
+
+    file<<(comp==3?"PF":"Pf")<<"\n"<<width_<<" "<<height_<<"\n-1.0\n";
+    std::vector<float> row(size_t(width_)*comp);
+    for(int y=height_-1;y>=0;--y){
+        for(int x=0;x<width_;++x){
+            for(int c=0;c<comp;++c)
+                row[size_t(x)*comp+c]=src[c][size_t(y)*width_+x];
+        }
+        file.write(reinterpret_cast<const char*>(row.data()),row.size()*sizeof(float));
+    }
+
+    std::cout<<"AOV saved: "<<filename<<std::endl;
+    return true;
+}
+
+bool AOVBuffer::loadPFM(AOVType type,const std::string& filename){
+    std::ifstream file(filename,std::ios::binary);
+    std::string magic;
+    int width=0,height=0;
+    float scale=0.f;
+    if(!(file>>magic>>width>>height>>scale)){
+        std::cerr<<"AOVBuffer::loadPFM: can not read "<<filename<<std::endl;
+        return false;
+    }
+    int comp=getComponentNum(type);
+    if(magic!=(comp==3?"PF":"Pf")||width!=width_||height!=height_||scale>=0.f){
+        std::cerr<<"AOVBuffer::loadPFM: "<<filename<<" does not match the buffer"<<std::endl;
+        return false;
+    }
+    file.get();     // the single whitespace after the scale
+
+    float* dst[3];
+    for(int c=0;c<comp;++c)
+        dst[c]=plane(type,c);
+
+    std::vector<float> row(size_t(width_)*comp);
+    for(int y=height_-1;y>=0;--y){
+        if(!file.read(reinterpret_cast<char*>(row.data()),row.size()*sizeof(float))){
+            std::cerr<<"AOVBuffer::loadPFM: "<<filename<<" is truncated"<<std::endl;
+            return false;
+        }
+        for(int x=0;x<width_;++x){
+            for(int c=0;c<comp;++c)
+                dst[c][size_t(y)*width_+x]=row[size_t(x)*comp+c];
+        }
+    }
+    return true;
+}
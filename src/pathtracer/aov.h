@@ -0,0 +1,80 @@
+/* float output channels of the path tracer */
+#pragma once
+#include"common/common_include.h"
+#include"common/enumtypes.h"
+
+/**
+ * @brief the AOV channels of one film, each component kept as a plane of floats in film pixel order(top row first).
+ *        Only the channels of the mask are allocated; writing to an absent channel does nothing, so that the tiles
+ *        need not test each of them.
+ */
+class AOVBuffer{
+public:
+    static constexpr int CHANNEL_NUM=10;
+
+    void init(int width,int height,AOVType mask);
+
+    bool has(AOVType type)const{ return (bool)(mask_&type); }
+    AOVType getMask()const{ return mask_; }
+    int getWidth()const{ return width_; }
+    int getHeight()const{ return height_; }
+
+    // component `c` of a channel, nullptr if the channel is absent
+    float* plane(AOVType type,int c=0);
+    const float* plane(AOVType type,int c=0)const;
+
+    void set(AOVType type,size_t idx,float value){
+        if(has(type))
+            planes_[first_plane_[channelIndex(type)]][idx]=value;
+    }
+    void set(AOVType type,size_t idx,const glm::vec3& value){
+        if(!has(type))
+            return;
+        int first=first_plane_[channelIndex(type)];
+        for(int c=0;c<3;++c)
+            planes_[first+c][idx]=value[c];
+    }
+
+    /**
+     * @brief add the color of `other` to this buffer, each pixel averaged with the existing one by their sample
+     *        counts. Both need the color and sample count channels; a pixel with one contributor keeps its value
+     *        bit for bit. The other channels that both have are averaged the same way, but for the ids, which stay
+     *        those of the first contributor, and the time, which adds up.
+     * @return false if the buffers do not match
+     */
+    bool merge(const AOVBuffer& other);
+
+    /**
+     * @brief write the channels of `mask` that are present as `<prefix>_<name>.pfm`(portable float map).
+     * @return number of files written
+     */
+    int save(const std::string& prefix,AOVType mask)const;
+
+    /**
+     * @brief read the channels of `mask` from the files written by `save`, the buffer takes the size of the first one.
+     * @return false if a file is missing or does not match
+     */
+    bool load(const std::string& prefix,AOVType mask);
+
+    static const char* getName(AOVType type);
+    static int getComponentNum(AOVType type);
+
+    // position of the bit of a single channel
+    static int channelIndex(AOVType type){
+        int i=0;
+        while(((int)type>>i)>1)
+            ++i;
+        return i;
+    }
+
+private:
+    bool savePFM(AOVType type,const std::string& filename)const;
+    bool loadPFM(AOVType type,const std::string& filename);
+
+private:
+    int width_=0;
+    int height_=0;
+    AOVType mask_=AOVType::None;
+    std::vector<std::vector<float>> planes_;
+    int first_plane_[CHANNEL_NUM];          // of each channel, -1 if absent
+};
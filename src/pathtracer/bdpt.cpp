@@ -0,0 +1,500 @@
+#include"bdpt.h"
+#include"common/utils.h"
+#include<optional>
+
+/*-----------------------------------------------------------*/
+/*------------------------FilmCamera-------------------------*/
+/*-----------------------------------------------------------*/
+
+FilmCamera::FilmCamera(const glm::vec3& pos,const glm::vec3& front,const glm::vec3& up_lt,const glm::vec3& dx,
+                       const glm::vec3& dy,int width,int height)
+    :pos_(pos),front_(front),up_lt_(up_lt),dx_(dx),dy_(dy),width_(width),height_(height){
+    float near=glm::dot(up_lt_-pos_,front_);
+    image_area_=glm::length(dx_)*width_*glm::length(dy_)*height_/(near*near);
+}
+
+bool FilmCamera::project(const glm::vec3& p,glm::vec2& raster)const{
+    glm::vec3 d=p-pos_;
+    float z=glm::dot(d,front_);
+    if(z<=0.f)
+        return false;
+    // the point of the near plane on the way to p, then its pixel coordinates
+    glm::vec3 on_film=pos_+d*(glm::dot(up_lt_-pos_,front_)/z)-up_lt_;
+    raster=glm::vec2(glm::dot(on_film,dx_)/glm::dot(dx_,dx_),glm::dot(on_film,dy_)/glm::dot(dy_,dy_));
+    return raster.x>=0.f&&raster.y>=0.f&&raster.x<width_&&raster.y<height_;
+}
+
+float FilmCamera::pdfDir(const glm::vec3& dir)const{
+    float cos_theta=glm::dot(dir,front_);
+    glm::vec2 raster;
+    if(cos_theta<=0.f||!project(pos_+dir,raster))
+        return 0.f;
+    return 1.f/(image_area_*cos_theta*cos_theta*cos_theta);
+}
+
+void SplatFilm::add(int x,int y,const glm::vec3& value){
+    if(x<0||y<0||x>=width_||y>=height_)
+        return;
+    size_t idx=(size_t(y)*width_+x)*3;
+    for(int c=0;c<3;++c)
+        utils::atomicAdd(data_[idx+c],value[c]);
+}
+
+/*-----------------------------------------------------------*/
+/*------------------------BDPTVertex-------------------------*/
+/*-----------------------------------------------------------*/
+
+namespace{
+
+/**
+ * @brief the whole scattering of a material at a hit rather than a lobe of it, since a connection has to evaluate
+ *        every lobe for its fixed directions: f=sum(share_i*f_i) and pdf=sum(prob_i*pdf_i). Surfaces are one sided.
+ *        Mirrors only scatter along the sampled direction, and evaluate to 0.
+ *        The lobes are made from the compiled `BSDFDesc` of the material when they are needed, a vertex holds none.
+ */
+class MaterialBSDF{
+public:
+    explicit MaterialBSDF(IntersectRecord& inst)
+        :desc_(&inst.material_->bsdf_desc_),diffuse_(inst.getLobeDiffuse()),delta_(desc_->isDelta()){}
+
+    bool isDelta()const{ return delta_; }
+
+    // wo and wi in tangent space
+    glm::vec3 eval(IntersectRecord& inst,Sampler& sampler,const glm::vec3& wo,const glm::vec3& wi,float& pdf)const{
+        pdf=0.f;
+        glm::vec3 f(0.f);
+        if(delta_||wo.z<=0.f||wi.z<=0.f)
+            return f;
+        for(int i=0;i<desc_->lobe_num_;++i){
+            float prob=desc_->cdf_[i+1]-desc_->cdf_[i];
+            if(prob<=0.f)
+                continue;
+            // the middle of its cdf range picks the lobe
+            BSDF lobe(*desc_,0.5f*(desc_->cdf_[i]+desc_->cdf_[i+1]),diffuse_);
+            BSDFRecord rec(inst,sampler,wo,wi);
+            lobe.evalBSDF(rec);
+            // the lobe value is already scaled by share/prob
+            f+=prob*rec.bsdf_val;
+            pdf+=prob*rec.pdf;
+        }
+        return f;
+    }
+
+    float pdf(IntersectRecord& inst,Sampler& sampler,const glm::vec3& wo,const glm::vec3& wi)const{
+        float pdf;
+        eval(inst,sampler,wo,wi,pdf);
+        return pdf;
+    }
+
+    // sample wi for wo(tangent space) from one lobe; f and pdf are those of the whole material
+    bool sample(IntersectRecord& inst,Sampler& sampler,const glm::vec3& wo,glm::vec3& wi,glm::vec3& f,float& pdf)const{
+        if(desc_->lobe_num_==0||wo.z<=0.f)
+            return false;
+        BSDF lobe(*desc_,sampler.pcgRNG_.nextFloat(),diffuse_);
+        BSDFRecord rec(inst,sampler,wo,glm::vec3(0.f,0.f,1.f));
+        lobe.sampleBSDF(rec);
+        if(delta_){
+            lobe.evalBSDF(rec);
+            wi=rec.wi;
+            f=rec.bsdf_val;
+            pdf=rec.pdf;
+            return rec.isValid()&&wi.z>0.f;
+        }
+        if(rec.wi.z<=0.f)
+            return false;
+        wi=rec.wi;
+        f=eval(inst,sampler,wo,wi,pdf);
+        return pdf>0.f;
+    }
+
+private:
+    const BSDFDesc* desc_;
+    glm::vec3 diffuse_;     // of a textured lobe at the hit
+    bool delta_=false;
+};
+
+enum class VertexType{
+    Camera,
+    Light,      // the start of a light subpath on an emitter
+    Surface,
+};
+
+}   // namespace
+
+/**
+ * @brief a vertex of a subpath. The pdfs are over the area of the vertex: `pdf_fwd_` that of the walk that made it,
+ *        `pdf_rev_` that of the walk from the other end, which the weights fill in for the vertices of a connection.
+ */
+struct BDPTVertex{
+    VertexType type_=VertexType::Surface;
+    glm::vec3 pos_=glm::vec3(0.f);
+    glm::vec3 normal_=glm::vec3(0.f);   // shading normal, the view direction of a camera vertex
+    glm::vec3 geo_normal_=glm::vec3(0.f);
+    glm::vec3 beta_=glm::vec3(0.f);     // contribution of the subpath up to here over its pdf
+    glm::vec3 Le_=glm::vec3(0.f);       // emitted toward the previous vertex of a camera subpath, or by a light vertex
+    float pdf_fwd_=0.f;
+    float pdf_rev_=0.f;
+    bool delta_=false;
+    std::shared_ptr<IntersectRecord> inst_;
+    std::optional<MaterialBSDF> bsdf_;  // none for camera and light vertices, which end the subpaths
+};
+
+namespace{
+
+// pdf over the solid angle from `from` => pdf over the area of `to`
+float toArea(float pdf,const BDPTVertex& from,const BDPTVertex& to){
+    glm::vec3 d=to.pos_-from.pos_;
+    float dist2=glm::dot(d,d);
+    if(dist2<=0.f)
+        return 0.f;
+    if(to.type_!=VertexType::Camera)
+        pdf*=std::fabs(glm::dot(to.normal_,d))/std::sqrt(dist2);
+    return pdf/dist2;
+}
+
+// pdf over the area of `next` of the direction of a light path leaving the emitter point `light`
+float pdfLight(const BDPTVertex& light,const BDPTVertex& next){
+    glm::vec3 dir=glm::normalize(next.pos_-light.pos_);
+    return toArea(std::max(0.f,glm::dot(light.normal_,dir))*srender::INV_PI,light,next);
+}
+
+/**
+ * @brief the factor of the bsdf of a light subpath vertex that makes up for its shading normal(Veach): without it
+ *        the light paths and the camera paths would not carry the same light. wo leaves toward where the light came
+ *        from, wi toward where it goes.
+ */
+float shadingCorrection(const BDPTVertex& v,const glm::vec3& wo,const glm::vec3& wi){
+    float denom=std::fabs(glm::dot(wo,v.geo_normal_))*std::fabs(glm::dot(wi,v.normal_));
+    if(denom<=0.f)
+        return 0.f;
+    return std::fabs(glm::dot(wo,v.normal_))*std::fabs(glm::dot(wi,v.geo_normal_))/denom;
+}
+
+/**
+ * @brief whether `dir` leaves `v` on the side of the surface it was reached from. A smoothed shading normal lets the
+ *        bsdf scatter below the face itself, which a path can not do.
+ */
+bool leavesFront(const BDPTVertex& v,const glm::vec3& dir){
+    return glm::dot(dir,v.geo_normal_)>0.f;
+}
+
+bool isBlack(const glm::vec3& v){
+    return v.x<=0.f&&v.y<=0.f&&v.z<=0.f;
+}
+
+}   // namespace
+
+/*-----------------------------------------------------------*/
+/*-----------------BidirectionalPathTracer-------------------*/
+/*-----------------------------------------------------------*/
+
+int BidirectionalPathTracer::walk(Ray ray,glm::vec3 beta,float pdf_dir,BDPTVertex* path,int num,int max_num,
+                                  bool camera,PathTraceRecord& pRecord,glm::vec3& escaped)const{
+    const Scene& scene=pRecord.scene;
+    Sampler& sampler=pRecord.sampler;
+    float pdf_fwd=pdf_dir;
+    // Russian Roulette goes by the throughput since the start of the subpath
+    const float beta_start=beta[0]+beta[1]+beta[2];
+    while(num<max_num){
+        std::shared_ptr<IntersectRecord> inst=(camera&&num==1)?traceCameraRay(ray,pRecord):traceRay(ray,&scene);
+        if(!inst){
+            if(camera)
+                escaped+=beta*scene.getEnvironment(ray.dir_);
+            break;
+        }
+        auto& mtl=inst->material_;
+        if(!mtl){
+            throw std::runtime_error("BidirectionalPathTracer::walk: the hit point doesn't own a material!");
+        }
+
+        BDPTVertex& prev=path[num-1];
+        BDPTVertex& v=path[num++];
+        v=BDPTVertex();
+        v.pos_=inst->pos_;
+        v.normal_=inst->normal_;
+        v.geo_normal_=inst->geo_normal_;
+        v.beta_=beta;
+        v.inst_=inst;
+        v.pdf_fwd_=toArea(pdf_fwd,prev,v);
+        if(camera&&num==2)
+            recordFirstHitAOV(pRecord,*inst);
+
+        // emitters also reflect, as in path tracing, and the subpath goes on from them
+        if(camera&&(bool)(mtl->type_&MtlType::Emissive)&&glm::dot(ray.dir_,inst->normal_)<0.f)
+            v.Le_=mtl->getEmit();
+
+        v.bsdf_.emplace(*inst);
+        v.delta_=v.bsdf_->isDelta();
+        glm::vec3 wo=inst->ray2TangentSpace(-ray.dir_);
+        glm::vec3 wi,f;
+        float pdf;
+        if(!v.bsdf_->sample(*inst,sampler,wo,wi,f,pdf))
+            break;
+        glm::vec3 wi_world=inst->wi2WorldSpace(wi);
+        if(!leavesFront(v,wi_world))
+            break;
+        beta*=f*wi.z/pdf;
+        if(!camera)
+            beta*=shadingCorrection(v,-ray.dir_,wi_world);
+        if(isBlack(beta))
+            break;
+
+        // a mirror bounce has no density, the weights skip its strategies
+        float pdf_rev=0.f;
+        pdf_fwd=0.f;
+        if(!v.delta_){
+            pdf_rev=v.bsdf_->pdf(*inst,sampler,wi,wo);
+            pdf_fwd=pdf;
+        }
+        prev.pdf_rev_=toArea(pdf_rev,v,prev);
+        ray=Ray(inst->pos_+inst->geo_normal_*0.001f,wi_world);
+
+        if(roulette_){
+            /* Russian Roulette */
+            float RR=std::max(std::min((beta[0]+beta[1]+beta[2])/beta_start,0.95f),0.2f);
+            if(sampler.getRandom1D()>=RR)
+                break;
+            beta/=RR;
+        }
+    }
+    return num;
+}
+
+bool BidirectionalPathTracer::visible(const Scene& scene,const glm::vec3& from,const glm::vec3& from_normal,
+                                      const glm::vec3& to)const{
+    glm::vec3 d=to-from;
+    float dist=glm::length(d);
+    glm::vec3 origin=from+from_normal*0.001f;
+    // stop short of the end, which may be on a surface itself
+    Ray ray(origin,d,srender::EPSILON,dist*0.99f);
+    return !traceRay(ray,&scene);
+}
+
+glm::vec3 BidirectionalPathTracer::connect(BDPTVertex* light,BDPTVertex* camera,int s,int t,BDPTVertex& sampled,
+                                           glm::vec2& raster,PathTraceRecord& pRecord)const{
+    const Scene& scene=pRecord.scene;
+    Sampler& sampler=pRecord.sampler;
+    BDPTVertex& pt=camera[t-1];
+
+    // the camera subpath found an emitter
+    if(s==0)
+        return pt.beta_*pt.Le_;
+
+    // a light vertex seen by the camera
+    if(t==1){
+        BDPTVertex& qs=light[s-1];
+        if(!qs.bsdf_||!camera_.project(qs.pos_,raster))
+            return glm::vec3(0.f);
+        glm::vec3 d=camera_.pos_-qs.pos_;
+        float dist2=glm::dot(d,d);
+        glm::vec3 wi=d/std::sqrt(dist2);
+        glm::vec3 wo=glm::normalize(light[s-2].pos_-qs.pos_);
+        float pdf;
+        glm::vec3 f=qs.bsdf_->eval(*qs.inst_,sampler,qs.inst_->ray2TangentSpace(wo),qs.inst_->ray2TangentSpace(wi),pdf);
+        if(isBlack(f)||!leavesFront(qs,wi)||!visible(scene,qs.pos_,qs.geo_normal_,camera_.pos_))
+            return glm::vec3(0.f);
+        // the importance of the camera is the pdf of its rays
+        return qs.beta_*f*(shadingCorrection(qs,wo,wi)*std::fabs(glm::dot(qs.normal_,wi))/dist2*camera_.pdfDir(-wi));
+    }
+
+    if(!pt.bsdf_)
+        return glm::vec3(0.f);
+    glm::vec3 wo=pt.inst_->ray2TangentSpace(glm::normalize(camera[t-2].pos_-pt.pos_));
+
+    // a new light sample
+    if(s==1){
+        EmissionRecord er;
+        if(!scene.sampleEmission(sampler,er))
+            return glm::vec3(0.f);
+        sampled=BDPTVertex();
+        sampled.type_=VertexType::Light;
+        sampled.pos_=er.pos_;
+        sampled.normal_=er.normal_;
+        sampled.Le_=er.radiance_;
+        sampled.beta_=er.radiance_/er.pdf_pos_;
+        sampled.pdf_fwd_=er.pdf_pos_;
+
+        glm::vec3 d=er.pos_-pt.pos_;
+        float dist2=glm::dot(d,d);
+        glm::vec3 wi=d/std::sqrt(dist2);
+        float cos_light=glm::dot(er.normal_,-wi);
+        if(cos_light<=0.f)
+            return glm::vec3(0.f);
+        float pdf;
+        glm::vec3 f=pt.bsdf_->eval(*pt.inst_,sampler,wo,pt.inst_->ray2TangentSpace(wi),pdf);
+        if(isBlack(f)||!leavesFront(pt,wi)||!visible(scene,pt.pos_,pt.geo_normal_,er.pos_))
+            return glm::vec3(0.f);
+        return pt.beta_*f*er.radiance_*(std::fabs(glm::dot(pt.normal_,wi))*cos_light/(dist2*er.pdf_pos_));
+    }
+
+    // an edge between two surface vertices
+    BDPTVertex& qs=light[s-1];
+    if(!qs.bsdf_)
+        return glm::vec3(0.f);
+    glm::vec3 d=pt.pos_-qs.pos_;
+    float dist2=glm::dot(d,d);
+    glm::vec3 dir=d/std::sqrt(dist2);
+    glm::vec3 wo_light=glm::normalize(light[s-2].pos_-qs.pos_);
+    float pdf;
+    glm::vec3 f_light=qs.bsdf_->eval(*qs.inst_,sampler,qs.inst_->ray2TangentSpace(wo_light),
+                                     qs.inst_->ray2TangentSpace(dir),pdf)*shadingCorrection(qs,wo_light,dir);
+    if(isBlack(f_light)||!leavesFront(qs,dir))
+        return glm::vec3(0.f);
+    glm::vec3 f_camera=pt.bsdf_->eval(*pt.inst_,sampler,wo,pt.inst_->ray2TangentSpace(-dir),pdf);
+    if(isBlack(f_camera)||!leavesFront(pt,-dir)||!visible(scene,pt.pos_,pt.geo_normal_,qs.pos_))
+        return glm::vec3(0.f);
+    float G=std::fabs(glm::dot(qs.normal_,dir))*std::fabs(glm::dot(pt.normal_,dir))/dist2;
+    return qs.beta_*f_light*G*f_camera*pt.beta_;
+}
+
+float BidirectionalPathTracer::pdfArea(BDPTVertex& v,const BDPTVertex* prev,const BDPTVertex& next,
+                                       Sampler& sampler)const{
+    if(v.type_==VertexType::Light)
+        return pdfLight(v,next);
+    glm::vec3 wn=glm::normalize(next.pos_-v.pos_);
+    float pdf=0.f;
+    if(v.type_==VertexType::Camera)
+        pdf=camera_.pdfDir(wn);
+    else if(v.bsdf_&&prev)
+        pdf=v.bsdf_->pdf(*v.inst_,sampler,v.inst_->ray2TangentSpace(glm::normalize(prev->pos_-v.pos_)),
+                         v.inst_->ray2TangentSpace(wn));
+    return toArea(pdf,v,next);
+}
+
+/**
+ * @brief Veach's balance heuristic as in pbrt: the pdfs of the other strategies of the path follow from those of
+ *        this one by the ratios pdf_rev/pdf_fwd of the vertices that change hands. The vertices next to the
+ *        connection get the reverse pdfs of the connected path meanwhile. (1,1) is never sampled, so it is left out.
+ */
+float BidirectionalPathTracer::misWeight(BDPTVertex* light,BDPTVertex* camera,int s,int t,
+                                         PathTraceRecord& pRecord)const{
+    if(s+t==2)
+        return 1.f;
+    Sampler& sampler=pRecord.sampler;
+
+    BDPTVertex* qs=s>0?&light[s-1]:nullptr;
+    BDPTVertex* pt=&camera[t-1];
+    BDPTVertex* qs_minus=s>1?&light[s-2]:nullptr;
+    BDPTVertex* pt_minus=t>1?&camera[t-2]:nullptr;
+
+    // the reverse pdfs around the connection, all computed before any is set
+    float pt_rev=s>0?pdfArea(*qs,qs_minus,*pt,sampler):pRecord.scene.getEmissionPDF(pt->Le_);
+    float pt_minus_rev=0.f,qs_rev=0.f,qs_minus_rev=0.f;
+    if(pt_minus)
+        pt_minus_rev=s>0?pdfArea(*pt,qs,*pt_minus,sampler):pdfLight(*pt,*pt_minus);
+    if(qs)
+        qs_rev=pdfArea(*pt,pt_minus,*qs,sampler);
+    if(qs_minus)
+        qs_minus_rev=pdfArea(*qs,pt,*qs_minus,sampler);
+
+    // keep the subpaths as they were walked
+    float saved[4]={pt->pdf_rev_,pt_minus?pt_minus->pdf_rev_:0.f,qs?qs->pdf_rev_:0.f,qs_minus?qs_minus->pdf_rev_:0.f};
+    bool pt_delta=pt->delta_,qs_delta=qs?qs->delta_:false;
+    pt->pdf_rev_=pt_rev;
+    pt->delta_=false;
+    if(pt_minus)
+        pt_minus->pdf_rev_=pt_minus_rev;
+    if(qs){
+        qs->pdf_rev_=qs_rev;
+        qs->delta_=false;
+    }
+    if(qs_minus)
+        qs_minus->pdf_rev_=qs_minus_rev;
+
+    auto remap0=[](float f){ return f!=0.f?f:1.f; };
+    float sum=0.f;
+    float r=1.f;
+    for(int i=t-1;i>0;--i){
+        r*=remap0(camera[i].pdf_rev_)/remap0(camera[i].pdf_fwd_);
+        if(!camera[i].delta_&&!camera[i-1].delta_)
+            sum+=r;
+    }
+    r=1.f;
+    for(int i=s-1;i>=0;--i){
+        r*=remap0(light[i].pdf_rev_)/remap0(light[i].pdf_fwd_);
+        // emitters are never delta lights
+        if(!light[i].delta_&&(i==0||!light[i-1].delta_))
+            sum+=r;
+    }
+
+    pt->pdf_rev_=saved[0];
+    pt->delta_=pt_delta;
+    if(pt_minus)
+        pt_minus->pdf_rev_=saved[1];
+    if(qs){
+        qs->pdf_rev_=saved[2];
+        qs->delta_=qs_delta;
+    }
+    if(qs_minus)
+        qs_minus->pdf_rev_=saved[3];
+    return 1.f/(1.f+sum);
+}
+
+glm::vec3 BidirectionalPathTracer::Li(const Ray ray,PathTraceRecord& pRecord){
+    const Scene& scene=pRecord.scene;
+
+    BDPTVertex camera_path[MAX_BOUNCE+2];
+    BDPTVertex light_path[MAX_BOUNCE+1];
+
+    // the camera subpath, whose escapes see the environment
+    BDPTVertex& eye=camera_path[0];
+    eye.type_=VertexType::Camera;
+    eye.pos_=camera_.pos_;
+    eye.normal_=camera_.front_;
+    eye.beta_=glm::vec3(1.f);
+    glm::vec3 radiance(0.f);
+    int t_num=walk(ray,glm::vec3(1.f),camera_.pdfDir(ray.dir_),camera_path,1,max_depth_+2,true,pRecord,radiance);
+    if(t_num<=2)
+        pRecord.aov.direct+=radiance;
+    pRecord.curdepth=t_num-1;
+
+    // the light subpath
+    int s_num=0;
+    EmissionRecord er;
+    if(scene.sampleEmission(pRecord.sampler,er)){
+        BDPTVertex& origin=light_path[0];
+        origin.type_=VertexType::Light;
+        origin.pos_=er.pos_;
+        origin.normal_=er.normal_;
+        origin.Le_=er.radiance_;
+        origin.beta_=er.radiance_/er.pdf_pos_;
+        origin.pdf_fwd_=er.pdf_pos_;
+        s_num=1;
+        float cos_light=glm::dot(er.normal_,er.dir_);
+        if(er.pdf_dir_>0.f&&cos_light>0.f){
+            glm::vec3 unused(0.f);
+            glm::vec3 beta=er.radiance_*(cos_light/(er.pdf_pos_*er.pdf_dir_));
+            s_num=walk(Ray(er.pos_+er.dir_*0.001f,er.dir_),beta,er.pdf_dir_,light_path,1,max_depth_+1,false,
+                       pRecord,unused);
+        }
+    }
+
+    // every strategy of every path length
+    for(int t=1;t<=t_num;++t){
+        for(int s=0;s<=s_num;++s){
+            int depth=s+t-2;
+            if((s==1&&t==1)||depth<0||depth>max_depth_)
+                continue;
+            BDPTVertex sampled;
+            glm::vec2 raster;
+            glm::vec3 L=connect(light_path,camera_path,s,t,sampled,raster,pRecord);
+            if(isBlack(L))
+                continue;
+            // the new light sample stands in for the start of the light subpath while it is weighted
+            if(s==1)
+                std::swap(light_path[0],sampled);
+            L*=misWeight(light_path,camera_path,s,t,pRecord);
+            if(s==1)
+                std::swap(light_path[0],sampled);
+
+            if(t==1)
+                splats_->add((int)raster.x,(int)raster.y,L);
+            else{
+                radiance+=L;
+                if(depth<=1)
+                    pRecord.aov.direct+=L;
+            }
+        }
+    }
+    return radiance;
+}
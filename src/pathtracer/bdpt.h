@@ -0,0 +1,114 @@
+/* bidirectional path tracing: camera and light subpaths joined by every pair of their vertices */
+#pragma once
+#include"common/common_include.h"
+#include"pathtracer.h"
+#include<atomic>
+
+/**
+ * @brief the pinhole camera of a film, for the paths that reach it from the lights. Film coordinates are in
+ *        pixels from the top left corner, as the tiles sample them.
+ */
+struct FilmCamera{
+    glm::vec3 pos_;
+    glm::vec3 front_;
+    glm::vec3 up_lt_;       // top left corner of the film, on the near plane
+    glm::vec3 dx_;          // one pixel to the right
+    glm::vec3 dy_;          // one pixel down
+    int width_=0;
+    int height_=0;
+    float image_area_=0.f;  // of the film at unit distance from the camera
+
+    FilmCamera(){}
+    FilmCamera(const glm::vec3& pos,const glm::vec3& front,const glm::vec3& up_lt,const glm::vec3& dx,
+               const glm::vec3& dy,int width,int height);
+
+    // the film coordinates of the camera ray toward `p`, false if they are off the film
+    bool project(const glm::vec3& p,glm::vec2& raster)const;
+
+    /**
+     * @brief pdf over the solid angle of a camera ray along `dir`(normalized) among those of the whole film, which is
+     *        also the importance the camera gives it: 1/(area*cos^3)
+     */
+    float pdfDir(const glm::vec3& dir)const;
+};
+
+/**
+ * @brief float image the light paths add their contributions to, from any thread: atomic adds to each channel
+ */
+class SplatFilm{
+public:
+    SplatFilm(int width,int height):width_(width),height_(height),data_(size_t(width)*height*3){ clear(); }
+
+    void clear(){
+        for(auto& v:data_)
+            v.store(0.f,std::memory_order_relaxed);
+    }
+    void add(int x,int y,const glm::vec3& value);
+    glm::vec3 get(size_t idx)const{
+        return glm::vec3(data_[idx*3].load(std::memory_order_relaxed),data_[idx*3+1].load(std::memory_order_relaxed),
+                         data_[idx*3+2].load(std::memory_order_relaxed));
+    }
+
+private:
+    int width_;
+    int height_;
+    std::vector<std::atomic<float>> data_;
+};
+
+struct BDPTVertex;
+
+/**
+ * @brief bidirectional path tracing(Veach): each camera sample also traces a light subpath from the emitters, and
+ *        every strategy joining a prefix of one to a prefix of the other is weighted by the balance heuristic over
+ *        all the strategies of the same path. Strategies:
+ * - s=0 : the camera subpath hits an emitter
+ * - s=1 : a new light sample joined to a camera vertex, like the light samples of path tracing
+ * - t=1 : a light vertex joined to the camera(light tracing), added to the pixel it projects to in `splats_`
+ *         rather than to the radiance of the sample
+ * Paths have at most `max_depth_` bounces, or else each subpath ends by Russian Roulette on its throughput as in path
+ * tracing. Its survival is left out of the weights: that of the other subpath at a vertex is not known, and leaving
+ * it out of all of them keeps the weights of a path summing to one. Emitters reflect like the other surfaces, the subpaths go on from them and
+ * each vertex on one contributes through both the s=0 and the connecting strategies. The environment map is only seen
+ * by camera subpaths that escape.
+ */
+class BidirectionalPathTracer final:public PathTracer{
+public:
+    static constexpr int MAX_BOUNCE=32;    // bounds the subpaths, also those ended by Russian Roulette
+
+    BidirectionalPathTracer(int mdepth,const FilmCamera& camera,std::shared_ptr<SplatFilm> splats)
+        :max_depth_(mdepth>0?std::min(mdepth,MAX_BOUNCE):MAX_BOUNCE),roulette_(mdepth<=0),camera_(camera),
+         splats_(splats){}
+
+    glm::vec3 Li(const Ray ray,PathTraceRecord& pRecord) override;
+
+private:
+    /**
+     * @brief extend the subpath `path` of `num` vertices by bsdf sampling, from `ray` leaving its last vertex with
+     *        `pdf_dir` over the solid angle, up to `max_num` vertices. Camera rays that escape add the environment
+     *        to `escaped`.
+     * @return the number of vertices of the path
+     */
+    int walk(Ray ray,glm::vec3 beta,float pdf_dir,BDPTVertex* path,int num,int max_num,bool camera,
+             PathTraceRecord& pRecord,glm::vec3& escaped)const;
+
+    /**
+     * @brief the unweighted contribution of the strategy (s,t). For s=1 `sampled` gets the new light vertex.
+     * @param raster gets the film coordinates for t=1
+     */
+    glm::vec3 connect(BDPTVertex* light,BDPTVertex* camera,int s,int t,BDPTVertex& sampled,glm::vec2& raster,
+                      PathTraceRecord& pRecord)const;
+
+    // balance heuristic weight of the strategy (s,t); for s=1 the new light vertex must be in `light[0]`
+    float misWeight(BDPTVertex* light,BDPTVertex* camera,int s,int t,PathTraceRecord& pRecord)const;
+
+    // pdf over the area of `next` of sampling it from `v`, the path having arrived at `v` from `prev`
+    float pdfArea(BDPTVertex& v,const BDPTVertex* prev,const BDPTVertex& next,Sampler& sampler)const;
+
+    // whether the segment between two points is free, `from` being on a face of normal `from_normal` that faces `to`
+    bool visible(const Scene& scene,const glm::vec3& from,const glm::vec3& from_normal,const glm::vec3& to)const;
+
+    int max_depth_;
+    bool roulette_;
+    FilmCamera camera_;
+    std::shared_ptr<SplatFilm> splats_;
+};
@@ -62,29 +62,29 @@ public:
  * sampling([0,1]^2->[theta,phi]) the model, and querying the pdf(w_i).
  * Note that Wi and Wo are both in tangent space local to the hit point 
  * and both point in the direciton of Normal
+ * 
+ * A BSDF is the lobe picked at one hit among those of the material's `BSDFDesc`, with the texture already looked
+ * up. It is a small value, and the lobes dispatch through a switch on `bsdf_type_` rather than virtual calls.
  */
 class BSDF{
 public:
-    BSDF(BSDFType type):bsdf_type_(type){}
-    virtual ~BSDF(){}
+    /**
+     * @brief pick a lobe of `desc` with u in [0,1)
+     * @param diffuse reflectance of a textured Lambert lobe at the hit, unused otherwise
+     */
+    BSDF(const BSDFDesc& desc,float u,const glm::vec3& diffuse);
 
     /**
      * @brief Sample a wi in tangent space with the information stored in BSDFRecord,including wo,inst,sampler and such.
      *        Have to fill wi and costheta
      */
-    virtual void sampleBSDF(BSDFRecord& bsdfRec)const=0;
+    void sampleBSDF(BSDFRecord& bsdfRec)const;
 
     /**
      * @brief After the sampling of wi, this function takes charge of calculate bsdf_value and pdf.
      *        So remember to sample before calling this.
      */
-    virtual void evalBSDF(BSDFRecord& rec)const=0;
-
-    /**
-     * @brief When choosing among different bsdfs, each BSDF are required to offer a weight, 
-     *        for example, LambertianBSDF's weight is albedo(Kd)
-     */
-    virtual float getWeight()const=0;
+    void evalBSDF(BSDFRecord& rec)const;
 
     /**
      * @brief static function for sampling in hemishpere with cos weighted
@@ -97,126 +97,15 @@ public:
 
 public:
     BSDFType bsdf_type_;
-    float prob_;
-    
-};
-
-/**
- * @brief `BSDFlist` is an abstract for multiple bsdfs, which will sample a wi among all the bsdfs by their weights
- * 
- */
-class BSDFlist:public BSDF{
-public:
-    BSDFlist(BSDFType type=BSDFType::EMPTY):BSDF(type),total_weight_(0.f){}
-
-    void insertBSDF(std::shared_ptr<const BSDF> bsdf);
-
-    void initWeights();
-
-    /**
-     * @brief For each hit, randomly choose a bsdf ,and record the chosen type in member: bsdf_type_
-     * 
-     * @param rd : a random number in [0,1)
-     */
-    void randomSelectBSDF(float rd){
-        // choose a bsdf randomly
-        chosenIdx_=binarySearchBRDF(rd);
-        this->bsdf_type_=bsdfs_[chosenIdx_]->bsdf_type_;
-    }
-
-    // must be called after `randomSelectBSDF`
-    void evalBSDF(BSDFRecord& rec)const override;
-
-    // must be called after `randomSelectBSDF`
-    void sampleBSDF(BSDFRecord& bsdfRec)const override;
-
-    float getWeight()const override;
- 
-private:
-
-    /**
-     * @brief find the i such that cdf_[i]<u<=cdf_[i+1]
-     * 
-     * @param u : random number in [0,1)
-     * @return int : the chosen index of bsdf in bsdfs_
-     */
-    int binarySearchBRDF(float u)const;
-
-    std::vector<float> cdf_;    // the cdf of probablity; cdf_[i+1] is the sum of bsdfs_[0~i].prob_
-    std::vector<float> weights_;
-    std::vector<std::shared_ptr<const BSDF>> bsdfs_;
-    float total_weight_;
-    int chosenIdx_;
-
-};
-
-class LambertBRDF:public BSDF{
-public:
-    LambertBRDF(glm::vec3 r,BSDFType type=BSDFType::LambertReflection):BSDF(type),albedo_(r){
-        prob_=0.5;
-    }
-
-    void evalBSDF(BSDFRecord& rec)const override;
-
-    void sampleBSDF(BSDFRecord& bsdfRec)const override;
-
-    float getWeight()const override;
-
-private:
-    glm::vec3 albedo_;
-
-};
-
-class SpecularBRDF:public BSDF{
-public:
-    SpecularBRDF(glm::vec3 ks,BSDFType type=BSDFType::PerfectReflection):BSDF(type),albedo_(ks){
-        prob_=0.7;
-    }
-
-    void evalBSDF( BSDFRecord& rec)const override;
-
-    void sampleBSDF(BSDFRecord& bsdfRec)const override;
-
-    float getWeight()const override;
 
 private:
-    glm::vec3 perfectReflect(const glm::vec3& normal,const glm::vec3& wo)const{
+    static glm::vec3 perfectReflect(const glm::vec3& normal,const glm::vec3& wo){
         auto wi=2*glm::dot(wo,normal)*normal-wo;
         assert(fabs(glm::length(wi)-1)<srender::EPSILON);   // wi should be normalized by nature
         return wi;
     }
 
-    glm::vec3 albedo_;
-
+    glm::vec3 color_;   // Kd or Ks of the lobe
+    float shininess_;
+    float scale_;       // share of the lobe in the reflectance over the probability of picking it
 };
-
-
-class BPhongSpecularBRDF:public BSDF{
-public:
-    BPhongSpecularBRDF(glm::vec3 ks,float ns,BSDFType type=BSDFType::BlinnPhongSpecular):BSDF(type),Ks(ks),Ns(ns){
-        prob_=0.5;
-    }
-
-    void evalBSDF( BSDFRecord& rec)const override;
-
-    void sampleBSDF(BSDFRecord& bsdfRec)const override;
-
-    float getWeight()const override;
-
-private:
-    glm::vec3 getReflect(const glm::vec3& h,const glm::vec3& wo)const{
-        auto wi=2*glm::dot(wo,h)*h-wo;
-        assert(fabs(glm::length(wi)-1)<srender::EPSILON);   // wi should be normalized by nature
-        return wi;
-    }
-
-    // glm::vec3 Fresnel(const glm::vec3& F0,float NdotV)const{
-    //     float cos=std::max(NdotV,0.f);
-    //     float cos5=pow(1-cos,5);
-    //     return F0+(glm::vec3(1)-F0)*glm::vec3(cos5);
-    // }
-
-
-    glm::vec3 Ks;
-    float Ns;
-};
\ No newline at end of file
@@ -0,0 +1,96 @@
+#include"checkpoint.h"
+#include<fstream>
+#include<filesystem>
+#include<cstring>
+#include<cstdio>
+#ifdef _WIN32
+#include<io.h>
+#else
+#include<unistd.h>
+#endif
+
+bool RenderCheckpoint::Header::matches(const Header& other)const{
+    return std::memcmp(this,&other,sizeof(Header))==0;
+}
+
+void RenderCheckpoint::reset(const Header& header){
+    header_=header;
+    pass_num_=0;
+    spp_num_=0;
+    film_.init(header.width_,header.height_,CHANNELS);
+}
+
+/**
+ * @brief layout: the header, the number of finished passes and of their samples per pixel, then the planes of `CHANNELS` in film pixel order.
+ */
+bool RenderCheckpoint::load(const std::string& path,const Header& header){
+    std::ifstream file(path,std::ios::binary);
+    if(!file.is_open())
+        return false;
+
+    Header saved;
+    uint32_t pass_num=0,spp_num=0;
+    file.read(reinterpret_cast<char*>(&saved),sizeof(Header));
+    file.read(reinterpret_cast<char*>(&pass_num),sizeof(uint32_t));
+    file.read(reinterpret_cast<char*>(&spp_num),sizeof(uint32_t));
+    if(!file||!saved.matches(header)){
+        std::cerr<<"RenderCheckpoint::load: "<<path<<" belongs to another render, ignored"<<std::endl;
+        return false;
+    }
+
+    AOVBuffer film;
+    film.init(header.width_,header.height_,CHANNELS);
+    size_t bytes=size_t(header.width_)*header.height_*sizeof(float);
+    for(AOVType type:{AOVType::Color,AOVType::SampleCount}){
+        for(int c=0;c<AOVBuffer::getComponentNum(type);++c)
+            file.read(reinterpret_cast<char*>(film.plane(type,c)),bytes);
+    }
+    if(!file){
+        std::cerr<<"RenderCheckpoint::load: "<<path<<" is truncated, ignored"<<std::endl;
+        return false;
+    }
+
+    header_=saved;
+    pass_num_=pass_num;
+    spp_num_=spp_num;
+    film_=std::move(film);
+    return true;
+}
+
+bool RenderCheckpoint::save(const std::string& path)const{
+    std::string tmp=path+".tmp";
+    FILE* file=std::fopen(tmp.c_str(),"wb");
+    if(!file){
+        std::cerr<<"RenderCheckpoint::save: can not open "<<tmp<<std::endl;
+        return false;
+    }
+    bool ok=std::fwrite(&header_,sizeof(Header),1,file)==1;
+    ok=ok&&std::fwrite(&pass_num_,sizeof(uint32_t),1,file)==1;
+    ok=ok&&std::fwrite(&spp_num_,sizeof(uint32_t),1,file)==1;
+    size_t num=size_t(header_.width_)*header_.height_;
+    for(AOVType type:{AOVType::Color,AOVType::SampleCount}){
+        for(int c=0;c<AOVBuffer::getComponentNum(type);++c)
+            ok=ok&&std::fwrite(film_.plane(type,c),sizeof(float),num,file)==num;
+    }
+    // the data has to be on the disk before the rename, or a crash may leave a renamed but empty file
+    ok=ok&&std::fflush(file)==0;
+#ifdef _WIN32
+    ok=ok&&_commit(_fileno(file))==0;
+#else
+    ok=ok&&fsync(fileno(file))==0;
+#endif
+    ok=std::fclose(file)==0&&ok;
+    if(!ok){
+        std::cerr<<"RenderCheckpoint::save: can not write "<<tmp<<std::endl;
+        return false;
+    }
+
+    // replaces the old checkpoint in one step
+    std::error_code err;
+    std::filesystem::rename(tmp,path,err);
+    if(err){
+        std::cerr<<"RenderCheckpoint::save: can not replace "<<path<<": "<<err.message()<<std::endl;
+        return false;
+    }
+    return true;
+}
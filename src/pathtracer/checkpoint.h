@@ -0,0 +1,54 @@
+/* saved state of a long path tracing render */
+#pragma once
+#include"common/common_include.h"
+#include"aov.h"
+
+/**
+ * @brief the float film of a render made of passes, enough to resume it: the accumulated color and sample count of
+ *        each pixel, the number of finished passes and of the samples per pixel they rendered. Pass `p` seeds the sampler of tile `i` with `i+p*tile_num`,
+ *        so the passes of a resumed render trace new samples, and the result is the one of an uninterrupted render.
+ *        Files are written next to the target, flushed to the disk and renamed over it, a kill or a crash during
+ *        `save` leaves the old checkpoint.
+ */
+class RenderCheckpoint{
+public:
+    static constexpr AOVType CHANNELS=AOVType((int)AOVType::Color|(int)AOVType::SampleCount);
+
+    // what a checkpoint must agree on to be resumed
+    struct Header{
+        char magic_[4]={'P','L','C','K'};
+        uint32_t version_=3;
+        int32_t width_=0;
+        int32_t height_=0;
+        uint32_t tiles_num_=0;
+        uint32_t max_depth_=0;
+        uint32_t light_split_=0;
+        uint32_t pass_spp_=0;
+        uint32_t integrator_=0;
+        float camera_pos_[3]={0,0,0};
+        float camera_front_[3]={0,0,0};
+
+        bool matches(const Header& other)const;
+    };
+
+    // start an empty accumulation
+    void reset(const Header& header);
+
+    /**
+     * @brief read the checkpoint at `path` if it was made with `header`.
+     * @return false if there is none or it belongs to another render, the checkpoint is left untouched then
+     */
+    bool load(const std::string& path,const Header& header);
+    bool save(const std::string& path)const;
+
+    AOVBuffer& film(){ return film_; }
+    uint32_t getPassNum()const{ return pass_num_; }
+    uint32_t getSppNum()const{ return spp_num_; }
+    void setProgress(uint32_t pass_num,uint32_t spp_num){ pass_num_=pass_num; spp_num_=spp_num; }
+
+private:
+    Header header_;
+    uint32_t pass_num_=0;   // finished passes
+    uint32_t spp_num_=0;    // samples per pixel of the finished passes, the last one may be short
+    AOVBuffer film_;
+};
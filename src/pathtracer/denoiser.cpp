@@ -0,0 +1,263 @@
+#include"denoiser.h"
+#include"common/threadpool.h"
+#include"common/profiler.h"
+#include<cstring>
+#ifdef __AVX2__
+#include<immintrin.h>
+#endif
+
+namespace{
+constexpr int TILE_SIZE=64;
+constexpr float DEMODULATE_EPS=0.01f;       // keeps black albedo from dividing by zero
+constexpr float FIREFLY_RATIO=2.f;          // a pixel may be this much brighter than its brightest neighbour
+constexpr float VARIANCE_EPS=1e-8f;
+constexpr float B3_SPLINE[3]={3.f/8.f,1.f/4.f,1.f/16.f};
+
+inline float luminance(float r,float g,float b){
+    return 0.2126f*r+0.7152f*g+0.0722f*b;
+}
+
+// exp(x) for x<=0: 2^(x*log2(e)) split into an exponent and a polynomial of the fraction, rel. error ~1e-6
+inline float expNegative(float x){
+    float t=std::max(x,-80.f)*1.44269504f;
+    float fi=std::floor(t);
+    float f=t-fi;
+    float p=1.f+f*(0.69314718f+f*(0.24022650f+f*(0.05550411f+f*(0.00961813f+f*0.00133336f))));
+    int32_t bits=(int32_t(fi)+127)<<23;
+    float scale;
+    std::memcpy(&scale,&bits,sizeof(float));
+    return p*scale;
+}
+
+#ifdef __AVX2__
+inline __m256 expNegative(__m256 x){
+    __m256 t=_mm256_mul_ps(_mm256_max_ps(x,_mm256_set1_ps(-80.f)),_mm256_set1_ps(1.44269504f));
+    __m256 fi=_mm256_floor_ps(t);
+    __m256 f=_mm256_sub_ps(t,fi);
+    __m256 p=_mm256_set1_ps(0.00133336f);
+    p=_mm256_add_ps(_mm256_mul_ps(p,f),_mm256_set1_ps(0.00961813f));
+    p=_mm256_add_ps(_mm256_mul_ps(p,f),_mm256_set1_ps(0.05550411f));
+    p=_mm256_add_ps(_mm256_mul_ps(p,f),_mm256_set1_ps(0.24022650f));
+    p=_mm256_add_ps(_mm256_mul_ps(p,f),_mm256_set1_ps(0.69314718f));
+    p=_mm256_add_ps(_mm256_mul_ps(p,f),_mm256_set1_ps(1.f));
+    __m256i bits=_mm256_slli_epi32(_mm256_add_epi32(_mm256_cvtps_epi32(fi),_mm256_set1_epi32(127)),23);
+    return _mm256_mul_ps(p,_mm256_castsi256_ps(bits));
+}
+
+inline __m256 luminance(__m256 r,__m256 g,__m256 b){
+    return _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(r,_mm256_set1_ps(0.2126f)),_mm256_mul_ps(g,_mm256_set1_ps(0.7152f))),
+                         _mm256_mul_ps(b,_mm256_set1_ps(0.0722f)));
+}
+
+inline __m256 squaredDiff(__m256 a,__m256 b){
+    __m256 d=_mm256_sub_ps(a,b);
+    return _mm256_mul_ps(d,d);
+}
+#endif
+}
+
+void Denoiser::denoise(const AOVBuffer& aovs,std::vector<glm::vec3>& out){
+    PROFILE_ZONE("Denoise");
+    assert((aovs.getMask()&INPUT_AOVS)==INPUT_AOVS);
+    int width=aovs.getWidth();
+    int height=aovs.getHeight();
+    size_t num=size_t(width)*height;
+    width_=width;
+    height_=height;
+    for(auto& plane:planes_)
+        plane.resize(num);
+    for(auto& plane:dst_)
+        plane.resize(num);
+    inv_depth_.resize(num);
+    inv_sigma_lum_.resize(num);
+
+    for(int c=0;c<3;++c){
+        const float* color=aovs.plane(AOVType::Color,c);
+        const float* albedo=aovs.plane(AOVType::Albedo,c);
+        std::copy(albedo,albedo+num,planes_[AR+c].begin());
+        std::copy(aovs.plane(AOVType::Normal,c),aovs.plane(AOVType::Normal,c)+num,planes_[NX+c].begin());
+        for(size_t i=0;i<num;++i)
+            planes_[R+c][i]=color[i]/(albedo[i]+DEMODULATE_EPS);
+    }
+    const float* depth=aovs.plane(AOVType::Depth);
+    std::copy(depth,depth+num,planes_[DEPTH].begin());
+    for(size_t i=0;i<num;++i)
+        inv_depth_[i]=1.f/(sigma_depth_*std::max(depth[i],srender::EPSILON));
+
+    suppressFireflies();
+    estimateVariance();
+
+    int tiles_x=(width+TILE_SIZE-1)/TILE_SIZE;
+    int tiles_y=(height+TILE_SIZE-1)/TILE_SIZE;
+    for(int it=0;it<iterations_;++it){
+        for(size_t i=0;i<num;++i)
+            inv_sigma_lum_[i]=1.f/(sigma_luminance_*std::sqrt(planes_[VAR][i])+VARIANCE_EPS);
+
+        int step=1<<it;
+        ThreadPool::global().parallelFor(size_t(tiles_x*tiles_y),[&](size_t t){
+            int x0=int(t%tiles_x)*TILE_SIZE;
+            int y0=int(t/tiles_x)*TILE_SIZE;
+            filterTile(x0,std::min(x0+TILE_SIZE,width),y0,std::min(y0+TILE_SIZE,height),step);
+        });
+        for(int k=0;k<FILTERED_NUM;++k)
+            planes_[k].swap(dst_[k]);
+    }
+
+    out.resize(num);
+    for(size_t i=0;i<num;++i){
+        for(int c=0;c<3;++c)
+            out[i][c]=planes_[R+c][i]*(planes_[AR+c][i]+DEMODULATE_EPS);
+    }
+}
+
+void Denoiser::suppressFireflies(){
+    // a lone sample far brighter than the rest stands out by many standard deviations and would survive the filter
+    std::vector<float> lum(size_t(width_)*height_);
+    for(size_t i=0;i<lum.size();++i)
+        lum[i]=luminance(planes_[R][i],planes_[G][i],planes_[B][i]);
+
+    ThreadPool::global().parallelRange(size_t(height_),16,[&](size_t begin,size_t end){
+        for(int y=(int)begin;y<(int)end;++y){
+            for(int x=0;x<width_;++x){
+                float brightest=0.f;
+                for(int qy=std::max(y-1,0);qy<=std::min(y+1,height_-1);++qy){
+                    for(int qx=std::max(x-1,0);qx<=std::min(x+1,width_-1);++qx){
+                        if(qx!=x||qy!=y)
+                            brightest=std::max(brightest,lum[size_t(qy)*width_+qx]);
+                    }
+                }
+                size_t i=size_t(y)*width_+x;
+                if(lum[i]>brightest*FIREFLY_RATIO){
+                    float scale=brightest*FIREFLY_RATIO/lum[i];
+                    for(int c=0;c<3;++c)
+                        planes_[R+c][i]*=scale;
+                }
+            }
+        }
+    });
+}
+
+void Denoiser::estimateVariance(){
+    std::vector<float> lum(size_t(width_)*height_);
+    for(size_t i=0;i<lum.size();++i)
+        lum[i]=luminance(planes_[R][i],planes_[G][i],planes_[B][i]);
+
+    ThreadPool::global().parallelRange(size_t(height_),16,[&](size_t begin,size_t end){
+        for(int y=(int)begin;y<(int)end;++y){
+            for(int x=0;x<width_;++x){
+                float sum=0.f,sum_sq=0.f;
+                int n=0;
+                for(int qy=std::max(y-1,0);qy<=std::min(y+1,height_-1);++qy){
+                    for(int qx=std::max(x-1,0);qx<=std::min(x+1,width_-1);++qx){
+                        float l=lum[size_t(qy)*width_+qx];
+                        sum+=l;
+                        sum_sq+=l*l;
+                        ++n;
+                    }
+                }
+                float mean=sum/n;
+                planes_[VAR][size_t(y)*width_+x]=std::max(sum_sq/n-mean*mean,0.f);
+            }
+        }
+    });
+}
+
+void Denoiser::filterTile(int x0,int x1,int y0,int y1,int step){
+    const float inv_sigma_normal=1.f/(sigma_normal_*sigma_normal_);
+    const float inv_sigma_albedo=1.f/(sigma_albedo_*sigma_albedo_);
+    const float inv_step=1.f/step;
+    const float* plane[PLANE_NUM];
+    for(int k=0;k<PLANE_NUM;++k)
+        plane[k]=planes_[k].data();
+    const float* inv_depth=inv_depth_.data();
+    const float* inv_sigma_lum=inv_sigma_lum_.data();
+
+    // weighted sums of the taps for the pixels of one row of the tile; the variance is weighted by w^2
+    float sum_r[TILE_SIZE],sum_g[TILE_SIZE],sum_b[TILE_SIZE],sum_var[TILE_SIZE],sum_w[TILE_SIZE];
+
+    for(int y=y0;y<y1;++y){
+        for(float* sum:{sum_r,sum_g,sum_b,sum_var,sum_w})
+            std::fill(sum,sum+TILE_SIZE,0.f);
+        size_t row=size_t(y)*width_;
+
+        for(int dy=-2;dy<=2;++dy){
+            int qy=y+dy*step;
+            if(qy<0||qy>=height_)
+                continue;
+            for(int dx=-2;dx<=2;++dx){
+                // taps falling outside of the image are left out
+                int offset=dx*step;
+                int xb=std::max(x0,-offset);
+                int xe=std::min(x1,width_-offset);
+                if(xb>=xe)
+                    continue;
+                float h=B3_SPLINE[std::abs(dy)]*B3_SPLINE[std::abs(dx)];
+                ptrdiff_t q_shift=ptrdiff_t(qy-y)*width_+offset;
+
+                int x=xb;
+#ifdef __AVX2__
+                const __m256 v_h=_mm256_set1_ps(h);
+                const __m256 v_inv_normal=_mm256_set1_ps(-inv_sigma_normal);
+                const __m256 v_inv_albedo=_mm256_set1_ps(-inv_sigma_albedo);
+                const __m256 v_inv_step=_mm256_set1_ps(-inv_step);
+                const __m256 v_abs_mask=_mm256_castsi256_ps(_mm256_set1_epi32(0x7fffffff));
+                for(;x+8<=xe;x+=8){
+                    size_t p=row+x;
+                    size_t q=p+q_shift;
+                    auto load=[&](int k,size_t i){ return _mm256_loadu_ps(plane[k]+i); };
+
+                    __m256 qr=load(R,q),qg=load(G,q),qb=load(B,q);
+                    __m256 d_lum=_mm256_and_ps(_mm256_sub_ps(luminance(load(R,p),load(G,p),load(B,p)),luminance(qr,qg,qb)),v_abs_mask);
+                    __m256 d_normal=_mm256_add_ps(_mm256_add_ps(squaredDiff(load(NX,p),load(NX,q)),squaredDiff(load(NY,p),load(NY,q))),
+                                                  squaredDiff(load(NZ,p),load(NZ,q)));
+                    __m256 d_albedo=_mm256_add_ps(_mm256_add_ps(squaredDiff(load(AR,p),load(AR,q)),squaredDiff(load(AG,p),load(AG,q))),
+                                                  squaredDiff(load(AB,p),load(AB,q)));
+                    __m256 d_depth=_mm256_mul_ps(_mm256_and_ps(_mm256_sub_ps(load(DEPTH,p),load(DEPTH,q)),v_abs_mask),_mm256_loadu_ps(inv_depth+p));
+
+                    __m256 e=_mm256_sub_ps(_mm256_setzero_ps(),_mm256_mul_ps(d_lum,_mm256_loadu_ps(inv_sigma_lum+p)));
+                    e=_mm256_add_ps(e,_mm256_mul_ps(d_normal,v_inv_normal));
+                    e=_mm256_add_ps(e,_mm256_mul_ps(d_albedo,v_inv_albedo));
+                    e=_mm256_add_ps(e,_mm256_mul_ps(d_depth,v_inv_step));
+                    __m256 w=_mm256_mul_ps(v_h,expNegative(e));
+
+                    int k=x-x0;
+                    _mm256_storeu_ps(sum_r+k,_mm256_add_ps(_mm256_loadu_ps(sum_r+k),_mm256_mul_ps(w,qr)));
+                    _mm256_storeu_ps(sum_g+k,_mm256_add_ps(_mm256_loadu_ps(sum_g+k),_mm256_mul_ps(w,qg)));
+                    _mm256_storeu_ps(sum_b+k,_mm256_add_ps(_mm256_loadu_ps(sum_b+k),_mm256_mul_ps(w,qb)));
+                    _mm256_storeu_ps(sum_var+k,_mm256_add_ps(_mm256_loadu_ps(sum_var+k),_mm256_mul_ps(_mm256_mul_ps(w,w),load(VAR,q))));
+                    _mm256_storeu_ps(sum_w+k,_mm256_add_ps(_mm256_loadu_ps(sum_w+k),w));
+                }
+#endif
+                for(;x<xe;++x){
+                    size_t p=row+x;
+                    size_t q=p+q_shift;
+                    auto sq=[&](int k){ float d=plane[k][p]-plane[k][q]; return d*d; };
+
+                    float d_lum=std::abs(luminance(plane[R][p],plane[G][p],plane[B][p])-luminance(plane[R][q],plane[G][q],plane[B][q]));
+                    float d_normal=sq(NX)+sq(NY)+sq(NZ);
+                    float d_albedo=sq(AR)+sq(AG)+sq(AB);
+                    float d_depth=std::abs(plane[DEPTH][p]-plane[DEPTH][q])*inv_depth[p];
+                    float w=h*expNegative(-d_lum*inv_sigma_lum[p]-d_normal*inv_sigma_normal
+                                          -d_albedo*inv_sigma_albedo-d_depth*inv_step);
+
+                    int k=x-x0;
+                    sum_r[k]+=w*plane[R][q];
+                    sum_g[k]+=w*plane[G][q];
+                    sum_b[k]+=w*plane[B][q];
+                    sum_var[k]+=w*w*plane[VAR][q];
+                    sum_w[k]+=w;
+                }
+            }
+        }
+
+        // the center tap always weighs h(0)^2, the sum is never 0
+        for(int x=x0;x<x1;++x){
+            int k=x-x0;
+            float inv_w=1.f/sum_w[k];
+            dst_[R][row+x]=sum_r[k]*inv_w;
+            dst_[G][row+x]=sum_g[k]*inv_w;
+            dst_[B][row+x]=sum_b[k]*inv_w;
+            dst_[VAR][row+x]=sum_var[k]*inv_w*inv_w;
+        }
+    }
+}
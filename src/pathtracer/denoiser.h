@@ -0,0 +1,53 @@
+/* post-process denoising of a path traced film */
+#pragma once
+#include"common/common_include.h"
+#include"aov.h"
+
+/**
+ * @brief edge-avoiding à-trous wavelet filter(Dammertz et al. 2010) guided by the first-hit AOVs.
+ *        Each iteration is a 5x5 B3-spline kernel whose taps are `2^i` pixels apart, weighted down across
+ *        differences of normal, depth and albedo. As in SVGF, luminance differences are measured in standard
+ *        deviations of the local noise, which is filtered along with the color: the filter smooths noise but stops
+ *        at reflections and shadows that the guides know nothing about.
+ *        The radiance is divided by the albedo before filtering and multiplied back afterwards, so that textures
+ *        are not blurred with the noise.
+ *        Images are kept as planes of floats, rows are filtered in 8-wide AVX2 batches, tiles run on the thread pool.
+ */
+class Denoiser{
+public:
+    // the channels a film needs for denoising
+    static constexpr AOVType INPUT_AOVS=AOVType((int)AOVType::Color|(int)AOVType::Albedo|(int)AOVType::Normal|(int)AOVType::Depth);
+
+    Denoiser(int iterations=5):iterations_(iterations){}
+
+    // filter the color of `aovs`, which must hold the `INPUT_AOVS`
+    void denoise(const AOVBuffer& aovs,std::vector<glm::vec3>& out);
+
+public:
+    int iterations_;
+    float sigma_luminance_=4.f; // in standard deviations of the noise
+    float sigma_normal_=0.3f;
+    float sigma_depth_=0.05f;   // relative to the depth of the filtered pixel
+    float sigma_albedo_=0.1f;
+
+private:
+    enum Plane{ R,G,B,VAR,NX,NY,NZ,DEPTH,AR,AG,AB,PLANE_NUM };
+    static constexpr int FILTERED_NUM=VAR+1;    // color and variance, rewritten by every iteration
+
+    // clamp pixels much brighter than all of their 8 neighbours
+    void suppressFireflies();
+
+    // luminance variance of the noise, estimated in the 3x3 neighbourhood of each pixel
+    void estimateVariance();
+
+    // one iteration from the filtered planes to `dst_`, the rows [y0,y1) and columns [x0,x1)
+    void filterTile(int x0,int x1,int y0,int y1,int step);
+
+private:
+    int width_=0;
+    int height_=0;
+    std::vector<float> planes_[PLANE_NUM];  // demodulated color, its variance and the guides
+    std::vector<float> inv_depth_;          // 1/(sigma_depth_*depth) of each pixel
+    std::vector<float> inv_sigma_lum_;      // 1/(sigma_luminance_*stddev) of each pixel, for the current iteration
+    std::vector<float> dst_[FILTERED_NUM];
+};
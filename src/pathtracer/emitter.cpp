@@ -1,4 +1,5 @@
 #include"emitter.h"
+#include"stb_image.h"
 
 /*-----------------------------------------------------------*/
 /*------------------------Emitters---------------------------*/
@@ -49,9 +50,38 @@ void Emitters::sampleLight(const glm::vec3& src_pos,LightSampleRecord& lsRec,flo
     glm::vec3 Le= tri.radiance_rgb;
 
     lsRec.value_ = Le*inv_pdf_w;
+    lsRec.radiance_=Le;
+    lsRec.light_normal_=light_norm;
 }
 
 
+bool Emitters::sampleEmission(float u0,const glm::vec2& u_pos,const glm::vec2& u_dir,EmissionRecord& rec)const{
+    if(etris_.empty()||totalWeight_<=0.f)
+        return false;
+    const EmitTriangle& tri=etris_[binarySearchEmitFace(u0)];
+
+    float u1=u_pos.x,u2=u_pos.y;
+    if(u1+u2>1){
+        u1=1-u1;
+        u2=1-u2;
+    }
+    rec.pos_=(1-u1-u2)*tri.v0->w_pos_+u1*tri.v1->w_pos_+u2*tri.v2->w_pos_;
+
+    // cosine weighted around the shading normal, in a frame of it
+    glm::vec3 n=glm::normalize((1-u1-u2)*tri.v0->w_norm_+u1*tri.v1->w_norm_+u2*tri.v2->w_norm_);
+    glm::vec3 t=glm::normalize(glm::cross(std::fabs(n.x)>0.9f?glm::vec3(0,1,0):glm::vec3(1,0,0),n));
+    glm::vec3 b=glm::cross(n,t);
+    float r=std::sqrt(u_dir.x);
+    float phi=2.f*srender::PI*u_dir.y;
+    float cos_theta=std::sqrt(std::max(0.f,1.f-u_dir.x));
+    rec.dir_=r*std::cos(phi)*t+r*std::sin(phi)*b+cos_theta*n;
+    rec.normal_=n;
+    rec.radiance_=tri.radiance_rgb;
+    rec.pdf_pos_=getPositionPDF(tri.radiance_rgb);
+    rec.pdf_dir_=cos_theta*srender::INV_PI;
+    return true;
+}
+
 float Emitters::getSamplePDF(const Ray& ray,const IntersectRecord& inst)const{
 
     if(glm::dot(ray.dir_,inst.normal_)>0.f)
@@ -102,4 +132,128 @@ uint32_t Emitters::binarySearchEmitFace(float u)const{
     }
 
     return lt;
-}
\ No newline at end of file
+}
+
+
+
+/*-----------------------------------------------------------*/
+/*--------------------EnvironmentEmitter---------------------*/
+/*-----------------------------------------------------------*/
+
+bool EnvironmentEmitter::load(const std::string& filename,float intensity,float rotation){
+    int width,height,channel;
+    float* data=stbi_loadf(filename.c_str(),&width,&height,&channel,3);
+    if(!data){
+        std::cerr<<"EnvironmentEmitter::load: can not read "<<filename<<std::endl;
+        return false;
+    }
+
+    width_=width;
+    height_=height;
+    rotation_=rotation;
+    texels_.resize(size_t(width)*height);
+    for(size_t i=0;i<texels_.size();++i)
+        texels_[i]=intensity*glm::vec3(data[3*i],data[3*i+1],data[3*i+2]);
+    stbi_image_free(data);
+
+    buildDistribution();
+    std::cout<<"Environment map loaded: "<<filename<<" ("<<width_<<"x"<<height_<<")"<<std::endl;
+    return true;
+}
+
+void EnvironmentEmitter::buildDistribution(){
+    row_presum_.assign(height_+1,0.f);
+    texel_presum_.assign(size_t(height_)*(width_+1),0.f);
+
+    for(int y=0;y<height_;++y){
+        // texels near the poles cover a smaller solid angle
+        float sin_theta=std::sin(srender::PI*(y+0.5f)/height_);
+        float* presum=&texel_presum_[size_t(y)*(width_+1)];
+        for(int x=0;x<width_;++x)
+            presum[x+1]=presum[x]+utils::getLuminance(texels_[size_t(y)*width_+x])*sin_theta;
+        row_presum_[y+1]=row_presum_[y]+presum[width_];
+    }
+    total_weight_=row_presum_[height_];
+}
+
+int EnvironmentEmitter::searchPresum(const float* presum,int num,float x){
+    // the first entry whose upper bound exceeds x; empty entries are never chosen
+    int lt=0,rt=num-1;
+    while(lt<rt){
+        int mid=(lt+rt)/2;
+        if(presum[mid+1]<=x)
+            lt=mid+1;
+        else
+            rt=mid;
+    }
+    return lt;
+}
+
+glm::vec2 EnvironmentEmitter::dirToUV(const glm::vec3& dir)const{
+    float theta=std::acos(std::clamp(dir.y,-1.f,1.f));
+    float phi=std::atan2(dir.z,dir.x)-rotation_;
+    phi-=2*srender::PI*std::floor(phi*0.5f*srender::INV_PI);
+    return glm::vec2(phi*0.5f*srender::INV_PI,theta*srender::INV_PI);
+}
+
+glm::vec3 EnvironmentEmitter::uvToDir(const glm::vec2& uv)const{
+    float theta=uv.y*srender::PI;
+    float phi=uv.x*2*srender::PI+rotation_;
+    float sin_theta=std::sin(theta);
+    return glm::vec3(sin_theta*std::cos(phi),std::cos(theta),sin_theta*std::sin(phi));
+}
+
+glm::vec3 EnvironmentEmitter::eval(const glm::vec3& dir)const{
+    if(texels_.empty())
+        return glm::vec3(0.f);
+    glm::vec2 uv=dirToUV(dir);
+    int x=std::min(int(uv.x*width_),width_-1);
+    int y=std::min(int(uv.y*height_),height_-1);
+    return texels_[size_t(y)*width_+x];
+}
+
+void EnvironmentEmitter::sampleLight(const glm::vec3& src_pos,LightSampleRecord& lsRec,float u1,float u2)const{
+    if(total_weight_<=0.f)
+        return;
+
+    // pick a row, then a texel of the row; the remainder of each search places the direction inside the texel
+    float target=std::clamp(u1,0.f,srender::OneMinusEpsilon)*total_weight_;
+    int y=searchPresum(row_presum_.data(),height_,target);
+    float row_weight=row_presum_[y+1]-row_presum_[y];
+    float dv=std::clamp((target-row_presum_[y])/row_weight,0.f,srender::OneMinusEpsilon);
+
+    const float* presum=&texel_presum_[size_t(y)*(width_+1)];
+    target=std::clamp(u2,0.f,srender::OneMinusEpsilon)*row_weight;
+    int x=searchPresum(presum,width_,target);
+    float du=std::clamp((target-presum[x])/(presum[x+1]-presum[x]),0.f,srender::OneMinusEpsilon);
+
+    glm::vec3 dir=uvToDir(glm::vec2((x+du)/width_,(y+dv)/height_));
+    float pdf=getSamplePDF(dir);
+    if(pdf<=0.f)
+        return;
+
+    lsRec.shadow_ray_=std::make_shared<Ray>(src_pos,dir);
+    lsRec.dist_=srender::MAXFLOAT;
+    lsRec.infinite_=true;
+    lsRec.pdf_=pdf;
+    lsRec.radiance_=eval(dir);
+    lsRec.value_=lsRec.radiance_/pdf;
+}
+
+/**
+ * @brief the texel is chosen with probability weight/total and covers (2pi/w)*(pi/h) of (phi,theta), whose
+ *        solid angle is sin(theta) times larger.
+ */
+float EnvironmentEmitter::getSamplePDF(const glm::vec3& dir)const{
+    if(total_weight_<=0.f)
+        return 0.f;
+    glm::vec2 uv=dirToUV(dir);
+    int x=std::min(int(uv.x*width_),width_-1);
+    int y=std::min(int(uv.y*height_),height_-1);
+    const float* presum=&texel_presum_[size_t(y)*(width_+1)];
+    float weight=presum[x+1]-presum[x];
+    float sin_theta=std::sqrt(std::max(0.f,1.f-dir.y*dir.y));
+    if(weight<=0.f||sin_theta<=0.f)
+        return 0.f;
+    return weight/total_weight_*width_*height_/(2.f*srender::PI*srender::PI*sin_theta);
+}
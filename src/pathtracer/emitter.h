@@ -43,6 +43,38 @@ struct LightSampleRecord{
     float dist_=0;                      // distance between src_pos and sample_pos
     glm::vec3 value_=glm::vec3(0.f);    // for Mento Carlo: Radiance*cos(theta')/(dist^2*A)
     float pdf_=0;                       // pdf in dWi measurement rather than dA, that is G/area
+    bool infinite_=false;               // a distant light: lit if the shadow ray escapes the scene
+    // the sampled point itself, so that other shading points can reuse it
+    glm::vec3 radiance_=glm::vec3(0.f); // emitted toward the shading point
+    glm::vec3 light_normal_=glm::vec3(0.f);  // shading normal of the emitter, zero for a distant light
+
+    // geometry term of the area measure of the emitters at the sample: cos/dist^2, 1 for a distant light
+    float getGeometry()const{
+        if(infinite_)
+            return 1.f;
+        return std::max(glm::dot(light_normal_,-shadow_ray_->dir_),0.f)/(dist_*dist_);
+    }
+
+    /**
+     * @brief whether the sampled light is seen through the hit of the shadow ray(nullptr if it hit nothing)
+     */
+    bool isVisible(const IntersectRecord* hit)const{
+        if(infinite_)
+            return !hit;
+        return hit&&fabs(hit->t_-dist_)<dist_*0.01;
+    }
+};
+
+/**
+ * @brief the start of a light path on an emitter
+ */
+struct EmissionRecord{
+    glm::vec3 pos_=glm::vec3(0.f);
+    glm::vec3 normal_=glm::vec3(0.f);   // shading normal of the emitter
+    glm::vec3 dir_=glm::vec3(0.f);      // normalized, out of the front face
+    glm::vec3 radiance_=glm::vec3(0.f);
+    float pdf_pos_=0.f;                 // over the area of all the emitters
+    float pdf_dir_=0.f;                 // over the solid angle
 };
 
 /**
@@ -67,6 +99,7 @@ public:
      * @brief Get the Total Radiance Weight of the scene, which is the sum of radiance*area of the whole scene
      */
     float getWeight(){return totalWeight_;}
+    bool empty()const{return etris_.empty();}
 
     /**
      * @brief sample a light from the intersection point
@@ -78,6 +111,18 @@ public:
      */
     void sampleLight(const glm::vec3& src_pos,LightSampleRecord& lsRec,float u0,float u1,float u2)const;
 
+    /**
+     * @brief start a light path: a triangle picked by its power, a point on it and a cosine weighted direction
+     *        out of its front face
+     * @return false if there is no emitter
+     */
+    bool sampleEmission(float u0,const glm::vec2& u_pos,const glm::vec2& u_dir,EmissionRecord& rec)const;
+
+    // pdf over the area of `sampleEmission` picking a point of radiance `radiance`
+    float getPositionPDF(const glm::vec3& radiance)const{
+        return totalWeight_>0.f?utils::getLuminance(radiance)/totalWeight_:0.f;
+    }
+
     /**
      * @brief Given an incident wi (`ray`) and its intersection `inst` with emitter, return its pdf(wi)
      */
@@ -107,4 +152,58 @@ private:
     float totalWeight_;
 
 
-};
\ No newline at end of file
+};
+
+
+/**
+ * @brief a distant light given by a lat-long HDR map: the texel (x,y) of a w*h map covers phi in [2pi*x/w,2pi*(x+1)/w)
+ *        and theta(from +y) in [pi*y/h,pi*(y+1)/h), rotated by `rotation_` around +y.
+ *        Directions are importance sampled from a piecewise-constant 2D distribution of luminance*sin(theta):
+ *        a row from the marginal prefix sum, then a texel from the prefix sum of the row, each by binary search.
+ */
+class EnvironmentEmitter{
+public:
+    /**
+     * @brief load an image(.hdr or any format of stb_image) as the map
+     * @return false if the file can not be read
+     */
+    bool load(const std::string& filename,float intensity=1.f,float rotation=0.f);
+
+    /**
+     * @brief radiance coming from the direction `dir`(pointing away from the scene)
+     */
+    glm::vec3 eval(const glm::vec3& dir)const;
+
+    /**
+     * @brief sample a direction towards the map from `src_pos`
+     * @param u1&u2 pick the row and the texel in the row, then the position inside the texel
+     */
+    void sampleLight(const glm::vec3& src_pos,LightSampleRecord& lsRec,float u1,float u2)const;
+
+    /**
+     * @brief pdf(wi) of `sampleLight` in solid angle
+     */
+    float getSamplePDF(const glm::vec3& dir)const;
+
+    float getWeight()const{ return total_weight_; }
+
+private:
+    void buildDistribution();
+
+    // direction -> [0,1)^2 of the map and back
+    glm::vec2 dirToUV(const glm::vec3& dir)const;
+    glm::vec3 uvToDir(const glm::vec2& uv)const;
+
+    // index `i` such that presum[i]<=x<presum[i+1], among the `num` entries that start at `presum`
+    static int searchPresum(const float* presum,int num,float x);
+
+private:
+    int width_=0;
+    int height_=0;
+    float rotation_=0.f;                // radians around +y
+    std::vector<glm::vec3> texels_;     // linear radiance, top row first
+
+    std::vector<float> row_presum_;     // h+1 prefix sums of the weights of the rows
+    std::vector<float> texel_presum_;   // h rows of w+1 prefix sums of the weights of the texels
+    float total_weight_=0.f;
+};
@@ -1,19 +1,75 @@
 #include"film.h"
 #include"tile.h"
+#include"denoiser.h"
+#include"checkpoint.h"
+#include"common/profiler.h"
+#include"common/threadpool.h"
 
 void Film::initTiles(const RTracingSetting& setting,std::shared_ptr<ColorBuffer> buffer,const Scene* scene){
+    // tiles keep a reference to it, so the ui can not change the setting of a running render
+    setting_=setting;
+
+    AOVType aov_mask=AOVType(setting_.aov_mask_);
+    // the chains of the Metropolis integrator see no first hits to guide the denoiser
+    if(setting_.denoise_&&setting_.integrator_!=IntegratorType::Metropolis)
+        aov_mask=aov_mask|Denoiser::INPUT_AOVS;
+    const bool splitting=setting_.splitting_&&setting_.max_depth_==0&&setting_.integrator_==IntegratorType::PathTracing;
+    if(setting_.checkpoint_interval_>0||setting_.photon_passes_>1||(splitting&&setting_.splitting_passes_>1))
+        aov_mask=aov_mask|RenderCheckpoint::CHANNELS;
+    // the splats are added to the color of the tiles afterwards, or make all of it
+    if(setting_.integrator_==IntegratorType::Bidirectional||setting_.integrator_==IntegratorType::Metropolis)
+        aov_mask=aov_mask|AOVType::Color;
 
     // init shared memory
     // tracer_=std::make_shared<PathTracer>();
-    tracer_=std::make_shared<MonteCarloPathTracer>(setting.max_depth_);
     // tracer_=std::make_shared<MonteCarloPathTracerNEE>(setting.max_depth_);
+    // the variant of the tracer for this render: only glossy lobes need MIS
+    const AOVType first_hit_aovs=AOVType::Direct|AOVType::Indirect|AOVType::Albedo|AOVType::Normal|AOVType::Depth;
+    if(setting_.integrator_==IntegratorType::PathTracing&&setting_.path_guiding_&&setting_.guiding_iterations_>0
+       &&!setting_.interactive_&&scene)
+        guiding_=std::make_shared<GuidingField>(scene->getSceneBound());
+    if(setting_.integrator_==IntegratorType::Bidirectional){
+        FilmCamera camera(camera_pos_,camera_front_,up_lt_pos_,deltaX_,deltaY_,(int)resolution_.x,(int)resolution_.y);
+        splats_=std::make_shared<SplatFilm>((int)resolution_.x,(int)resolution_.y);
+        tracer_=std::make_shared<BidirectionalPathTracer>(setting_.max_depth_,camera,splats_);
+    }
+    else if(setting_.integrator_==IntegratorType::Metropolis&&scene){
+        // the chains mutate the numbers of the plain path tracer
+        FilmCamera camera(camera_pos_,camera_front_,up_lt_pos_,deltaX_,deltaY_,(int)resolution_.x,(int)resolution_.y);
+        tracer_=createMonteCarloPathTracer(setting.max_depth_,scene->hasLobe(BSDFType::BlinnPhongSpecular),
+                                           setting.light_split_<=1,false);
+        metropolis_=std::make_shared<MetropolisRenderer>(*scene,tracer_,camera,setting_.light_split_,
+                                                         setting_.mlt_chains_,setting_.mlt_bootstrap_,
+                                                         setting_.mlt_large_step_);
+    }
+    else if(setting_.integrator_!=IntegratorType::PathTracing&&scene){
+        photons_=std::make_shared<PhotonMapper>(*scene,setting_.photon_num_,
+                                                setting_.photon_radius_*scene->getSceneScale(),setting_.max_depth_);
+        tracer_=std::make_shared<PhotonMapTracer>(setting_.integrator_,setting_.max_depth_,
+                                                  setting_.photon_gather_rays_,photons_);
+    }
+    else{
+        if(setting_.radiance_cache_&&setting_.radiance_cache_depth_>0&&scene){
+            // cells of about `CELL_PIXELS` pixels, not finer than a fraction of the scene
+            glm::vec3 center=up_lt_pos_+deltaX_*(resolution_.x*0.5f)+deltaY_*(resolution_.y*0.5f);
+            float pixel_angle=glm::length(deltaX_)/glm::length(center-camera_pos_);
+            radiance_cache_=std::make_shared<RadianceCache>(camera_pos_,0.002f*scene->getSceneScale(),pixel_angle,
+                                                            setting_.radiance_cache_cells_);
+        }
+        if(splitting&&scene)
+            splitting_=std::make_shared<SplittingCache>(scene->getSceneBound(),(int)resolution_.x,(int)resolution_.y);
+        tracer_=createMonteCarloPathTracer(setting.max_depth_,scene&&scene->hasLobe(BSDFType::BlinnPhongSpecular),
+                                           setting.light_split_<=1,(bool)(aov_mask&first_hit_aovs),guiding_,
+                                           radiance_cache_,setting_.radiance_cache_depth_,
+                                           (int)setting_.light_candidates_,splitting_);
+    }
     
     tile_msg_=std::make_shared<TileMessageBlock>();
     tile_msg_->arr_check.resize(buffer->getPixelNum());
 
     // init tiles
     tile_num_=setting.tiles_num_;
-    assert(buffer->getPixelNum()==resolution_.x*resolution_.y);
+    assert(buffer->getPixelNum()==uint32_t(image_size_.x*image_size_.y));
 
     // each tile's pixel num
     int w=(resolution_.x+tile_num_-1)/tile_num_;
@@ -23,42 +79,81 @@ void Film::initTiles(const RTracingSetting& setting,std::shared_ptr<ColorBuffer>
     glm::vec3 vec_h=float(h)*deltaY_;
     
     // each row
-    for(int i=0;i<tile_num_;++i){
+    for(uint32_t i=0;i<tile_num_;++i){
         
         int px_h=(i==tile_num_-1)?resolution_.y-(tile_num_-1)*h:h;
         
         // each column
-        for(int j=0;j<tile_num_;++j){
+        for(uint32_t j=0;j<tile_num_;++j){
             int px_w=(j==tile_num_-1)?resolution_.x-(tile_num_-1)*w:w;
 
             glm::vec2 px_num(px_w,px_h);
             glm::vec3 pos=up_lt_pos_+float(i)*vec_h+float(j)*vec_w;
             glm::vec2 px_offset(j*w,i*h);
-            tiles_.emplace_back(std::make_unique<Tile>(j,this,px_num,px_offset,pos,buffer,scene,tracer_,setting));
+            tiles_.emplace_back(std::make_unique<Tile>(j,this,px_num,px_offset,pos,buffer,scene,tracer_,setting_));
         }
     }
 
 
+    aovs_.init((int)resolution_.x,(int)resolution_.y,aov_mask);
+
     // init sampler
-    for(int i=0;i<tiles_.size();++i){
-        tiles_[i]->sampler_=std::make_unique<StratifiedSampler>(setting.spp_, i,true);
+    seedSamplers(0);
+}
+
+void Film::seedSamplers(uint32_t pass){
+    seed_pass_=pass;
+    for(size_t i=0;i<tiles_.size();++i){
+        tiles_[i]->sampler_=std::make_unique<StratifiedSampler>(setting_.spp_, i+uint64_t(pass)*tiles_.size(),true);
         tiles_[i]->sampler_->preAddSamples2D(1+2*10);    // image samples,each path sample a Wi
         tiles_[i]->sampler_->preAddSamples1D(1+1*10); // each path sample a emitter
     }
 }
 
+void Film::trainGuiding(){
+    if(!guiding_||guiding_->isRecording()||guiding_->getIteration()>=setting_.guiding_iterations_)
+        return;
+
+    const uint32_t spp=setting_.spp_;
+    const uint32_t pass=seed_pass_;
+    guiding_->setRecording(true);
+    while(guiding_->getIteration()<setting_.guiding_iterations_){
+        int k=guiding_->getIteration();
+        setting_.spp_=1u<<k;
+        // seeds counting down from the last one never meet those of the render passes
+        seedSamplers(UINT32_MAX-k);
+        parallelTiles();
+        guiding_->refine();
+        std::cout<<"Guiding iteration "<<k<<" : "<<setting_.spp_<<" spp, "
+                 <<guiding_->getLeafNum()<<" spatial leaves"<<std::endl;
+    }
+    guiding_->setRecording(false);
+    setting_.spp_=spp;
+    seedSamplers(pass);
+}
+
 int Film::parallelTiles(){
+    trainGuiding();
+    // each pass of samples gathers from its own photons
+    if(photons_)
+        photons_->emit(seed_pass_);
+    if(splats_)
+        splats_->clear();
 
     // get system's max concurrency
     size_t threadCnt=std::thread::hardware_concurrency()-1;
     std::cout<<"System's max concurrency is "<<threadCnt+1<<std::endl;
     
-    size_t total_tiles=tile_num_*tile_num_;
+    size_t first_tile=std::min<size_t>(tile_begin_,tiles_.size());
+    size_t end_tile=tile_end_<0?tiles_.size():std::min<size_t>(tile_end_,tiles_.size());
+    end_tile=std::max(end_tile,first_tile);
+    size_t total_tiles=end_tile-first_tile;
     threadCnt = std::min(threadCnt,total_tiles);
     if(threadCnt==0){
         threadCnt=8;
     }
     
+    info_=TileInfo();
     std::vector<std::thread> threads_pool;
     threads_pool.reserve(threadCnt);
 
@@ -66,7 +161,8 @@ int Film::parallelTiles(){
     for(size_t t=0;t<threadCnt;++t){
         threads_pool.emplace_back(
             [&,t]{
-                for(size_t i=t;i<total_tiles;i+=threadCnt){
+                PROFILE_THREAD("Tile Worker");
+                for(size_t i=first_tile+t;i<end_tile;i+=threadCnt){
                     tiles_[i]->render();
                 }
             }
@@ -77,15 +173,26 @@ int Film::parallelTiles(){
 
     for(auto& th:threads_pool)
         th.join();
+    if(splats_)
+        addSplats(first_tile,end_tile);
+    if(splitting_)
+        splitting_->update();
 
-    for(auto& tile:tiles_){
-        info_.avg_length+=tile->info_.avg_length;
+    for(size_t i=first_tile;i<end_tile;++i){
+        info_.avg_length+=tiles_[i]->info_.avg_length;
+        info_.raster_hit_num+=tiles_[i]->info_.raster_hit_num;
     }
-    info_.avg_length/=tiles_.size();
+    info_.avg_length/=std::max<size_t>(total_tiles,1);
     std::cout<<"Average depth is : "<<info_.avg_length<<std::endl;
+    if(primary_hits_){
+        std::cout<<"Rasterized primary hits : "<<info_.raster_hit_num<<" / "
+                 <<uint64_t(resolution_.x*resolution_.y)*tiles_[0]->setting_.spp_<<std::endl;
+    }
 
 #ifdef THREAD_SAFTY_CHECK
     bool pass=true;
+    if(total_tiles!=tiles_.size())
+        std::cout<<"only the tiles ["<<first_tile<<","<<end_tile<<") are rendered"<<std::endl;
     if(tile_msg_->cnt!=resolution_.x*resolution_.y){
         std::cout<<"err: tile_msg_.cnt = "<<tile_msg_->cnt<<";resolution_.x*resolution_.y="<<resolution_.x*resolution_.y<<std::endl;
         pass=false;
@@ -104,4 +211,282 @@ int Film::parallelTiles(){
     
 }
 
+void Film::addSplats(size_t first_tile,size_t end_tile){
+    size_t range_pixels=0;
+    for(size_t i=first_tile;i<end_tile;++i)
+        range_pixels+=size_t(tiles_[i]->pixels_num_.x*tiles_[i]->pixels_num_.y);
+    if(range_pixels==0)
+        return;
+    float scale=float(resolution_.x*resolution_.y)/(float(range_pixels)*setting_.spp_);
+
+    float* color[3];
+    float* indirect[3];
+    for(int c=0;c<3;++c){
+        color[c]=aovs_.plane(AOVType::Color,c);
+        indirect[c]=aovs_.plane(AOVType::Indirect,c);
+    }
+    for(size_t i=first_tile;i<end_tile;++i){
+        Tile& tile=*tiles_[i];
+        for(int y=0;y<tile.pixels_num_.y;++y){
+            for(int x=0;x<tile.pixels_num_.x;++x){
+                size_t idx=size_t(tile.first_pixel_offset_.y+y)*resolution_.x+tile.first_pixel_offset_.x+x;
+                glm::vec3 splat=splats_->get(idx)*scale;
+                // light tracing is not told apart by depth, it all goes to the indirect part
+                for(int c=0;c<3;++c){
+                    color[c][idx]+=splat[c];
+                    if(indirect[c])
+                        indirect[c][idx]+=splat[c];
+                }
+                tile.setPixel(x,y,glm::vec4(color[0][idx],color[1][idx],color[2][idx],1.f));
+            }
+        }
+    }
+}
+
+void Film::denoise(){
+    if((aovs_.getMask()&Denoiser::INPUT_AOVS)!=Denoiser::INPUT_AOVS)
+        return;
+
+    Denoiser denoiser(setting_.denoise_iterations_);
+    std::vector<glm::vec3> denoised;
+    denoiser.denoise(aovs_,denoised);
+
+    writePixels([&](size_t idx){ return denoised[idx]; });
+}
+
+int Film::render(const std::string& checkpoint){
+    if(metropolis_)
+        return renderMetropolis();
+    if(setting_.checkpoint_interval_>0)
+        return renderWithCheckpoints(checkpoint);
+    if(photons_&&setting_.photon_passes_>1)
+        return renderPasses(0,"",(uint32_t)setting_.photon_passes_);
+    // the passes after the first split the paths by what the ones before them learned
+    if(splitting_&&setting_.splitting_passes_>1)
+        return renderPasses(0,"",(uint32_t)setting_.splitting_passes_);
+    return parallelTiles();
+}
+
+int Film::renderMetropolis(){
+    metropolis_->render(setting_.spp_);
+
+    size_t num=size_t(resolution_.x*resolution_.y);
+    for(size_t idx=0;idx<num;++idx){
+        glm::vec3 color=metropolis_->getPixel(idx);
+        aovs_.set(AOVType::Color,idx,color);
+        aovs_.set(AOVType::SampleCount,idx,(float)setting_.spp_);
+    }
+    writePixels([&](size_t idx){ return metropolis_->getPixel(idx); });
+    return ThreadPool::global().size();
+}
+
+int Film::renderWithCheckpoints(const std::string& path){
+    return renderPasses(setting_.checkpoint_spp_,path);
+}
+
+int Film::renderPasses(uint32_t pass_spp,const std::string& path,uint32_t pass_num){
+    const uint32_t target_spp=setting_.spp_;
+    // no pass of a given number is left without a sample
+    pass_num=std::min(pass_num,target_spp);
+    if(pass_num>0)
+        pass_spp=(target_spp+pass_num-1)/pass_num;
+    pass_spp=std::clamp<uint32_t>(pass_spp,1,std::max(target_spp,1u));
+
+    RenderCheckpoint::Header header;
+    header.width_=(int32_t)resolution_.x;
+    header.height_=(int32_t)resolution_.y;
+    header.tiles_num_=tile_num_;
+    header.max_depth_=setting_.max_depth_;
+    header.light_split_=setting_.light_split_;
+    header.pass_spp_=pass_spp;
+    header.integrator_=(uint32_t)setting_.integrator_;
+    for(int c=0;c<3;++c){
+        header.camera_pos_[c]=camera_pos_[c];
+        header.camera_front_[c]=camera_front_[c];
+    }
+
+    RenderCheckpoint checkpoint;
+    if(!path.empty()&&checkpoint.load(path,header))
+        std::cout<<"Resume from "<<path<<" : "<<checkpoint.getSppNum()<<" spp"<<std::endl;
+    else
+        checkpoint.reset(header);
+
+    int thread_num=0;
+    auto last_save=std::chrono::steady_clock::now();
+    for(uint32_t pass=checkpoint.getPassNum();checkpoint.getSppNum()<target_spp;++pass){
+        // the tiles read the pass size from the setting, the last pass only renders what is left
+        uint32_t done=checkpoint.getSppNum();
+        if(pass_num>0)
+            setting_.spp_=uint32_t(uint64_t(target_spp)*(pass+1)/pass_num)-done;
+        else
+            setting_.spp_=std::min(pass_spp,target_spp-done);
+        seedSamplers(pass);
+        thread_num=parallelTiles();
+        checkpoint.film().merge(aovs_);
+        checkpoint.setProgress(pass+1,done+setting_.spp_);
+
+        auto now=std::chrono::steady_clock::now();
+        if(path.empty())
+            continue;
+        bool last=checkpoint.getSppNum()>=target_spp;
+        if(last||std::chrono::duration<float>(now-last_save).count()>=setting_.checkpoint_interval_){
+            checkpoint.save(path);
+            last_save=now;
+            std::cout<<"Checkpoint "<<path<<" : "<<checkpoint.getSppNum()<<" / "<<target_spp<<" spp"<<std::endl;
+        }
+    }
+    setting_.spp_=target_spp;
+
+    // the film holds the whole accumulation, the other AOVs are those of the last pass
+    float* count=aovs_.plane(AOVType::SampleCount);
+    if(count)
+        std::fill(count,count+size_t(resolution_.x*resolution_.y),0.f);
+    aovs_.merge(checkpoint.film());
+    resolve();
+    return thread_num;
+}
+
+bool Film::mergePartial(const AOVBuffer& partial){
+    if(!aovs_.merge(partial)){
+        std::cerr<<"Film::mergePartial: the partial film does not match"<<std::endl;
+        return false;
+    }
+    return true;
+}
+
+void Film::resolve(){
+    const float* color[3];
+    for(int c=0;c<3;++c)
+        color[c]=aovs_.plane(AOVType::Color,c);
+    if(!color[0])
+        return;
+    writePixels([&](size_t idx){ return glm::vec3(color[0][idx],color[1][idx],color[2][idx]); });
+}
+
+void Film::writePixels(const std::function<glm::vec3(size_t)>& color){
+    for(auto& tile:tiles_){
+        for(int j=0;j<tile->pixels_num_.y;++j){
+            for(int i=0;i<tile->pixels_num_.x;++i){
+                int idx=(tile->first_pixel_offset_.y+j)*resolution_.x+tile->first_pixel_offset_.x+i;
+                tile->setPixel(i,j,glm::vec4(color(idx),1.0));
+            }
+        }
+    }
+}
+
+void Film::initProgressive(){
+    if(!accum_.empty())
+        return;
+    size_t num=size_t(resolution_.x*resolution_.y);
+    accum_.assign(num,glm::vec4(0));
+    hit_pos_.assign(num,glm::vec3(0));
+    hit_normal_.assign(num,glm::vec3(0));
+    hit_depth_.assign(num,0.f);
+    hit_checked_.assign(num,0);
+    if(setting_.integrator_==IntegratorType::PathTracing&&setting_.light_candidates_>1&&setting_.light_reuse_){
+        for(auto& reservoirs:reservoirs_)
+            reservoirs.assign(num,LightReservoir());
+    }
+}
 
+bool Film::renderPass(const std::atomic<bool>& cancel){
+    PROFILE_ZONE("Film Pass");
+    initProgressive();
+    // the chains go on from the last pass, the image is their average over all of them
+    if(metropolis_){
+        if(!metropolis_->render(setting_.spp_,&cancel))
+            return false;
+        writePixels([&](size_t idx){ return metropolis_->getPixel(idx); });
+        ++pass_num_;
+        return true;
+    }
+    if(photons_)
+        photons_->emit(pass_num_);
+    if(splats_)
+        splats_->clear();
+
+    // tiles are independent, the pool hands them out dynamically
+    std::atomic<bool> finished{true};
+    ThreadPool::global().parallelFor(tiles_.size(),[&](size_t t){
+        if(!tiles_[t]->renderPass(cancel))
+            finished=false;
+    });
+    if(!finished)
+        return false;
+    if(splitting_)
+        splitting_->update();
+
+    // the light tracing of the pass, worth one sample of each pixel like the camera rays
+    if(splats_){
+        float scale=1.f/setting_.spp_;
+        for(size_t idx=0;idx<accum_.size();++idx)
+            accum_[idx]+=glm::vec4(splats_->get(idx)*scale,0.f);
+        writePixels([&](size_t idx){ return glm::vec3(accum_[idx])/accum_[idx].a; });
+    }
+
+    ++pass_num_;
+    return true;
+}
+
+void Film::reprojectHistory(const Film& prev,float max_weight){
+    PROFILE_ZONE("Reproject History");
+    initProgressive();
+    if(prev.accum_.empty())
+        return;
+
+    // a coarse pixel of `prev` covers several pixels of this film
+    int footprint=std::max(1,prev.pixel_scale_/pixel_scale_);
+    glm::vec2 to_film=glm::vec2(image_size_)*0.5f/float(pixel_scale_);
+    int width=resolution_.x,height=resolution_.y;
+
+    for(size_t i=0;i<prev.accum_.size();++i){
+        const glm::vec4& acc=prev.accum_[i];
+        if(acc.a<=0.f||prev.hit_depth_[i]<=0.f)
+            continue;
+
+        glm::vec4 clip=mat_vp_*glm::vec4(prev.hit_pos_[i],1.f);
+        if(clip.w<=srender::EPSILON)
+            continue;
+        // ndc => film pixel, the film's y axis points down
+        float fx=(clip.x/clip.w+1.f)*to_film.x;
+        float fy=(1.f-clip.y/clip.w)*to_film.y;
+        int x0=int(std::floor(fx))-(footprint-1)/2;
+        int y0=int(std::floor(fy))-(footprint-1)/2;
+
+        float weight=std::min(acc.a,max_weight);
+        glm::vec4 history(glm::vec3(acc)*(weight/acc.a),weight);
+        for(int y=std::max(y0,0);y<std::min(y0+footprint,height);++y){
+            for(int x=std::max(x0,0);x<std::min(x0+footprint,width);++x){
+                size_t idx=size_t(y)*width+x;
+                // the nearest surface wins
+                if(hit_depth_[idx]>0.f&&hit_depth_[idx]<=clip.w)
+                    continue;
+                accum_[idx]=history;
+                hit_pos_[idx]=prev.hit_pos_[i];
+                hit_normal_[idx]=prev.hit_normal_[i];
+                hit_depth_[idx]=clip.w;
+            }
+        }
+    }
+}
+
+void Film::recordFirstHit(size_t idx,const IntersectRecord* hit){
+    // relative depth difference and normal cosine that still count as the same surface
+    constexpr float DEPTH_TOLERANCE=0.05f;
+    constexpr float NORMAL_TOLERANCE=0.9f;
+
+    float depth=hit?(mat_vp_*glm::vec4(hit->pos_,1.f)).w:0.f;
+    if(!hit_checked_[idx]){
+        hit_checked_[idx]=1;
+        bool same_surface=hit&&hit_depth_[idx]>0.f
+                        &&std::abs(depth-hit_depth_[idx])<=DEPTH_TOLERANCE*depth
+                        &&glm::dot(hit->normal_,hit_normal_[idx])>=NORMAL_TOLERANCE;
+        if(!same_surface)
+            accum_[idx]=glm::vec4(0);
+    }
+    if(hit){
+        hit_pos_[idx]=hit->pos_;
+        hit_normal_[idx]=hit->normal_;
+    }
+    hit_depth_[idx]=depth;
+}
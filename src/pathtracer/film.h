@@ -4,12 +4,19 @@
 #include <chrono>
 #include <thread>
 #include <mutex>
+#include <atomic>
+#include <functional>
 
 #include"scene_loader.h"
 #include"interface.h"
 #include"sample.h"
 #include"pathtracer.h"
+#include"photonmap.h"
+#include"bdpt.h"
+#include"mlt.h"
 #include"tile.h"
+#include"primaryhit.h"
+#include"aov.h"
 
 
 struct TileMessageBlock{
@@ -27,15 +34,81 @@ public:
 
     int parallelTiles();
 
+    /**
+     * @brief render `spp_` samples per pixel as passes of `checkpoint_spp_`, saving the accumulated float film to
+     *        `path` after a pass once `checkpoint_interval_` seconds have gone by, and after the last one. A checkpoint
+     *        of the same view and setting at `path` is resumed, also to go on to a higher `spp_`; see `RenderCheckpoint`.
+     * @return the thread number of `parallelTiles`
+     */
+    int renderWithCheckpoints(const std::string& path);
+
+    /**
+     * @brief the whole render of the setting: with checkpoints to `checkpoint` if they are on, as `photon_passes_`
+     *        passes if there are several, in one `parallelTiles` otherwise
+     * @return the thread number of `parallelTiles`
+     */
+    int render(const std::string& checkpoint);
+
+    // distributed rendering: `parallelTiles` only renders the tiles [begin,end) of the row-major tile order, end<0 for all
+    void setTileRange(int begin,int end){ tile_begin_=begin; tile_end_=end; }
+    size_t getTileNum()const{ return tiles_.size(); }
+
+    /**
+     * @brief distributed rendering: add the float partial film of a worker to the AOVs of this film, each pixel
+     *        averaged with the existing one by their sample counts, see `AOVBuffer::merge`. Both need the color and
+     *        sample count channels; a pixel with one contributor keeps its value bit for bit.
+     * @return false if the partial does not match the film
+     */
+    bool mergePartial(const AOVBuffer& partial);
+    // write the merged color AOV to the color buffer
+    void resolve();
+
+    /**
+     * @brief filter the radiance of the last `parallelTiles` with its first-hit guides and write the result to
+     *        the color buffer. Only available if the film was set up with `denoise_` on.
+     */
+    void denoise();
+
+    // write the AOVs requested by the setting as `<prefix>_<name>.pfm`, returns the number of files
+    int saveAOVs(const std::string& prefix)const{ return aovs_.save(prefix,AOVType(setting_.aov_mask_)); }
+    const AOVBuffer& getAOVs()const{ return aovs_; }
+
+    /**
+     * @brief progressive rendering: add one more pass of `spp_` samples per pixel to the running average.
+     *        Tiles check `cancel` once per row, a cancelled pass leaves the film half updated and returns false.
+     */
+    bool renderPass(const std::atomic<bool>& cancel);
+    uint32_t getPassNum()const{ return pass_num_; }
+
+    /**
+     * @brief temporal reuse: splat the accumulated radiance of `prev` into this film through the first hits
+     *        of its pixels. A pixel keeps the history only if its own first hit agrees with it, see `recordFirstHit`.
+     * @param max_weight cap of the history weight in samples, so that the estimate keeps moving with the new view
+     */
+    void reprojectHistory(const Film& prev,float max_weight);
+
+    /**
+     * @brief record the first hit of a sample of pixel `idx`; on the first call of a pixel the reprojected
+     *        history is dropped if it was seen at another depth or with another normal(disocclusion).
+     */
+    void recordFirstHit(size_t idx,const IntersectRecord* hit);
+
+    // hand rasterized primary visibility to the tiles, must match the resolution of the film
+    void setPrimaryHits(std::shared_ptr<const PrimaryHitBuffer> hits){ primary_hits_=hits; }
+
 
 
 private:
     glm::vec2 resolution_;    // {width,height}
+    glm::ivec2 image_size_;   // {width,height} of the color buffer
+    int pixel_scale_=1;       // each film pixel covers pixel_scale_*pixel_scale_ pixels of the color buffer
     glm::vec3 up_lt_pos_;
     glm::vec3 deltaX_;
     glm::vec3 deltaY_;
     uint32_t tile_num_;
     std::vector<std::unique_ptr<Tile>> tiles_;
+    int tile_begin_=0;
+    int tile_end_=-1;
     glm::vec3 camera_pos_;
     glm::vec3 camera_front_;// delete this
     
@@ -43,7 +116,72 @@ private:
     std::shared_ptr<TileMessageBlock> tile_msg_;    // use `mx_msg_` to avoid race.
     std::mutex mx_msg_;
     std::shared_ptr<PathTracer> tracer_;        // read only, thread safe
+    std::shared_ptr<const PrimaryHitBuffer> primary_hits_;  // read only, nullptr if camera rays are all traced
     TileInfo info_;
+    RTracingSetting setting_;
+
+    // float channels of the last `parallelTiles`: those requested by the setting plus the inputs of the denoiser
+    AOVBuffer aovs_;
+    // seed the samplers of the tiles for the pass `pass` of `spp_` samples
+    void seedSamplers(uint32_t pass);
+    uint32_t seed_pass_=0;
+
+    // learned incident radiance guiding the bounces, nullptr without path guiding
+    std::shared_ptr<GuidingField> guiding_;
+    /**
+     * @brief the training iterations of `guiding_` that are left, each a `parallelTiles` with recording paths.
+     *        The image of the last one is overwritten by the render.
+     */
+    void trainGuiding();
+
+    // radiance of the diffuse hits learned by the paths of all the passes, nullptr without radiance cache
+    std::shared_ptr<RadianceCache> radiance_cache_;
+
+    // statistics of the paths of all the passes for Russian Roulette and splitting, nullptr without splitting
+    std::shared_ptr<SplittingCache> splitting_;
+
+    // photons of the photon map integrators, nullptr for path tracing
+    std::shared_ptr<PhotonMapper> photons_;
+
+    // light tracing contributions of the bidirectional integrator, nullptr for the others
+    std::shared_ptr<SplatFilm> splats_;
+    /**
+     * @brief add the splats of the tiles [first_tile,end_tile), which were rendered with `spp_` samples per pixel, to
+     *        their color AOV and pixels. The light paths of the range spread over the whole film, so the splats of its
+     *        pixels are scaled up by the share of the film the range covers.
+     */
+    void addSplats(size_t first_tile,size_t end_tile);
+
+    // Markov chains of the Metropolis integrator, nullptr for the others. They replace the tiles, which only write
+    // the resulting image to the color buffer
+    std::shared_ptr<MetropolisRenderer> metropolis_;
+    // `spp_` mutations per pixel into the color AOV, the film is not split into passes or tile ranges
+    int renderMetropolis();
+
+    /**
+     * @brief render `spp_` samples per pixel as passes of `pass_spp`, the last one with the samples left, accumulated
+     *        into the color and sample count.
+     *        With a `path`, the accumulation is resumed from and saved to it, see `renderWithCheckpoints`.
+     *        With a `pass_num`, the samples are rather shared out as evenly as they go over that many passes.
+     */
+    int renderPasses(uint32_t pass_spp,const std::string& path,uint32_t pass_num=0);
+    // write a color of each film pixel to the color buffer, through the tiles like the rendered image
+    void writePixels(const std::function<glm::vec3(size_t)>& color);
+
+    // progressive rendering
+    void initProgressive();
+    std::vector<glm::vec4> accum_;  // rgb: weighted sum of the samples of each film pixel, a: sum of the weights
+    uint32_t pass_num_=0;
+
+    // first hit of each film pixel, for temporal reprojection
+    glm::mat4 mat_vp_;                  // world to clip space of the camera
+    std::vector<glm::vec3> hit_pos_;
+    std::vector<glm::vec3> hit_normal_;
+    std::vector<float> hit_depth_;      // view depth of `hit_pos_`, 0 if unknown or no hit
+    std::vector<uint8_t> hit_checked_;  // the history of the pixel has been checked against a traced hit
+
+    // first-hit light reservoirs of the last pass and of this one, alternating; empty without reuse
+    std::vector<LightReservoir> reservoirs_[2];
 
     friend Camera;
     friend Tile;
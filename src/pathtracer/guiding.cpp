@@ -0,0 +1,206 @@
+#include"guiding.h"
+#include"common/utils.h"
+
+namespace{
+
+constexpr float ONE_MINUS_EPSILON=0.99999994f;
+
+}   // namespace
+
+/*--------------------------------------------------------------------*/
+/*---------------------------   DTree  ------------------------------*/
+/*--------------------------------------------------------------------*/
+glm::vec2 DTree::dirToSquare(const glm::vec3& dir){
+    float cos_theta=std::clamp(dir.z,-1.f,1.f);
+    float phi=std::atan2(dir.y,dir.x);
+    if(phi<0.f)
+        phi+=2.f*srender::PI;
+    return glm::vec2(std::clamp((cos_theta+1.f)*0.5f,0.f,ONE_MINUS_EPSILON),
+                     std::clamp(phi*0.5f*srender::INV_PI,0.f,ONE_MINUS_EPSILON));
+}
+
+glm::vec3 DTree::squareToDir(const glm::vec2& p){
+    float cos_theta=2.f*p.x-1.f;
+    float sin_theta=std::sqrt(std::max(0.f,1.f-cos_theta*cos_theta));
+    float phi=2.f*srender::PI*p.y;
+    return glm::vec3(sin_theta*std::cos(phi),sin_theta*std::sin(phi),cos_theta);
+}
+
+// the quadrant of p, which is moved into the unit square of that quadrant
+int DTree::quadrant(glm::vec2& p){
+    int q=0;
+    if(p.x>=0.5f){
+        q|=1;
+        p.x-=0.5f;
+    }
+    if(p.y>=0.5f){
+        q|=2;
+        p.y-=0.5f;
+    }
+    p*=2.f;
+    return q;
+}
+
+void DTree::record(const glm::vec3& dir,float energy){
+    glm::vec2 p=dirToSquare(dir);
+    uint32_t node=0;
+    do{
+        int q=quadrant(p);
+        utils::atomicAdd(nodes_[node].sum_[q],energy);
+        node=nodes_[node].child_[q];
+    }while(node);
+    sample_num_.fetch_add(1,std::memory_order_relaxed);
+}
+
+float DTree::pdf(const glm::vec3& dir)const{
+    constexpr float INV_4PI=0.25f*srender::INV_PI;
+    if(nodes_[0].total()<=0.f)
+        return INV_4PI;
+
+    glm::vec2 p=dirToSquare(dir);
+    float density=1.f;
+    uint32_t node=0;
+    do{
+        const Node& n=nodes_[node];
+        float total=n.total();
+        if(total<=0.f)
+            return 0.f;
+        int q=quadrant(p);
+        density*=4.f*n.sum(q)/total;
+        node=n.child_[q];
+    }while(node);
+    return density*INV_4PI;
+}
+
+glm::vec3 DTree::sample(glm::vec2 u)const{
+    glm::vec2 origin(0.f);
+    float size=1.f;
+    uint32_t node=0;
+    do{
+        const Node& n=nodes_[node];
+        float total=n.total();
+        if(total<=0.f)
+            break;
+
+        // the column first(bit 0), then the quadrant in the column(bit 1)
+        float left=(n.sum(0)+n.sum(2))/total;
+        int q=0;
+        if(u.x<left)
+            u.x/=left;
+        else{
+            u.x=(u.x-left)/(1.f-left);
+            q|=1;
+        }
+        float bottom=n.sum(q)/(n.sum(q)+n.sum(q|2));
+        if(u.y<bottom)
+            u.y/=bottom;
+        else{
+            u.y=(u.y-bottom)/(1.f-bottom);
+            q|=2;
+        }
+        u=glm::min(u,glm::vec2(ONE_MINUS_EPSILON));
+
+        size*=0.5f;
+        origin+=size*glm::vec2(q&1,q>>1);
+        node=n.child_[q];
+    }while(node);
+    return squareToDir(origin+size*u);
+}
+
+void DTree::refine(const DTree& source,float threshold,int max_depth){
+    nodes_.assign(1,Node());
+    sample_num_.store(0,std::memory_order_relaxed);
+    float total=source.getEnergy();
+    if(total>0.f)
+        split(source,0,0,total,total,threshold,1,max_depth);
+}
+
+/**
+ * @brief give the quadrants of `node` the children their energy in `source_node` asks for. A quadrant that is a
+ *        leaf in `source`(source_node<0) is taken as uniform, its children share its energy.
+ */
+void DTree::split(const DTree& source,uint32_t node,int source_node,float energy,float total,
+                  float threshold,int depth,int max_depth){
+    for(int q=0;q<4;++q){
+        float child_energy=source_node>=0?source.nodes_[source_node].sum(q):energy*0.25f;
+        if(depth>=max_depth||child_energy<=threshold*total)
+            continue;
+
+        uint32_t child=(uint32_t)nodes_.size();
+        nodes_.emplace_back();
+        nodes_[node].child_[q]=child;
+        int source_child=(source_node>=0&&source.nodes_[source_node].child_[q])?
+                         (int)source.nodes_[source_node].child_[q]:-1;
+        split(source,child,source_child,child_energy,total,threshold,depth+1,max_depth);
+    }
+}
+
+/*--------------------------------------------------------------------*/
+/*-------------------------   GuidingField  -------------------------*/
+/*--------------------------------------------------------------------*/
+GuidingField::GuidingField(const AABB3d& bound){
+    // a little larger than the scene, so that points on its faces are inside
+    glm::vec3 extent=glm::max(bound.max-bound.min,glm::vec3(srender::EPSILON));
+    glm::vec3 pad=0.01f*extent;
+    origin_=bound.min-pad;
+    inv_extent_=1.f/(extent+2.f*pad);
+
+    nodes_.push_back({0,{0,0},0,true});
+    leaves_.emplace_back();
+}
+
+uint32_t GuidingField::findLeaf(const glm::vec3& pos)const{
+    glm::vec3 p=glm::clamp((pos-origin_)*inv_extent_,glm::vec3(0.f),glm::vec3(1.f));
+    uint32_t node=0;
+    while(!nodes_[node].is_leaf_){
+        int axis=nodes_[node].axis_;
+        if(p[axis]<0.5f){
+            p[axis]*=2.f;
+            node=nodes_[node].child_[0];
+        }
+        else{
+            p[axis]=p[axis]*2.f-1.f;
+            node=nodes_[node].child_[1];
+        }
+    }
+    return nodes_[node].leaf_;
+}
+
+void GuidingField::splitSpatial(uint32_t node,float threshold){
+    uint32_t leaf=nodes_[node].leaf_;
+    uint32_t sample_num=leaves_[leaf].record_.getSampleNum();
+    if(sample_num<=threshold)
+        return;
+
+    // both halves start from the trees of the parent, with half of its samples each
+    leaves_[leaf].record_.setSampleNum(sample_num/2);
+    uint32_t other=(uint32_t)leaves_.size();
+    SpatialLeaf half=leaves_[leaf];
+    leaves_.push_back(half);
+
+    int axis=(nodes_[node].axis_+1)%3;
+    uint32_t first=(uint32_t)nodes_.size();
+    nodes_.push_back({axis,{0,0},leaf,true});
+    nodes_.push_back({axis,{0,0},other,true});
+    nodes_[node].is_leaf_=false;
+    nodes_[node].child_[0]=first;
+    nodes_[node].child_[1]=first+1;
+
+    splitSpatial(first,threshold);
+    splitSpatial(first+1,threshold);
+}
+
+void GuidingField::refine(){
+    float threshold=SPATIAL_THRESHOLD*std::sqrt(std::pow(2.f,(float)iteration_));
+    uint32_t node_num=(uint32_t)nodes_.size();
+    for(uint32_t i=0;i<node_num;++i){
+        if(nodes_[i].is_leaf_)
+            splitSpatial(i,threshold);
+    }
+
+    for(auto& leaf:leaves_){
+        leaf.guide_=leaf.record_;
+        leaf.record_.refine(leaf.guide_,DIRECTIONAL_THRESHOLD,MAX_DIRECTIONAL_DEPTH);
+    }
+    ++iteration_;
+}
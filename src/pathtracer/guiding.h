@@ -0,0 +1,140 @@
+/* path guiding: the incident radiance of the scene learned while rendering, after "Practical Path Guiding" */
+#pragma once
+#include"common/common_include.h"
+#include"common/AABB.h"
+#include<atomic>
+
+/**
+ * @brief DTree: quadtree over the directions, mapped to the unit square by (cos theta, phi) which keeps areas, so
+ *        the density of a cell is its share of the energy over its area. Each node keeps the energy of its four
+ *        quadrants(x>=0.5 is the bit 0 of a quadrant, y>=0.5 the bit 1); a recorded sample is added to the quadrants
+ *        on its way down, so that the sums of all levels agree without a build step. `record` only uses atomics
+ *        and can run on any thread, the structure is only changed by `refine`.
+ */
+class DTree{
+public:
+    DTree(){ nodes_.emplace_back(); }
+    DTree(const DTree& other):nodes_(other.nodes_),sample_num_(other.sample_num_.load(std::memory_order_relaxed)){}
+    DTree& operator=(const DTree& other){
+        nodes_=other.nodes_;
+        sample_num_.store(other.sample_num_.load(std::memory_order_relaxed),std::memory_order_relaxed);
+        return *this;
+    }
+
+    // add `energy` to the cell of the direction `dir`(normalized, world space)
+    void record(const glm::vec3& dir,float energy);
+
+    // pdf over the solid angle of sampling `dir`, uniform before any energy is recorded
+    float pdf(const glm::vec3& dir)const;
+
+    // a direction distributed as the recorded energy, u in [0,1)^2
+    glm::vec3 sample(glm::vec2 u)const;
+
+    /**
+     * @brief the empty structure for the next iteration: the cells of `source` holding more than `threshold` of its
+     *        energy are split, down to `max_depth`, and the others are merged.
+     */
+    void refine(const DTree& source,float threshold,int max_depth);
+
+    float getEnergy()const{ return nodes_[0].total(); }
+    uint32_t getSampleNum()const{ return sample_num_.load(std::memory_order_relaxed); }
+    void setSampleNum(uint32_t num){ sample_num_.store(num,std::memory_order_relaxed); }
+
+    static glm::vec2 dirToSquare(const glm::vec3& dir);
+    static glm::vec3 squareToDir(const glm::vec2& p);
+
+private:
+    struct Node{
+        std::atomic<float> sum_[4];
+        uint32_t child_[4];     // 0 for a leaf quadrant, the root can not be a child
+
+        Node(){
+            for(int q=0;q<4;++q){
+                sum_[q].store(0.f,std::memory_order_relaxed);
+                child_[q]=0;
+            }
+        }
+        Node(const Node& other){ *this=other; }
+        Node& operator=(const Node& other){
+            for(int q=0;q<4;++q){
+                sum_[q].store(other.sum(q),std::memory_order_relaxed);
+                child_[q]=other.child_[q];
+            }
+            return *this;
+        }
+
+        float sum(int q)const{ return sum_[q].load(std::memory_order_relaxed); }
+        float total()const{ return sum(0)+sum(1)+sum(2)+sum(3); }
+    };
+
+    static int quadrant(glm::vec2& p);
+    void split(const DTree& source,uint32_t node,int source_node,float energy,float total,
+               float threshold,int depth,int max_depth);
+
+    std::vector<Node> nodes_;
+    std::atomic<uint32_t> sample_num_{0};
+};
+
+/**
+ * @brief SD-tree: a binary tree over the box of the scene, splitting the axes in turn, whose leaves hold two DTrees:
+ *        the one guiding this iteration, learned by the previous one, and the one being recorded.
+ *        Training goes by iterations of doubling sample counts: paths sample from the guiding trees and splat their
+ *        radiance into the recording ones, lock free; `refine` then splits the crowded leaves in space, and makes
+ *        the recorded trees guide the next iteration.
+ */
+class GuidingField{
+public:
+    // how much of the energy of a DTree a cell may hold before it is split
+    static constexpr float DIRECTIONAL_THRESHOLD=0.01f;
+    static constexpr int MAX_DIRECTIONAL_DEPTH=20;
+    // recorded samples of a spatial leaf that split it, times sqrt(2^iteration)
+    static constexpr float SPATIAL_THRESHOLD=12000.f;
+
+    explicit GuidingField(const AABB3d& bound);
+
+    // the guiding DTree around `pos`
+    const DTree& getGuide(const glm::vec3& pos)const{ return leaves_[findLeaf(pos)].guide_; }
+
+    /**
+     * @brief splat the radiance arriving at `pos` from `dir` into the recording DTree around it
+     * @param pdf of the direction having been sampled, the energy of a cell is an estimate of its radiance integral
+     */
+    void record(const glm::vec3& pos,const glm::vec3& dir,float radiance,float pdf){
+        if(radiance>0.f&&pdf>0.f&&std::isfinite(radiance/pdf))
+            leaves_[findLeaf(pos)].record_.record(dir,radiance/pdf);
+    }
+
+    // end an iteration: single threaded, no path may be traced meanwhile
+    void refine();
+
+    // whether the guiding trees have learned something, BSDF sampling alone until then
+    bool isTrained()const{ return iteration_>0; }
+    // whether paths record their radiance
+    bool isRecording()const{ return recording_; }
+    void setRecording(bool recording){ recording_=recording; }
+    int getIteration()const{ return iteration_; }
+    size_t getLeafNum()const{ return leaves_.size(); }
+
+private:
+    struct SpatialNode{
+        int axis_;
+        uint32_t child_[2];     // children for an inner node
+        uint32_t leaf_;         // index in `leaves_` for a leaf
+        bool is_leaf_;
+    };
+    struct SpatialLeaf{
+        DTree guide_;
+        DTree record_;
+    };
+
+    uint32_t findLeaf(const glm::vec3& pos)const;
+    // split the leaf node `node` while its recorded samples exceed `threshold`
+    void splitSpatial(uint32_t node,float threshold);
+
+    glm::vec3 origin_;
+    glm::vec3 inv_extent_;
+    std::vector<SpatialNode> nodes_;
+    std::vector<SpatialLeaf> leaves_;
+    int iteration_=0;
+    bool recording_=false;
+};
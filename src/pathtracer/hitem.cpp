@@ -12,57 +12,43 @@ IntersectRecord& IntersectRecord::operator=(const IntersectRecord& inst){
     pos_=inst.pos_;
     t_=inst.t_;
     normal_=inst.normal_;
+    geo_normal_=inst.geo_normal_;
     material_=inst.material_;
     uv_=inst.uv_;
     
     bvhnode_idx_=inst.bvhnode_idx_;
+    instance_idx_=inst.instance_idx_;
+    primitive_idx_=inst.primitive_idx_;
 
     return *this;
 }
 
 // use material to initialize bsdf
-std::shared_ptr<BSDF> IntersectRecord::getBSDF(float u){
+BSDF IntersectRecord::getBSDF(float u){
 
     // init TBN Matrix
     if(!TBN_)  TBN_=genTBN();
     assert(material_);
 
-    auto type=this->material_->type_;
-    // set emission bits to 0
-    type=MtlType((int)type&(~(int)MtlType::Emissive));
+    const BSDFDesc& desc=material_->bsdf_desc_;
+    if(!desc.lobe_num_)
+        throw std::runtime_error("IntersectRecord::getBSDF: the material has not been compiled!");
 
-    auto bsdf_=std::make_shared<BSDFlist>();
-
-    // test scattering bits
-    bool init=false;
-    if((int)(type&MtlType::Diffuse)){
-        if(material_->dif_texture_){
-            auto ks= utils::srgbToLinear( material_->getDiffuse(uv_[0],uv_[1]) );
-            bsdf_->insertBSDF(std::make_shared<LambertBRDF>(ks));
-        }
-        else
-            bsdf_->insertBSDF(std::make_shared<LambertBRDF>(material_->diffuse_));
-
-        init=true;
-    }
-    if((int)(type&MtlType::Specular)){
-        if(!init)// TODO: delete this when xml-parser is prepared
-            bsdf_->insertBSDF(std::make_shared<SpecularBRDF>(material_->getSpecular()));
-        else
-            bsdf_->insertBSDF(std::make_shared<BPhongSpecularBRDF>(material_->getSpecular(),material_->shininess_));
-
-        init=true;
-    }
+    return BSDF(desc,u,getLobeDiffuse());
+}
 
-    // If the scattering type is not initialized, simply give it a LambertBRDF
-    if(!init){
-        bsdf_->insertBSDF(std::make_shared<LambertBRDF>(material_->diffuse_));
-    }
+glm::vec3 IntersectRecord::getLobeDiffuse()const{
+    // only a textured lobe(the Lambert one, first if any) needs more than the descriptor
+    const BSDFDesc& desc=material_->bsdf_desc_;
+    if(desc.lobe_num_&&desc.lobes_[0].textured_)
+        return utils::srgbToLinear(material_->getDiffuse(uv_[0],uv_[1]));
+    return glm::vec3(0.f);
+}
 
-    // Init bsdf weights and choose a bsdf
-    bsdf_->initWeights();
-    bsdf_->randomSelectBSDF(u);
-    return bsdf_;
+glm::vec3 IntersectRecord::getAlbedo()const{
+    assert(material_);
+    glm::vec3 diffuse=material_->dif_texture_?utils::srgbToLinear(material_->getDiffuse(uv_[0],uv_[1])):material_->diffuse_;
+    return glm::min(diffuse+material_->getSpecular(),glm::vec3(1.f));
 }
 
 // Generate an orthonormal base for tangent space samples, refering: https://graphics.pixar.com/library/OrthonormalB/paper.pdf
@@ -184,6 +170,8 @@ bool Htriangle::rayIntersect(const Ray& ray,IntersectRecord& inst)const{
             if(glm::dot(local_norm,ray.dir_)>0)
                 local_norm=-local_norm;     // reverse the shading norm to always keep the inverse direction of incident ray 
             inst.normal_=glm::normalize(local_norm);
+            glm::vec3 face_norm=glm::cross(e1,e2);
+            inst.geo_normal_=glm::dot(face_norm,ray.dir_)>0?-face_norm:face_norm;
 
             // interpolate UV
             for(int i=0;i<2;++i){
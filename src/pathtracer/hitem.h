@@ -18,8 +18,11 @@ public:
 
     IntersectRecord& operator=(const IntersectRecord& inst);
 
-    // Use material to initialize bsdf, and then Select a bsdf with random number u(in [0,1))
-    std::shared_ptr<BSDF> getBSDF(float u);
+    // Select a lobe of the material's compiled bsdf with random number u(in [0,1)), the texture is looked up at `uv_`
+    BSDF getBSDF(float u);
+
+    // reflectance of the textured Lambert lobe of the material at `uv_`, 0 if it has none
+    glm::vec3 getLobeDiffuse()const;
 
     // Generate an orthonormal base for tangent space samples. Reference: https://graphics.pixar.com/library/OrthonormalB/paper.pdf
     std::shared_ptr<glm::mat3> genTBN();
@@ -30,17 +33,23 @@ public:
     // transform the sampled Wi from tangent space to world space.
     glm::vec3 wi2WorldSpace(const glm::vec3& wi);
 
+    // linear reflectance of the surface(diffuse plus specular), the texture is looked up at `uv_`
+    glm::vec3 getAlbedo()const;
+
 public:
 
     glm::vec3 pos_;
     float t_;           // distance from origin to the hit point
     glm::vec3 normal_;  // the Shading normal of the face,normalized
+    glm::vec3 geo_normal_=glm::vec3(0.f);   // the normal of the face itself, normalized; on the same side as `normal_`
     glm::vec2 uv_;
     std::shared_ptr<glm::mat3> TBN_;     // Tangent, Bitangent and Normal vectors in world space
 
     std::shared_ptr<const Material> material_;  // to generate bsdf
 
     int32_t bvhnode_idx_;
+    int32_t instance_idx_=-1;   // of the TLAS
+    int32_t primitive_idx_=-1;  // face of the instance's object
     
 };
 
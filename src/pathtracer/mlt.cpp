@@ -0,0 +1,212 @@
+#include"mlt.h"
+#include"common/utils.h"
+#include"common/threadpool.h"
+#include"common/profiler.h"
+
+/*-----------------------------------------------------------*/
+/*------------------------MLTSampler-------------------------*/
+/*-----------------------------------------------------------*/
+
+void MLTSampler::reset(uint64_t seed){
+    pcgRNG_.getRNG()->seed(seed);
+    samples_.clear();
+    iteration_=0;
+    large_step_=true;
+    last_large_step_=0;
+    sample_idx_=0;
+}
+
+void MLTSampler::startIteration(){
+    ++iteration_;
+    large_step_=pcgRNG_.nextFloat()<large_step_prob_;
+    sample_idx_=0;
+}
+
+void MLTSampler::accept(){
+    if(large_step_)
+        last_large_step_=iteration_;
+}
+
+void MLTSampler::reject(){
+    for(auto& sample:samples_){
+        if(sample.modified_==iteration_){
+            sample.value_=sample.value_backup_;
+            sample.modified_=sample.modified_backup_;
+        }
+    }
+    --iteration_;
+}
+
+float MLTSampler::getSample1D(){
+    ensureReady(sample_idx_);
+    return samples_[sample_idx_++].value_;
+}
+
+glm::vec2 MLTSampler::getSample2D(){
+    float a=getSample1D();
+    float b=getSample1D();
+    return glm::vec2(a,b);
+}
+
+void MLTSampler::ensureReady(size_t idx){
+    if(idx>=samples_.size())
+        samples_.resize(idx+1);
+    PrimarySample& sample=samples_[idx];
+
+    // a sample not asked for since the last accepted large step was drawn anew by it, as is a new one
+    if(sample.modified_<last_large_step_){
+        sample.value_=pcgRNG_.nextFloat();
+        sample.modified_=last_large_step_;
+    }
+
+    sample.value_backup_=sample.value_;
+    sample.modified_backup_=sample.modified_;
+    if(large_step_)
+        sample.value_=pcgRNG_.nextFloat();
+    else{
+        // the small steps it missed since its last change, and that of this iteration
+        for(int64_t k=sample.modified_;k<iteration_;++k)
+            sample.value_=mutate(sample.value_);
+    }
+    sample.modified_=iteration_;
+}
+
+float MLTSampler::mutate(float value){
+    // offsets from S1 to S2 with a density of 1/offset, either way, wrapping around [0,1)
+    constexpr float S1=1.f/1024.f;
+    constexpr float S2=1.f/64.f;
+    float offset=S2*std::exp(-std::log(S2/S1)*pcgRNG_.nextFloat());
+    if(pcgRNG_.nextFloat()<0.5f){
+        value+=offset;
+        if(value>=1.f)
+            value-=1.f;
+    }
+    else{
+        value-=offset;
+        if(value<0.f)
+            value+=1.f;
+    }
+    return std::min(value,std::nextafter(1.f,0.f));
+}
+
+/*-----------------------------------------------------------*/
+/*---------------------MetropolisRenderer--------------------*/
+/*-----------------------------------------------------------*/
+
+MetropolisRenderer::MetropolisRenderer(const Scene& scene,std::shared_ptr<PathTracer> tracer,const FilmCamera& camera,
+                                       uint32_t light_split,uint32_t chain_num,uint32_t bootstrap_num,
+                                       float large_step_prob)
+    :scene_(scene),tracer_(tracer),camera_(camera),light_split_(light_split),chain_num_(std::max(chain_num,1u)),
+     bootstrap_num_(std::max(bootstrap_num,chain_num_)),large_step_prob_(large_step_prob),
+     image_(camera.width_,camera.height_){}
+
+glm::vec3 MetropolisRenderer::evaluate(Sampler& sampler,glm::vec2& raster)const{
+    glm::vec2 u=sampler.getSample2D();
+    raster=glm::vec2(u.x*camera_.width_,u.y*camera_.height_);
+    glm::vec3 sample_pos=camera_.up_lt_+raster.x*camera_.dx_+raster.y*camera_.dy_;
+    Ray ray(camera_.pos_,sample_pos-camera_.pos_);
+
+    PathTraceRecord pRec(scene_,sampler,light_split_);
+    glm::vec3 radiance=tracer_->Li(ray,pRec);
+    // a broken path is not worth a chain stuck on it
+    if(!std::isfinite(radiance.x+radiance.y+radiance.z))
+        return glm::vec3(0.f);
+    return radiance;
+}
+
+void MetropolisRenderer::bootstrap(){
+    PROFILE_ZONE("MLT Bootstrap");
+    // the bootstrap path `i` is the first state of the seed `i`, a chain started from it retraces it
+    constexpr size_t BLOCK=256;
+    std::vector<float> weights(bootstrap_num_);
+    ThreadPool::global().parallelFor((bootstrap_num_+BLOCK-1)/BLOCK,[&](size_t b){
+        MLTSampler sampler(0,large_step_prob_);
+        for(size_t i=b*BLOCK;i<std::min<size_t>((b+1)*BLOCK,bootstrap_num_);++i){
+            sampler.reset(i);
+            glm::vec2 raster;
+            weights[i]=std::max(utils::getLuminance(evaluate(sampler,raster)),0.f);
+        }
+    });
+
+    std::vector<double> cdf(bootstrap_num_+1,0.);
+    for(size_t i=0;i<bootstrap_num_;++i)
+        cdf[i+1]=cdf[i]+weights[i];
+    brightness_=float(cdf.back()/bootstrap_num_);
+    if(brightness_<=0.f){
+        std::cerr<<"MetropolisRenderer::bootstrap: no light reaches the camera"<<std::endl;
+        return;
+    }
+
+    // the chains start at bootstrap paths picked in proportion to their luminance, stratified over the chains
+    PCGRandom rng(bootstrap_num_);
+    double jitter=rng.nextFloat();
+    chains_.resize(chain_num_);
+    ThreadPool::global().parallelFor(chain_num_,[&](size_t k){
+        double u=(k+jitter)/chain_num_*cdf.back();
+        size_t i=std::upper_bound(cdf.begin()+1,cdf.end(),u)-cdf.begin()-1;
+        i=std::min<size_t>(i,bootstrap_num_-1);
+
+        auto chain=std::make_unique<Chain>(i,large_step_prob_);
+        chain->radiance_=evaluate(chain->sampler_,chain->raster_);
+        chain->contribution_=utils::getLuminance(chain->radiance_);
+        chains_[k]=std::move(chain);
+    });
+    std::cout<<"MLT bootstrap : "<<bootstrap_num_<<" paths, mean luminance "<<brightness_<<std::endl;
+}
+
+bool MetropolisRenderer::render(uint32_t mutations_per_pixel,const std::atomic<bool>* cancel){
+    PROFILE_ZONE("MLT Render");
+    if(brightness_<0.f)
+        bootstrap();
+    if(brightness_<=0.f)
+        return true;
+
+    const uint64_t pixel_num=uint64_t(camera_.width_)*camera_.height_;
+    const uint64_t total=pixel_num*mutations_per_pixel;
+    std::atomic<bool> cancelled{false};
+    std::atomic<uint64_t> executed{0};
+    ThreadPool::global().parallelFor(chains_.size(),[&](size_t k){
+        Chain& chain=*chains_[k];
+        MLTSampler& sampler=chain.sampler_;
+        uint64_t num=total*(k+1)/chains_.size()-total*k/chains_.size();
+        uint64_t m=0;
+        for(;m<num;++m){
+            if((m&CANCEL_CHECK)==0&&cancel&&cancel->load(std::memory_order_relaxed)){
+                cancelled=true;
+                break;
+            }
+
+            sampler.startIteration();
+            glm::vec2 raster;
+            glm::vec3 radiance=evaluate(sampler,raster);
+            float contribution=utils::getLuminance(radiance);
+            float accept=contribution>0.f?std::min(1.f,contribution/chain.contribution_):0.f;
+
+            // both states are splatted by their chance to be the next one
+            if(accept>0.f)
+                image_.add((int)raster.x,(int)raster.y,radiance*(accept/contribution));
+            if(accept<1.f){
+                image_.add((int)chain.raster_.x,(int)chain.raster_.y,
+                           chain.radiance_*((1.f-accept)/chain.contribution_));
+            }
+
+            if(sampler.pcgRNG_.nextFloat()<accept){
+                chain.raster_=raster;
+                chain.radiance_=radiance;
+                chain.contribution_=contribution;
+                sampler.accept();
+            }
+            else
+                sampler.reject();
+        }
+        executed.fetch_add(m,std::memory_order_relaxed);
+    });
+
+    // each mutation splats a total weight of 1, the chains being distributed like the luminance over the film.
+    // A cancelled render only counts the mutations that ran
+    mutation_num_+=executed.load();
+    if(mutation_num_==0)
+        return !cancelled;
+    image_scale_=float(brightness_*double(pixel_num)/double(mutation_num_));
+    return !cancelled;
+}
@@ -0,0 +1,114 @@
+/* primary sample space Metropolis light transport(Kelemen et al.) over the paths of the path tracer */
+#pragma once
+#include"common/common_include.h"
+#include"pathtracer.h"
+#include"bdpt.h"
+#include<atomic>
+#include<memory>
+
+/**
+ * @brief the state of a Markov chain in primary sample space: the uniform numbers a path has drawn, in the order it
+ *        drew them. Each iteration proposes a new state, either a large step drawing all of them anew or a small
+ *        step perturbing each by an exponentially distributed offset(Kelemen). Numbers are mutated lazily when the
+ *        path asks for them, so a path only pays for the dimensions it uses.
+ */
+class MLTSampler final:public Sampler{
+public:
+    MLTSampler(uint64_t seed,float large_step_prob):Sampler(1,seed),large_step_prob_(large_step_prob){}
+
+    // start over from the first state of `seed`, which is a large step
+    void reset(uint64_t seed);
+
+    // propose the next state, from the current one
+    void startIteration();
+    // the proposal becomes the current state
+    void accept();
+    // back to the current state
+    void reject();
+
+    float getSample1D() override;
+    glm::vec2 getSample2D() override;
+    float getRandom1D() override{ return getSample1D(); }
+
+private:
+    struct PrimarySample{
+        float value_=0.f;
+        int64_t modified_=-1;       // iteration of the last change, -1 before the first draw
+        // the current state while a proposal is being evaluated
+        float value_backup_=0.f;
+        int64_t modified_backup_=0;
+    };
+
+    // bring the sample `idx` up to the current iteration
+    void ensureReady(size_t idx);
+    float mutate(float value);
+
+    std::vector<PrimarySample> samples_;
+    float large_step_prob_;
+    int64_t iteration_=0;
+    bool large_step_=true;
+    int64_t last_large_step_=0;
+    size_t sample_idx_=0;
+};
+
+/**
+ * @brief PSSMLT: Markov chains wander the primary sample space of a path tracer with a density proportional to the
+ *        luminance of their path, so that the paths that carry the light, however rare, get most of the samples.
+ *        The first 2D sample of a path picks its film position, each mutation splats the proposed and the current
+ *        path weighted by the acceptance probability(expected values) into a float film.
+ *        Chains start at bootstrap paths picked by their luminance, whose mean is also the brightness of the image.
+ *        They live as long as the renderer and go on from one `render` to the next. Chains are independent tasks of
+ *        the thread pool, the film is the only state they share.
+ */
+class MetropolisRenderer{
+public:
+    /**
+     * @param tracer a path tracer drawing all its numbers from the sampler, read only
+     * @param chain_num Markov chains, a few per thread at least
+     * @param bootstrap_num paths estimating the brightness of the image and seeding the chains
+     * @param large_step_prob probability of a large step, the rest are small ones
+     */
+    MetropolisRenderer(const Scene& scene,std::shared_ptr<PathTracer> tracer,const FilmCamera& camera,
+                       uint32_t light_split,uint32_t chain_num,uint32_t bootstrap_num,float large_step_prob);
+
+    /**
+     * @brief run `mutations_per_pixel` mutations of each film pixel more, over all the chains. Bootstraps the chains
+     *        on the first call. Chains check `cancel` now and then, a cancelled render keeps the mutations that ran
+     *        and scales the film by their number.
+     * @return false if cancelled
+     */
+    bool render(uint32_t mutations_per_pixel,const std::atomic<bool>* cancel=nullptr);
+
+    // the radiance of pixel `idx`, averaged over all the mutations so far
+    glm::vec3 getPixel(size_t idx)const{ return image_.get(idx)*image_scale_; }
+
+private:
+    struct Chain{
+        Chain(uint64_t seed,float large_step_prob):sampler_(seed,large_step_prob){}
+        MLTSampler sampler_;
+        glm::vec2 raster_;
+        glm::vec3 radiance_;
+        float contribution_;
+    };
+
+    static constexpr uint64_t CANCEL_CHECK=1023;   // mutations of a chain between two checks of `cancel`
+
+    // the radiance of the path of the sampler's state, and the film position it lands on
+    glm::vec3 evaluate(Sampler& sampler,glm::vec2& raster)const;
+    void bootstrap();
+
+    const Scene& scene_;
+    std::shared_ptr<PathTracer> tracer_;
+    FilmCamera camera_;
+    uint32_t light_split_;
+    uint32_t chain_num_;
+    uint32_t bootstrap_num_;
+    float large_step_prob_;
+
+    std::vector<std::unique_ptr<Chain>> chains_;    // empty before the bootstrap
+    float brightness_=-1.f;                         // mean luminance of the bootstrap paths, <0 before it
+    uint64_t mutation_num_=0;                       // of all the chains so far
+
+    SplatFilm image_;
+    float image_scale_=0.f;                         // from the splats to the radiance
+};
@@ -7,7 +7,296 @@ bool needMIS(const BSDFType& bsdf_type){
             (bool)(bsdf_type&BSDFType::PerfectReflection);
 }
 
-glm::vec3 MonteCarloPathTracer::Li(const Ray ray,PathTraceRecord& pRecord){
+namespace{
+
+/**
+ * @brief the bounces of a path being recorded into the guiding field. The radiance a bounce sees arriving along its
+ *        sampled direction is what the path gathers after it, over the throughput up to it; it is only known
+ *        once the path is done.
+ */
+class GuidingPath{
+public:
+    void addVertex(const glm::vec3& pos,const glm::vec3& dir,const glm::vec3& throughput,float pdf){
+        if(num_<MAX_VERTEX)
+            vertices_[num_++]={pos,dir,throughput,glm::vec3(0.f),pdf};
+        ++bounce_num_;
+    }
+
+    // a contribution to the radiance of the path, seen by all the bounces so far
+    void splat(const glm::vec3& contribution){
+        splat(contribution,0,num_);
+    }
+
+    /**
+     * @brief the light reached by the last bounce, `weighted` by MIS in the image: the last bounce sees all of it
+     *        and the others what the image gets, since their light samples cover the rest.
+     */
+    void splatLight(const glm::vec3& full,const glm::vec3& weighted){
+        int last=bounce_num_==num_?num_-1:num_;
+        splat(weighted,0,last);
+        splat(full,last,num_);
+    }
+
+    void commit(GuidingField& field)const{
+        for(int k=0;k<num_;++k){
+            const Vertex& v=vertices_[k];
+            field.record(v.pos,v.dir,(v.radiance[0]+v.radiance[1]+v.radiance[2])*0.3333333f,v.pdf);
+        }
+    }
+
+private:
+    void splat(const glm::vec3& contribution,int begin,int end){
+        for(int k=std::max(begin,0);k<end;++k){
+            for(int c=0;c<3;++c){
+                if(vertices_[k].throughput[c]>0.f)
+                    vertices_[k].radiance[c]+=contribution[c]/vertices_[k].throughput[c];
+            }
+        }
+    }
+
+    static constexpr int MAX_VERTEX=32;
+    struct Vertex{
+        glm::vec3 pos;
+        glm::vec3 dir;          // sampled direction, world space
+        glm::vec3 throughput;   // of the path after the bounce
+        glm::vec3 radiance;     // arriving along `dir`
+        float pdf;              // of sampling `dir`
+    };
+    Vertex vertices_[MAX_VERTEX];
+    int num_=0;
+    int bounce_num_=0;          // bounces past `MAX_VERTEX` are not recorded
+};
+
+/**
+ * @brief the diffuse hits of a path being recorded into the radiance cache: each sees the radiance the path gathers
+ *        from it on, over the throughput that reached it.
+ */
+class CachePath{
+public:
+    void addVertex(int32_t cell,const glm::vec3& throughput){
+        if(num_<MAX_VERTEX)
+            vertices_[num_++]={cell,throughput,glm::vec3(0.f)};
+    }
+
+    void splat(const glm::vec3& contribution){
+        for(int k=0;k<num_;++k){
+            for(int c=0;c<3;++c){
+                if(vertices_[k].throughput[c]>0.f)
+                    vertices_[k].radiance[c]+=contribution[c]/vertices_[k].throughput[c];
+            }
+        }
+    }
+
+    void commit(RadianceCache& cache)const{
+        for(int k=0;k<num_;++k)
+            cache.record(vertices_[k].cell,vertices_[k].radiance);
+    }
+
+private:
+    static constexpr int MAX_VERTEX=32;
+    struct Vertex{
+        int32_t cell;
+        glm::vec3 throughput;   // of the path arriving at the hit
+        glm::vec3 radiance;     // leaving the hit toward the path
+    };
+    Vertex vertices_[MAX_VERTEX];
+    int num_=0;
+};
+
+/**
+ * @brief the branches of a path split by the splitting cache, and the hits whose reflected radiance is recorded
+ *        there. Branches wait on a stack and are traced depth first, so that a hit has gathered all of its radiance
+ *        once its branch ends with none of the branches split off after it left. Its estimate is then what the
+ *        radiance of the path grew by since the hit, over the throughput that reached it; likewise for its cost.
+ */
+class SplitPath{
+public:
+    // the branches that may still be split off
+    int getRoom()const{ return MAX_BRANCH-(int)branches_.size(); }
+
+    void push(const Ray& ray,std::shared_ptr<IntersectRecord> inst,const glm::vec3& throughput,int depth){
+        branches_.push_back({ray,inst,throughput,depth});
+    }
+
+    // a hit reached with `throughput`, the path having gathered `radiance` with `cost` rays so far(luminance)
+    void addVertex(int32_t cell,float throughput,float radiance,uint32_t cost){
+        if(num_<MAX_VERTEX&&throughput>0.f)
+            vertices_[num_++]={cell,throughput,radiance,cost,branches_.size()};
+    }
+
+    /**
+     * @brief end the current branch: record the hits it is done with, and go on with the next branch if any
+     * @return false if it was the last one
+     */
+    bool nextBranch(SplittingCache& cache,float radiance,uint32_t cost,Ray& ray,
+                    std::shared_ptr<IntersectRecord>& inst,glm::vec3& throughput,int& depth){
+        while(num_>0&&vertices_[num_-1].branch_num>=branches_.size()){
+            const Vertex& v=vertices_[--num_];
+            cache.recordHit(v.cell,std::max(radiance-v.radiance,0.f)/v.throughput,float(cost-v.cost));
+        }
+        if(branches_.empty())
+            return false;
+        Branch& b=branches_.back();
+        ray=b.ray;
+        inst=b.inst;
+        throughput=b.throughput;
+        depth=b.depth;
+        branches_.pop_back();
+        return true;
+    }
+
+private:
+    static constexpr int MAX_BRANCH=16;
+    static constexpr int MAX_VERTEX=32;
+    struct Branch{
+        Ray ray;
+        std::shared_ptr<IntersectRecord> inst;
+        glm::vec3 throughput;
+        int depth;
+    };
+    struct Vertex{
+        int32_t cell;
+        float throughput;
+        float radiance;         // of the path when it reached the hit
+        uint32_t cost;
+        size_t branch_num;      // waiting then, those split off after the hit are pushed above them
+    };
+    std::vector<Branch> branches_;
+    Vertex vertices_[MAX_VERTEX];
+    int num_=0;
+};
+
+// bsdf*cos of the hit toward the light sample of `lsRec`, which has a shadow ray
+glm::vec3 evalTowardLight(IntersectRecord& inst,const BSDF& bsdf,const glm::vec3& wo,const LightSampleRecord& lsRec,
+                          Sampler& sampler){
+    glm::vec3 wi=inst.ray2TangentSpace(lsRec.shadow_ray_->dir_);
+    BSDFRecord bsdfRec(inst,sampler,wo,wi);
+    bsdf.evalBSDF(bsdfRec);
+    return bsdfRec.bsdf_val*std::max(wi.z,0.f);
+}
+
+}   // namespace
+
+template<bool FIXED_DEPTH,bool MIS,bool SINGLE_LIGHT,bool AOV>
+bool MonteCarloPathTracer<FIXED_DEPTH,MIS,SINGLE_LIGHT,AOV>::sampleBounce(IntersectRecord& inst,const BSDF& bsdf,
+                                                BSDFRecord& rec,Sampler& sampler,glm::vec3& wi_world)const{
+    if(!guide_||!guide_->isTrained()||(bool)(bsdf.bsdf_type_&BSDFType::PerfectReflection)){
+        bsdf.sampleBSDF(rec);
+        bsdf.evalBSDF(rec);
+        if(!rec.isValid())// If bsdf value or pdf is too small, this path would gain us little benefit. 
+            return false;
+        wi_world=inst.wi2WorldSpace(rec.wi);
+        return true;
+    }
+
+    const DTree& dtree=guide_->getGuide(inst.pos_);
+    if(sampler.getRandom1D()<BSDF_FRACTION){
+        bsdf.sampleBSDF(rec);
+        wi_world=inst.wi2WorldSpace(rec.wi);
+    }
+    else{
+        wi_world=dtree.sample(sampler.getSample2D());
+        rec.wi=inst.ray2TangentSpace(wi_world);
+    }
+    rec.costheta=std::max(rec.wi.z,0.f);
+    bsdf.evalBSDF(rec);
+    rec.pdf=BSDF_FRACTION*rec.pdf+(1.f-BSDF_FRACTION)*dtree.pdf(wi_world);
+    return rec.costheta>0.f&&rec.isValid();
+}
+
+template<bool FIXED_DEPTH,bool MIS,bool SINGLE_LIGHT,bool AOV>
+glm::vec3 MonteCarloPathTracer<FIXED_DEPTH,MIS,SINGLE_LIGHT,AOV>::sampleResampledLight(
+        IntersectRecord& inst,const BSDF& bsdf,const glm::vec3& wo,const glm::vec3& src_pos,PathTraceRecord& pRecord,
+        bool reuse)const{
+    const Scene& scene=pRecord.scene;
+    Sampler& sampler=pRecord.sampler;
+
+    // candidates weighted by their unshadowed contribution over their pdf, that is bsdf*cos*value
+    LightReservoir r;
+    for(int k=0;k<light_candidates_;++k){
+        LightSampleRecord lsRec;
+        scene.sampleEmitters(src_pos,lsRec,sampler);
+        float u=sampler.getRandom1D();
+        if(!lsRec.shadow_ray_){
+            r.update(LightPoint(),0.f,0.f,1.f,u);
+            continue;
+        }
+        glm::vec3 f=evalTowardLight(inst,bsdf,wo,lsRec,sampler);
+        float target=utils::getLuminance(f*lsRec.radiance_)*lsRec.getGeometry();
+        r.update(LightPoint(lsRec),utils::getLuminance(f*lsRec.value_),target,1.f,u);
+    }
+    r.finalize();
+    if(reuse)
+        reuseReservoirs(inst,bsdf,wo,src_pos,pRecord,r);
+
+    // a single shadow ray, for the sample that was kept. An occluded sample stays in the reservoir: visibility is
+    // not part of the target, dropping it would darken the penumbrae of the pixels that reuse it
+    glm::vec3 contribution(0.f);
+    LightSampleRecord lsRec;
+    if(r.W_>0.f)
+        r.sample_.connect(src_pos,lsRec);
+    if(lsRec.shadow_ray_){
+        std::shared_ptr<IntersectRecord> light_inst=traceRay(*lsRec.shadow_ray_,&scene);
+        if(lsRec.isVisible(light_inst.get()))
+            contribution=evalTowardLight(inst,bsdf,wo,lsRec,sampler)*lsRec.radiance_*(lsRec.getGeometry()*r.W_);
+    }
+    if(reuse){
+        r.hit_normal_=inst.normal_;
+        r.hit_depth_=inst.t_;
+        *pRecord.reuse->cur_=r;
+    }
+    return contribution;
+}
+
+template<bool FIXED_DEPTH,bool MIS,bool SINGLE_LIGHT,bool AOV>
+void MonteCarloPathTracer<FIXED_DEPTH,MIS,SINGLE_LIGHT,AOV>::reuseReservoirs(
+        IntersectRecord& inst,const BSDF& bsdf,const glm::vec3& wo,const glm::vec3& src_pos,PathTraceRecord& pRecord,
+        LightReservoir& r)const{
+    const ReservoirReuse& reuse=*pRecord.reuse;
+    if(!reuse.prev_)
+        return;
+    Sampler& sampler=pRecord.sampler;
+    // relative depth difference and normal cosine of the surfaces that share their reservoirs
+    constexpr float DEPTH_TOLERANCE=0.1f;
+    constexpr float NORMAL_TOLERANCE=0.9f;
+    const float max_M=ReservoirReuse::MAX_HISTORY*light_candidates_;
+
+    // each reservoir counts as its sample with the weight target*W*M, its target being that at this hit.
+    // Normalized by the candidates of all of them rather than by MIS, which is biased where they disagree.
+    LightReservoir merged;
+    merged.update(r.sample_,r.weight_sum_,r.target_,r.M_,sampler.getRandom1D());
+    for(int k=0;k<=ReservoirReuse::SPATIAL_NUM;++k){
+        // the pixel itself, then neighbours within the radius
+        int x=reuse.x_;
+        int y=reuse.y_;
+        if(k>0){
+            float radius=ReservoirReuse::SPATIAL_RADIUS*std::sqrt(sampler.getRandom1D());
+            float phi=2.f*srender::PI*sampler.getRandom1D();
+            x+=(int)std::round(radius*std::cos(phi));
+            y+=(int)std::round(radius*std::sin(phi));
+            if(x<0||y<0||x>=reuse.width_||y>=reuse.height_)
+                continue;
+        }
+        const LightReservoir& q=reuse.prev_[size_t(y)*reuse.width_+x];
+        if(q.hit_depth_<=0.f||std::abs(q.hit_depth_-inst.t_)>DEPTH_TOLERANCE*inst.t_
+           ||glm::dot(q.hit_normal_,inst.normal_)<NORMAL_TOLERANCE)
+            continue;
+
+        float target=0.f;
+        LightSampleRecord lsRec;
+        if(q.W_>0.f)
+            q.sample_.connect(src_pos,lsRec);
+        if(lsRec.shadow_ray_)
+            target=utils::getLuminance(evalTowardLight(inst,bsdf,wo,lsRec,sampler)*lsRec.radiance_)*lsRec.getGeometry();
+        float M=std::min(q.M_,max_M);
+        merged.update(q.sample_,target*q.W_*M,target,M,sampler.getRandom1D());
+    }
+    merged.finalize();
+    r=merged;
+}
+
+template<bool FIXED_DEPTH,bool MIS,bool SINGLE_LIGHT,bool AOV>
+glm::vec3 MonteCarloPathTracer<FIXED_DEPTH,MIS,SINGLE_LIGHT,AOV>::Li(const Ray ray,PathTraceRecord& pRecord){
 
     const Scene& scene=pRecord.scene;
     Sampler& sampler=pRecord.sampler;
@@ -19,125 +308,275 @@ glm::vec3 MonteCarloPathTracer::Li(const Ray ray,PathTraceRecord& pRecord){
     // record the current ray
     Ray curRay(ray);
     // Trace the current ray
-    std::shared_ptr<IntersectRecord> inst=traceRay(curRay,&scene);
+    std::shared_ptr<IntersectRecord> inst=traceCameraRay(curRay,pRecord);
+    // the pixel block of the splitting cache
+    const int32_t block=split_cache_?split_cache_->findBlock(pRecord.pixel):-1;
     if(!inst){
-        radiance+=glm::vec3(0.f);// could be an environment map 
+        // the environment seen directly
+        radiance+=scene.getEnvironment(curRay.dir_);
+        if constexpr(AOV)
+            pRecord.aov.direct+=radiance;
+        if(split_cache_)
+            split_cache_->recordPixel(block,utils::getLuminance(radiance),1.f);
         return radiance;
     }
 
-    // Start Path Tracing!
-    while((pRecord.curdepth++)<max_depth_||max_depth_<=0){
-
-        auto& mtl=inst->material_;
-        if(!mtl){
-            throw std::runtime_error("Li(const Ray ray,PathTraceRecord& pRecord): the hit point doesn't own a material!");
-        }
-
-        /*-----------------------  0.EMISSION ------------------------*/
-        // for the (1)First hit with the (2)Front face of an (3)Emitter, get radiance
-        bool is_emitter=(bool)(mtl->type_&MtlType::Emissive);
-        if( is_emitter
-            &&glm::dot(curRay.dir_,inst->normal_)<0.f
-            &&pRecord.curdepth==1)
-        {
-            radiance+=throughput*mtl->getEmit();
-        }
-
-        //-----------------------------------------------------------//
-        /*--------------------- 1.DIRECT LIGHT ----------------------*/
-        //-----------------------------------------------------------//
-        float u=sampler.pcgRNG_.nextFloat();
-        auto bsdf=inst->getBSDF(u); // pick a bsdf among all possible bsdfs
+    // the bounces recorded into the guiding field
+    GuidingPath path;
+    bool recording=guide_&&guide_->isRecording();
+    // the diffuse hits recorded into the radiance cache
+    CachePath cache_path;
+    // the branches of a split path and the rays it has traced; paths recorded above are a single line of hits
+    SplitPath split_path;
+    uint32_t ray_num=1;
+    const bool can_split=!cache_&&!recording;
+
+    // Start Path Tracing! Each branch of a split path goes on from where it was split off
+    do{
+        while(continuePath(pRecord.curdepth++)){
+
+            auto& mtl=inst->material_;
+            if(!mtl){
+                throw std::runtime_error("Li(const Ray ray,PathTraceRecord& pRecord): the hit point doesn't own a material!");
+            }
+            if constexpr(AOV){
+                if(pRecord.curdepth==1)
+                    recordFirstHitAOV(pRecord,*inst);
+            }
 
+            /*-----------------------  0.EMISSION ------------------------*/
+            // for the (1)First hit with the (2)Front face of an (3)Emitter, get radiance
+            bool is_emitter=(bool)(mtl->type_&MtlType::Emissive);
+            if( is_emitter
+                &&glm::dot(curRay.dir_,inst->normal_)<0.f
+                &&pRecord.curdepth==1)
+            {
+                radiance+=throughput*mtl->getEmit();
+                if constexpr(AOV)
+                    pRecord.aov.direct+=throughput*mtl->getEmit();
+            }
 
-        /* --------- MIS: Sample Light's PDF ----------*/
+            /*--------------------- RADIANCE CACHE ----------------------*/
+            if(cache_&&!is_emitter&&mtl->bsdf_desc_.isDiffuse()){
+                int32_t cell=cache_->findCell(inst->pos_,inst->normal_);
+                glm::vec3 cached;
+                if(pRecord.curdepth>cache_depth_&&cache_->lookup(cell,cached)){
+                    radiance+=throughput*cached;
+                    cache_path.splat(throughput*cached);
+                    if(recording)
+                        path.splat(throughput*cached);
+                    break;
+                }
+                cache_path.addVertex(cell,throughput);
+            }
 
-        glm::vec3 direct(0.f);
-        int t=pRecord.light_split;
+            if(split_cache_){
+                split_path.addVertex(split_cache_->findCell(inst->pos_),utils::getLuminance(throughput),
+                                     utils::getLuminance(radiance),ray_num);
+            }
 
-        while(!is_emitter&&t--){
-            LightSampleRecord lsRec;
-            glm::vec3 adjust_pos=inst->pos_+inst->normal_*(float)(0.001);    //prevent from self-intersection
-            scene.sampleEmitters(adjust_pos,lsRec,sampler);  
+            //-----------------------------------------------------------//
+            /*--------------------- 1.DIRECT LIGHT ----------------------*/
+            //-----------------------------------------------------------//
+            float u=sampler.getRandom1D();
+            auto bsdf=inst->getBSDF(u); // pick a bsdf among all possible bsdfs
+
+            bool perfect_reflect=(bool)(bsdf.bsdf_type_&BSDFType::PerfectReflection);
+            // without MIS, light samples carry all of the direct light but for mirrors, which they can not sample
+            bool need_mis=MIS?needMIS(bsdf.bsdf_type_):perfect_reflect;
+
+
+            /* --------- MIS: Sample Light's PDF ----------*/
+
+            glm::vec3 direct(0.f);
+            const int light_num=SINGLE_LIGHT?1:pRecord.light_split;
+            int t=light_num;
+
+            while(!is_emitter&&t--){
+                LightSampleRecord lsRec;
+                glm::vec3 adjust_pos=inst->pos_+inst->normal_*(float)(0.001);    //prevent from self-intersection
+                ++ray_num;
+                // the weights of MIS are not known for resampled samples, they only replace those that need none
+                if(light_candidates_>1&&!need_mis){
+                    bool reuse=pRecord.reuse&&pRecord.curdepth==1&&t==light_num-1;
+                    direct+=throughput*sampleResampledLight(*inst,bsdf,inst->ray2TangentSpace(-curRay.dir_),
+                                                            adjust_pos,pRecord,reuse);
+                    continue;
+                }
+                scene.sampleEmitters(adjust_pos,lsRec,sampler);  
 
-            // Trace a Shadow Ray
-            if(lsRec.shadow_ray_){ 
+                // Trace a Shadow Ray
+                if(lsRec.shadow_ray_){ 
 
-                std::shared_ptr<IntersectRecord> light_inst=traceRay(*lsRec.shadow_ray_,&scene);
-                // if visible, update radiance
-                if(light_inst&&fabs(light_inst->t_-lsRec.dist_)<lsRec.dist_*0.01){
+                    std::shared_ptr<IntersectRecord> light_inst=traceRay(*lsRec.shadow_ray_,&scene);
+                    // if visible, update radiance
+                    if(lsRec.isVisible(light_inst.get())){
                     
-                    glm::vec3 wo=inst->ray2TangentSpace(-curRay.dir_);
-                    glm::vec3 wi=inst->ray2TangentSpace(lsRec.shadow_ray_->dir_);
-
-                    BSDFRecord bsdfRec(*inst,sampler,wo,wi);
-                    bsdf->evalBSDF(bsdfRec);        
-                    float cosTheta = std::max(0.f, wi.z);
-
-                    bool need_mis=needMIS(bsdf->bsdf_type_);
-                    float weight=need_mis?getMISweight(lsRec.pdf_,bsdfRec.pdf):1.0;
-
-                    direct+=throughput*bsdfRec.bsdf_val*lsRec.value_*cosTheta*weight;
+                        glm::vec3 wo=inst->ray2TangentSpace(-curRay.dir_);
+                        glm::vec3 wi=inst->ray2TangentSpace(lsRec.shadow_ray_->dir_);
+
+                        BSDFRecord bsdfRec(*inst,sampler,wo,wi);
+                        bsdf.evalBSDF(bsdfRec);        
+                        float cosTheta = std::max(0.f, wi.z);
+
+                        float bsdf_pdf=bsdfRec.pdf;
+                        // a guided bounce samples the mixture of sampleBounce, weight against that pdf
+                        if(guide_&&guide_->isTrained()&&!perfect_reflect)
+                            bsdf_pdf=BSDF_FRACTION*bsdf_pdf+(1.f-BSDF_FRACTION)*
+                                     guide_->getGuide(inst->pos_).pdf(lsRec.shadow_ray_->dir_);
+                        float weight=MIS&&needMIS(bsdf.bsdf_type_)?getMISweight(lsRec.pdf_,bsdf_pdf):1.0;
+
+                        direct+=throughput*bsdfRec.bsdf_val*lsRec.value_*cosTheta*weight;
+                    }
                 }
             }
-        }
 
-        radiance+=direct/float(pRecord.light_split);
+            if constexpr(!SINGLE_LIGHT)
+                direct/=float(pRecord.light_split);
+            radiance+=direct;
+            if(cache_)
+                cache_path.splat(direct);
+            if constexpr(AOV){
+                if(pRecord.curdepth==1)
+                    pRecord.aov.direct+=direct;
+            }
+            if(recording)
+                path.splat(direct);
         
-        /* --------- MIS: Sample BRDF's PDF ----------*/
+            /* --------- MIS: Sample BRDF's PDF ----------*/
 
-        BSDFRecord bsdfRec(*inst,sampler,-curRay.dir_);
-        bsdf->sampleBSDF(bsdfRec);
-        bsdf->evalBSDF(bsdfRec);
-        if(!bsdfRec.isValid())// If bsdf value or pdf is too small, this path would gain us little benefit. 
-            break;
+            BSDFRecord bsdfRec(*inst,sampler,-curRay.dir_);
+            glm::vec3 wi_world;
+            if(!sampleBounce(*inst,bsdf,bsdfRec,sampler,wi_world))
+                break;
         
-        // generate next direction and trace it
-        glm::vec3 wi_world=inst->wi2WorldSpace(bsdfRec.wi);
-        curRay=Ray(inst->pos_+inst->normal_*0.001f,wi_world);
-        inst=traceRay(curRay,&scene);
-        if(!inst)
-            break;
+            // generate next direction and trace it
+            glm::vec3 bounce_pos=inst->pos_;
+            curRay=Ray(inst->pos_+inst->normal_*0.001f,wi_world);
+            inst=traceRay(curRay,&scene);
+            ++ray_num;
         
-        // update throughput (recursion)
-        throughput*=bsdfRec.bsdf_val*bsdfRec.costheta/bsdfRec.pdf;
+            // update throughput (recursion)
+            throughput*=bsdfRec.bsdf_val*bsdfRec.costheta/bsdfRec.pdf;
+            if(recording)
+                path.addVertex(bounce_pos,wi_world,throughput,bsdfRec.pdf);
 
 
-        
-        bool perfect_reflect=(bool)(bsdf->bsdf_type_&BSDFType::PerfectReflection);
-        bool need_mis=needMIS(bsdf->bsdf_type_);
 
-        if((int)(inst->material_->type_&MtlType::Emissive)  // if meet an Emitter
-            &&glm::dot(curRay.dir_,inst->normal_)<0.f       // front face
-            &&need_mis)                                     // need mis
-        {
-            auto Li=inst->material_->radiance_rgb_;
-            float light_prob=scene.getLightPDF(curRay,*inst);
+            if(!inst){
+                // escaped to the environment, weighted against its light samples like an emitter
+                glm::vec3 env(0.f);
+                if(need_mis&&scene.hasEnvironment()){
+                    float weight= perfect_reflect?1.0:
+                                                 getMISweight(bsdfRec.pdf,scene.getLightPDF(curRay));
+                    env=throughput*scene.getEnvironment(curRay.dir_)*weight;
+                    radiance+=env;
+                    if(cache_)
+                        cache_path.splat(env);
+                    if constexpr(AOV){
+                        if(pRecord.curdepth==1)
+                            pRecord.aov.direct+=env;
+                    }
+                }
+                if(recording)
+                    path.splatLight(throughput*scene.getEnvironment(curRay.dir_),env);
+                break;
+            }
 
-            float weight= perfect_reflect?1.0: 
-                                         getMISweight(bsdfRec.pdf,light_prob);
+            bool front_emitter=(int)(inst->material_->type_&MtlType::Emissive)&&glm::dot(curRay.dir_,inst->normal_)<0.f;
+            if(front_emitter                                    // if meet the front face of an Emitter
+                &&need_mis)                                     // need mis
+            {
+                auto Li=inst->material_->radiance_rgb_;
+                float light_prob=scene.getLightPDF(curRay,*inst);
+
+                float weight= perfect_reflect?1.0: 
+                                             getMISweight(bsdfRec.pdf,light_prob);
+
+                radiance+=throughput*Li*weight;
+                if(cache_)
+                    cache_path.splat(throughput*Li*weight);
+                if constexpr(AOV){
+                    if(pRecord.curdepth==1)
+                        pRecord.aov.direct+=throughput*Li*weight;
+                }
+                if(recording)
+                    path.splatLight(throughput*Li,throughput*Li*weight);
+                break;
+            }
+            // light samples carry the emitter to the image, yet it is what the last bounce sees
+            if(recording&&front_emitter)
+                path.splatLight(throughput*inst->material_->radiance_rgb_,glm::vec3(0.f));
+
+            //-----------------------------------------------------------//
+            /*--------------------- 2.INDIRECT LIGHT --------------------*/
+            //-----------------------------------------------------------//
+
+            if constexpr(!FIXED_DEPTH){
+                float split=-1.f;
+                if(split_cache_){
+                    split=split_cache_->getSplitFactor(split_cache_->findCell(inst->pos_),block,
+                                                       utils::getLuminance(throughput));
+                }
+                if(split<0.f){
+                    /* Russian Roulette */
+                    float RR=std::max(std::min((throughput[0]+throughput[1]+throughput[2])*0.3333333f,0.95f),0.2f);
+                    if(pRecord.sampler.getRandom1D()<RR){
+                        throughput/=RR;
+                    }
+                    else
+                        break;
+                }
+                else{
+                    /* Russian Roulette and splitting: `split` branches on average, each weighing 1/split */
+                    split=std::min(split,can_split?float(1+split_path.getRoom()):1.f);
+                    int branch_num=int(split+pRecord.sampler.getRandom1D());
+                    if(branch_num==0)
+                        break;
+                    throughput/=split;
+                    for(int k=1;k<branch_num;++k)
+                        split_path.push(curRay,inst,throughput,pRecord.curdepth);
+                }
+            }
 
-            radiance+=throughput*Li*weight;
-            break;
         }
+    }while(split_cache_&&split_path.nextBranch(*split_cache_,utils::getLuminance(radiance),ray_num,curRay,inst,throughput,
+                                       pRecord.curdepth));
+    if(split_cache_)
+        split_cache_->recordPixel(block,utils::getLuminance(radiance),(float)ray_num);
+
+    if(recording)
+        path.commit(*guide_);
+    if(cache_)
+        cache_path.commit(*cache_);
+    
+    return radiance;
+}
 
-        //-----------------------------------------------------------//
-        /*--------------------- 2.INDIRECT LIGHT --------------------*/
-        //-----------------------------------------------------------//
 
-        if(max_depth_<=0){
-            /* Russian Roulette */
-            float RR=std::max(std::min((throughput[0]+throughput[1]+throughput[2])*0.3333333f,0.95f),0.2f);
-            if(pRecord.sampler.pcgRNG_.nextFloat()<RR){
-                throughput/=RR;
-            }
-            else
-                break;
-        }
 
-    }
-    
-    return radiance;
+std::shared_ptr<PathTracer> createMonteCarloPathTracer(int max_depth,bool mis,bool single_light,bool aov,
+                                                       std::shared_ptr<GuidingField> guide,
+                                                       std::shared_ptr<RadianceCache> cache,int cache_depth,
+                                                       int light_candidates,std::shared_ptr<SplittingCache> split_cache){
+    // one instantiation for each combination of the options
+    auto make=[&](auto fixed_depth,auto use_mis,auto single,auto record_aov)->std::shared_ptr<PathTracer>{
+        // splitting takes the place of Russian Roulette, paths of a fixed depth have none
+        return std::make_shared<MonteCarloPathTracer<decltype(fixed_depth)::value,decltype(use_mis)::value,
+                                                     decltype(single)::value,decltype(record_aov)::value>>(
+                                                         max_depth,guide,cache,cache_depth,light_candidates,
+                                                         max_depth>0?nullptr:split_cache);
+    };
+    auto pick=[](bool b,auto&& next){
+        return b?next(std::true_type()):next(std::false_type());
+    };
+    return pick(max_depth>0,[&](auto d){
+        return pick(mis,[&](auto m){
+            return pick(single_light,[&](auto s){
+                return pick(aov,[&](auto a){ return make(d,m,s,a); });
+            });
+        });
+    });
 }
 
 
@@ -153,9 +592,11 @@ glm::vec3 MonteCarloPathTracerNEE::Li(const Ray ray,PathTraceRecord& pRecord) {
     // record the current ray
     Ray curRay(ray);
     // Trace the current ray
-    std::shared_ptr<IntersectRecord> inst=traceRay(curRay,&scene);
+    std::shared_ptr<IntersectRecord> inst=traceCameraRay(curRay,pRecord);
     if(!inst){
-        radiance+=glm::vec3(0.f);//I can possibly use an environment map.
+        // the environment seen directly
+        radiance+=scene.getEnvironment(curRay.dir_);
+        pRecord.aov.direct+=radiance;
         return radiance;
     }
 
@@ -167,14 +608,17 @@ glm::vec3 MonteCarloPathTracerNEE::Li(const Ray ray,PathTraceRecord& pRecord) {
         if(!mtl){
             throw std::runtime_error("Li(const Ray ray,PathTraceRecord& pRecord): the hit point doesn't own a material!");
         }
+        if(pRecord.curdepth==1)
+            recordFirstHitAOV(pRecord,*inst);
         // Attention:  Only consider self-emssion for the first intersection, 
         // because the following bounces are considered only in the term of "Indirect Light"
         if((int)(mtl->type_&MtlType::Emissive)&&pRecord.curdepth==1){
             radiance+=throughput*mtl->getEmit();
+            pRecord.aov.direct+=throughput*mtl->getEmit();
         }
 
         /*-----------------------Sample Direct Light------------------------*/
-        float u=sampler.pcgRNG_.nextFloat();
+        float u=sampler.getRandom1D();
         auto bsdf=inst->getBSDF(u);
     
         // Sampling a Direct Light
@@ -187,16 +631,18 @@ glm::vec3 MonteCarloPathTracerNEE::Li(const Ray ray,PathTraceRecord& pRecord) {
 
             std::shared_ptr<IntersectRecord> light_inst=traceRay(*lsRec.shadow_ray_,&scene);
             // if visible, update radiance
-            if(light_inst&&fabs(light_inst->t_-lsRec.dist_)<lsRec.dist_*0.01){
+            if(lsRec.isVisible(light_inst.get())){
                 
                 glm::vec3 wo=inst->ray2TangentSpace(-curRay.dir_);
                 glm::vec3 wi=inst->ray2TangentSpace(lsRec.shadow_ray_->dir_);
 
                 BSDFRecord bsdfRec(*inst,sampler,wo,wi);
-                bsdf->evalBSDF(bsdfRec);
+                bsdf.evalBSDF(bsdfRec);
                 float cosTheta = std::max(0.f, wi.z);
 
                 radiance+=throughput*bsdfRec.bsdf_val*lsRec.value_*cosTheta;
+                if(pRecord.curdepth==1)
+                    pRecord.aov.direct+=throughput*bsdfRec.bsdf_val*lsRec.value_*cosTheta;
                 
             }
         }
@@ -205,8 +651,8 @@ glm::vec3 MonteCarloPathTracerNEE::Li(const Ray ray,PathTraceRecord& pRecord) {
         /*-----------------------InDirect Light------------------------*/
         if(max_depth_<=0||pRecord.curdepth<max_depth_){
             BSDFRecord bsdfRec(*inst,sampler,-curRay.dir_);
-            bsdf->sampleBSDF(bsdfRec);
-            bsdf->evalBSDF(bsdfRec);
+            bsdf.sampleBSDF(bsdfRec);
+            bsdf.evalBSDF(bsdfRec);
             if(!bsdfRec.isValid())// If bsdf value or pdf is too small, this path would gain us little benefit. 
                 break;
             
@@ -222,7 +668,7 @@ glm::vec3 MonteCarloPathTracerNEE::Li(const Ray ray,PathTraceRecord& pRecord) {
 
             /* Russian Roulette */
             float RR=std::max(std::min((throughput[0]+throughput[1]+throughput[2])*0.3333333f,0.75f),0.2f);
-            if(pRecord.sampler.pcgRNG_.nextFloat()<RR){
+            if(pRecord.sampler.getRandom1D()<RR){
                 throughput/=RR;
             }
             else
@@ -5,8 +5,38 @@
 #include"hitem.h"
 #include"sample.h"
 #include"bsdf.h"
+#include"guiding.h"
+#include"radiancecache.h"
+#include"restir.h"
+#include"splitting.h"
 #include<mutex>
 
+/**
+ * @brief what a camera ray saw at its first hit: guides of the denoiser and AOVs of the film.
+ *        A ray that misses the scene keeps the defaults: white albedo, zero normal and depth.
+ */
+struct FirstHitAOV{
+    glm::vec3 albedo=glm::vec3(1.f);
+    glm::vec3 normal=glm::vec3(0.f);    // shading normal
+    float depth=0.f;                    // distance from the camera
+    glm::vec3 direct=glm::vec3(0.f);    // part of the radiance: emission and direct light at the first hit
+
+    FirstHitAOV& operator+=(const FirstHitAOV& other){
+        albedo+=other.albedo;
+        normal+=other.normal;
+        depth+=other.depth;
+        direct+=other.direct;
+        return *this;
+    }
+    FirstHitAOV& operator*=(float s){
+        albedo*=s;
+        normal*=s;
+        depth*=s;
+        direct*=s;
+        return *this;
+    }
+};
+
 /**
  * @brief Encapsulate all the necessary infos for tracing a light in a scene
  * 
@@ -19,6 +49,18 @@ struct PathTraceRecord{
 
     int curdepth;
     int light_split;
+
+    // the hit of the camera ray. Set beforehand if it is already known(rasterized primary visibility),
+    // filled by the tracer otherwise; nullptr after tracing if the camera ray missed the scene.
+    std::shared_ptr<IntersectRecord> primary_hit;
+
+    FirstHitAOV aov;    // written by the tracer at `curdepth==1`
+
+    // the first-hit reservoirs of a progressive film, used by resampled light sampling; nullptr for no reuse
+    ReservoirReuse* reuse=nullptr;
+
+    // the film pixel of the camera ray, (-1,-1) if it has none
+    glm::ivec2 pixel=glm::ivec2(-1);
 };
 
 /**
@@ -48,13 +90,32 @@ public:
         return inst;
     }
 
+    /**
+     * @brief the first hit of a camera ray: taken from the record when the rasterizer has resolved it,
+     *        kept in the record otherwise so that the caller can see it.
+     */
+    std::shared_ptr<IntersectRecord> traceCameraRay(const Ray& ray,PathTraceRecord& pRecord)const{
+        if(!pRecord.primary_hit)
+            pRecord.primary_hit=traceRay(ray,&pRecord.scene);
+        return pRecord.primary_hit;
+    }
+
+    /**
+     * @brief keep the albedo, normal and depth of the first hit for the denoiser; emitters count as white so that
+     *        their radiance survives the albedo demodulation.
+     */
+    static void recordFirstHitAOV(PathTraceRecord& pRecord,const IntersectRecord& inst){
+        bool is_emitter=(bool)(inst.material_->type_&MtlType::Emissive);
+        pRecord.aov.albedo=is_emitter?glm::vec3(1.f):inst.getAlbedo();
+        pRecord.aov.normal=inst.normal_;
+        pRecord.aov.depth=inst.t_;
+    }
+
     /**
      * @brief get the radiance color of an incident ray after hitting the scene.
      */
     virtual glm::vec3 Li(const Ray ray,PathTraceRecord& pRecord){
-        const Scene& scene=pRecord.scene;
-
-        std::shared_ptr<IntersectRecord> inst=traceRay(ray,&scene);
+        std::shared_ptr<IntersectRecord> inst=traceCameraRay(ray,pRecord);
         if(!inst)   return glm::vec3(0.f);
 
         glm::vec3 color = (inst->normal_ * 0.5f + 0.5f);
@@ -70,10 +131,33 @@ public:
  * Members:
  * - max_depth_ ; <=0:infinite length,1:direct light,2: one bounce,...
  * 
+ * - guide_ : if set, sample the bounces from a mixture of the bsdf and the field once it is trained, and record
+ *            the radiance of the paths into it while it is recording
+ * - cache_ : if set, record the radiance leaving the diffuse hits into it, and end a path at a diffuse hit past
+ *            `cache_depth_` bounces with the cached radiance if its cell has learned enough
+ * - light_candidates_ : if >1, light samples that carry the whole direct light are each picked among that many by
+ *                       their unshadowed contribution(RIS), for a single shadow ray. At the first hit the reservoir
+ *                       is also merged with those of the last pass around the pixel, see `PathTraceRecord::reuse`
+ * - split_cache_ : if set, with Russian Roulette, a path goes on from a hit with as many branches as it finds the
+ *                  most efficient for its pixel, which may be none or several; the hits and pixels record what it
+ *                  learns from. Paths recording into the guiding field or the radiance cache are not split, only ended
+ * 
+ * The options on every bounce are template parameters, so that each variant compiles to a loop without their branches:
+ * - FIXED_DEPTH : paths end at `max_depth_`, Russian Roulette otherwise
+ * - MIS : weight light and bsdf samples of glossy lobes; without it light samples carry the whole direct light,
+ *         as they do for diffuse lobes anyway
+ * - SINGLE_LIGHT : one light sample per hit rather than `light_split`
+ * - AOV : record the first hit in `PathTraceRecord::aov`
+ * Use `createMonteCarloPathTracer` to get the variant of a setting.
  */
-class MonteCarloPathTracer:public PathTracer{
+template<bool FIXED_DEPTH,bool MIS,bool SINGLE_LIGHT,bool AOV>
+class MonteCarloPathTracer final:public PathTracer{
 public:
-    MonteCarloPathTracer(int mdepth):max_depth_(mdepth){}
+    MonteCarloPathTracer(int mdepth,std::shared_ptr<GuidingField> guide=nullptr,
+                         std::shared_ptr<RadianceCache> cache=nullptr,int cache_depth=0,int light_candidates=1,
+                         std::shared_ptr<SplittingCache> split_cache=nullptr)
+        :max_depth_(mdepth),guide_(guide),cache_(cache),cache_depth_(cache_depth),light_candidates_(light_candidates),
+         split_cache_(split_cache){}
 
     glm::vec3 Li(const Ray ray,PathTraceRecord& pRecord) override;
 
@@ -90,10 +174,62 @@ private:
         return weight;
     }
 
+    // whether a path at `depth` goes on
+    bool continuePath(int depth)const{
+        if constexpr(FIXED_DEPTH)
+            return depth<max_depth_;
+        else
+            return true;
+    }
+
+    /**
+     * @brief sample the next direction of the path and evaluate the bsdf for it. Guided, the direction comes from the
+     *        bsdf or the guiding field with probability `BSDF_FRACTION`, and `rec.pdf` is that of the mixture
+     *        (one-sample MIS); mirrors are never guided.
+     * @return false if the path should end there
+     */
+    bool sampleBounce(IntersectRecord& inst,const BSDF& bsdf,BSDFRecord& rec,Sampler& sampler,glm::vec3& wi_world)const;
+
+    /**
+     * @brief the direct light of one resampled light sample from `src_pos` off the hit, seen from `wo`(tangent space)
+     * @param reuse merge the reservoir with those of `pRecord.reuse` and keep it there
+     */
+    glm::vec3 sampleResampledLight(IntersectRecord& inst,const BSDF& bsdf,const glm::vec3& wo,const glm::vec3& src_pos,
+                                   PathTraceRecord& pRecord,bool reuse)const;
+
+    /**
+     * @brief merge the reservoirs of the last pass at and around the pixel into `r`, those seen from a surface of
+     *        another depth or orientation left out; they are retargeted at this hit
+     */
+    void reuseReservoirs(IntersectRecord& inst,const BSDF& bsdf,const glm::vec3& wo,const glm::vec3& src_pos,
+                         PathTraceRecord& pRecord,LightReservoir& r)const;
+
+    static constexpr float BSDF_FRACTION=0.5f;
+
     int max_depth_;
+    std::shared_ptr<GuidingField> guide_;
+    std::shared_ptr<RadianceCache> cache_;
+    int cache_depth_;
+    int light_candidates_;
+    std::shared_ptr<SplittingCache> split_cache_;
 
 };
 
+/**
+ * @brief the `MonteCarloPathTracer` variant of the options, see there
+ * @param max_depth <=0 for Russian Roulette
+ * @param guide nullptr for no path guiding
+ * @param cache nullptr for no radiance cache
+ * @param cache_depth bounces of a path before it may end in the cache
+ * @param light_candidates candidates of a resampled light sample, <=1 for plain light sampling
+ * @param split_cache nullptr for the usual Russian Roulette, ignored with a `max_depth`
+ */
+std::shared_ptr<PathTracer> createMonteCarloPathTracer(int max_depth,bool mis,bool single_light,bool aov,
+                                                       std::shared_ptr<GuidingField> guide=nullptr,
+                                                       std::shared_ptr<RadianceCache> cache=nullptr,
+                                                       int cache_depth=0,int light_candidates=1,
+                                                       std::shared_ptr<SplittingCache> split_cache=nullptr);
+
 
 /**
  * @brief a simple implementation of Monte Carlo Path tracing
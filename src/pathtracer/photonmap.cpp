@@ -0,0 +1,293 @@
+#include"photonmap.h"
+#include"common/threadpool.h"
+
+/*-----------------------------------------------------------*/
+/*------------------------PhotonMap--------------------------*/
+/*-----------------------------------------------------------*/
+
+void PhotonMap::build(std::vector<Photon>&& photons,float radius){
+    radius_=radius;
+    inv_cell_=0.5f/radius;
+    uint32_t table=1;
+    while(table<photons.size())
+        table<<=1;
+    mask_=table-1;
+
+    // counting sort by bucket
+    std::vector<uint32_t> bucket(photons.size());
+    cell_start_.assign(table+1,0);
+    for(size_t i=0;i<photons.size();++i){
+        bucket[i]=hash(cellOf(photons[i].pos_));
+        ++cell_start_[bucket[i]+1];
+    }
+    for(uint32_t h=0;h<table;++h)
+        cell_start_[h+1]+=cell_start_[h];
+
+    std::vector<uint32_t> next(cell_start_.begin(),cell_start_.end()-1);
+    photons_.resize(photons.size());
+    for(size_t i=0;i<photons.size();++i)
+        photons_[next[bucket[i]]++]=photons[i];
+    photons.clear();
+}
+
+/*-----------------------------------------------------------*/
+/*-----------------------PhotonMapper------------------------*/
+/*-----------------------------------------------------------*/
+
+namespace{
+
+// photons a job of the thread pool traces
+constexpr uint32_t PHOTON_CHUNK=4096;
+
+std::shared_ptr<IntersectRecord> traceScene(const Ray& ray,const Scene& scene){
+    auto inst=std::make_shared<IntersectRecord>();
+    if(!scene.getConstTLAS().traceRayInAccel(ray,0,*inst,true)||!ray.acceptT(inst->t_))
+        return nullptr;
+    return inst;
+}
+
+}   // namespace
+
+PhotonMapper::PhotonMapper(const Scene& scene,uint32_t photon_num,float radius,int max_depth)
+    :scene_(scene),photon_num_(std::max(photon_num,1u)),radius_(radius),max_depth_(max_depth){}
+
+void PhotonMapper::emit(uint32_t pass){
+    if(emitted_&&pass_==pass)
+        return;
+
+    // radius of the pass
+    float r2=radius_*radius_;
+    for(uint32_t i=1;i<=pass;++i)
+        r2*=(i-1+ALPHA)/i;
+
+    // chunks trace with their own seeds and are joined in order, the maps do not depend on the threads
+    uint32_t chunk_num=(photon_num_+PHOTON_CHUNK-1)/PHOTON_CHUNK;
+    std::vector<std::vector<Photon>> global(chunk_num),caustic(chunk_num);
+    ThreadPool::global().parallelFor(chunk_num,[&](size_t c){
+        Sampler sampler(1,(uint64_t(pass)<<32)+c+1);
+        sampler.startPixle();
+        uint32_t num=std::min(PHOTON_CHUNK,photon_num_-uint32_t(c)*PHOTON_CHUNK);
+        tracePhotons(num,sampler,global[c],caustic[c]);
+    });
+
+    auto join=[](std::vector<std::vector<Photon>>& chunks){
+        std::vector<Photon> all;
+        size_t total=0;
+        for(auto& chunk:chunks)
+            total+=chunk.size();
+        all.reserve(total);
+        for(auto& chunk:chunks)
+            all.insert(all.end(),chunk.begin(),chunk.end());
+        return all;
+    };
+    float radius=std::sqrt(r2);
+    global_.build(join(global),radius);
+    caustic_.build(join(caustic),radius);
+    pass_=pass;
+    emitted_=true;
+    std::cout<<"Photon pass "<<pass<<" : "<<global_.size()<<" global, "<<caustic_.size()
+             <<" caustic photons, radius "<<radius<<std::endl;
+}
+
+void PhotonMapper::tracePhotons(uint32_t num,Sampler& sampler,
+                                std::vector<Photon>& global,std::vector<Photon>& caustic)const{
+    const float inv_num=1.f/photon_num_;
+    const int max_bounce=max_depth_>0?max_depth_:MAX_BOUNCE;
+    for(uint32_t n=0;n<num;++n){
+        EmissionRecord er;
+        if(!scene_.sampleEmission(sampler,er))
+            return;
+        // the flux of the path: Le*cos/(pdf_pos*pdf_dir)
+        glm::vec3 emitted=er.radiance_*(glm::dot(er.normal_,er.dir_)/(er.pdf_pos_*er.pdf_dir_)*inv_num);
+        glm::vec3 throughput(1.f);
+
+        // only mirror bounces so far, the next stored hit is a caustic
+        bool specular_chain=false;
+        Ray ray(er.pos_+er.dir_*0.001f,er.dir_);
+        for(int bounce=0;bounce<max_bounce;++bounce){
+            auto inst=traceScene(ray,scene_);
+            // photons are absorbed by emitters and the back of surfaces
+            if(!inst||(bool)(inst->material_->type_&MtlType::Emissive)||glm::dot(ray.dir_,inst->normal_)>=0.f)
+                break;
+
+            if(!inst->material_->bsdf_desc_.isDelta()){
+                Photon photon{inst->pos_,-ray.dir_,emitted*throughput};
+                global.push_back(photon);
+                if(specular_chain)
+                    caustic.push_back(photon);
+            }
+
+            BSDF bsdf=inst->getBSDF(sampler.pcgRNG_.nextFloat());
+            BSDFRecord rec(*inst,sampler,-ray.dir_);
+            bsdf.sampleBSDF(rec);
+            bsdf.evalBSDF(rec);
+            if(!rec.isValid())
+                break;
+            throughput*=rec.bsdf_val*rec.costheta/rec.pdf;
+            specular_chain=(bool)(bsdf.bsdf_type_&BSDFType::PerfectReflection)&&(bounce==0||specular_chain);
+
+            if(max_depth_<=0){
+                /* Russian Roulette */
+                float RR=std::max(std::min((throughput[0]+throughput[1]+throughput[2])*0.3333333f,0.95f),0.2f);
+                if(sampler.pcgRNG_.nextFloat()>=RR)
+                    break;
+                throughput/=RR;
+            }
+            ray=Ray(inst->pos_+inst->normal_*0.001f,inst->wi2WorldSpace(rec.wi));
+        }
+    }
+}
+
+glm::vec3 PhotonMapper::estimate(const PhotonMap& map,IntersectRecord& inst,const BSDF& bsdf,
+                                 const glm::vec3& wo_world,Sampler& sampler)const{
+    glm::vec3 wo=inst.ray2TangentSpace(wo_world);
+    glm::vec3 flux(0.f);
+    map.query(inst.pos_,[&](const Photon& photon){
+        if(glm::dot(photon.dir_,inst.normal_)<=0.f)
+            return;
+        BSDFRecord rec(inst,sampler,wo,inst.ray2TangentSpace(photon.dir_));
+        bsdf.evalBSDF(rec);
+        flux+=rec.bsdf_val*photon.power_;
+    });
+    float r=map.getRadius();
+    return flux/(srender::PI*r*r);
+}
+
+/*-----------------------------------------------------------*/
+/*----------------------PhotonMapTracer----------------------*/
+/*-----------------------------------------------------------*/
+
+glm::vec3 PhotonMapTracer::directLight(IntersectRecord& inst,const BSDF& bsdf,const glm::vec3& wo_world,
+                                       PathTraceRecord& pRecord)const{
+    LightSampleRecord lsRec;
+    pRecord.scene.sampleEmitters(inst.pos_+inst.normal_*0.001f,lsRec,pRecord.sampler);
+    if(!lsRec.shadow_ray_)
+        return glm::vec3(0.f);
+    std::shared_ptr<IntersectRecord> light_inst=traceRay(*lsRec.shadow_ray_,&pRecord.scene);
+    if(!lsRec.isVisible(light_inst.get()))
+        return glm::vec3(0.f);
+
+    BSDFRecord rec(inst,pRecord.sampler,inst.ray2TangentSpace(wo_world),inst.ray2TangentSpace(lsRec.shadow_ray_->dir_));
+    bsdf.evalBSDF(rec);
+    return rec.bsdf_val*lsRec.value_*std::max(0.f,rec.wi.z);
+}
+
+glm::vec3 PhotonMapTracer::gather(Ray ray,PathTraceRecord& pRecord)const{
+    Sampler& sampler=pRecord.sampler;
+    glm::vec3 throughput(1.f);
+    for(int mirror=0;mirror<=MAX_GATHER_MIRROR;++mirror){
+        std::shared_ptr<IntersectRecord> inst=traceRay(ray,&pRecord.scene);
+        // the direct light and caustics of the gathering point are already there
+        if(!inst)
+            return mirror>0?throughput*pRecord.scene.getEnvironment(ray.dir_):glm::vec3(0.f);
+        if((bool)(inst->material_->type_&MtlType::Emissive))
+            return glm::vec3(0.f);
+
+        BSDF bsdf=inst->getBSDF(sampler.pcgRNG_.nextFloat());
+        if(!(bool)(bsdf.bsdf_type_&BSDFType::PerfectReflection))
+            return throughput*photons_->estimate(photons_->getGlobalMap(),*inst,bsdf,-ray.dir_,sampler);
+
+        BSDFRecord rec(*inst,sampler,-ray.dir_);
+        bsdf.sampleBSDF(rec);
+        bsdf.evalBSDF(rec);
+        if(!rec.isValid())
+            break;
+        throughput*=rec.bsdf_val*rec.costheta/rec.pdf;
+        ray=Ray(inst->pos_+inst->normal_*0.001f,inst->wi2WorldSpace(rec.wi));
+    }
+    return glm::vec3(0.f);
+}
+
+glm::vec3 PhotonMapTracer::Li(const Ray ray,PathTraceRecord& pRecord){
+    const Scene& scene=pRecord.scene;
+    Sampler& sampler=pRecord.sampler;
+
+    glm::vec3 throughput(1.0);
+    glm::vec3 radiance(0.f);
+    Ray curRay(ray);
+    std::shared_ptr<IntersectRecord> inst=traceCameraRay(curRay,pRecord);
+    if(!inst){
+        radiance+=scene.getEnvironment(curRay.dir_);
+        pRecord.aov.direct+=radiance;
+        return radiance;
+    }
+
+    // a surface that is not a mirror has been seen: its light sample and caustic estimate stand for the light that
+    // the path would find at an emitter through mirrors
+    bool diffuse_seen=false;
+    bool last_specular=false;
+    while((pRecord.curdepth++)<max_depth_||max_depth_<=0){
+        auto& mtl=inst->material_;
+        if(!mtl){
+            throw std::runtime_error("PhotonMapTracer::Li: the hit point doesn't own a material!");
+        }
+        if(pRecord.curdepth==1)
+            recordFirstHitAOV(pRecord,*inst);
+
+        /*-----------------------  Emission ------------------------*/
+        bool is_emitter=(bool)(mtl->type_&MtlType::Emissive);
+        if(is_emitter&&!diffuse_seen&&glm::dot(curRay.dir_,inst->normal_)<0.f){
+            radiance+=throughput*mtl->getEmit();
+            if(pRecord.curdepth==1)
+                pRecord.aov.direct+=throughput*mtl->getEmit();
+        }
+
+        auto bsdf=inst->getBSDF(sampler.pcgRNG_.nextFloat());
+        bool specular=(bool)(bsdf.bsdf_type_&BSDFType::PerfectReflection);
+
+        /*---------------- Direct Light and Caustics ---------------*/
+        if(!is_emitter&&!specular){
+            glm::vec3 direct=throughput*directLight(*inst,bsdf,-curRay.dir_,pRecord);
+            glm::vec3 caustic=throughput*photons_->estimate(photons_->getCausticMap(),*inst,bsdf,-curRay.dir_,sampler);
+            radiance+=direct+caustic;
+            if(pRecord.curdepth==1)
+                pRecord.aov.direct+=direct;
+            diffuse_seen=true;
+
+            /*---------------------- Final Gather ----------------------*/
+            if(mode_==IntegratorType::PhotonFinalGather){
+                glm::vec3 indirect(0.f);
+                for(int g=0;g<gather_rays_;++g){
+                    BSDFRecord rec(*inst,sampler,-curRay.dir_);
+                    bsdf.sampleBSDF(rec);
+                    bsdf.evalBSDF(rec);
+                    if(!rec.isValid())
+                        continue;
+                    Ray gather_ray(inst->pos_+inst->normal_*0.001f,inst->wi2WorldSpace(rec.wi));
+                    indirect+=rec.bsdf_val*rec.costheta/rec.pdf*gather(gather_ray,pRecord);
+                }
+                radiance+=throughput*indirect/float(gather_rays_);
+                break;
+            }
+        }
+
+        /*---------------------- Next Bounce -----------------------*/
+        BSDFRecord bsdfRec(*inst,sampler,-curRay.dir_);
+        bsdf.sampleBSDF(bsdfRec);
+        bsdf.evalBSDF(bsdfRec);
+        if(!bsdfRec.isValid())
+            break;
+        last_specular=specular;
+        curRay=Ray(inst->pos_+inst->normal_*0.001f,inst->wi2WorldSpace(bsdfRec.wi));
+        inst=traceRay(curRay,&scene);
+        throughput*=bsdfRec.bsdf_val*bsdfRec.costheta/bsdfRec.pdf;
+
+        if(!inst){
+            // light samples cover the environment behind a diffuse bounce, the photons never carry it
+            if(!diffuse_seen||last_specular)
+                radiance+=throughput*scene.getEnvironment(curRay.dir_);
+            break;
+        }
+
+        if(max_depth_<=0){
+            /* Russian Roulette */
+            float RR=std::max(std::min((throughput[0]+throughput[1]+throughput[2])*0.3333333f,0.95f),0.2f);
+            if(sampler.pcgRNG_.nextFloat()<RR)
+                throughput/=RR;
+            else
+                break;
+        }
+    }
+
+    return radiance;
+}
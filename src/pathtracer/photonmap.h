@@ -0,0 +1,139 @@
+/* photon mapping: light paths traced from the emitters, their hits estimating the light arriving at a surface */
+#pragma once
+#include"common/common_include.h"
+#include"pathtracer.h"
+
+/**
+ * @brief the light a photon path brought to a surface
+ */
+struct Photon{
+    glm::vec3 pos_;
+    glm::vec3 dir_;     // normalized, toward where the photon came from
+    glm::vec3 power_;   // flux
+};
+
+/**
+ * @brief the photons of a pass in a hash grid of cells twice the query radius across, so that a query only visits
+ *        the 2x2x2 cells around its position. Photons are sorted by bucket into one array: `cell_start_[h]` is the
+ *        first photon of bucket `h`, whose end is the start of the next one.
+ */
+class PhotonMap{
+public:
+    void build(std::vector<Photon>&& photons,float radius);
+
+    // call `func(photon)` for each photon closer than the radius to `pos`
+    template<typename Func>
+    void query(const glm::vec3& pos,Func&& func)const;
+
+    size_t size()const{ return photons_.size(); }
+    float getRadius()const{ return radius_; }
+
+private:
+    uint32_t hash(const glm::ivec3& cell)const{
+        return (uint32_t(cell.x)*73856093u^uint32_t(cell.y)*19349663u^uint32_t(cell.z)*83492791u)&mask_;
+    }
+    glm::ivec3 cellOf(const glm::vec3& pos)const{ return glm::ivec3(glm::floor(pos*inv_cell_)); }
+
+    std::vector<Photon> photons_;
+    std::vector<uint32_t> cell_start_;  // table size+1 entries
+    uint32_t mask_=0;
+    float radius_=0.f;
+    float inv_cell_=0.f;
+};
+
+template<typename Func>
+void PhotonMap::query(const glm::vec3& pos,Func&& func)const{
+    if(photons_.empty())
+        return;
+    const float r2=radius_*radius_;
+    glm::ivec3 base(glm::floor(pos*inv_cell_-0.5f));
+    uint32_t visited[8];
+    int visited_num=0;
+    for(int k=0;k<8;++k){
+        uint32_t h=hash(base+glm::ivec3(k&1,(k>>1)&1,(k>>2)&1));
+        // neighbouring cells may share a bucket
+        if(std::find(visited,visited+visited_num,h)!=visited+visited_num)
+            continue;
+        visited[visited_num++]=h;
+        for(uint32_t i=cell_start_[h];i<cell_start_[h+1];++i){
+            glm::vec3 d=photons_[i].pos_-pos;
+            if(glm::dot(d,d)<=r2)
+                func(photons_[i]);
+        }
+    }
+}
+
+/**
+ * @brief traces the photons of a pass and keeps two maps of them, at the surfaces that are not perfect mirrors:
+ *        - global: every such hit, the light reflected by a surface
+ *        - caustic: the hits right after one or more mirror bounces from the emitter
+ *        Each pass emits a new set with a smaller radius, r_i^2=r_{i-1}^2*(i-1+alpha)/i, so that the average of the
+ *        passes converges(progressive photon mapping). The environment map emits no photons.
+ */
+class PhotonMapper{
+public:
+    // share of the radius kept from a pass to the next
+    static constexpr float ALPHA=2.f/3.f;
+    static constexpr int MAX_BOUNCE=32;
+
+    /**
+     * @param radius query radius of the first pass, in world units
+     * @param max_depth bounces of a photon path, <=0 for Russian Roulette
+     */
+    PhotonMapper(const Scene& scene,uint32_t photon_num,float radius,int max_depth);
+
+    // trace the photons of pass `pass`, nothing if they are already there; the maps are read only until the next call
+    void emit(uint32_t pass);
+
+    const PhotonMap& getGlobalMap()const{ return global_; }
+    const PhotonMap& getCausticMap()const{ return caustic_; }
+
+    /**
+     * @brief density estimate of the light `map` reflects at `inst` toward `wo_world`, with the lobe `bsdf` of it.
+     *        Photons that arrived from behind the surface are left out.
+     */
+    glm::vec3 estimate(const PhotonMap& map,IntersectRecord& inst,const BSDF& bsdf,
+                       const glm::vec3& wo_world,Sampler& sampler)const;
+
+private:
+    // trace `num` photon paths with `sampler`, appending their hits
+    void tracePhotons(uint32_t num,Sampler& sampler,std::vector<Photon>& global,std::vector<Photon>& caustic)const;
+
+    const Scene& scene_;
+    uint32_t photon_num_;
+    float radius_;
+    int max_depth_;
+
+    PhotonMap global_;
+    PhotonMap caustic_;
+    uint32_t pass_=0;
+    bool emitted_=false;
+};
+
+/**
+ * @brief the integrators over a photon map, see `IntegratorType`:
+ * - PhotonCaustics : path tracing whose diffuse hits take the caustics from the caustic map; the paths that reach an
+ *                    emitter through mirrors after a diffuse hit are left to it
+ * - PhotonFinalGather : at the first diffuse hit, direct light and caustics as above, and the rest of the light from
+ *                       the global map at the ends of `gather_rays_` bsdf sampled rays, which go through mirrors
+ */
+class PhotonMapTracer final:public PathTracer{
+public:
+    PhotonMapTracer(IntegratorType mode,int mdepth,int gather_rays,std::shared_ptr<const PhotonMapper> photons)
+        :mode_(mode),max_depth_(mdepth),gather_rays_(std::max(gather_rays,1)),photons_(photons){}
+
+    glm::vec3 Li(const Ray ray,PathTraceRecord& pRecord) override;
+
+private:
+    // the light sample of `inst`, unweighted
+    glm::vec3 directLight(IntersectRecord& inst,const BSDF& bsdf,const glm::vec3& wo_world,PathTraceRecord& pRecord)const;
+    // the light the global map sees at the end of a gather ray
+    glm::vec3 gather(Ray ray,PathTraceRecord& pRecord)const;
+
+    static constexpr int MAX_GATHER_MIRROR=4;
+
+    IntegratorType mode_;
+    int max_depth_;
+    int gather_rays_;
+    std::shared_ptr<const PhotonMapper> photons_;
+};
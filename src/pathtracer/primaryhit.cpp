@@ -0,0 +1,71 @@
+#include"primaryhit.h"
+
+namespace{
+
+float cross2(const glm::vec2& a,const glm::vec2& b){
+    return a.x*b.y-a.y*b.x;
+}
+
+}   // namespace
+
+void PrimaryHitBuffer::addOverlap(const glm::vec3 p[3],uint32_t inst_id,uint32_t face_id){
+    // a little margin keeps the pixels a corner or an edge only touches
+    constexpr float MARGIN=1e-3f;
+    glm::vec3 lo=glm::min(p[0],glm::min(p[1],p[2]));
+    glm::vec3 hi=glm::max(p[0],glm::max(p[1],p[2]));
+    int x0=std::max(0,(int)std::floor(lo.x-MARGIN)),x1=std::min(width_-1,(int)std::floor(hi.x+MARGIN));
+    int y0=std::max(0,(int)std::floor(lo.y-MARGIN)),y1=std::min(height_-1,(int)std::floor(hi.y+MARGIN));
+
+    glm::vec2 e1=glm::vec2(p[1]-p[0]),e2=glm::vec2(p[2]-p[0]);
+    float area=cross2(e1,e2);
+    // a face seen edge on keeps the bounds of its box and of its corners' depths
+    bool flat=std::fabs(area)<1e-8f;
+    float orient=area<0.f?-1.f:1.f;
+
+    const uint64_t id=packID(inst_id,face_id);
+    for(int y=y0;y<=y1;++y){
+        for(int x=x0;x<=x1;++x){
+            size_t i=size_t(y)*width_+x;
+            if(ids_[i]==packID(INVALID_ID,INVALID_ID))
+                continue;
+            float near=lo.z,far=hi.z;
+            if(!flat){
+                glm::vec2 corners[4]={glm::vec2(x,y),glm::vec2(x+1,y),glm::vec2(x,y+1),glm::vec2(x+1,y+1)};
+                // out of the pixel if all of its corners are outside of one edge
+                bool outside=false;
+                for(int k=0;k<3&&!outside;++k){
+                    glm::vec2 a(p[k]),edge=glm::vec2(p[(k+1)%3])-a;
+                    float inner=-srender::MAXFLOAT;
+                    for(auto& c:corners)
+                        inner=std::max(inner,orient*cross2(edge,c-a));
+                    outside=inner<-MARGIN*glm::length(edge);
+                }
+                if(outside)
+                    continue;
+                // the depth plane at the corners, within the depths of the triangle itself
+                float cmin=srender::MAXFLOAT,cmax=-srender::MAXFLOAT;
+                for(auto& c:corners){
+                    glm::vec2 q=c-glm::vec2(p[0]);
+                    float d=p[0].z+(cross2(q,e2)*(p[1].z-p[0].z)+cross2(e1,q)*(p[2].z-p[0].z))/area;
+                    cmin=std::min(cmin,d);
+                    cmax=std::max(cmax,d);
+                }
+                near=std::max(near,cmin);
+                far=std::min(far,cmax);
+            }
+            if(ids_[i]==id)
+                face_far_[i]=std::max(face_far_[i],far);
+            else
+                other_near_[i]=std::min(other_near_[i],near);
+        }
+    }
+}
+
+void PrimaryHitBuffer::resolveOcclusion(){
+    for(size_t i=0;i<ids_.size();++i){
+        if(!(face_far_[i]<other_near_[i]))
+            ids_[i]=packID(INVALID_ID,INVALID_ID);
+    }
+    std::vector<float>().swap(face_far_);
+    std::vector<float>().swap(other_near_);
+}
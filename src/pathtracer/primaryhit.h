@@ -0,0 +1,88 @@
+/* primary visibility rasterized from the camera of a film, used to skip the first traversal of camera rays */
+#pragma once
+#include"common/common_include.h"
+
+/**
+ * @brief the (instance, face) of the nearest triangle for each pixel of a film.
+ *        The scene is rasterized at the four corners and the center of every pixel. A pixel keeps its face only
+ *        when all of them agree: an edge or an intersection line crossing the pixel separates its corners, so
+ *        pixels around silhouettes and edges are left to ordinary tracing.
+ *        Five points can still miss a thin or small face in front, so the faces are then rasterized once more over
+ *        whole pixels(`addOverlap`): a pixel keeps its face only if all the others that overlap it lie behind it.
+ *        The view starts at the near plane, as the rasterizer's does.
+ *        Coordinates follow the film: x to the right, y downwards from the top-left pixel.
+ */
+class PrimaryHitBuffer{
+public:
+    static constexpr uint32_t INVALID_ID=0xffffffffu;
+    static constexpr int JITTER_NUM=5;
+
+    PrimaryHitBuffer(int width,int height):width_(width),height_(height){
+        for(auto& ids:jitter_ids_)
+            ids.assign(width*height,packID(INVALID_ID,INVALID_ID));
+    }
+
+    // sub-pixel offset of the k-th rasterization, the pixel corners then the center
+    static glm::vec2 getJitter(int k){
+        if(k==JITTER_NUM-1)
+            return glm::vec2(0.5f);
+        return glm::vec2(float(k&1),float(k>>1));
+    }
+
+    inline void setID(int k,int x,int y,uint32_t inst_id,uint32_t face_id){
+        jitter_ids_[k][y*width_+x]=packID(inst_id,face_id);
+    }
+
+    // merge the jittered rasterizations into one id per pixel, must be called once after all of them are written
+    void resolve(){
+        ids_.swap(jitter_ids_[0]);
+        for(size_t i=0;i<ids_.size();++i){
+            for(int k=1;k<JITTER_NUM;++k){
+                if(jitter_ids_[k][i]!=ids_[i]){
+                    ids_[i]=packID(INVALID_ID,INVALID_ID);
+                    break;
+                }
+            }
+        }
+        for(auto& ids:jitter_ids_)
+            std::vector<uint64_t>().swap(ids);
+        face_far_.assign(ids_.size(),-srender::MAXFLOAT);
+        other_near_.assign(ids_.size(),srender::MAXFLOAT);
+    }
+
+    /**
+     * @brief after `resolve`, a triangle of a face with its corners in film pixels and a depth of -1/w, which is
+     *        linear over the film. It counts for every pixel its square may overlap, with the depths it may take there.
+     */
+    void addOverlap(const glm::vec3 p[3],uint32_t inst_id,uint32_t face_id);
+
+    // after all the `addOverlap`, drop the face of a pixel where another one is not all behind it
+    void resolveOcclusion();
+
+    /**
+     * @brief get the face covering the whole pixel (x,y), return false if there is none or the pixel is not resolved
+     */
+    inline bool getFace(int x,int y,uint32_t& inst_id,uint32_t& face_id)const{
+        uint64_t id=ids_[y*width_+x];
+        inst_id=uint32_t(id>>32);
+        face_id=uint32_t(id);
+        return inst_id!=INVALID_ID;
+    }
+
+    inline int getWidth()const{ return width_; }
+    inline int getHeight()const{ return height_; }
+
+private:
+    static inline uint64_t packID(uint32_t inst_id,uint32_t face_id){
+        return (uint64_t(inst_id)<<32)|face_id;
+    }
+
+private:
+    int width_;
+    int height_;
+    std::vector<uint64_t> jitter_ids_[JITTER_NUM];
+    std::vector<uint64_t> ids_;
+    // per pixel: the farthest depth of its face, the nearest of the others
+    std::vector<float> face_far_;
+    std::vector<float> other_near_;
+};
@@ -0,0 +1,82 @@
+#include"radiancecache.h"
+#include"common/utils.h"
+
+namespace{
+
+// finalizer of splitmix64
+uint64_t mixKey(uint64_t x){
+    x^=x>>30;
+    x*=0xbf58476d1ce4e5b9ull;
+    x^=x>>27;
+    x*=0x94d049bb133111ebull;
+    return x^(x>>31);
+}
+
+}   // namespace
+
+RadianceCache::RadianceCache(const glm::vec3& camera_pos,float min_cell,float pixel_angle,uint32_t capacity)
+    :camera_pos_(camera_pos),min_cell_(min_cell),pixel_angle_(pixel_angle){
+    capacity_=MAX_PROBE;
+    while(capacity_<capacity&&capacity_<(1u<<31))
+        capacity_<<=1;
+    cells_.reset(new Cell[capacity_]);
+}
+
+/**
+ * @brief bit 0 is set so that no key is 0, then 4 bits of level, 9 of normal and 16 of each cell coordinate.
+ *        Coordinates wrap, cells 2^16 apart share their key.
+ */
+uint64_t RadianceCache::getKey(const glm::vec3& pos,const glm::vec3& normal)const{
+    float footprint=glm::length(pos-camera_pos_)*pixel_angle_*CELL_PIXELS;
+    int level=footprint>min_cell_?std::min((int)std::ceil(std::log2(footprint/min_cell_)),15):0;
+    float inv_cell=1.f/std::ldexp(min_cell_,level);
+
+    glm::ivec3 p(glm::floor(pos*inv_cell));
+    glm::ivec3 n=glm::ivec3(glm::round(normal*2.f))+2;   // [0,4] on each axis
+    uint64_t key=1|uint64_t(level)<<1|uint64_t(n.x|n.y<<3|n.z<<6)<<5;
+    for(int c=0;c<3;++c)
+        key|=uint64_t(uint16_t(p[c]))<<(14+16*c);
+    return key;
+}
+
+int32_t RadianceCache::findCell(const glm::vec3& pos,const glm::vec3& normal){
+    uint64_t key=getKey(pos,normal);
+    uint32_t slot=uint32_t(mixKey(key))&(capacity_-1);
+    for(int probe=0;probe<MAX_PROBE;++probe,slot=(slot+1)&(capacity_-1)){
+        uint64_t found=cells_[slot].key_.load(std::memory_order_relaxed);
+        if(found==0){
+            // claim it, unless another thread took it meanwhile
+            if(cells_[slot].key_.compare_exchange_strong(found,key,std::memory_order_relaxed)){
+                cell_num_.fetch_add(1,std::memory_order_relaxed);
+                return (int32_t)slot;
+            }
+        }
+        if(found==key)
+            return (int32_t)slot;
+    }
+    return -1;
+}
+
+bool RadianceCache::lookup(int32_t cell,glm::vec3& radiance)const{
+    if(cell<0)
+        return false;
+    const Cell& c=cells_[cell];
+    uint32_t count=c.count_.load(std::memory_order_relaxed);
+    if(count<MIN_SAMPLES)
+        return false;
+    // the sums may be a record ahead of the count, that is noise
+    for(int i=0;i<3;++i)
+        radiance[i]=c.sum_[i].load(std::memory_order_relaxed)/count;
+    return true;
+}
+
+void RadianceCache::record(int32_t cell,const glm::vec3& radiance){
+    if(cell<0)
+        return;
+    Cell& c=cells_[cell];
+    if(c.count_.load(std::memory_order_relaxed)>=MAX_SAMPLES)
+        return;
+    for(int i=0;i<3;++i)
+        utils::atomicAdd(c.sum_[i],radiance[i]);
+    c.count_.fetch_add(1,std::memory_order_relaxed);
+}
@@ -0,0 +1,53 @@
+/* radiance cache: the light reflected by diffuse surfaces, averaged over the paths that went by, in world space */
+#pragma once
+#include"common/common_include.h"
+#include<atomic>
+#include<memory>
+
+/**
+ * @brief a hash table of cells keyed by quantized position and normal. Cells grow with the distance from the camera
+ *        in powers of two(level of detail), so that a cell spans about `CELL_PIXELS` pixels of the image, and never
+ *        get smaller than `min_cell`. Each cell sums the outgoing radiance that paths recorded there.
+ *        Lock free: cells are claimed by a compare and swap of their key in a linear probe, and sums are atomic.
+ *        Nothing is ever removed, a full neighbourhood leaves the position uncached.
+ */
+class RadianceCache{
+public:
+    static constexpr int MAX_PROBE=16;
+    static constexpr float CELL_PIXELS=8.f;
+    // records of a cell before it is looked up, and after which it stops learning
+    static constexpr uint32_t MIN_SAMPLES=16;
+    static constexpr uint32_t MAX_SAMPLES=1u<<16;
+
+    /**
+     * @param min_cell smallest cell size, in world units
+     * @param pixel_angle size of a pixel at unit distance from the camera
+     * @param capacity cells of the table, rounded up to a power of two
+     */
+    RadianceCache(const glm::vec3& camera_pos,float min_cell,float pixel_angle,uint32_t capacity);
+
+    // the cell of a surface point, claimed if it is new; -1 if there is no room for it
+    int32_t findCell(const glm::vec3& pos,const glm::vec3& normal);
+
+    // the mean radiance of a cell, false if it has too few samples to be used
+    bool lookup(int32_t cell,glm::vec3& radiance)const;
+    void record(int32_t cell,const glm::vec3& radiance);
+
+    size_t getCellNum()const{ return cell_num_.load(std::memory_order_relaxed); }
+
+private:
+    struct Cell{
+        std::atomic<uint64_t> key_{0};      // 0 for a free cell
+        std::atomic<float> sum_[3]={{0.f},{0.f},{0.f}};
+        std::atomic<uint32_t> count_{0};
+    };
+
+    uint64_t getKey(const glm::vec3& pos,const glm::vec3& normal)const;
+
+    glm::vec3 camera_pos_;
+    float min_cell_;
+    float pixel_angle_;
+    uint32_t capacity_;
+    std::unique_ptr<Cell[]> cells_;
+    std::atomic<size_t> cell_num_{0};
+};
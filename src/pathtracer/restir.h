@@ -0,0 +1,94 @@
+/* resampled light sampling(ReSTIR DI): reservoirs of light samples, reused over pixels and passes */
+#pragma once
+#include"common/common_include.h"
+#include"emitter.h"
+
+/**
+ * @brief a light sample that any shading point can evaluate: a point on an emitter, or a direction toward the
+ *        environment map for a distant light
+ */
+struct LightPoint{
+    glm::vec3 pos_=glm::vec3(0.f);      // the direction for a distant light
+    glm::vec3 normal_=glm::vec3(0.f);
+    glm::vec3 radiance_=glm::vec3(0.f);
+    bool infinite_=false;
+
+    LightPoint(){}
+    explicit LightPoint(const LightSampleRecord& lsRec)
+        :normal_(lsRec.light_normal_),radiance_(lsRec.radiance_),infinite_(lsRec.infinite_){
+        pos_=infinite_?lsRec.shadow_ray_->dir_:lsRec.shadow_ray_->origin_+lsRec.shadow_ray_->dir_*lsRec.dist_;
+    }
+
+    /**
+     * @brief the light sample of `src_pos` toward it, but for its value and pdf which the resampling replaces.
+     *        The shadow ray stays nullptr if `src_pos` is the light point itself.
+     */
+    void connect(const glm::vec3& src_pos,LightSampleRecord& lsRec)const{
+        lsRec.infinite_=infinite_;
+        lsRec.radiance_=radiance_;
+        lsRec.light_normal_=normal_;
+        if(infinite_){
+            lsRec.shadow_ray_=std::make_shared<Ray>(src_pos,pos_);
+            lsRec.dist_=srender::MAXFLOAT;
+            return;
+        }
+        glm::vec3 dist_vec=pos_-src_pos;
+        lsRec.dist_=glm::length(dist_vec);
+        if(lsRec.dist_>srender::EPSILON)
+            lsRec.shadow_ray_=std::make_shared<Ray>(src_pos,dist_vec);
+    }
+};
+
+/**
+ * @brief weighted reservoir sampling over a stream of light samples(resampled importance sampling): it keeps one of
+ *        them with a probability proportional to its weight target/source pdf. The target is the luminance of the
+ *        unshadowed contribution at the shading point, over the area of the emitters(directions for distant lights),
+ *        so that a sample keeps its target at another shading point without a change of measure.
+ */
+struct LightReservoir{
+    LightPoint sample_;
+    float weight_sum_=0.f;
+    float target_=0.f;          // of `sample_` at the shading point
+    float M_=0.f;               // number of candidates seen
+    float W_=0.f;               // unbiased contribution weight of `sample_`, an estimate of 1/its pdf
+
+    // where the reservoir was made, to tell whether a neighbour may reuse it
+    glm::vec3 hit_normal_=glm::vec3(0.f);
+    float hit_depth_=0.f;       // distance from the camera, 0 if there is no reservoir
+
+    /**
+     * @brief see one more candidate of weight `weight`, `u` uniform in [0,1)
+     * @param M the candidates it stands for, more than one for a reservoir merged into this one
+     */
+    void update(const LightPoint& sample,float weight,float target,float M,float u){
+        weight_sum_+=weight;
+        M_+=M;
+        if(weight>0.f&&u*weight_sum_<weight){
+            sample_=sample;
+            target_=target;
+        }
+    }
+
+    // the contribution weight once all the candidates have been seen
+    void finalize(){
+        W_=target_>0.f&&M_>0.f?weight_sum_/(M_*target_):0.f;
+    }
+};
+
+/**
+ * @brief reuse of the first-hit reservoirs by the passes of a progressive film. The reservoirs of the last pass are
+ *        read only, the sample of a pixel merges those of its own pixel(temporal) and of a few neighbours(spatial)
+ *        into its new one, and writes it for the next pass.
+ */
+struct ReservoirReuse{
+    const LightReservoir* prev_=nullptr;    // of the last pass, row-major over the film; nullptr on the first pass
+    LightReservoir* cur_=nullptr;           // of this pixel in this pass
+    int width_=0;
+    int height_=0;
+    int x_=0;
+    int y_=0;
+
+    static constexpr int SPATIAL_NUM=3;     // neighbours merged
+    static constexpr float SPATIAL_RADIUS=16.f;    // in pixels
+    static constexpr float MAX_HISTORY=20.f;        // cap of the candidates of a reused reservoir, in those of one
+};
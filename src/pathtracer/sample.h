@@ -35,12 +35,18 @@ public:
     /**
      * @brief Get the Sample1 D object. If samples1D has enough samples, we simply fetch one. Otherwise, degenerate into pcg random number generator.
      */
-    float getSample1D();
+    virtual float getSample1D();
 
     /**
      * @brief Get the Sample2 D object. If samples2D has enough samples, we simply fetch one. Otherwise, degenerate into pcg random number generator.
      */
-    glm::vec2 getSample2D();
+    virtual glm::vec2 getSample2D();
+
+    /**
+     * @brief a uniform number for a choice that gains nothing from stratification(lobes, Russian Roulette).
+     *        A Metropolis sampler makes it a dimension of the path like the others.
+     */
+    virtual float getRandom1D(){ return pcgRNG_.nextFloat(); }
 
 
     PCGRandom pcgRNG_;
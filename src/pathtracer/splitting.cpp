@@ -0,0 +1,110 @@
+#include"splitting.h"
+#include"common/utils.h"
+
+void SplittingCache::Record::add(float value,float cost){
+    utils::atomicAdd(sum_,value);
+    utils::atomicAdd(sum_sq_,value*value);
+    utils::atomicAdd(cost_,cost);
+    count_.fetch_add(1,std::memory_order_relaxed);
+}
+
+SplittingCache::SplittingCache(const AABB3d& bound,int width,int height)
+    :blocks_x_((width+BLOCK_PIXELS-1)/BLOCK_PIXELS),blocks_y_((height+BLOCK_PIXELS-1)/BLOCK_PIXELS){
+    // a little larger than the scene, so that points on its faces are inside
+    glm::vec3 extent=glm::max(bound.max-bound.min,glm::vec3(srender::EPSILON));
+    glm::vec3 pad=0.01f*extent;
+    origin_=bound.min-pad;
+    inv_extent_=float(GRID_RES)/(extent+2.f*pad);
+
+    size_t cell_num=size_t(GRID_RES)*GRID_RES*GRID_RES;
+    size_t block_num=size_t(blocks_x_)*blocks_y_;
+    cell_records_.reset(new Record[cell_num]);
+    block_records_.reset(new Record[block_num]);
+    cells_.resize(cell_num);
+    blocks_.resize(block_num);
+}
+
+int32_t SplittingCache::findCell(const glm::vec3& pos)const{
+    glm::ivec3 p=glm::clamp(glm::ivec3(glm::floor((pos-origin_)*inv_extent_)),glm::ivec3(0),glm::ivec3(GRID_RES-1));
+    return (p.z*GRID_RES+p.y)*GRID_RES+p.x;
+}
+
+int32_t SplittingCache::findBlock(const glm::ivec2& pixel)const{
+    glm::ivec2 b=pixel/BLOCK_PIXELS;
+    if(pixel.x<0||pixel.y<0||b.x>=blocks_x_||b.y>=blocks_y_)
+        return -1;
+    return b.y*blocks_x_+b.x;
+}
+
+float SplittingCache::getSplitFactor(int32_t cell,int32_t block,float throughput)const{
+    if(cell<0||block<0)
+        return -1.f;
+    const Estimate& hit=cells_[cell];
+    const Estimate& pixel=blocks_[block];
+    if(!hit.valid_||!pixel.valid_||image_variance_<=0.f)
+        return -1.f;
+    // the hit adds about (T/I)^2*M2/q to the relative variance of its pixel of value I with Russian Roulette,
+    // (T/I)^2*Var/q with splitting, and q*C(x) to the cost; the product of the variance and the cost of the image
+    // is the least for the q below, the rest of the image being what it was
+    float weight=throughput/std::sqrt(pixel.mean_*pixel.mean_+image_epsilon_);
+    float cost_ratio=image_cost_/(image_variance_*hit.cost_);
+    float q=weight*std::sqrt(hit.second_moment_*cost_ratio);
+    if(q>1.f)
+        q=std::max(weight*std::sqrt(hit.variance_*cost_ratio),1.f);
+    if(!std::isfinite(q))
+        return -1.f;
+    return std::clamp(q,MIN_FACTOR,MAX_FACTOR);
+}
+
+void SplittingCache::recordHit(int32_t cell,float radiance,float cost){
+    if(cell>=0&&std::isfinite(radiance))
+        cell_records_[cell].add(radiance,cost);
+}
+
+void SplittingCache::recordPixel(int32_t block,float radiance,float cost){
+    if(block>=0&&std::isfinite(radiance))
+        block_records_[block].add(radiance,cost);
+}
+
+void SplittingCache::Estimate::merge(Record& r){
+    uint32_t count=r.count_.exchange(0,std::memory_order_relaxed);
+    sum_+=r.sum_.exchange(0.f,std::memory_order_relaxed);
+    sum_sq_+=r.sum_sq_.exchange(0.f,std::memory_order_relaxed);
+    cost_sum_+=r.cost_.exchange(0.f,std::memory_order_relaxed);
+    count_+=count;
+    if(count_<MIN_SAMPLES)
+        return;
+    double mean=sum_/count_;
+    mean_=float(mean);
+    second_moment_=float(sum_sq_/count_);
+    variance_=float(std::max(sum_sq_/count_-mean*mean,0.));
+    cost_=float(cost_sum_/count_);
+    valid_=cost_>0.f;
+}
+
+void SplittingCache::update(){
+    for(size_t i=0;i<cells_.size();++i){
+        cells_[i].merge(cell_records_[i]);
+        // a cell that has seen no light yet may just not have been lucky, it keeps the usual Russian Roulette
+        cells_[i].valid_=cells_[i].valid_&&cells_[i].second_moment_>0.f;
+    }
+    // the relative variance and the cost of a sample of the image, averaged over its pixel samples
+    double sum=0.,cost=0.;
+    uint64_t count=0;
+    for(size_t i=0;i<blocks_.size();++i){
+        blocks_[i].merge(block_records_[i]);
+        sum+=blocks_[i].sum_;
+        cost+=blocks_[i].cost_sum_;
+        count+=blocks_[i].count_;
+    }
+    if(count==0)
+        return;
+    image_epsilon_=float(std::pow(EPSILON_FRACTION*sum/count,2.));
+    double variance=0.;
+    for(const Estimate& b:blocks_){
+        if(b.count_>0)
+            variance+=b.count_*(b.sum_sq_/b.count_-std::pow(b.sum_/b.count_,2.))/(std::pow(b.sum_/b.count_,2.)+image_epsilon_);
+    }
+    image_variance_=float(variance/count);
+    image_cost_=float(cost/count);
+}
@@ -0,0 +1,94 @@
+/* efficiency-aware Russian Roulette and splitting(after EARS, Rath et al.): learned statistics of the paths */
+#pragma once
+#include"common/common_include.h"
+#include"common/AABB.h"
+#include<atomic>
+#include<memory>
+
+/**
+ * @brief what the paths of the passes so far tell about the efficiency of tracing on: a coarse grid over the scene
+ *        with the moments and the cost(rays) of the estimates of the radiance reflected at its hits, and a coarse
+ *        grid over the film with the mean and the variance of the pixel samples, which make the relative variance V
+ *        and the cost C of a sample of the image.
+ *        A path of throughput T reaching a hit x of a pixel of value I goes on with `getSplitFactor`
+ *        q = T/I*sqrt(M2(x)*C/(V*C(x))) branches, which minimizes the relative variance times the time of the image:
+ *        q<1 is Russian Roulette, q>1 splitting, where the variance of x replaces its second moment M2 since its mean
+ *        is gathered by one branch as well as by several.
+ *        Paths record into running sums with atomics, on any thread; the factors are read from the estimates of the
+ *        last `update`, which stay the same over a pass so that the factors only depend on the path.
+ */
+class SplittingCache{
+public:
+    static constexpr int GRID_RES=32;           // cells along each axis of the scene
+    static constexpr int BLOCK_PIXELS=8;        // film pixels along each side of a block
+    static constexpr uint32_t MIN_SAMPLES=16;   // records of a cell or a block before its estimate is used
+    // range of the factors: the least survival probability and the most branches at a hit. The second moments miss
+    // the rare bright paths a while, the survivors of a lower probability would make fireflies of them
+    static constexpr float MIN_FACTOR=0.2f;
+    static constexpr float MAX_FACTOR=4.f;
+    // of the mean of the image, added to the value of the pixels so that dark ones do not need all the samples
+    static constexpr float EPSILON_FRACTION=0.1f;
+
+    SplittingCache(const AABB3d& bound,int width,int height);
+
+    // the cell of a point of the scene
+    int32_t findCell(const glm::vec3& pos)const;
+    // the block of a film pixel, -1 if it is off the film
+    int32_t findBlock(const glm::ivec2& pixel)const;
+
+    /**
+     * @brief the expected number of branches of a path of throughput `throughput`(luminance) at a hit of `cell`, for
+     *        the pixel block `block`; <0 if either has not learned enough, Russian Roulette has to do without
+     */
+    float getSplitFactor(int32_t cell,int32_t block,float throughput)const;
+
+    // an estimate of the radiance reflected at a hit of `cell`(luminance), which took `cost` rays
+    void recordHit(int32_t cell,float radiance,float cost);
+    // a pixel sample of `block`, which took `cost` rays
+    void recordPixel(int32_t block,float radiance,float cost);
+
+    // the estimates of all the records so far: single threaded, no path may be traced meanwhile
+    void update();
+
+private:
+    // the records of a pass
+    struct Record{
+        std::atomic<float> sum_{0.f};
+        std::atomic<float> sum_sq_{0.f};
+        std::atomic<float> cost_{0.f};
+        std::atomic<uint32_t> count_{0};
+
+        void add(float value,float cost);
+    };
+    // the records of all the passes, and what they tell
+    struct Estimate{
+        double sum_=0.;
+        double sum_sq_=0.;
+        double cost_sum_=0.;
+        uint64_t count_=0;
+
+        float mean_=0.f;
+        float second_moment_=0.f;
+        float variance_=0.f;
+        float cost_=0.f;
+        bool valid_=false;
+
+        // add the records of the pass, which start over
+        void merge(Record& r);
+    };
+
+    glm::vec3 origin_;
+    glm::vec3 inv_extent_;
+    int blocks_x_;
+    int blocks_y_;
+
+    std::unique_ptr<Record[]> cell_records_;
+    std::unique_ptr<Record[]> block_records_;
+    std::vector<Estimate> cells_;
+    std::vector<Estimate> blocks_;
+
+    // of a sample of the image: relative variance, cost, and the square of the value added to that of its pixels
+    float image_variance_=0.f;
+    float image_cost_=0.f;
+    float image_epsilon_=0.f;
+};
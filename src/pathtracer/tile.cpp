@@ -1,39 +1,45 @@
 #include"tile.h"
 #include"film.h"
+#include"common/profiler.h"
+#include<chrono>
 
 
 void Tile::render(){
+    PROFILE_ZONE("Render Tile");
 
     info_.avg_length=0;
+    info_.raster_hit_num=0;
 
+    // float channels, the guides of the denoiser among them; nothing but this test if none is requested
+    AOVBuffer& aovs=film_->aovs_;
+    bool keep_aov=aovs.getMask()!=AOVType::None;
+    bool need_hit=aovs.has(AOVType::InstanceId|AOVType::PrimitiveId);
+    bool need_time=aovs.has(AOVType::Time);
     for(int j=0;j<pixels_num_.y;++j){
         for(int i=0;i<pixels_num_.x;++i){
-            glm::vec3 color(0);
-            sampler_->startPixle();
-            for(int s=0;s<setting_.spp_;++s){
-                // generate a ray
-                glm::vec2 offset=sampler_->getSample2D();
-                glm::vec3 origin=film_->camera_pos_;
-                glm::vec3 sample_pos=up_lt_pos_+float(i+offset.x)*film_->deltaX_+float(j+offset.y)*film_->deltaY_;
-                glm::vec3 direction=sample_pos-origin;
-                float startT=srender::EPSILON;
-                float endT=srender::MAXFLOAT;
-
-                Ray ray(origin,direction,startT,endT);
-                // trace the ray and get its color
-                PathTraceRecord pRec(*scene_,*sampler_,setting_.light_split_);
-                color+=tracer_->Li(ray,pRec);
-                info_.avg_length+=pRec.curdepth;
-                
-                // move on to the next image sample.
-                sampler_->nextPixleSample();
-
+            if(!keep_aov){
+                setPixel(i,j,glm::vec4(samplePixel(i,j),1.0));
+                continue;
             }
 
-            // set color to buffer
-            color=(float)(1.0/setting_.spp_)*color;
+            auto start=need_time?std::chrono::steady_clock::now():std::chrono::steady_clock::time_point();
+            FirstHitAOV aov;
+            std::shared_ptr<IntersectRecord> first_hit;
+            glm::vec3 color=samplePixel(i,j,need_hit?&first_hit:nullptr,&aov);
             setPixel(i,j,glm::vec4(color,1.0));
 
+            size_t idx=size_t(first_pixel_offset_.y+j)*film_->resolution_.x+first_pixel_offset_.x+i;
+            aovs.set(AOVType::Color,idx,color);
+            aovs.set(AOVType::Direct,idx,aov.direct);
+            aovs.set(AOVType::Indirect,idx,color-aov.direct);
+            aovs.set(AOVType::Albedo,idx,aov.albedo);
+            aovs.set(AOVType::Normal,idx,aov.normal);
+            aovs.set(AOVType::Depth,idx,aov.depth);
+            aovs.set(AOVType::InstanceId,idx,first_hit?(float)first_hit->instance_idx_:-1.f);
+            aovs.set(AOVType::PrimitiveId,idx,first_hit?(float)first_hit->primitive_idx_:-1.f);
+            aovs.set(AOVType::SampleCount,idx,(float)setting_.spp_);
+            if(need_time)
+                aovs.set(AOVType::Time,idx,std::chrono::duration<float,std::micro>(std::chrono::steady_clock::now()-start).count());
         }
     }
 
@@ -42,6 +48,109 @@ void Tile::render(){
 
 }
 
+bool Tile::renderPass(const std::atomic<bool>& cancel){
+    PROFILE_ZONE("Render Tile Pass");
+
+    // the light reservoirs of the first hits, written to those of this pass and reused by the next one
+    ReservoirReuse reuse;
+    uint32_t pass=film_->pass_num_;
+    bool reuse_lights=!film_->reservoirs_[0].empty();
+    if(reuse_lights){
+        reuse.prev_=pass>0?film_->reservoirs_[(pass+1)&1].data():nullptr;
+        reuse.width_=film_->resolution_.x;
+        reuse.height_=film_->resolution_.y;
+    }
+
+    for(int j=0;j<pixels_num_.y;++j){
+        if(cancel.load(std::memory_order_relaxed))
+            return false;
+
+        for(int i=0;i<pixels_num_.x;++i){
+            int idx=(first_pixel_offset_.y+j)*film_->resolution_.x+first_pixel_offset_.x+i;
+            if(reuse_lights){
+                reuse.x_=first_pixel_offset_.x+i;
+                reuse.y_=first_pixel_offset_.y+j;
+                reuse.cur_=&film_->reservoirs_[pass&1][idx];
+                *reuse.cur_=LightReservoir();
+            }
+            std::shared_ptr<IntersectRecord> first_hit;
+            glm::vec3 color=samplePixel(i,j,&first_hit,nullptr,reuse_lights?&reuse:nullptr);
+            film_->recordFirstHit(idx,first_hit.get());
+
+            // each sample weighs 1, a reprojected history weighs the samples it was made of
+            glm::vec4& acc=film_->accum_[idx];
+            acc+=glm::vec4(color,1.f);
+            setPixel(i,j,glm::vec4(glm::vec3(acc)/acc.a,1.0));
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief trace `spp_` camera rays through the pixel (i,j) of this tile and return their average radiance.
+ * @param first_hit if not null, gets the first hit of the first camera ray(nullptr if it missed)
+ * @param aov if not null, gets the first-hit guides averaged over the samples
+ * @param reuse if not null, the first-hit light reservoirs of the pixel for resampled light sampling
+ */
+glm::vec3 Tile::samplePixel(int i,int j,std::shared_ptr<IntersectRecord>* first_hit,FirstHitAOV* aov,
+                            ReservoirReuse* reuse){
+    const PrimaryHitBuffer* primary_hits=film_->primary_hits_.get();
+    auto& tlas=scene_->getConstTLAS();
+
+    glm::vec3 color(0);
+    // a sum starts from a zero albedo, not the white one of a miss
+    FirstHitAOV aov_sum{glm::vec3(0.f)};
+    sampler_->startPixle();
+
+    // the face covering this whole pixel, if the rasterizer knows it
+    uint32_t inst_id,face_id;
+    bool known_face=primary_hits&&primary_hits->getFace(first_pixel_offset_.x+i,first_pixel_offset_.y+j,inst_id,face_id);
+    // with the rasterized hits the view starts at the near plane, where the rasterizer clips
+    const float near=primary_hits?glm::dot(film_->up_lt_pos_-film_->camera_pos_,film_->camera_front_):0.f;
+
+    for(int s=0;s<setting_.spp_;++s){
+        // generate a ray
+        glm::vec2 offset=sampler_->getSample2D();
+        glm::vec3 origin=film_->camera_pos_;
+        glm::vec3 sample_pos=up_lt_pos_+float(i+offset.x)*film_->deltaX_+float(j+offset.y)*film_->deltaY_;
+        glm::vec3 direction=sample_pos-origin;
+        float startT=srender::EPSILON;
+        float endT=srender::MAXFLOAT;
+        if(primary_hits)
+            startT=std::max(startT,near/glm::dot(glm::normalize(direction),film_->camera_front_));
+
+        Ray ray(origin,direction,startT,endT);
+        // trace the ray and get its color
+        PathTraceRecord pRec(*scene_,*sampler_,setting_.light_split_);
+        pRec.reuse=reuse;
+        pRec.pixel=glm::ivec2(first_pixel_offset_.x+i,first_pixel_offset_.y+j);
+        if(known_face){
+            // a single ray-triangle test instead of a traversal; if the sample falls outside
+            // of the face after all, the tracer traverses as usual.
+            auto hit=std::make_shared<IntersectRecord>();
+            if(tlas.traceRayInFace(ray,inst_id,face_id,*hit)){
+                pRec.primary_hit=hit;
+                ++info_.raster_hit_num;
+            }
+        }
+        color+=tracer_->Li(ray,pRec);
+        info_.avg_length+=pRec.curdepth;
+        if(first_hit&&s==0)
+            *first_hit=pRec.primary_hit;
+        if(aov)
+            aov_sum+=pRec.aov;
+        
+        // move on to the next image sample.
+        sampler_->nextPixleSample();
+
+    }
+    if(aov){
+        aov_sum*=1.f/setting_.spp_;
+        *aov=aov_sum;
+    }
+    return (float)(1.0/setting_.spp_)*color;
+}
+
 /**
  * @brief implement post color process and write the device rgb color to buffer
  * 
@@ -62,8 +171,14 @@ void Tile::setPixel(const uint32_t x,const uint32_t y,const glm::vec4& linear_co
     int offset_y=first_pixel_offset_.y+y;
 
     // Since the origin of color_buffer is bottom-left and that of film is top-left,
-    // a simple transformation is going on here
-    shared_buffer_->setPixel(offset_x,film_->resolution_.y-1-offset_y,glm::vec4(gammacolor,255.f));
+    // a simple transformation is going on here. A coarse film fills a block of pixels.
+    int s=film_->pixel_scale_;
+    int width=film_->image_size_.x;
+    int height=film_->image_size_.y;
+    for(int by=offset_y*s;by<std::min((offset_y+1)*s,height);++by){
+        for(int bx=offset_x*s;bx<std::min((offset_x+1)*s,width);++bx)
+            shared_buffer_->setPixel(bx,height-1-by,glm::vec4(gammacolor,255.f));
+    }
 
     // check thread safty when necessary
 #ifdef THREAD_SAFTY_CHECK
@@ -5,11 +5,13 @@
 #include"sample.h"
 #include"pathtracer.h"
 #include"buffer.h"
+#include<atomic>
 
 class Film;
 
 struct TileInfo{
     uint32_t avg_length=0;
+    uint32_t raster_hit_num=0;  // camera rays whose first hit came from the rasterized primary visibility
 };
 
 class Tile{
@@ -25,6 +27,10 @@ public:
         }
 
     void render();
+    // one progressive pass of the film, returns false if cancelled
+    bool renderPass(const std::atomic<bool>& cancel);
+    glm::vec3 samplePixel(int i,int j,std::shared_ptr<IntersectRecord>* first_hit=nullptr,FirstHitAOV* aov=nullptr,
+                          ReservoirReuse* reuse=nullptr);
     void setPixel(const uint32_t x,const uint32_t y,const glm::vec4& linear_color);
 
 
@@ -118,6 +118,10 @@ public:
         return true;
     }
 
+    // raw row-major depth values, used by rasterizers that test a whole row of pixels at once
+    inline float* getData(){ return zbuffer_.data(); }
+    inline int getWidth()const{ return width_; }
+
     inline float getDepth(int x,int y){
         int idx=y*width_+x;
         if(x<0||y<0||x>width_-1||y>height_-1){
@@ -135,4 +139,46 @@ private:
 
     friend class HZbuffer;
 };
+
+/**
+ * @brief (instance id, triangle id) of the nearest triangle for each pixel, written by the raster pass of
+ *        the visibility-buffer pipeline so that shading can run once per pixel afterwards.
+ *        The triangle id indexes the clipped vertex buffer of the instance: vertices [3*id,3*id+3).
+ */
+class VisibilityBuffer{
+public:
+    static constexpr uint32_t INVALID_ID=0xffffffffu;
+
+    VisibilityBuffer(int width,int height){
+        reSetBuffer(width,height);
+    }
+    inline void reSetBuffer(int width,int height){
+        width_=width;
+        height_=height;
+        inst_ids_.assign(width*height,INVALID_ID);
+        tri_ids_.assign(width*height,INVALID_ID);
+    }
+
+    void clear(){
+        std::fill(inst_ids_.begin(),inst_ids_.end(),INVALID_ID);
+    }
+
+    // the caller has passed the depth test on (x,y), which is inside the screen
+    inline void setID(int x,int y,uint32_t inst_id,uint32_t tri_id){
+        int idx=y*width_+x;
+        inst_ids_[idx]=inst_id;
+        tri_ids_[idx]=tri_id;
+    }
+    inline uint32_t getInstID(int x,int y)const{ return inst_ids_[y*width_+x]; }
+    inline uint32_t getTriID(int x,int y)const{ return tri_ids_[y*width_+x]; }
+
+    inline int getWidth()const{ return width_; }
+    inline int getHeight()const{ return height_; }
+
+private:
+    int width_;
+    int height_;
+    std::vector<uint32_t> inst_ids_;
+    std::vector<uint32_t> tri_ids_;
+};
  
\ No newline at end of file
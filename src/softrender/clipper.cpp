@@ -1,4 +1,5 @@
 #include"render.h"
+#include<chrono>
 
 namespace ClipTools{
 // Defines a bit flag for the clipping plane
@@ -11,28 +12,30 @@ enum ClipPlaneBit {
     CLIP_FAR    = 1 << 5  // 100000
 };
 
-int computeOutcode(const glm::vec4& pos) {
+// `guard` scales the side planes: 1 is the viewport, srender::GUARD_BAND the guard band
+int computeOutcode(const glm::vec4& pos,float guard=1.0f) {
     int outcode = 0;
-    if (pos.x < -pos.w) outcode |= CLIP_LEFT;
-    if (pos.x > pos.w)  outcode |= CLIP_RIGHT;
-    if (pos.y < -pos.w) outcode |= CLIP_BOTTOM;
-    if (pos.y > pos.w)  outcode |= CLIP_TOP;
+    float gw = guard * pos.w;
+    if (pos.x < -gw) outcode |= CLIP_LEFT;
+    if (pos.x > gw)  outcode |= CLIP_RIGHT;
+    if (pos.y < -gw) outcode |= CLIP_BOTTOM;
+    if (pos.y > gw)  outcode |= CLIP_TOP;
     if (pos.z < -pos.w) outcode |= CLIP_NEAR;
     if (pos.z > pos.w)  outcode |= CLIP_FAR;
     return outcode;
 }
 
-bool isInside(const Vertex& vertex, ClipPlane plane) {
+bool isInside(const Vertex& vertex, ClipPlane plane,float guard=1.0f) {
     const glm::vec4& pos = vertex.c_pos_;
     switch (plane) {
         case ClipPlane::Left:
-            return pos.x >= -pos.w;
+            return pos.x >= -guard * pos.w;
         case ClipPlane::Right:
-            return pos.x <= pos.w;
+            return pos.x <= guard * pos.w;
         case ClipPlane::Bottom:
-            return pos.y >= -pos.w;
+            return pos.y >= -guard * pos.w;
         case ClipPlane::Top:
-            return pos.y <= pos.w;
+            return pos.y <= guard * pos.w;
         case ClipPlane::Near:
             return pos.z >= -pos.w;
         case ClipPlane::Far:
@@ -42,20 +45,20 @@ bool isInside(const Vertex& vertex, ClipPlane plane) {
     }
 }
 
-bool computeIntersection(const Vertex& v1, const Vertex& v2,Vertex& v3, ClipPlane plane) {
+bool computeIntersection(const Vertex& v1, const Vertex& v2,Vertex& v3, ClipPlane plane,float guard=1.0f) {
     float A, B, C, D;
     switch (plane) {
         case ClipPlane::Left:
-            A = 1.0f; B = 0.0f; C = 0.0f; D = 1.0f;
+            A = 1.0f; B = 0.0f; C = 0.0f; D = guard;
             break;
         case ClipPlane::Right:
-            A = -1.0f; B = 0.0f; C = 0.0f; D = 1.0f;
+            A = -1.0f; B = 0.0f; C = 0.0f; D = guard;
             break;
         case ClipPlane::Bottom:
-            A = 0.0f; B = 1.0f; C = 0.0f; D = 1.0f;
+            A = 0.0f; B = 1.0f; C = 0.0f; D = guard;
             break;
         case ClipPlane::Top:
-            A = 0.0f; B = -1.0f; C = 0.0f; D = 1.0f;
+            A = 0.0f; B = -1.0f; C = 0.0f; D = guard;
             break;
         case ClipPlane::Near:
             A = 0.0f; B = 0.0f; C = 1.0f; D = 1.0f;
@@ -85,7 +88,7 @@ bool computeIntersection(const Vertex& v1, const Vertex& v2,Vertex& v3, ClipPlan
 }
 
 
-void Render::clipWithPlane(ClipPlane plane, std::vector<Vertex>& in, std::vector<Vertex>& out) {
+void Render::clipWithPlane(ClipPlane plane, std::vector<Vertex>& in, std::vector<Vertex>& out, float guard) {
     if (in.empty()) return;
 
     std::vector<Vertex> result;
@@ -96,8 +99,8 @@ void Render::clipWithPlane(ClipPlane plane, std::vector<Vertex>& in, std::vector
         const Vertex& current = in[i];
         const Vertex& nextPos = in[next];
 
-        bool currentInside = ClipTools::isInside(current, plane);
-        bool nextInside = ClipTools::isInside(nextPos, plane);
+        bool currentInside = ClipTools::isInside(current, plane, guard);
+        bool nextInside = ClipTools::isInside(nextPos, plane, guard);
 
         if (currentInside && nextInside) {
             // Case 1: Both inside
@@ -106,13 +109,13 @@ void Render::clipWithPlane(ClipPlane plane, std::vector<Vertex>& in, std::vector
         else if (currentInside && !nextInside) {
             // Case 2: Current inside, next outside
             Vertex intersectVertex;
-            bool flag=ClipTools::computeIntersection(current, nextPos,intersectVertex,plane);
+            bool flag=ClipTools::computeIntersection(current, nextPos,intersectVertex,plane,guard);
             if(flag) result.push_back(intersectVertex);
         }
         else if (!currentInside && nextInside) {
             // Case 3: Current outside, next inside
             Vertex intersectVertex;
-            bool flag=ClipTools::computeIntersection(current, nextPos, intersectVertex,plane);
+            bool flag=ClipTools::computeIntersection(current, nextPos, intersectVertex,plane,guard);
             if(flag) result.push_back(intersectVertex);
             result.push_back(nextPos);
         }
@@ -184,38 +187,46 @@ int Render::pipelineClipping(std::vector<Vertex>& vertices, std::vector<Vertex>&
     return out.size() / 3;
 }
 
+// Guard-band clipping scissors instead of clipping, which needs a rasterizer that walks a scissored
+// bounding box. The scan-line converter indexes its edge table by screen row and wireframes are drawn
+// with unclipped lines, so both keep full geometric clipping.
+bool Render::useGuardBand() const {
+    const auto& setting=info_.raster_setting_;
+    return setting.guard_band && setting.rasterize_type!=RasterizeType::Scan_convert && setting.shader_type!=ShaderType::Frame;
+}
+
 // in screen space
 bool Render::backCulling(const glm::vec3& face_norm,const glm::vec3& dir) const {
     return glm::dot(dir,face_norm) <= 0;
 }
 
-// backculling and frustrum culling
-void Render::cullingTriangleInstance(ASInstance& instance,const glm::mat4 normal_mat){
-    instance.refreshVertices();
-    info_.profile_.total_face_num_+=instance.blas_->object_->getFaceNum();
-
+// backculling and frustrum culling for the faces [chunk.face_begin_,chunk.face_end_).
+// Outputs go to the chunk only, so disjoint ranges can be culled in parallel.
+void Render::cullingTriangleRange(const ASInstance& instance,const glm::mat4& normal_mat,CullingChunk& chunk){
+    PROFILE_ZONE("Culling Range");
     auto& obj=instance.blas_->object_;
     const std::vector<Vertex>& in_vertices=obj->getconstVertices();
     const std::vector<uint32_t>& in_indices=obj->getIndices();
-    std::vector<glm::vec3>& objfacenorms=obj->getFaceNorms();
+    const std::vector<glm::vec3>& objfacenorms=obj->getFaceNorms();
     const std::vector<int>& in_mtlidx=obj->getMtlIdx();
 
-    std::vector<Vertex>& out_vertices=*instance.vertices_;
-     std::vector<PrimitiveHolder>& out_primitives_buffer=*instance.primitives_buffer_;
-
-    uint32_t ver_num=in_vertices.size();
-    uint32_t idx_num=in_indices.size();
-    uint32_t face_num=in_mtlidx.size();
-    uint32_t primitive_num=instance.blas_->primitives_indices_->size();
+    std::vector<Vertex>& out_vertices=chunk.vertices_;
+    std::vector<PrimitiveHolder>& out_primitives_buffer=chunk.primitives_;
+    PerfCnt& profile=chunk.profile_;
+    out_vertices.clear();
+    out_primitives_buffer.clear();
+    profile.clear();
 
     // reserve some space
-    out_vertices.reserve(ver_num+100);
-    out_primitives_buffer.reserve(primitive_num+10);
+    out_vertices.reserve(3*(chunk.face_end_-chunk.face_begin_)+100);
+    out_primitives_buffer.reserve(chunk.face_end_-chunk.face_begin_);
 
-    assert(idx_num%3==0&&idx_num/3==primitive_num);
+    const bool do_back_culling=info_.raster_setting_.back_culling&&obj->isBackCulling();
+    const bool guard_band=useGuardBand();
+    const glm::vec3 camera_pos=camera_.getPosition();
 
     // define clipping order
-    std::vector<ClipPlane> planes = {
+    const ClipPlane planes[] = {
         ClipPlane::Left,
         ClipPlane::Right,
         ClipPlane::Bottom,
@@ -224,10 +235,10 @@ void Render::cullingTriangleInstance(ASInstance& instance,const glm::mat4 normal
         ClipPlane::Far
     };
 
-
-    for(int indices_offset=0;indices_offset<idx_num;indices_offset+=3){
+    std::vector<Vertex> input,temp;
+    for(uint32_t face_cnt=chunk.face_begin_;face_cnt<chunk.face_end_;++face_cnt){
     // clipping each triangle.
-        int face_cnt=indices_offset/3;
+        uint32_t indices_offset=face_cnt*3;
 
         uint32_t idx1=in_indices[indices_offset+0];
         uint32_t idx2=in_indices[indices_offset+1];
@@ -238,12 +249,12 @@ void Render::cullingTriangleInstance(ASInstance& instance,const glm::mat4 normal
         auto& v3=in_vertices[idx3];
 
         /* ---------------- back culling ---------------- */
-        if(info_.raster_setting_.back_culling&&obj->isBackCulling()){
+        if(do_back_culling){
 
             glm::vec3 norm=normal_mat*glm::vec4(objfacenorms[face_cnt],0.f);
-            glm::vec3 dir=camera_.getPosition()-v1.w_pos_;
+            glm::vec3 dir=camera_pos-v1.w_pos_;
             if(backCulling(norm,dir)==true){
-                ++info_.profile_.back_culled_face_num_;
+                ++profile.back_culled_face_num_;
                 out_primitives_buffer.emplace_back(ClipFlag::refused,
                                                 -1,// mtlidx_
                                                 0, // vertex_start_pos_
@@ -263,7 +274,7 @@ void Render::cullingTriangleInstance(ASInstance& instance,const glm::mat4 normal
 
         // rapid reject
         if (outcode_AND != 0) {
-            ++info_.profile_.clipped_face_num_;
+            ++profile.clipped_face_num_;
             out_primitives_buffer.emplace_back(ClipFlag::refused,
                                                 -1,// mtlidx_
                                                 0, // vertex_start_pos_
@@ -275,7 +286,7 @@ void Render::cullingTriangleInstance(ASInstance& instance,const glm::mat4 normal
         if (outcode_OR == 0) {
             out_primitives_buffer.emplace_back(ClipFlag::accecpted,
                                                 in_mtlidx[face_cnt], // mtlidx_
-                                                out_vertices.size(), // vertex_start_pos_
+                                                out_vertices.size(), // vertex_start_pos_, relative to the chunk
                                                 3);                  // vertex_num_
             out_vertices.emplace_back(v1);
             out_vertices.emplace_back(v2);
@@ -284,23 +295,54 @@ void Render::cullingTriangleInstance(ASInstance& instance,const glm::mat4 normal
             continue;
         }
 
-        std::vector<Vertex> input{v1,v2,v3};
-        std::vector<Vertex> temp;
+        // only the planes crossed by the triangle need clipping
+        int clip_mask = outcode_OR;
+        float guard = 1.0f;
+        if (guard_band) {
+            int guard_OR = ClipTools::computeOutcode(v1.c_pos_, srender::GUARD_BAND)
+                         | ClipTools::computeOutcode(v2.c_pos_, srender::GUARD_BAND)
+                         | ClipTools::computeOutcode(v3.c_pos_, srender::GUARD_BAND);
+            // fragments behind the far plane fail the depth test(the buffers are cleared to FAR_Z),
+            // fragments outside the viewport are dropped by the scissor box of the rasterizer.
+            guard_OR &= ~ClipTools::CLIP_FAR;
+            if (guard_OR == 0) {
+                ++profile.guard_band_face_num_;
+                out_primitives_buffer.emplace_back(ClipFlag::accecpted,
+                                                    in_mtlidx[face_cnt], // mtlidx_
+                                                    out_vertices.size(), // vertex_start_pos_, relative to the chunk
+                                                    3);                  // vertex_num_
+                out_vertices.emplace_back(v1);
+                out_vertices.emplace_back(v2);
+                out_vertices.emplace_back(v3);
+                continue;
+            }
+            // crossing the near plane or leaving the guard band: clip, but against the guard band
+            clip_mask = guard_OR;
+            guard = srender::GUARD_BAND;
+        }
+
+        ++profile.geometric_clip_num_;
+        auto clip_begin=std::chrono::steady_clock::now();
+
+        input.assign({v1,v2,v3});
 
         bool clipflag=false;
-        for (const auto& plane : planes) {// TODO: use mask to reduce unneccessary clipping
+        for (const auto& plane : planes) {
+            if (!(clip_mask & (1 << (int)plane)))
+                continue;
             temp.clear();
-            clipWithPlane(plane, input, temp);
-            input = std::move(temp);
+            clipWithPlane(plane, input, temp, guard);
+            std::swap(input,temp);
 
             if (input.empty()) {
                 clipflag=true;
                 break;
             }
         }
+        profile.clip_time_us_+=std::chrono::duration<double,std::micro>(std::chrono::steady_clock::now()-clip_begin).count();
         // totally clipped out
         if(clipflag){
-            ++info_.profile_.clipped_face_num_;
+            ++profile.clipped_face_num_;
             out_primitives_buffer.emplace_back(ClipFlag::refused,
                                             -1,// mtlidx_
                                             0, // vertex_start_pos_
@@ -310,7 +352,7 @@ void Render::cullingTriangleInstance(ASInstance& instance,const glm::mat4 normal
 
         int vnum = input.size();
         if (vnum < 3){
-             ++info_.profile_.clipped_face_num_;
+             ++profile.clipped_face_num_;
             out_primitives_buffer.emplace_back(ClipFlag::refused,
                                                 -1,// mtlidx_
                                                 0, // vertex_start_pos_
@@ -325,16 +367,65 @@ void Render::cullingTriangleInstance(ASInstance& instance,const glm::mat4 normal
             out_vertices.emplace_back(input[i]);
             out_vertices.emplace_back(input[i + 1]);
         }
-        info_.profile_.total_face_num_+=vnum-3;
+        profile.total_face_num_+=vnum-3;
         out_primitives_buffer.emplace_back(ClipFlag::clipped,
                                             in_mtlidx[face_cnt], // mtlidx_
                                             vertex_start_pos,    // vertex_start_pos_
                                             3*(vnum-2));         // vertex_num_
     }
+}
+
+// cull the faces of an instance in parallel chunks, then compact the per-chunk outputs in face order
+void Render::cullingTriangleInstance(ASInstance& instance,const glm::mat4 normal_mat){
+    PROFILE_ZONE("Culling Instance");
+    instance.refreshVertices();
+    info_.profile_.total_face_num_+=instance.blas_->object_->getFaceNum();
+
+    std::vector<Vertex>& out_vertices=*instance.vertices_;
+    std::vector<PrimitiveHolder>& out_primitives_buffer=*instance.primitives_buffer_;
+
+    uint32_t idx_num=instance.blas_->object_->getIndices().size();
+    uint32_t face_num=idx_num/3;
+    uint32_t primitive_num=instance.blas_->primitives_indices_->size();
+    assert(idx_num%3==0&&face_num==primitive_num);
+
+    auto& pool=ThreadPool::global();
+    const size_t grain=2048;
+    size_t chunk_num=std::max<size_t>(1,std::min<size_t>((face_num+grain-1)/grain,pool.size()*4));
+    size_t chunk_faces=(face_num+chunk_num-1)/chunk_num;
+    if(culling_chunks_.size()<chunk_num)
+        culling_chunks_.resize(chunk_num);
+
+    pool.parallelFor(chunk_num,[&](size_t c){
+        auto& chunk=culling_chunks_[c];
+        chunk.face_begin_=std::min<size_t>(face_num,c*chunk_faces);
+        chunk.face_end_=std::min<size_t>(face_num,(c+1)*chunk_faces);
+        cullingTriangleRange(instance,normal_mat,chunk);
+    });
+
+    // prefix sum over the chunk sizes gives each chunk its place in the instance buffers
+    size_t vertex_total=0;
+    for(size_t c=0;c<chunk_num;++c){
+        auto& chunk=culling_chunks_[c];
+        chunk.vertex_offset_=vertex_total;
+        vertex_total+=chunk.vertices_.size();
+        info_.profile_.accumulate(chunk.profile_);
+    }
+    out_vertices.resize(vertex_total);
+    out_primitives_buffer.resize(face_num);
+
+    pool.parallelFor(chunk_num,[&](size_t c){
+        auto& chunk=culling_chunks_[c];
+        std::copy(chunk.vertices_.begin(),chunk.vertices_.end(),out_vertices.begin()+chunk.vertex_offset_);
+        for(size_t i=0;i<chunk.primitives_.size();++i){
+            auto& holder=out_primitives_buffer[chunk.face_begin_+i];
+            holder=chunk.primitives_[i];
+            if(holder.clipflag_!=ClipFlag::refused)
+                holder.vertex_start_pos_+=chunk.vertex_offset_;
+        }
+    });
 
     assert(out_vertices.size()%3==0);
     assert(out_primitives_buffer.size()==primitive_num);
 
 }
-
-
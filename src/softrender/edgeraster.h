@@ -0,0 +1,246 @@
+/* half-space (edge function) triangle rasterization */
+#pragma once
+#include"common/common_include.h"
+#include"common/AABB.h"
+#include<cstdint>
+#ifdef __AVX2__
+#include<immintrin.h>
+#endif
+
+/**
+ * @brief Coverage is decided by fixed-point edge functions with SUBPIXEL_BITS of sub-pixel precision
+ *        and the top-left fill rule, so pixels on an edge shared by two triangles are drawn exactly once.
+ *        The bounding box is walked in BLOCK_SIZE x BLOCK_SIZE blocks: a block outside any edge is rejected,
+ *        and the per-pixel test is skipped for every edge that fully contains the block.
+ *        Inside a block, one row (8 pixels) is handled at a time with AVX2 when it is available.
+ *        Depth and the perspective-correct barycenter come from plane equations, so no per-pixel
+ *        `getBaryCenter` is needed.
+ */
+namespace EdgeRaster{
+
+constexpr int SUBPIXEL_BITS=4;
+constexpr int SUBPIXEL_ONE=1<<SUBPIXEL_BITS;
+constexpr int BLOCK_SIZE=8;
+
+struct TriangleSetup{
+    // edge k is opposite to vertex k: E_k(x,y)=A_k*x+B_k*y+C_k, x and y in sub-pixel units.
+    // E_k>=0 inside the triangle after orientation is normalized.
+    int64_t A[3],B[3],C[3];
+    int32_t bias[3];                    // 0 for top-left edges, -1 otherwise
+
+    // pixel bounding box after scissoring
+    int min_x,min_y,max_x,max_y;
+
+    // plane equations in pixels, relative to (min_x,min_y)
+    float z0,dzdx,dzdy;                 // screen-space depth
+    float q0[3],dqdx[3],dqdy[3];        // barycenter divided by clip-space w
+
+    /**
+     * @brief snap the screen-space triangle to the fixed-point grid and build the edge and plane equations.
+     * @param s : screen-space positions, z in [-1,1]
+     * @param w : clip-space w of each vertex, used for perspective-correct barycenters
+     * @param scissor : pixels outside this box are never visited
+     * @return false if the triangle is degenerate or covers no pixel centers of the scissor box
+     */
+    bool setup(const glm::vec3 s[3],const float w[3],const AABB2d& scissor){
+        int64_t X[3],Y[3];
+        for(int i=0;i<3;++i){
+            X[i]=(int64_t)std::llround((double)s[i].x*SUBPIXEL_ONE);
+            Y[i]=(int64_t)std::llround((double)s[i].y*SUBPIXEL_ONE);
+        }
+
+        int64_t area=(X[1]-X[0])*(Y[2]-Y[0])-(Y[1]-Y[0])*(X[2]-X[0]);
+        if(area==0)
+            return false;
+        int64_t sign=area>0?1:-1;
+        area*=sign;
+
+        for(int k=0;k<3;++k){
+            int a=(k+1)%3,b=(k+2)%3;
+            A[k]=sign*(Y[a]-Y[b]);
+            B[k]=sign*(X[b]-X[a]);
+            C[k]=-A[k]*X[a]-B[k]*Y[a];
+            // the opposite triangle sees the shared edge with (-A,-B), so exactly one of them owns it
+            bool top_left=A[k]>0||(A[k]==0&&B[k]<0);
+            bias[k]=top_left?0:-1;
+        }
+
+        // bounding box of the pixel centers(integer coordinates) that may be covered
+        int64_t bx0=std::min({X[0],X[1],X[2]}),bx1=std::max({X[0],X[1],X[2]});
+        int64_t by0=std::min({Y[0],Y[1],Y[2]}),by1=std::max({Y[0],Y[1],Y[2]});
+        min_x=(int)std::max<int64_t>((bx0+SUBPIXEL_ONE-1)>>SUBPIXEL_BITS,(int64_t)std::ceil(scissor.min.x));
+        min_y=(int)std::max<int64_t>((by0+SUBPIXEL_ONE-1)>>SUBPIXEL_BITS,(int64_t)std::ceil(scissor.min.y));
+        max_x=(int)std::min<int64_t>(bx1>>SUBPIXEL_BITS,(int64_t)std::floor(scissor.max.x));
+        max_y=(int)std::min<int64_t>(by1>>SUBPIXEL_BITS,(int64_t)std::floor(scissor.max.y));
+        if(min_x>max_x||min_y>max_y)
+            return false;
+
+        // linear barycenter: l_k=E_k/area
+        double inv_area=1.0/(double)area;
+        double l0[3],ldx[3],ldy[3];
+        for(int k=0;k<3;++k){
+            l0[k]=(double)evalEdge(k,min_x,min_y)*inv_area;
+            ldx[k]=(double)(A[k]*SUBPIXEL_ONE)*inv_area;
+            ldy[k]=(double)(B[k]*SUBPIXEL_ONE)*inv_area;
+        }
+        z0=dzdx=dzdy=0;
+        for(int k=0;k<3;++k){
+            z0+=l0[k]*s[k].z;
+            dzdx+=ldx[k]*s[k].z;
+            dzdy+=ldy[k]*s[k].z;
+            double inv_w=1.0/(double)w[k];
+            q0[k]=l0[k]*inv_w;
+            dqdx[k]=ldx[k]*inv_w;
+            dqdy[k]=ldy[k]*inv_w;
+        }
+        return true;
+    }
+
+    // edge function at the pixel center (x,y)
+    inline int64_t evalEdge(int k,int x,int y)const{
+        return A[k]*((int64_t)x<<SUBPIXEL_BITS)+B[k]*((int64_t)y<<SUBPIXEL_BITS)+C[k];
+    }
+};
+
+#ifdef __AVX2__
+// f0+dfdx*x+dfdy*y for 8 pixels
+inline __m256 planeAt(float f0,float dfdx,float dfdy,__m256 x,__m256 y){
+    return _mm256_add_ps(_mm256_set1_ps(f0),_mm256_add_ps(_mm256_mul_ps(x,_mm256_set1_ps(dfdx)),_mm256_mul_ps(y,_mm256_set1_ps(dfdy))));
+}
+
+inline int lowestBit(int bits){
+#ifdef _MSC_VER
+    unsigned long idx;
+    _BitScanForward(&idx,(unsigned long)bits);
+    return (int)idx;
+#else
+    return __builtin_ctz((unsigned)bits);
+#endif
+}
+#endif
+
+/**
+ * @brief rasterize a triangle built by `TriangleSetup::setup`.
+ * @param zbuffer : row-major depth buffer with `zstride` floats per row; nullptr disables the depth test.
+ *        When enabled, a fragment passes if its depth is not farther than the stored one, and the stored depth
+ *        is updated before `frag` is called.
+ * @param frag : callable as frag(int x,int y,float depth,const glm::vec3& perspective_correct_bary)
+ */
+template<typename FragmentFunc>
+void rasterizeTriangle(const TriangleSetup& tri,float* zbuffer,int zstride,FragmentFunc&& frag){
+    constexpr int S=BLOCK_SIZE;
+    const int64_t step_x[3]={tri.A[0]*SUBPIXEL_ONE,tri.A[1]*SUBPIXEL_ONE,tri.A[2]*SUBPIXEL_ONE};
+    const int64_t step_y[3]={tri.B[0]*SUBPIXEL_ONE,tri.B[1]*SUBPIXEL_ONE,tri.B[2]*SUBPIXEL_ONE};
+
+#ifdef __AVX2__
+    const __m256i lane=_mm256_setr_epi32(0,1,2,3,4,5,6,7);
+    const __m256 lanef=_mm256_setr_ps(0,1,2,3,4,5,6,7);
+    __m256i lane_step[3];
+    for(int k=0;k<3;++k)
+        lane_step[k]=_mm256_mullo_epi32(lane,_mm256_set1_epi32((int32_t)step_x[k]));
+#endif
+
+    for(int by=tri.min_y;by<=tri.max_y;by+=S){
+        const int row_end=std::min(by+S-1,tri.max_y);
+        for(int bx=tri.min_x;bx<=tri.max_x;bx+=S){
+            const int col_end=std::min(bx+S-1,tri.max_x);
+
+            // classify the block against each edge by its four corner samples
+            bool partial[3];
+            int64_t e_origin[3];
+            bool reject=false;
+            for(int k=0;k<3;++k){
+                int64_t e00=tri.evalEdge(k,bx,by)+tri.bias[k];
+                int64_t e10=e00+step_x[k]*(col_end-bx);
+                int64_t e01=e00+step_y[k]*(row_end-by);
+                int64_t e11=e10+step_y[k]*(row_end-by);
+                int64_t emax=std::max(std::max(e00,e10),std::max(e01,e11));
+                int64_t emin=std::min(std::min(e00,e10),std::min(e01,e11));
+                if(emax<0){
+                    reject=true;
+                    break;
+                }
+                partial[k]=emin<0;
+                // a partially covered block stays within a few steps of the edge, so it fits into 32 bits
+                e_origin[k]=e00;
+            }
+            if(reject)
+                continue;
+
+            const int lanes=col_end-bx+1;
+            for(int y=by;y<=row_end;++y){
+                float* zrow=zbuffer?zbuffer+(size_t)y*zstride+bx:nullptr;
+                const float fy=(float)(y-tri.min_y);
+                const float fx0=(float)(bx-tri.min_x);
+#ifdef __AVX2__
+                __m256i mask=_mm256_cmpgt_epi32(_mm256_set1_epi32(lanes),lane);
+                for(int k=0;k<3;++k){
+                    if(!partial[k]) continue;
+                    int32_t e_row=(int32_t)(e_origin[k]+step_y[k]*(y-by));
+                    __m256i e=_mm256_add_epi32(_mm256_set1_epi32(e_row),lane_step[k]);
+                    mask=_mm256_and_si256(mask,_mm256_cmpgt_epi32(e,_mm256_set1_epi32(-1)));
+                }
+                if(_mm256_testz_si256(mask,mask))
+                    continue;
+
+                __m256 fx=_mm256_add_ps(_mm256_set1_ps(fx0),lanef);
+                __m256 vfy=_mm256_set1_ps(fy);
+                __m256 z=planeAt(tri.z0,tri.dzdx,tri.dzdy,fx,vfy);
+                __m256 pass=_mm256_castsi256_ps(mask);
+                if(zrow){
+                    __m256 zold=_mm256_maskload_ps(zrow,mask);
+                    pass=_mm256_and_ps(pass,_mm256_cmp_ps(z,zold,_CMP_LE_OQ));
+                    _mm256_maskstore_ps(zrow,_mm256_castps_si256(pass),z);
+                }
+                int bits=_mm256_movemask_ps(pass);
+                if(!bits)
+                    continue;
+
+                __m256 q[3];
+                for(int k=0;k<3;++k)
+                    q[k]=planeAt(tri.q0[k],tri.dqdx[k],tri.dqdy[k],fx,vfy);
+                __m256 inv_sum=_mm256_div_ps(_mm256_set1_ps(1.0f),_mm256_add_ps(_mm256_add_ps(q[0],q[1]),q[2]));
+                alignas(32) float zs[8],b0[8],b1[8],b2[8];
+                _mm256_store_ps(zs,z);
+                _mm256_store_ps(b0,_mm256_mul_ps(q[0],inv_sum));
+                _mm256_store_ps(b1,_mm256_mul_ps(q[1],inv_sum));
+                _mm256_store_ps(b2,_mm256_mul_ps(q[2],inv_sum));
+                while(bits){
+                    int l=lowestBit(bits);
+                    bits&=bits-1;
+                    frag(bx+l,y,zs[l],glm::vec3(b0[l],b1[l],b2[l]));
+                }
+#else
+                int64_t e_row[3];
+                for(int k=0;k<3;++k)
+                    e_row[k]=e_origin[k]+step_y[k]*(y-by);
+                for(int l=0;l<lanes;++l){
+                    bool inside=true;
+                    for(int k=0;k<3;++k){
+                        if(partial[k]&&e_row[k]+step_x[k]*l<0){
+                            inside=false;
+                            break;
+                        }
+                    }
+                    if(!inside)
+                        continue;
+                    float fx=fx0+(float)l;
+                    float z=tri.z0+tri.dzdx*fx+tri.dzdy*fy;
+                    if(zrow){
+                        if(z>zrow[l])
+                            continue;
+                        zrow[l]=z;
+                    }
+                    float q[3];
+                    for(int k=0;k<3;++k)
+                        q[k]=tri.q0[k]+tri.dqdx[k]*fx+tri.dqdy[k]*fy;
+                    float inv_sum=1.0f/(q[0]+q[1]+q[2]);
+                    frag(bx+l,y,z,glm::vec3(q[0]*inv_sum,q[1]*inv_sum,q[2]*inv_sum));
+                }
+#endif
+            }
+        }
+    }
+}
+
+}
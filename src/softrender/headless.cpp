@@ -0,0 +1,348 @@
+#include"headless.h"
+#include"render.h"
+#include<cstdlib>
+#ifdef _WIN32
+#include<process.h>
+#else
+#include<spawn.h>
+#include<sys/wait.h>
+extern char** environ;
+#endif
+
+namespace{
+
+const AOVType PARTIAL_AOVS=AOVType::Color|AOVType::SampleCount;
+
+// the channels a worker writes: those asked for, and those the coordinator merges by
+AOVType partialMask(const RTracingSetting& setting){
+    return (AOVType(setting.aov_mask_)|PARTIAL_AOVS)&AOVType::ALL;
+}
+
+std::vector<AOVType> getChannels(AOVType mask){
+    std::vector<AOVType> channels;
+    for(int i=0;i<AOVBuffer::CHANNEL_NUM;++i){
+        if((bool)(mask&AOVType(1<<i)))
+            channels.push_back(AOVType(1<<i));
+    }
+    return channels;
+}
+
+void printUsage(){
+    std::cout<<"usage: pathlume [--headless [options]]\n"
+             <<"  --scene NAME          demo scene to render\n"
+             <<"  --out PREFIX          prefix of the written files\n"
+             <<"  --spp N  --depth N  --tiles N  --light-split N\n"
+             <<"  --light-candidates N  resample each light sample among N candidates, 1 for off\n"
+             <<"  --raster-primary 0|1  take the camera hits from the rasterizer\n"
+             <<"  --aov-mask N          bits of the AOVs written as pfm\n"
+             <<"  --compress-bvh        quantize the BVH of every mesh\n"
+             <<"  --bvh-report          with --compress-bvh, report the memory and rays/s of each quantized BVH against\n"
+             <<"                        the full one\n"
+             <<"  --env FILE            lat-long HDR map lighting the scene\n"
+             <<"  --env-intensity F  --env-rotation DEGREES\n"
+             <<"  --guiding N           path guiding trained over N passes, 0 for off\n"
+             <<"  --radiance-cache N    end paths in the radiance cache after N bounces, 0 for off\n"
+             <<"  --radiance-cache-cells N   size of the radiance cache\n"
+             <<"  --splitting N         Russian Roulette and splitting learned over N passes(with --depth 0), 0 for off\n"
+             <<"  --integrator pt|caustics|gather|bdpt|mlt   path tracing, with the caustics / final gather of a photon map,\n"
+             <<"                        bidirectional path tracing or Metropolis light transport(spp: mutations per pixel)\n"
+             <<"  --photons N  --photon-radius F(of the scene size)  --photon-passes N\n"
+             <<"  --mlt-chains N  --mlt-bootstrap N  --mlt-large-step F\n"
+             <<"  --checkpoint S        save the float film to PREFIX.ckpt every S seconds, resume it if present\n"
+             <<"  --checkpoint-spp N    samples per pixel of a pass between checkpoints\n"
+             <<"  --workers N           split the film over N worker processes; mlt, bdpt, guiding, the radiance cache\n"
+             <<"                        and splitting render in one process\n"
+             <<"  --worker --tile-range B:E   (internal) render the tiles [B,E) as a partial film\n";
+}
+
+bool readInt(const char* arg,int& value){
+    char* end=nullptr;
+    long v=std::strtol(arg,&end,10);
+    if(end==arg||*end!='\0')
+        return false;
+    value=(int)v;
+    return true;
+}
+
+bool readFloat(const char* arg,float& value){
+    char* end=nullptr;
+    float v=std::strtof(arg,&end);
+    if(end==arg||*end!='\0')
+        return false;
+    value=v;
+    return true;
+}
+
+const char* INTEGRATOR_NAMES[]={"pt","caustics","gather","bdpt","mlt"};
+
+bool readIntegrator(const std::string& name,IntegratorType& type){
+    for(int i=0;i<5;++i){
+        if(name==INTEGRATOR_NAMES[i]){
+            type=IntegratorType(i);
+            return true;
+        }
+    }
+    return false;
+}
+
+// the tracer settings of the default setup with the overrides of the command line
+void applyOption(RTracingSetting& setting,const HeadlessOption& option){
+    if(option.spp_>0)           setting.spp_=option.spp_;
+    if(option.max_depth_>=0)    setting.max_depth_=option.max_depth_;
+    if(option.tiles_num_>0)     setting.tiles_num_=option.tiles_num_;
+    if(option.light_split_>0)   setting.light_split_=option.light_split_;
+    if(option.light_candidates_>0)  setting.light_candidates_=option.light_candidates_;
+    if(option.raster_primary_>=0)   setting.raster_primary_=option.raster_primary_!=0;
+    if(option.aov_mask_>=0)     setting.aov_mask_=option.aov_mask_;
+    if(option.checkpoint_interval_>=0)  setting.checkpoint_interval_=option.checkpoint_interval_;
+    if(option.checkpoint_spp_>0)        setting.checkpoint_spp_=option.checkpoint_spp_;
+    if(option.guiding_iterations_>=0){
+        setting.path_guiding_=option.guiding_iterations_>0;
+        if(setting.path_guiding_)
+            setting.guiding_iterations_=option.guiding_iterations_;
+    }
+    if(option.radiance_cache_depth_>=0){
+        setting.radiance_cache_=option.radiance_cache_depth_>0;
+        if(setting.radiance_cache_)
+            setting.radiance_cache_depth_=option.radiance_cache_depth_;
+    }
+    if(option.radiance_cache_cells_>0)  setting.radiance_cache_cells_=option.radiance_cache_cells_;
+    if(option.splitting_passes_>=0){
+        setting.splitting_=option.splitting_passes_>0;
+        if(setting.splitting_)
+            setting.splitting_passes_=option.splitting_passes_;
+    }
+    if(!option.integrator_.empty())     readIntegrator(option.integrator_,setting.integrator_);
+    if(option.photon_num_>0)            setting.photon_num_=option.photon_num_;
+    if(option.photon_radius_>0.f)       setting.photon_radius_=option.photon_radius_;
+    if(option.photon_passes_>0)         setting.photon_passes_=option.photon_passes_;
+    if(option.mlt_chains_>0)            setting.mlt_chains_=option.mlt_chains_;
+    if(option.mlt_bootstrap_>0)         setting.mlt_bootstrap_=option.mlt_bootstrap_;
+    if(option.mlt_large_step_>=0.f)     setting.mlt_large_step_=std::min(option.mlt_large_step_,1.f);
+    if(!option.env_map_.empty()){
+        setting.env_map_=option.env_map_;
+        setting.env_rotation_=option.env_rotation_;
+    }
+    if(option.env_intensity_>=0.f)      setting.env_intensity_=option.env_intensity_;
+    setting.interactive_=false;
+    setting.denoise_=false;
+}
+
+/**
+ * @brief why the film of the setting can not be split over processes, nullptr if it can: these learn from or splat
+ *        over the paths of the whole film, a worker with a range of tiles would render another image
+ */
+const char* singleProcessReason(const RTracingSetting& setting){
+    if(setting.integrator_==IntegratorType::Metropolis)
+        return "the Markov chains of Metropolis light transport wander over the whole film";
+    if(setting.integrator_==IntegratorType::Bidirectional)
+        return "the light paths of bidirectional path tracing splat over the whole film";
+    if(setting.integrator_!=IntegratorType::PathTracing)
+        return nullptr;
+    if(setting.path_guiding_&&setting.guiding_iterations_>0)
+        return "path guiding learns from the paths of the whole film";
+    if(setting.radiance_cache_&&setting.radiance_cache_depth_>0)
+        return "the radiance cache fills from the paths of the whole film";
+    if(setting.splitting_&&setting.max_depth_==0)
+        return "splitting learns from the paths of the whole film";
+    return nullptr;
+}
+
+std::string partPrefix(const std::string& output,int k){
+    return output+"_part"+std::to_string(k);
+}
+
+/**
+ * @brief run `args[0]` with the arguments `args` and wait for it, without a shell in between: paths reach the
+ *        process as they are, whatever quotes or metacharacters they hold.
+ * @return the exit code of the process, -1 if it could not be started or did not exit normally
+ */
+int runProcess(const std::vector<std::string>& args){
+    std::vector<char*> argv;
+    for(const std::string& arg:args)
+        argv.push_back(const_cast<char*>(arg.c_str()));
+    argv.push_back(nullptr);
+#ifdef _WIN32
+    intptr_t code=_spawnv(_P_WAIT,argv[0],argv.data());
+    return code<0?-1:(int)code;
+#else
+    pid_t pid;
+    if(posix_spawnp(&pid,argv[0],nullptr,nullptr,argv.data(),environ)!=0)
+        return -1;
+    int status=0;
+    if(waitpid(pid,&status,0)<0||!WIFEXITED(status))
+        return -1;
+    return WEXITSTATUS(status);
+#endif
+}
+
+int renderLocal(Render& render,const RTracingSetting& setting,const HeadlessOption& option){
+    CPUTimer timer;
+    timer.start("Rendering");
+    auto film=render.createFilm(setting);
+    film->render(option.output_+".ckpt");
+    timer.stop("Rendering");
+    std::cout<<"Rendering time : "<<timer.getElapsedTime("Rendering")<<" s"<<std::endl;
+
+    render.getColorBuffer().saveToImage(option.output_+".png");
+    film->saveAOVs(option.output_);
+    return 0;
+}
+
+int renderWorker(Render& render,RTracingSetting setting,const HeadlessOption& option){
+    const AOVType mask=partialMask(setting);
+    setting.aov_mask_=(uint32_t)mask;
+    auto film=render.createFilm(setting);
+    film->setTileRange(option.tile_begin_,option.tile_end_);
+    film->render("");
+    return film->getAOVs().save(option.output_,mask)==(int)getChannels(mask).size()?0:1;
+}
+
+/**
+ * @brief workers get the resolved settings rather than the overrides, so they render exactly the film of the
+ *        coordinator. Tiles seed their samplers with their own index: a tile traces the same samples in whichever
+ *        process renders it, and the merged film is the one of a single process. That only holds for settings
+ *        without a `singleProcessReason`, which never get here.
+ */
+int renderCoordinator(Render& render,RTracingSetting setting,const HeadlessOption& option){
+    const AOVType mask=partialMask(setting);
+    setting.aov_mask_=(uint32_t)mask;
+    auto film=render.createFilm(setting,false);
+    int tile_total=(int)film->getTileNum();
+    int workers=std::min(option.workers_,tile_total);
+
+    std::vector<std::string> common={option.executable_,"--headless","--worker",
+        "--scene",render.info_.filename_,
+        "--spp",std::to_string(setting.spp_),
+        "--depth",std::to_string(setting.max_depth_),
+        "--tiles",std::to_string(setting.tiles_num_),
+        "--light-split",std::to_string(setting.light_split_),
+        "--light-candidates",std::to_string(setting.light_candidates_),
+        "--raster-primary",std::to_string((int)setting.raster_primary_),
+        "--aov-mask",std::to_string((int)mask),
+        "--guiding",std::to_string(setting.path_guiding_?setting.guiding_iterations_:0),
+        "--radiance-cache",std::to_string(setting.radiance_cache_?setting.radiance_cache_depth_:0),
+        "--radiance-cache-cells",std::to_string(setting.radiance_cache_cells_),
+        "--splitting",std::to_string(setting.splitting_?setting.splitting_passes_:0),
+        "--integrator",INTEGRATOR_NAMES[(int)setting.integrator_],
+        "--photons",std::to_string(setting.photon_num_),
+        "--photon-radius",std::to_string(setting.photon_radius_),
+        "--photon-passes",std::to_string(setting.photon_passes_)};
+    if(option.compress_bvh_)
+        common.push_back("--compress-bvh");
+    if(!setting.env_map_.empty()){
+        common.insert(common.end(),{"--env",setting.env_map_,
+                                    "--env-intensity",std::to_string(setting.env_intensity_),
+                                    "--env-rotation",std::to_string(setting.env_rotation_)});
+    }
+
+    CPUTimer timer;
+    timer.start("Distributed");
+    std::vector<int> codes(workers,0);
+    std::vector<std::thread> launchers;
+    for(int k=0;k<workers;++k){
+        int begin=tile_total*k/workers;
+        int end=tile_total*(k+1)/workers;
+        std::vector<std::string> args=common;
+        args.insert(args.end(),{"--tile-range",std::to_string(begin)+":"+std::to_string(end),
+                                "--out",partPrefix(option.output_,k)});
+        std::cout<<"launch worker "<<k<<" : tiles ["<<begin<<","<<end<<")"<<std::endl;
+        launchers.emplace_back([&codes,k,args]{ codes[k]=runProcess(args); });
+    }
+    for(auto& th:launchers)
+        th.join();
+
+    for(int k=0;k<workers;++k){
+        AOVBuffer partial;
+        if(codes[k]!=0||!partial.load(partPrefix(option.output_,k),mask)||!film->mergePartial(partial)){
+            std::cerr<<"renderCoordinator: worker "<<k<<" failed(exit code "<<codes[k]<<")"<<std::endl;
+            return 1;
+        }
+        for(AOVType type:getChannels(mask))
+            std::remove((partPrefix(option.output_,k)+"_"+AOVBuffer::getName(type)+".pfm").c_str());
+    }
+    timer.stop("Distributed");
+    std::cout<<"Distributed rendering time : "<<timer.getElapsedTime("Distributed")<<" s"<<std::endl;
+
+    film->resolve();
+    render.getColorBuffer().saveToImage(option.output_+".png");
+    film->saveAOVs(option.output_);
+    return 0;
+}
+
+}   // namespace
+
+bool parseHeadlessArgs(int argc,char** argv,HeadlessOption& option){
+    option.executable_=argc>0?argv[0]:"pathlume";
+    for(int i=1;i<argc;++i){
+        std::string arg=argv[i];
+        bool has_value=i+1<argc;
+        bool ok=true;
+        if(arg=="--headless")               option.enabled_=true;
+        else if(arg=="--worker")            option.worker_=true;
+        else if(arg=="--compress-bvh")      option.compress_bvh_=true;
+        else if(arg=="--bvh-report")        option.bvh_report_=true;
+        else if(arg=="--scene"&&has_value)  option.scene_=argv[++i];
+        else if(arg=="--out"&&has_value)    option.output_=argv[++i];
+        else if(arg=="--spp"&&has_value)    ok=readInt(argv[++i],option.spp_);
+        else if(arg=="--depth"&&has_value)  ok=readInt(argv[++i],option.max_depth_);
+        else if(arg=="--tiles"&&has_value)  ok=readInt(argv[++i],option.tiles_num_);
+        else if(arg=="--light-split"&&has_value)    ok=readInt(argv[++i],option.light_split_);
+        else if(arg=="--light-candidates"&&has_value)   ok=readInt(argv[++i],option.light_candidates_);
+        else if(arg=="--raster-primary"&&has_value) ok=readInt(argv[++i],option.raster_primary_);
+        else if(arg=="--aov-mask"&&has_value)       ok=readInt(argv[++i],option.aov_mask_);
+        else if(arg=="--env"&&has_value)            option.env_map_=argv[++i];
+        else if(arg=="--env-intensity"&&has_value)  ok=readFloat(argv[++i],option.env_intensity_);
+        else if(arg=="--env-rotation"&&has_value)   ok=readFloat(argv[++i],option.env_rotation_);
+        else if(arg=="--guiding"&&has_value)        ok=readInt(argv[++i],option.guiding_iterations_);
+        else if(arg=="--radiance-cache"&&has_value) ok=readInt(argv[++i],option.radiance_cache_depth_);
+        else if(arg=="--radiance-cache-cells"&&has_value)   ok=readInt(argv[++i],option.radiance_cache_cells_);
+        else if(arg=="--splitting"&&has_value)      ok=readInt(argv[++i],option.splitting_passes_);
+        else if(arg=="--integrator"&&has_value){
+            IntegratorType type;
+            option.integrator_=argv[++i];
+            ok=readIntegrator(option.integrator_,type);
+        }
+        else if(arg=="--photons"&&has_value)        ok=readInt(argv[++i],option.photon_num_);
+        else if(arg=="--photon-radius"&&has_value)  ok=readFloat(argv[++i],option.photon_radius_);
+        else if(arg=="--photon-passes"&&has_value)  ok=readInt(argv[++i],option.photon_passes_);
+        else if(arg=="--mlt-chains"&&has_value)     ok=readInt(argv[++i],option.mlt_chains_);
+        else if(arg=="--mlt-bootstrap"&&has_value)  ok=readInt(argv[++i],option.mlt_bootstrap_);
+        else if(arg=="--mlt-large-step"&&has_value) ok=readFloat(argv[++i],option.mlt_large_step_);
+        else if(arg=="--checkpoint"&&has_value)     ok=readInt(argv[++i],option.checkpoint_interval_);
+        else if(arg=="--checkpoint-spp"&&has_value) ok=readInt(argv[++i],option.checkpoint_spp_);
+        else if(arg=="--workers"&&has_value)        ok=readInt(argv[++i],option.workers_);
+        else if(arg=="--tile-range"&&has_value){
+            std::string range=argv[++i];
+            size_t colon=range.find(':');
+            ok=colon!=std::string::npos
+               &&readInt(range.substr(0,colon).c_str(),option.tile_begin_)
+               &&readInt(range.substr(colon+1).c_str(),option.tile_end_);
+        }
+        else ok=false;
+
+        if(!ok){
+            std::cerr<<"invalid argument: "<<arg<<std::endl;
+            printUsage();
+            return false;
+        }
+    }
+    return true;
+}
+
+int runHeadless(Render& render,const HeadlessOption& option){
+    render.setBVHCompression(option.compress_bvh_,option.bvh_report_);
+    render.pipelineInit(option.scene_);
+    applyOption(render.info_.tracer_setting_,option);
+    const RTracingSetting& setting=render.info_.tracer_setting_;
+
+    if(option.worker_)
+        return renderWorker(render,setting,option);
+    if(option.workers_>0){
+        const char* reason=singleProcessReason(setting);
+        if(!reason)
+            return renderCoordinator(render,setting,option);
+        std::cout<<"Rendering in a single process: "<<reason<<std::endl;
+    }
+    return renderLocal(render,setting,option);
+}
@@ -0,0 +1,61 @@
+/* path tracing from the command line, in one process or split over worker processes */
+#pragma once
+#include"common/common_include.h"
+#include"softrender/interface.h"
+
+class Render;
+
+/**
+ * @brief options of `pathlume --headless`. The tracer settings left at -1 keep their defaults.
+ *        A coordinator(`workers_`>0) splits the tiles of the film into contiguous ranges and runs one worker process
+ *        per range, each writes its float partial film as pfm files that the coordinator merges.
+ */
+struct HeadlessOption{
+    bool enabled_=false;
+    std::string scene_;                 // demo scene, the default one if empty
+    std::string output_="headless";     // prefix of the written files
+    int workers_=0;                     // number of worker processes, 0 renders in this process
+    bool compress_bvh_=false;           // quantize the trees of all the BLAS
+    bool bvh_report_=false;             // benchmark each quantized tree against the full one as it is built
+
+    // tracer settings
+    int spp_=-1;
+    int max_depth_=-1;
+    int tiles_num_=-1;
+    int light_split_=-1;
+    int light_candidates_=-1;
+    int raster_primary_=-1;
+    int aov_mask_=-1;
+    int checkpoint_interval_=-1;
+    int checkpoint_spp_=-1;
+    int guiding_iterations_=-1;         // 0 turns path guiding off
+    int radiance_cache_depth_=-1;       // 0 turns the radiance cache off
+    int radiance_cache_cells_=-1;
+    int splitting_passes_=-1;           // 0 turns splitting off
+    std::string integrator_;            // pt|caustics|gather|bdpt|mlt, the default if empty
+    int photon_num_=-1;
+    float photon_radius_=-1.f;
+    int photon_passes_=-1;
+    int mlt_chains_=-1;
+    int mlt_bootstrap_=-1;
+    float mlt_large_step_=-1.f;
+    std::string env_map_;
+    float env_intensity_=-1.f;
+    float env_rotation_=0.f;
+
+    // worker: renders the tiles [tile_begin_,tile_end_) and writes the partial film to `output_`
+    bool worker_=false;
+    int tile_begin_=0;
+    int tile_end_=-1;
+
+    std::string executable_;            // the program the workers run, argv[0]
+};
+
+/**
+ * @brief read the command line; without `--headless` the option stays disabled and the window is used.
+ * @return false if the arguments are invalid, after printing the usage
+ */
+bool parseHeadlessArgs(int argc,char** argv,HeadlessOption& option);
+
+// render the scene of the option without a window, returns the exit code of the program
+int runHeadless(Render& render,const HeadlessOption& option);
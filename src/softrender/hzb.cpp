@@ -1,4 +1,7 @@
 #include"hzb.h"
+#ifdef __AVX2__
+#include<immintrin.h>
+#endif
 
 unsigned int nextPowerOfTwo(unsigned int x) {
     x--;
@@ -15,6 +18,8 @@ HZbuffer::HZbuffer(uint32_t w,uint32_t h){
 
     width_=nextPowerOfTwo(w);
     height_=nextPowerOfTwo(h);
+    valid_width_=w;
+    valid_height_=h;
 
     fineset_level_=std::log2(std::min((int)width_,(int)height_))-1;
     hzb_.resize(fineset_level_+1);
@@ -27,14 +32,75 @@ HZbuffer::HZbuffer(uint32_t w,uint32_t h){
         tHeight/=2;
     }
     
-    for(int i=0;i<width_;++i){
-        for(int j=0;j<height_;++j){
-            if(i<w&&j<h) continue;
-            // set the extended area to NearZ
-            updateDepth(i,j,srender::NEAR_Z);
+    resetFinest();
+    buildPyramid();
+}
+
+// clear the finest level: far inside the image, near in the padding so that it never keeps a box alive
+void HZbuffer::resetFinest(){
+    DepthBuffer& finest=hzb_[fineset_level_];
+    finest.clear();
+    if(valid_width_<width_||valid_height_<height_){
+        float* data=finest.getData();
+        for(uint32_t y=0;y<height_;++y){
+            uint32_t x0=y<valid_height_?valid_width_:0;
+            std::fill(data+y*width_+x0,data+(y+1)*width_,srender::NEAR_Z);
         }
     }
+    dirty_min_x_=0;
+    dirty_min_y_=0;
+    dirty_max_x_=width_-1;
+    dirty_max_y_=height_-1;
+}
+
+void HZbuffer::setDeferredBuild(bool flag){
+    if(deferred_&&!flag)
+        buildPyramid();     // eager updates expect a consistent pyramid
+    deferred_=flag;
+}
+
+void HZbuffer::buildPyramid(){
+    if(!isDirty())
+        return;
+    int x0=dirty_min_x_,y0=dirty_min_y_,x1=dirty_max_x_,y1=dirty_max_y_;
+    for(int i=fineset_level_-1;i>=0;--i){
+        x0>>=1; y0>>=1; x1>>=1; y1>>=1;
+        reduceLevel(i,x0,y0,x1,y1);
+    }
+    dirty_min_x_=dirty_min_y_=srender::INF;
+    dirty_max_x_=dirty_max_y_=-1;
+}
 
+// parents [x0,x1]x[y0,y1] of `level` = max of their 2x2 children in level+1
+void HZbuffer::reduceLevel(int level,int x0,int y0,int x1,int y1){
+    DepthBuffer& parent=hzb_[level];
+    DepthBuffer& child=hzb_[level+1];
+    const int pw=parent.getWidth();
+    const int cw=child.getWidth();
+    float* pdata=parent.getData();
+    const float* cdata=child.getData();
+
+    for(int y=y0;y<=y1;++y){
+        const float* row0=cdata+(2*y)*cw;
+        const float* row1=row0+cw;
+        float* prow=pdata+y*pw;
+        int x=x0;
+#ifdef __AVX2__
+        for(;x+7<=x1;x+=8){
+            __m256 m0=_mm256_max_ps(_mm256_loadu_ps(row0+2*x),_mm256_loadu_ps(row1+2*x));
+            __m256 m1=_mm256_max_ps(_mm256_loadu_ps(row0+2*x+8),_mm256_loadu_ps(row1+2*x+8));
+            // horizontal pairs: even and odd children, lanes come out as [p0 p1 p4 p5 | p2 p3 p6 p7]
+            __m256 even=_mm256_shuffle_ps(m0,m1,_MM_SHUFFLE(2,0,2,0));
+            __m256 odd=_mm256_shuffle_ps(m0,m1,_MM_SHUFFLE(3,1,3,1));
+            __m256 r=_mm256_max_ps(even,odd);
+            r=_mm256_castpd_ps(_mm256_permute4x64_pd(_mm256_castps_pd(r),_MM_SHUFFLE(3,1,2,0)));
+            _mm256_storeu_ps(prow+x,r);
+        }
+#endif
+        for(;x<=x1;++x){
+            prow[x]=std::max(std::max(row0[2*x],row0[2*x+1]),std::max(row1[2*x],row1[2*x+1]));
+        }
+    }
 }
 
 void HZbuffer::updateDepth(uint32_t x,uint32_t y,float depth){
@@ -74,20 +140,25 @@ bool HZbuffer::rapidRefuseBox(const AABB3d& box){
         return true;
     }
     
+    if(deferred_)
+        buildPyramid();
+
     float nearest_depth=box.min.z;
 
     float box_length=std::max(box.max.y-box.min.y,box.max.x-box.min.x);
     int cur_level=fineset_level_-getLevel(box_length);
     float inv_unit=1.0/(std::pow(2,fineset_level_-cur_level));
 
-    int left=std::floor(box.min.x*inv_unit);
-    int right=std::floor(box.max.x*inv_unit);
-    int top=std::floor(box.max.y*inv_unit);
-    int down=std::floor(box.min.y*inv_unit);
+    // boxes of unclipped geometry may reach beyond the screen, only the part on it can be tested
+    DepthBuffer& level=hzb_[cur_level];
+    int left=std::max(0,(int)std::floor(box.min.x*inv_unit));
+    int right=std::min(level.width_-1,(int)std::floor(box.max.x*inv_unit));
+    int top=std::min(level.height_-1,(int)std::floor(box.max.y*inv_unit));
+    int down=std::max(0,(int)std::floor(box.min.y*inv_unit));
 
-    for(int r=top;r>=std::max(0,down);--r){
-        for(int c=std::max(0,left);c<=right;++c){
-            float depth=hzb_[cur_level].getDepth(c,r);
+    for(int r=top;r>=down;--r){
+        for(int c=left;c<=right;++c){
+            float depth=level.getDepth(c,r);
             // if this quarter is closer then we can't refuse this box
             if(depth>nearest_depth){
                 return false;
@@ -106,14 +177,26 @@ int HZbuffer::getLevel(float coarsest_length){
 
 bool HZbuffer::finestZTest(uint32_t x,uint32_t y, float new_depth){
     if(hzb_[fineset_level_].zTest(x,y,new_depth)==true){
-        updateDepth(x,y,new_depth);
+        if(deferred_)
+            markDirty(x,y);
+        else
+            updateDepth(x,y,new_depth);
         return true;
     }
     return false;
 }
 
 void HZbuffer::clear(){
-    for(auto& buffer:hzb_){
-        buffer.clear();
+    for(int i=0;i<fineset_level_;++i){
+        hzb_[i].clear();
+    }
+    resetFinest();
+    if(valid_width_==width_&&valid_height_==height_){
+        // every level is already at the far plane
+        dirty_min_x_=dirty_min_y_=srender::INF;
+        dirty_max_x_=dirty_max_y_=-1;
+    }
+    else{
+        buildPyramid();
     }
 }
\ No newline at end of file
@@ -8,8 +8,18 @@ public:
     HZbuffer(){};
     HZbuffer(uint32_t w,uint32_t h);
 
+    // propagate one finest-level write up to the root, used when the pyramid is maintained eagerly.
     void updateDepth(uint32_t x,uint32_t y,float depth);
 
+    /**
+     * @brief in deferred mode `finestZTest` only writes the finest level and records the dirty region,
+     *        the coarser levels are rebuilt in bulk by `buildPyramid` right before the next box test.
+     */
+    void setDeferredBuild(bool flag);
+
+    // rebuild the coarser levels above the dirty region with a max-reduction, 8 parents per step with AVX2.
+    void buildPyramid();
+
     // Refuse a 3d-box in screen space.
     bool rapidRefuseBox(const AABB3d& box);
 
@@ -21,10 +31,30 @@ public:
 
     DepthBuffer& getFinesetZbuffer(){return hzb_[fineset_level_];}
 
+private:
+    void resetFinest();
+    void reduceLevel(int level,int x0,int y0,int x1,int y1);
+    inline void markDirty(int x,int y){
+        dirty_min_x_=std::min(dirty_min_x_,x);
+        dirty_min_y_=std::min(dirty_min_y_,y);
+        dirty_max_x_=std::max(dirty_max_x_,x);
+        dirty_max_y_=std::max(dirty_max_y_,y);
+    }
+    inline bool isDirty()const{ return dirty_min_x_<=dirty_max_x_; }
+
 private:
     uint32_t width_;
     uint32_t height_;
+    uint32_t valid_width_;      // the image size, the rest of the power-of-two levels is padding
+    uint32_t valid_height_;
     uint32_t fineset_level_;
     std::vector<DepthBuffer> hzb_;
-    
+
+    bool deferred_=false;
+    // inclusive dirty rectangle of the finest level, empty when min>max
+    int dirty_min_x_=srender::INF;
+    int dirty_min_y_=srender::INF;
+    int dirty_max_x_=-1;
+    int dirty_max_y_=-1;
+
 };
\ No newline at end of file
@@ -13,7 +13,7 @@ void Render::initRenderIoInfo()
     info_.raster_setting_.bvh_leaf_num = 12;
     info_.raster_setting_.back_culling = true;
     info_.raster_setting_.earlyz_test = true;
-    info_.raster_setting_.rasterize_type = RasterizeType::Naive;
+    info_.raster_setting_.rasterize_type = RasterizeType::Edge_function;
     info_.raster_setting_.show_tlas = false;
     info_.raster_setting_.show_blas = false;
     info_.raster_setting_.shader_type = ShaderType::Depth;
@@ -52,7 +52,13 @@ void Render::GameLoop(){
         window.newImGuiFrame(); 
 
         // Different Pipeline
-        if(!info_.begin_path_tracing){
+        if(!info_.begin_path_tracing&&info_.tracer_setting_.interactive_){
+            this->progressivePathTracing();
+            during_path_tracing=false;
+        }
+        else if(!info_.begin_path_tracing){
+            this->stopPreview();
+
              // move camera according to the input
             this->moveCamera();
 
@@ -65,6 +71,7 @@ void Render::GameLoop(){
             during_path_tracing=false;
         }
         else if(!during_path_tracing){
+            this->stopPreview();
             std::thread rtwork(&Render::startPathTracer,this);
             rtwork.detach();
             during_path_tracing=true;
@@ -91,6 +98,7 @@ void Render::GameLoop(){
 // #endif
     }// game loop
 
+    stopPreview();
     window.shutdownImGui();
     glfwTerminate();
 
@@ -115,3 +123,74 @@ void Render::moveCamera(){
 void Render::handleMouseInput(double xoffset, double yoffset) {
     camera_.processMouseMovement(static_cast<float>(xoffset), static_cast<float>(yoffset));
 }
+
+
+/**
+ * @brief Refines the path traced view while the camera stands still. Once it moves, the running passes are
+ *        cancelled and a coarse film is traced at 1spp, the full resolution one starts when the camera stops.
+ */
+void Render::progressivePathTracing(){
+    moveCamera();
+
+    if(camera_.needUpdateView())
+        updateViewMatrix();
+
+    // input raises the flag of the camera even when it leaves the view as it was, only a new view restarts the film
+    if(preview_film_&&camera_.getViewMatrix()!=preview_view_){
+        startPreview(info_.tracer_setting_.preview_pixel_scale_);
+        preview_coarse_=true;
+    }
+    else if(preview_coarse_||!preview_film_){
+        startPreview(1);
+        preview_coarse_=false;
+    }
+}
+
+void Render::startPreview(int pixel_scale){
+    PROFILE_ZONE("Restart Preview");
+    // entering the interactive mode: emitters are sampled at the world positions written by the vertex shader
+    if(!preview_film_){
+        pipelineGeometryPhase();
+        auto& setting=info_.tracer_setting_;
+        scene_.setEnvironmentMap(setting.env_map_,setting.env_intensity_,glm::radians(setting.env_rotation_));
+        scene_.findAllEmitters();
+    }
+    cancelPreview();
+    std::shared_ptr<Film> history=info_.tracer_setting_.temporal_reuse_?preview_film_:nullptr;
+
+    // one sample per pixel in every pass, the primary hits are not rasterized for a film that may live a few ms
+    RTracingSetting setting=info_.tracer_setting_;
+    setting.spp_=1;
+    uint32_t target_passes=std::max<uint32_t>(info_.tracer_setting_.spp_,1);
+
+    preview_film_=camera_.getNewFilm(pixel_scale);
+    preview_film_->initTiles(setting,colorbuffer_,&scene_);
+    preview_view_=camera_.getViewMatrix();
+    info_.preview_passes_=0;
+
+    std::shared_ptr<Film> film=preview_film_;
+    float max_history=(float)info_.tracer_setting_.temporal_max_history_;
+    preview_thread_=std::thread([this,film,history,max_history,target_passes]()mutable{
+        PROFILE_THREAD("Preview");
+        if(history){
+            film->reprojectHistory(*history,max_history);
+            history.reset();
+        }
+        while(film->getPassNum()<target_passes&&film->renderPass(preview_cancel_))
+            info_.preview_passes_=film->getPassNum();
+    });
+}
+
+void Render::cancelPreview(){
+    if(!preview_thread_.joinable())
+        return;
+    // tiles give up at their next row
+    preview_cancel_=true;
+    preview_thread_.join();
+    preview_cancel_=false;
+}
+
+void Render::stopPreview(){
+    cancelPreview();
+    preview_film_=nullptr;
+}
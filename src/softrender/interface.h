@@ -4,6 +4,7 @@
 #include"common/cputimer.h"
 #include<string>
 #include<mutex>
+#include<atomic>
 
 struct RasterSetting{
 
@@ -24,6 +25,14 @@ struct RasterSetting{
     
     bool back_culling=true;
 
+    // only clip triangles that cross the near plane or leave the guard band, the rest is scissored
+    bool guard_band=true;
+
+    // build the coarser HZB levels in bulk before box tests instead of on every depth write
+    bool hzb_deferred_build=true;
+    // Bvh_hzb: draw the BLAS leaves visible last frame first, then test the rest against their HZB
+    bool hzb_two_pass_occlusion=true;
+
     // always true
     bool earlyz_test=true;
 };
@@ -33,6 +42,68 @@ struct RTracingSetting{
     uint32_t tiles_num_;
     uint32_t spp_;
     uint32_t light_split_;
+    // resampled light sampling(RIS): each light sample is picked among `light_candidates_` by its unshadowed
+    // contribution, 1 for plain light sampling. The interactive preview also reuses them over pixels and passes
+    uint32_t light_candidates_=1;
+    bool light_reuse_=true;
+    // take the first hit of camera rays from a rasterized id buffer instead of traversing the TLAS. Like the
+    // rasterizer, the camera then sees nothing closer than the near plane
+    bool raster_primary_=true;
+
+    // progressive path tracing in the window instead of rasterizing, refined up to `spp_` passes of 1spp
+    bool interactive_=false;
+    int preview_pixel_scale_=4;     // pixel size of the preview while the camera moves
+    // reproject the accumulated preview into the new view instead of starting over
+    bool temporal_reuse_=true;
+    int temporal_max_history_=32;   // weight cap of the reprojected history, in samples
+
+    // lat-long HDR map lighting the scene from infinitely far, none if empty
+    std::string env_map_;
+    float env_intensity_=1.f;
+    float env_rotation_=0.f;        // degrees around +y
+
+    // float channels(bits of `AOVType`) written next to the image, as pfm files
+    uint32_t aov_mask_=0;
+
+    // filter the finished image with its first-hit albedo, normal and depth, saved next to the raw one
+    bool denoise_=false;
+    int denoise_iterations_=5;      // of the a-trous filter, the kernel spans 2^(n+2)-3 pixels
+
+    // render in passes of `checkpoint_spp_` and save the float film every `checkpoint_interval_` seconds, 0 for off.
+    // A saved render of the same view is resumed, and can be continued to a higher `spp_`
+    int checkpoint_interval_=0;
+    uint32_t checkpoint_spp_=16;
+
+    // learn where the light comes from over `guiding_iterations_` passes of 1,2,4.. spp before rendering, and sample
+    // the bounces from it as well as from the bsdf. Not used by the interactive preview
+    bool path_guiding_=false;
+    int guiding_iterations_=4;
+
+    // end the paths at diffuse hits past `radiance_cache_depth_` bounces with the radiance cached there by earlier
+    // paths, a small bias for much fewer rays. The cache lives as long as the film, over all its passes, and holds
+    // `radiance_cache_cells_` cells(24 bytes each) that are only allocated when it is on
+    bool radiance_cache_=false;
+    int radiance_cache_depth_=2;
+    uint32_t radiance_cache_cells_=1u<<18;
+
+    // with Russian Roulette(`max_depth_` of 0), end or split the paths at each hit as it pays off for their pixel,
+    // learned from the paths of the passes so far. A render without passes is split into `splitting_passes_`
+    bool splitting_=false;
+    int splitting_passes_=4;
+
+    // photon map integrators: `photon_num_` photons per pass, gathered within `photon_radius_` of the scene size.
+    // More than one of `photon_passes_` splits the render into passes of new photons and a shrinking radius
+    IntegratorType integrator_=IntegratorType::PathTracing;
+    uint32_t photon_num_=200000;
+    float photon_radius_=0.01f;
+    int photon_passes_=1;
+    int photon_gather_rays_=4;      // final gather rays of a sample
+
+    // Metropolis integrator: `spp_` mutations per pixel spread over `mlt_chains_` chains, started from `mlt_bootstrap_`
+    // paths; a mutation is a large step(a new independent path) with probability `mlt_large_step_`
+    uint32_t mlt_chains_=1024;
+    uint32_t mlt_bootstrap_=100000;
+    float mlt_large_step_=0.3f;
 
     // std::string filepath_;
     // std::string filename_;
@@ -48,16 +119,39 @@ struct PerfCnt{
     int back_culled_face_num_=0;
     int clipped_face_num_=0;
     int hzb_culled_face_num_=0;
+    int guard_band_face_num_=0;     // partly outside the viewport but accepted without clipping
+    int geometric_clip_num_=0;      // triangles that went through polygon clipping
+    double clip_time_us_=0;         // time spent in polygon clipping, summed over threads
+    int prev_visible_leaf_num_=0;   // two-pass occlusion: leaves drawn in the first pass
+    int new_visible_leaf_num_=0;    // two-pass occlusion: leaves that became visible in the second pass
 
     // path tracer
 
 
+    void accumulate(const PerfCnt& other){
+        total_face_num_+=other.total_face_num_;
+        shaded_face_num_+=other.shaded_face_num_;
+        back_culled_face_num_+=other.back_culled_face_num_;
+        clipped_face_num_+=other.clipped_face_num_;
+        hzb_culled_face_num_+=other.hzb_culled_face_num_;
+        guard_band_face_num_+=other.guard_band_face_num_;
+        geometric_clip_num_+=other.geometric_clip_num_;
+        clip_time_us_+=other.clip_time_us_;
+        prev_visible_leaf_num_+=other.prev_visible_leaf_num_;
+        new_visible_leaf_num_+=other.new_visible_leaf_num_;
+    }
+
     void clear(){
         total_face_num_=0;
         shaded_face_num_=0;
         back_culled_face_num_=0;
         clipped_face_num_=0;
         hzb_culled_face_num_=0;
+        guard_band_face_num_=0;
+        geometric_clip_num_=0;
+        clip_time_us_=0;
+        prev_visible_leaf_num_=0;
+        new_visible_leaf_num_=0;
     }
 };
 
@@ -67,6 +161,7 @@ struct RenderIOInfo{
     std::mutex mx_msg_;             
     bool begin_path_tracing=false;  // trigger render to path tracing work mode.
     bool end_path_tracing=true;
+    std::atomic<uint32_t> preview_passes_{0};  // passes accumulated by the interactive path tracer
 
     /*------------thread safe-------------*/
     bool profile_report=true;
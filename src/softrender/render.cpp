@@ -2,6 +2,7 @@
 
 Render::Render() : camera_(), colorbuffer_(std::make_shared<ColorBuffer>(camera_.getImageWidth(), camera_.getImageHeight())),
                    zbuffer_(std::make_shared<DepthBuffer>(camera_.getImageWidth(), camera_.getImageHeight())),
+                   visbuffer_(std::make_shared<VisibilityBuffer>(camera_.getImageWidth(), camera_.getImageHeight())),
                    info_()
 {
 
@@ -11,6 +12,11 @@ Render::Render() : camera_(), colorbuffer_(std::make_shared<ColorBuffer>(camera_
     box3d_.max = {camera_.getImageWidth() - 1, camera_.getImageHeight() - 1, 1};
 }
 
+Render::~Render()
+{
+    stopPreview();
+}
+
 // once change camera property, we need to update VPV-matrix accordingly
 void Render::updateMatrix()
 {
@@ -20,15 +26,18 @@ void Render::updateMatrix()
 
 }
 
-void Render::addObjInstance(std::string filename, glm::mat4 &model, ShaderType shader, bool flipn, bool backculling)
+void Render::addObjInstance(std::string filename, glm::mat4 &model, ShaderType shader, bool flipn, bool backculling, bool compress_bvh)
 {
-    scene_.addObjInstance(filename,model,shader,flipn,backculling);
+    scene_.addObjInstance(filename,model,shader,flipn,backculling,compress_bvh);
 }
 
-void Render::pipelineInit()
+void Render::pipelineInit(const std::string& scene)
 {
+    PROFILE_THREAD("Render");
     // get default setting_
     initRenderIoInfo();
+    if (!scene.empty())
+        info_.filename_ = scene;
 
     // 1. load scene and camera setting
     loadDemoScene(info_.filename_, info_.raster_setting_.shader_type);
@@ -51,6 +60,7 @@ void Render::pipelineInit()
 
 
 void Render::startPathTracer(){
+    PROFILE_ZONE("Path Tracer");
 
     // preprocess: 
     {
@@ -58,38 +68,158 @@ void Render::startPathTracer(){
         info_.begin_path_tracing=true;
         info_.end_path_tracing=false;
     }
-    // 1.create film and tiles
-    std::shared_ptr<Film> film=camera_.getNewFilm();
-    film->initTiles(info_.tracer_setting_,colorbuffer_,&scene_);
-    // 2.make sure: world position and emitters are prepared
-    scene_.findAllEmitters();
+    std::shared_ptr<Film> film=createFilm(info_.tracer_setting_);
 
     CPUTimer timer;
     timer.start("Rendering");
 
     // rendering
-    int thread_num=film->parallelTiles();
+    int thread_num=film->render(info_.filename_+".ckpt");
 
     timer.stop("Rendering");
     
     info_.tracer_setting_.render_time_=timer.getElapsedTime("Rendering");
-    {
-        std::lock_guard<std::mutex> lock(info_.mx_msg_);
-        info_.end_path_tracing=true;
-        // info_.begin_path_tracing=false;  leave this to user to trigger
-    }
 
     // write to file
     auto pathinfo=info_.tracer_setting_;
 
-    colorbuffer_->saveToImage(info_.filename_    \
+    std::string filename=info_.filename_    \
                 +"_S"+std::to_string(pathinfo.spp_) \
                 +"_L"+std::to_string(info_.tracer_setting_.light_split_)    \
                 +"_D"+std::to_string(pathinfo.max_depth_)   \
                 +"_T"+std::to_string(info_.tracer_setting_.render_time_)   \
-                +"_C"+std::to_string(thread_num) \
-                +".png");
-    
+                +"_C"+std::to_string(thread_num);
+    colorbuffer_->saveToImage(filename+".png");
+    film->saveAOVs(filename);
+
+    // the denoised image replaces the raw one on screen
+    if(pathinfo.denoise_){
+        timer.start("Denoising");
+        film->denoise();
+        timer.stop("Denoising");
+        std::cout<<"Denoising time : "<<timer.getElapsedTime("Denoising")<<" s"<<std::endl;
+        colorbuffer_->saveToImage(filename+"_denoised.png");
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(info_.mx_msg_);
+        info_.end_path_tracing=true;
+        // info_.begin_path_tracing=false;  leave this to user to trigger
+    }
+
+}
+
+std::shared_ptr<Film> Render::createFilm(const RTracingSetting& setting,bool prepare){
+    // 1.create film and tiles
+    std::shared_ptr<Film> film=camera_.getNewFilm();
+    film->initTiles(setting,colorbuffer_,&scene_);
+    if(!prepare)
+        return film;
+    // 2.make sure: world position and emitters are prepared
+    scene_.setEnvironmentMap(setting.env_map_,setting.env_intensity_,glm::radians(setting.env_rotation_));
+    scene_.findAllEmitters();
+    // 3.primary visibility from the rasterizer
+    if (setting.raster_primary_)
+        film->setPrimaryHits(rasterizePrimaryHits());
+    return film;
+}
+
+/**
+ * @brief A film sample at pixel (i,j) with offset (ox,oy) looks through ndc ((i+ox)*2/W-1, 1-(j+oy)*2/H).
+ *        Each jittered pass maps ndc to a screen where that sample of pixel (i,H-1-j) sits on integer coordinates,
+ *        so the edge-function rasterizer can write film ids directly.
+ *        Depth is -1/w rather than ndc z: it is linear in screen space as well, but keeps its precision far from
+ *        the near plane, where ndc z can not separate e.g. an area light from the ceiling right behind it.
+ *        Geometry closer to the camera than the near plane is clipped away and not seen here, the camera rays that
+ *        use these hits start at the near plane as well.
+ *        A second pass over the faces covers whole pixels, and only keeps the faces no other one may hide in part,
+ *        see `PrimaryHitBuffer`.
+ */
+std::shared_ptr<PrimaryHitBuffer> Render::rasterizePrimaryHits()
+{
+    PROFILE_ZONE("Rasterize Primary Hits");
+    // a camera ray hits back faces too, so cull against the frustum only
+    bool back_culling = info_.raster_setting_.back_culling;
+    info_.raster_setting_.back_culling = false;
+    pipelineGeometryPhase();
+    info_.raster_setting_.back_culling = back_culling;
+
+    const int width = camera_.getImageWidth();
+    const int height = camera_.getImageHeight();
+    auto hits = std::make_shared<PrimaryHitBuffer>(width, height);
+    DepthBuffer depth(width, height);
+    auto &asinstances = scene_.getAllInstances();
+
+    for (int k = 0; k < PrimaryHitBuffer::JITTER_NUM; ++k)
+    {
+        glm::vec2 jitter = PrimaryHitBuffer::getJitter(k);
+        depth.clear();
+
+        for (uint32_t inst_id = 0; inst_id < asinstances.size(); ++inst_id)
+        {
+            auto &objvertices = *asinstances[inst_id]->vertices_;
+            auto &primitive_buffer = *asinstances[inst_id]->primitives_buffer_;
+
+            // primitives are stored per face, in face order
+            for (uint32_t face_id = 0; face_id < primitive_buffer.size(); ++face_id)
+            {
+                auto &prim = primitive_buffer[face_id];
+                if (prim.clipflag_ == ClipFlag::refused)
+                    continue;
+
+                for (int v = 0; v < prim.vertex_num_; v += 3)
+                {
+                    glm::vec3 t[3];
+                    float w[3];
+                    for (int i = 0; i < 3; ++i)
+                    {
+                        const glm::vec4 &c = objvertices[prim.vertex_start_pos_ + v + i].c_pos_;
+                        t[i] = glm::vec3((c.x / c.w + 1.f) * 0.5f * width - jitter.x,
+                                         (c.y / c.w + 1.f) * 0.5f * height - 1.f + jitter.y,
+                                         -1.f / c.w);
+                        w[i] = c.w;
+                    }
+
+                    EdgeRaster::TriangleSetup tri;
+                    if (!tri.setup(t, w, box2d_))
+                        continue;
+
+                    EdgeRaster::rasterizeTriangle(tri, depth.getData(), depth.getWidth(),
+                                                  [&](int x, int y, float, const glm::vec3 &)
+                                                  {
+                                                      hits->setID(k, x, height - 1 - y, inst_id, face_id);
+                                                  });
+                }
+            }
+        }
+    }
+
+    hits->resolve();
+
+    for (uint32_t inst_id = 0; inst_id < asinstances.size(); ++inst_id)
+    {
+        auto &objvertices = *asinstances[inst_id]->vertices_;
+        auto &primitive_buffer = *asinstances[inst_id]->primitives_buffer_;
+        for (uint32_t face_id = 0; face_id < primitive_buffer.size(); ++face_id)
+        {
+            auto &prim = primitive_buffer[face_id];
+            if (prim.clipflag_ == ClipFlag::refused)
+                continue;
+            for (int v = 0; v < prim.vertex_num_; v += 3)
+            {
+                // film pixels, y downwards
+                glm::vec3 p[3];
+                for (int i = 0; i < 3; ++i)
+                {
+                    const glm::vec4 &c = objvertices[prim.vertex_start_pos_ + v + i].c_pos_;
+                    p[i] = glm::vec3((c.x / c.w + 1.f) * 0.5f * width, (1.f - c.y / c.w) * 0.5f * height, -1.f / c.w);
+                }
+                hits->addOverlap(p, inst_id, face_id);
+            }
+        }
+    }
+    hits->resolveOcclusion();
+    return hits;
 }
 
 // drawLine in screen space
@@ -254,6 +384,225 @@ void Render::drawTriangleScanLine()
     }
 }
 
+// half-space rasterization: fixed-point edge functions, 8x8 block rejection and SIMD coverage per row
+void Render::drawTriangleEdge()
+{
+    ++info_.profile_.shaded_face_num_;
+
+    glm::vec3 t[3];
+    float w[3];
+    for (int i = 0; i < 3; ++i)
+    {
+        t[i] = sdptr_->getScreenPos(i);
+        w[i] = sdptr_->getVertices(i)->c_pos_.w;
+    }
+
+    if (ShaderType::Frame == sdptr_->getType())
+    {
+        AABB3d aabb(t[0], t[1], t[2]);
+        aabb.clipAABB(box3d_);
+        if (aabb.min.x >= aabb.max.x || aabb.min.y >= aabb.max.y)
+            return;
+        for (int i = 0; i < 3; ++i)
+        {
+            drawLine(t[i], t[(i + 1) % 3]);
+        }
+        return;
+    }
+
+    EdgeRaster::TriangleSetup tri;
+    if (!tri.setup(t, w, box2d_))
+        return;
+
+    EdgeRaster::rasterizeTriangle(tri, zbuffer_->getData(), zbuffer_->getWidth(),
+                                  [this](int x, int y, float depth, const glm::vec3 &bary)
+                                  {
+                                      sdptr_->bindFragmentBary(depth, bary);
+                                      sdptr_->fragmentShader(x, y);
+                                      colorbuffer_->setPixel(x, y, sdptr_->getColor());
+                                  });
+}
+
+void Render::pipelineVisibilityBuffer()
+{
+    PROFILE_ZONE("Frame(Visibility mode)");
+
+#ifdef TIME_RECORD
+    info_.rasterize_timer_.start("110.Geometry Phase");
+#endif
+
+    pipelineGeometryPhase();
+
+#ifdef TIME_RECORD
+    info_.rasterize_timer_.stop("110.Geometry Phase");
+#endif
+
+#ifdef TIME_RECORD
+    info_.rasterize_timer_.start("120.Rasterize Phase(Visibility mode)");
+#endif
+
+    rasterizeVisibility();
+
+#ifdef TIME_RECORD
+    info_.rasterize_timer_.stop("120.Rasterize Phase(Visibility mode)");
+#endif
+
+#ifdef TIME_RECORD
+    info_.rasterize_timer_.start("130.Deferred Shading");
+#endif
+
+    shadeVisibility();
+    // lines are depth-tested against the final z-buffer, after the visible surfaces are shaded
+    drawWireframeInstances();
+
+#ifdef TIME_RECORD
+    info_.rasterize_timer_.stop("130.Deferred Shading");
+#endif
+}
+
+// write depth and ids only. The primitives are walked through `primitives_buffer_` so that every triangle
+// of a clipped face keeps the material of that face.
+void Render::rasterizeVisibility()
+{
+    PROFILE_ZONE("Rasterize Visibility");
+    auto &asinstances = scene_.getAllInstances();
+    vis_tri_mtl_.resize(asinstances.size());
+
+    for (uint32_t inst_id = 0; inst_id < asinstances.size(); ++inst_id)
+    {
+        auto &ins = asinstances[inst_id];
+        if (ins->shader_ == ShaderType::Frame)
+            continue;
+
+        auto &objvertices = *ins->vertices_;
+        auto &tri_mtl = vis_tri_mtl_[inst_id];
+        tri_mtl.assign(objvertices.size() / 3, -1);
+
+        for (auto &prim : *ins->primitives_buffer_)
+        {
+            if (prim.clipflag_ == ClipFlag::refused)
+                continue;
+
+            for (int v = 0; v < prim.vertex_num_; v += 3)
+            {
+                ++info_.profile_.shaded_face_num_;
+                uint32_t tri_id = (prim.vertex_start_pos_ + v) / 3;
+                tri_mtl[tri_id] = prim.mtlidx_;
+
+                glm::vec3 t[3];
+                float w[3];
+                for (int i = 0; i < 3; ++i)
+                {
+                    t[i] = objvertices[tri_id * 3 + i].s_pos_;
+                    w[i] = objvertices[tri_id * 3 + i].c_pos_.w;
+                }
+
+                EdgeRaster::TriangleSetup tri;
+                if (!tri.setup(t, w, box2d_))
+                    continue;
+
+                EdgeRaster::rasterizeTriangle(tri, zbuffer_->getData(), zbuffer_->getWidth(),
+                                              [&](int x, int y, float, const glm::vec3 &)
+                                              {
+                                                  visbuffer_->setID(x, y, inst_id, tri_id);
+                                              });
+            }
+        }
+    }
+}
+
+// rebuild the perspective-correct barycenter of every visible pixel and shade it once, rows are split among threads.
+void Render::shadeVisibility()
+{
+    PROFILE_ZONE("Deferred Shading");
+    auto &asinstances = scene_.getAllInstances();
+    const int width = visbuffer_->getWidth();
+    const int height = visbuffer_->getHeight();
+    const float *depthbuf = zbuffer_->getData();
+    const int zstride = zbuffer_->getWidth();
+
+    ThreadPool::global().parallelRange(height, 16, [&](size_t y_begin, size_t y_end)
+    {
+        PROFILE_ZONE("Shade Rows");
+        // the shader keeps per-fragment state, so each task works on its own copy
+        Shader shader(*sdptr_);
+        uint32_t cur_inst = VisibilityBuffer::INVALID_ID;
+        int cur_mtl = -2;
+
+        for (int y = (int)y_begin; y < (int)y_end; ++y)
+        {
+            for (int x = 0; x < width; ++x)
+            {
+                uint32_t inst_id = visbuffer_->getInstID(x, y);
+                if (inst_id == VisibilityBuffer::INVALID_ID)
+                    continue;
+                uint32_t tri_id = visbuffer_->getTriID(x, y);
+                auto &ins = *asinstances[inst_id];
+
+                if (inst_id != cur_inst)
+                {
+                    shader.setShaderType(ins.shader_);
+                    shader.setPrimitiveType(ins.blas_->object_->getPrimitiveType());
+                    cur_inst = inst_id;
+                    cur_mtl = -2;
+                }
+
+                // binds the material if it has one
+                int midx = vis_tri_mtl_[inst_id][tri_id];
+                if (midx != cur_mtl)
+                {
+                    auto &objmtls = ins.blas_->object_->getMtls();
+                    if (midx >= 0 && midx < objmtls.size())
+                        shader.bindMaterial(objmtls[midx]);
+                    else
+                        shader.bindMaterial(nullptr);
+                    cur_mtl = midx;
+                }
+
+                Vertex *v = &(*ins.vertices_)[tri_id * 3];
+                shader.assemblePrimitive(v, v + 1, v + 2);
+
+                // perspective correct interpolation. The triangle covered this pixel, so it is not degenerate,
+                // but it can be far smaller than the threshold of utils::getBaryCenter: use double edge functions.
+                glm::dvec2 p0(v[0].s_pos_), p1(v[1].s_pos_), p2(v[2].s_pos_), p(x, y);
+                auto edge = [](const glm::dvec2 &a, const glm::dvec2 &b, const glm::dvec2 &c)
+                { return (b.x - a.x) * (c.y - a.y) - (b.y - a.y) * (c.x - a.x); };
+                double area = edge(p0, p1, p2);
+                if (area == 0.0)
+                    continue;
+                glm::dvec3 dbary(edge(p1, p2, p) / area, edge(p2, p0, p) / area, 0.0);
+                dbary.z = 1.0 - dbary.x - dbary.y;
+                glm::vec3 bary;
+                for (int i = 0; i < 3; ++i)
+                    bary[i] = float(dbary[i] / v[i].c_pos_.w);
+                bary /= (bary[0] + bary[1] + bary[2]);
+
+                shader.bindFragmentBary(depthbuf[y * zstride + x], bary);
+                shader.fragmentShader(x, y);
+                colorbuffer_->setPixel(x, y, shader.getColor());
+            }
+        }
+    });
+}
+
+void Render::drawWireframeInstances()
+{
+    for (auto &ins : scene_.getAllInstances())
+    {
+        if (ins->shader_ != ShaderType::Frame)
+            continue;
+
+        sdptr_->setShaderType(ins->shader_);
+        sdptr_->setPrimitiveType(ins->blas_->object_->getPrimitiveType());
+        auto &objvertices = *ins->vertices_;
+        for (size_t v = 0; v + 2 < objvertices.size(); v += 3)
+        {
+            sdptr_->assemblePrimitive(&objvertices[v], &objvertices[v + 1], &objvertices[v + 2]);
+            drawTriangleEdge();
+        }
+    }
+}
+
 void Render::pipelineBegin()
 {
 
@@ -299,6 +648,8 @@ void Render::pipelineBegin()
     if (camera_.needUpdateView())
         updateViewMatrix();
 
+    hzb_->setDeferredBuild(setting.hzb_deferred_build);
+
     // prepare for shader
     sdptr_->bindCamera(std::make_shared<Camera>(camera_));
     sdptr_->bindLights(scene_.getLights());
@@ -309,6 +660,10 @@ void Render::pipelineBegin()
     {
         pipelineHZB_BVH();
     }
+    else if (setting.rasterize_type == RasterizeType::Visibility_buffer)
+    {
+        pipelineVisibilityBuffer();
+    }
     else
     {
         pipelinePerInstance();
@@ -337,6 +692,7 @@ void Render::pipelineBegin()
 
 void Render::pipelineGeometryPhase()
 {
+    PROFILE_ZONE("Geometry Phase");
 
     auto &asinstances = scene_.getAllInstances();
     for (auto ins : asinstances)
@@ -353,26 +709,35 @@ void Render::pipelineGeometryPhase()
         sdptr_->bindNormalMat(&normal_mat);
         sdptr_->bindModelMat(&mat_model);
 
-        // MVP => clip space
-        for (auto &v : obj->getVertices())
-        {
-            sdptr_->vertexShader(v);
-        }
+        // MVP => clip space, in parallel over vertex ranges
+        auto &pool = ThreadPool::global();
+        auto &objvertices = obj->getVertices();
+        if (obj->getStreams().px.size() != objvertices.size())
+            obj->buildStreams();
+        const auto &streams = obj->getStreams();
+        pool.parallelRange(objvertices.size(), 4096, [&](size_t begin, size_t end)
+                           {
+                               PROFILE_ZONE("Vertex Shader");
+                               sdptr_->vertexShaderBatch(streams, objvertices, begin, end);
+                           });
 
         // culling
-
         cullingTriangleInstance(*ins, normal_mat);
 
         // clip space => NDC => screen space
-        for (auto &newv : *(ins->vertices_))
-        {
-            sdptr_->vertex2Screen(newv);
-        }
+        auto &newvertices = *(ins->vertices_);
+        pool.parallelRange(newvertices.size(), 4096, [&](size_t begin, size_t end)
+                           {
+                               PROFILE_ZONE("Vertex To Screen");
+                               for (size_t i = begin; i < end; ++i)
+                                   sdptr_->vertex2Screen(newvertices[i]);
+                           });
     }
 }
 
 void Render::pipelinePerInstance()
 {
+    PROFILE_ZONE("Frame(Per-Instance mode)");
 
 #ifdef TIME_RECORD
     info_.rasterize_timer_.start("110.Geometry Phase");
@@ -397,6 +762,7 @@ void Render::pipelinePerInstance()
 
 void Render::pipelineRasterizePhasePerInstance()
 {
+    PROFILE_ZONE("Rasterize Phase(Per-Instance mode)");
 
     // put each instance into the pipeline.
     auto &asinstances = scene_.getAllInstances();
@@ -446,6 +812,8 @@ void Render::pipelineRasterizePhasePerInstance()
                 drawTriangleScanLine();
             else if (info_.raster_setting_.rasterize_type == RasterizeType::Naive)
                 drawTriangleNaive();
+            else if (info_.raster_setting_.rasterize_type == RasterizeType::Edge_function)
+                drawTriangleEdge();
             else
             {
                 std::cerr << "unknown RasterizeType::setting_.rasterize_type\n";
@@ -460,6 +828,7 @@ void Render::pipelineRasterizePhasePerInstance()
 
 void Render::pipelineHZB_BVH()
 {
+    PROFILE_ZONE("Frame(HZB_BVH mode)");
 
 #ifdef TIME_RECORD
     info_.rasterize_timer_.start("110.Geometry Phase");
@@ -484,6 +853,7 @@ void Render::pipelineHZB_BVH()
 
 void Render::pipelineRasterizePhaseHZB_BVH()
 {
+    PROFILE_ZONE("Rasterize Phase(HZB_BVH mode)");
 
 #ifdef TIME_RECORD
     info_.rasterize_timer_.start("121.update SBox");
@@ -498,14 +868,36 @@ void Render::pipelineRasterizePhaseHZB_BVH()
     info_.rasterize_timer_.stop("121.update SBox");
 #endif
 
+    // the visibility of the last frame becomes the first-pass set of this frame
+    for (auto &inst : scene_.getAllInstances())
+    {
+        std::swap(inst->leaf_visible_, inst->leaf_visible_prev_);
+        std::fill(inst->leaf_visible_.begin(), inst->leaf_visible_.end(), 0);
+    }
+
+    if (info_.raster_setting_.hzb_two_pass_occlusion)
+    {
+#ifdef TIME_RECORD
+        info_.rasterize_timer_.start("122.Draw Previous Visible");
+#endif
+        drawPrevVisibleLeaves();
+        hzb_->buildPyramid();
 #ifdef TIME_RECORD
-    info_.rasterize_timer_.start("122.DfsTlas_BVHwithHZB()");
+        info_.rasterize_timer_.stop("122.Draw Previous Visible");
 #endif
-    auto &tlas_sboxes = *tlas.tlas_sboxes_;
-    DfsTlas_BVHwithHZB(tlas_tree, tlas_sboxes, scene_.getAllInstances(), 0);
+    }
 
 #ifdef TIME_RECORD
-    info_.rasterize_timer_.stop("122.DfsTlas_BVHwithHZB()");
+    info_.rasterize_timer_.start("123.DfsTlas_BVHwithHZB()");
+#endif
+    {
+        PROFILE_ZONE("DfsTlas_BVHwithHZB");
+        auto &tlas_sboxes = *tlas.tlas_sboxes_;
+        DfsTlas_BVHwithHZB(tlas_tree, tlas_sboxes, scene_.getAllInstances(), 0);
+    }
+
+#ifdef TIME_RECORD
+    info_.rasterize_timer_.stop("123.DfsTlas_BVHwithHZB()");
 #endif
 }
 
@@ -527,25 +919,25 @@ void Render::DfsTlas_BVHwithHZB(const std::vector<BVHnode> &tree, std::vector<AA
     }
 
     // ELSE dive deeper...
-    if (node.left > 0 && node.right > 0)
+    if (!node.isLeaf())
     {
         // select a nearer node as a prior candidate
-        AABB3d sbox_left = tlas_sboxes[node.left];
-        AABB3d sbox_right = tlas_sboxes[node.right];
+        AABB3d sbox_left = tlas_sboxes[node.left()];
+        AABB3d sbox_right = tlas_sboxes[node.right()];
         if (sbox_left.min.z < sbox_right.min.z)
         {
-            DfsTlas_BVHwithHZB(tree, tlas_sboxes, instances, node.left);
-            DfsTlas_BVHwithHZB(tree, tlas_sboxes, instances, node.right);
+            DfsTlas_BVHwithHZB(tree, tlas_sboxes, instances, node.left());
+            DfsTlas_BVHwithHZB(tree, tlas_sboxes, instances, node.right());
         }
         else
         {
-            DfsTlas_BVHwithHZB(tree, tlas_sboxes, instances, node.right);
-            DfsTlas_BVHwithHZB(tree, tlas_sboxes, instances, node.left);
+            DfsTlas_BVHwithHZB(tree, tlas_sboxes, instances, node.right());
+            DfsTlas_BVHwithHZB(tree, tlas_sboxes, instances, node.left());
         }
     }
-    else if (node.left == -1 && node.right == -1)
+    else
     {
-        auto &inst = instances[node.prmitive_start];
+        auto &inst = instances[node.offset];
         auto otype = inst->blas_->object_->getPrimitiveType();
 
         sdptr_->setShaderType(inst->shader_);
@@ -554,17 +946,9 @@ void Render::DfsTlas_BVHwithHZB(const std::vector<BVHnode> &tree, std::vector<AA
 
         DfsBlas_BVHwithHZB(*inst, 0);
     }
-    else if (node.left == -1 && node.right != -1)
-    {
-        DfsTlas_BVHwithHZB(tree, tlas_sboxes, instances, node.right);
-    }
-    else if (node.right == -1 && node.left != -1)
-    {
-        DfsTlas_BVHwithHZB(tree, tlas_sboxes, instances, node.left);
-    }
 }
 
-void Render::DfsBlas_BVHwithHZB(const ASInstance &inst, int32_t nodeIdx)
+void Render::DfsBlas_BVHwithHZB(ASInstance &inst, int32_t nodeIdx)
 {
     const std::vector<BVHnode> &tree = *inst.blas_->tree_;
 
@@ -583,75 +967,106 @@ void Render::DfsBlas_BVHwithHZB(const ASInstance &inst, int32_t nodeIdx)
     }
 
     // ELSE dive deeper...
-    if (node.left > 0 && node.right > 0)
+    if (!node.isLeaf())
     {
         // select a nearer node as the prior candidate
-        AABB3d sbox_left = inst.blas_sboxes_->at(node.left);
-        AABB3d sbox_right = inst.blas_sboxes_->at(node.right);
+        AABB3d sbox_left = inst.blas_sboxes_->at(node.left());
+        AABB3d sbox_right = inst.blas_sboxes_->at(node.right());
         if (sbox_left.min.z < sbox_right.min.z)
         {
-            DfsBlas_BVHwithHZB(inst, node.left);
-            DfsBlas_BVHwithHZB(inst, node.right);
+            DfsBlas_BVHwithHZB(inst, node.left());
+            DfsBlas_BVHwithHZB(inst, node.right());
         }
         else
         {
-            DfsBlas_BVHwithHZB(inst, node.right);
-            DfsBlas_BVHwithHZB(inst, node.left);
+            DfsBlas_BVHwithHZB(inst, node.right());
+            DfsBlas_BVHwithHZB(inst, node.left());
         }
     }
-    else if (node.left == -1 && node.right == -1)
+    else
     {
-        // reach the leaf: raseterize these triangles.
+        // reach the leaf: raseterize these triangles, unless the first pass already did.
+        inst.leaf_visible_[nodeIdx] = 1;
+        if (info_.raster_setting_.hzb_two_pass_occlusion)
+        {
+            if (inst.leaf_visible_prev_[nodeIdx])
+                return;
+            ++info_.profile_.new_visible_leaf_num_;
+        }
+        drawBlasLeafHZB(inst, nodeIdx);
+    }
+}
 
-        int st_primitive = tree[nodeIdx].prmitive_start;
+// rasterize the faces of a BLAS leaf with the HZB depth test
+void Render::drawBlasLeafHZB(const ASInstance &inst, int32_t nodeIdx)
+{
+    const std::vector<BVHnode> &tree = *inst.blas_->tree_;
 
-        for (int i = 0; i < tree[nodeIdx].primitive_num; ++i)
-        {
+    int st_primitive = tree[nodeIdx].offset;
 
-            uint32_t face_idx = inst.blas_->primitives_indices_->at(st_primitive + i);
-            auto &cur_face = inst.primitives_buffer_->at(face_idx);
+    for (int i = 0; i < tree[nodeIdx].primitive_num; ++i)
+    {
 
-            if (cur_face.clipflag_ == ClipFlag::clipped || cur_face.clipflag_ == ClipFlag::accecpted)
-            {
+        uint32_t face_idx = inst.blas_->primitives_indices_->at(st_primitive + i);
+        auto &cur_face = inst.primitives_buffer_->at(face_idx);
 
-                int32_t st_ver = cur_face.vertex_start_pos_;
-                auto &instvertices = *inst.vertices_;
-                auto &objmtls = inst.blas_->object_->getMtls();
+        if (cur_face.clipflag_ == ClipFlag::clipped || cur_face.clipflag_ == ClipFlag::accecpted)
+        {
 
-                for (int v = 0; v < cur_face.vertex_num_; v += 3)
-                { // >= 3 vertivces
+            int32_t st_ver = cur_face.vertex_start_pos_;
+            auto &instvertices = *inst.vertices_;
+            auto &objmtls = inst.blas_->object_->getMtls();
 
-                    Vertex *v1 = &instvertices[st_ver + v + 0];
-                    Vertex *v2 = &instvertices[st_ver + v + 1];
-                    Vertex *v3 = &instvertices[st_ver + v + 2];
+            for (int v = 0; v < cur_face.vertex_num_; v += 3)
+            { // >= 3 vertivces
 
-                    // assembly primitive
-                    sdptr_->assemblePrimitive(v1, v2, v3);
+                Vertex *v1 = &instvertices[st_ver + v + 0];
+                Vertex *v2 = &instvertices[st_ver + v + 1];
+                Vertex *v3 = &instvertices[st_ver + v + 2];
 
-                    // binds the material if it has one
-                    int midx = cur_face.mtlidx_;
-                    if (midx >= 0 && midx < objmtls.size())
-                    {
-                        sdptr_->bindMaterial(objmtls[midx]);
-                    }
-                    else
-                    {
-                        sdptr_->bindMaterial(nullptr);
-                    }
+                // assembly primitive
+                sdptr_->assemblePrimitive(v1, v2, v3);
 
-                    // render
-                    drawTriangleHZB();
+                // binds the material if it has one
+                int midx = cur_face.mtlidx_;
+                if (midx >= 0 && midx < objmtls.size())
+                {
+                    sdptr_->bindMaterial(objmtls[midx]);
+                }
+                else
+                {
+                    sdptr_->bindMaterial(nullptr);
                 }
+
+                // render
+                drawTriangleHZB();
             }
         }
     }
-    else if (node.left == -1 && node.right != -1)
-    {
-        DfsBlas_BVHwithHZB(inst, node.right);
-    }
-    else if (node.right == -1 && node.left != -1)
+}
+
+// first pass of the two-pass occlusion culling: draw the leaves that were visible in the previous frame
+// without testing them, their depth makes a good occluder set for testing everything else.
+void Render::drawPrevVisibleLeaves()
+{
+    PROFILE_ZONE("Draw Previous Visible");
+    for (auto &inst : scene_.getAllInstances())
     {
-        DfsBlas_BVHwithHZB(inst, node.left);
+        const std::vector<BVHnode> &tree = *inst->blas_->tree_;
+        bool shader_bound = false;
+        for (int32_t i = 0; i < (int32_t)tree.size(); ++i)
+        {
+            if (!inst->leaf_visible_prev_[i])
+                continue;
+            if (!shader_bound)
+            {
+                sdptr_->setShaderType(inst->shader_);
+                sdptr_->setPrimitiveType(inst->blas_->object_->getPrimitiveType());
+                shader_bound = true;
+            }
+            ++info_.profile_.prev_visible_leaf_num_;
+            drawBlasLeafHZB(*inst, i);
+        }
     }
 }
 
@@ -743,20 +1158,21 @@ void Render::traverseBVHandDraw(const std::vector<BVHnode> &tree, uint32_t nodeI
     }
 
     // dive into blas if possible and required
-    if (is_TLAS && node.left == -1 && node.right == -1)
+    if (is_TLAS && node.isLeaf())
     {
         if (info_.raster_setting_.show_blas)
         {
             auto &tlas = scene_.getTLAS();
-            uint32_t idx = node.prmitive_start;
+            uint32_t idx = node.offset;
             showBLAS(*(tlas.all_instances_.at(idx)));
         }
     }
 
-    if (node.left != -1)
-        traverseBVHandDraw(tree, node.left, is_TLAS, model);
-    if (node.right != -1)
-        traverseBVHandDraw(tree, node.right, is_TLAS, model);
+    if (!node.isLeaf())
+    {
+        traverseBVHandDraw(tree, node.left(), is_TLAS, model);
+        traverseBVHandDraw(tree, node.right(), is_TLAS, model);
+    }
 }
 
 // drawLine in screen space
@@ -874,6 +1290,7 @@ void Render::afterCameraUpdate()
 {
     colorbuffer_->reSetBuffer(camera_.getImageWidth(), camera_.getImageHeight());
     zbuffer_->reSetBuffer(camera_.getImageWidth(), camera_.getImageHeight());
+    visbuffer_->reSetBuffer(camera_.getImageWidth(), camera_.getImageHeight());
     updateMatrix();
 
     box2d_.min = {0, 0};
@@ -918,6 +1335,8 @@ void Render::cleanFrame()
     zbuffer_->clear();
     if (info_.raster_setting_.rasterize_type == RasterizeType::Easy_hzb || info_.raster_setting_.rasterize_type == RasterizeType::Bvh_hzb)
         hzb_->clear();
+    else if (info_.raster_setting_.rasterize_type == RasterizeType::Visibility_buffer)
+        visbuffer_->clear();
 
     if (info_.profile_report)
     {
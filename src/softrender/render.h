@@ -2,6 +2,7 @@
 #pragma once
 #include"common/common_include.h"
 #include"common/cputimer.h"
+#include"common/profiler.h"
 #include"softrender/shader.h"
 #include"camera.h"
 #include"scene_loader.h"
@@ -9,17 +10,31 @@
 #include"hzb.h"
 #include"common/AABB.h"
 #include"common/utils.h"
+#include"common/threadpool.h"
 #include"light.h"
 #include"softrender/scanline.h"
+#include"softrender/edgeraster.h"
 #include"softrender/interface.h"
 #include"window.h"
 #include"pathtracer.h"
 #include"film.h"
+#include"primaryhit.h"
+
+// output of culling one range of faces; the ranges are merged in face order by a prefix sum
+struct CullingChunk{
+    uint32_t face_begin_=0;
+    uint32_t face_end_=0;
+    size_t vertex_offset_=0;                    // position in the instance's vertex buffer after merging
+    std::vector<Vertex> vertices_;
+    std::vector<PrimitiveHolder> primitives_;   // vertex_start_pos_ is relative to `vertices_`
+    PerfCnt profile_;
+};
 
 class Render{
 public:
 
     Render();
+    ~Render();
 
     // MEMBER SETTING
 
@@ -27,7 +42,8 @@ public:
     void afterCameraUpdate();
 
     void setBVHLeafSize(uint32_t num){scene_.setBVHsize(num);}
-    void addObjInstance(std::string filename,glm::mat4& model,ShaderType shader,bool flipn=false,bool backculling=true);
+    void setBVHCompression(bool compressed,bool report=false){scene_.setBVHCompression(compressed,report);}
+    void addObjInstance(std::string filename,glm::mat4& model,ShaderType shader,bool flipn=false,bool backculling=true,bool compress_bvh=false);
 
     void setDeltaTime(float t){delta_time_=t;}
 
@@ -40,7 +56,8 @@ public:
     const Scene& getScene()const{ return scene_;}
 
     // RASTERIZATION PIPELINE
-    void pipelineInit();
+    // `scene`: one of the demo scenes, the default one if empty
+    void pipelineInit(const std::string& scene="");
     void pipelineBegin();
 
     void pipelineGeometryPhase();
@@ -50,15 +67,36 @@ public:
 
     void pipelineHZB_BVH();
     void pipelineRasterizePhaseHZB_BVH();
+
+    // visibility buffer: rasterize ids only, then interpolate and shade each visible pixel once
+    void pipelineVisibilityBuffer();
+    void rasterizeVisibility();
+    void shadeVisibility();
+    void drawWireframeInstances();
     
     void cullingTriangleInstance(ASInstance& instance,const glm::mat4 normal_mat);
+    void cullingTriangleRange(const ASInstance& instance,const glm::mat4& normal_mat,CullingChunk& chunk);
 
     int pipelineClipping(std::vector<Vertex>& v,std::vector<Vertex>& out);
-    void clipWithPlane(ClipPlane plane,std::vector<Vertex>&in,std::vector<Vertex>&out);
+    void clipWithPlane(ClipPlane plane,std::vector<Vertex>&in,std::vector<Vertex>&out,float guard=1.0f);
+    bool useGuardBand()const;
     bool backCulling(const glm::vec3& face_norm,const glm::vec3& dir)const;
 
     // PATH TRACING 
     void startPathTracer();
+    // a film of the current view with its tiles; `prepare` also gets the emitters and primary hits ready for tracing
+    std::shared_ptr<Film> createFilm(const RTracingSetting& setting,bool prepare=true);
+    // rasterize the ids of the faces seen by the camera of the film, see `PrimaryHitBuffer`
+    std::shared_ptr<PrimaryHitBuffer> rasterizePrimaryHits();
+
+    // INTERACTIVE PATH TRACING
+    // called every frame of the game loop instead of the raster pipeline
+    void progressivePathTracing();
+    // cancel the running preview and start accumulating a new film of the current view
+    void startPreview(int pixel_scale);
+    void cancelPreview();
+    // leave the interactive mode
+    void stopPreview();
 
 
     // INTERFACE
@@ -83,10 +121,13 @@ private:
     void drawTriangleNaive();
     void drawTriangleHZB();
     void drawTriangleScanLine();
+    void drawTriangleEdge();
 
     void traverseBVHandDraw(const std::vector<BVHnode>& tree,uint32_t nodeIdx,bool is_TLAS,const glm::mat4& model=glm::mat4(1.0));
     void DfsTlas_BVHwithHZB(const std::vector<BVHnode>& tree,std::vector<AABB3d> &tlas_sboxes,const std::vector<std::shared_ptr<ASInstance>>& instances,uint32_t nodeIdx);
-    void DfsBlas_BVHwithHZB(const ASInstance& inst,int32_t nodeIdx);
+    void DfsBlas_BVHwithHZB(ASInstance& inst,int32_t nodeIdx);
+    void drawBlasLeafHZB(const ASInstance& inst,int32_t nodeIdx);
+    void drawPrevVisibleLeaves();
 
 
     void initRenderIoInfo();
@@ -100,6 +141,8 @@ private:
     std::shared_ptr<ColorBuffer> colorbuffer_;
     std::shared_ptr<DepthBuffer> zbuffer_;
     std::shared_ptr<HZbuffer> hzb_;
+    std::shared_ptr<VisibilityBuffer> visbuffer_;
+    std::vector<std::vector<int>> vis_tri_mtl_;     // per instance: material index of each triangle in the visibility buffer
     Scene scene_;
     
     glm::mat4 mat_view_;        // world to camera
@@ -111,6 +154,16 @@ private:
 
     bool resize_viewport_flag_=false;
 
+    // reused between frames to avoid reallocating the culling outputs
+    std::vector<CullingChunk> culling_chunks_;
+
+    // interactive path tracing: a worker thread adds passes to `preview_film_` until cancelled
+    std::thread preview_thread_;
+    std::atomic<bool> preview_cancel_{false};
+    std::shared_ptr<Film> preview_film_;
+    bool preview_coarse_=false;     // the running preview is the coarse one of a moving camera
+    glm::mat4 preview_view_;        // the view `preview_film_` was started from
+
 public:
     // for ui
     float delta_time_;          // time spent to render last frame; (ms)
@@ -3,6 +3,7 @@
 
 void Render::loadDemoScene(std::string name, ShaderType shader)
 {
+    PROFILE_ZONE("Load Demo Scene");
 #ifdef TIME_RECORD
     info_.rasterize_timer_.start("loadDemoScene");
 #endif
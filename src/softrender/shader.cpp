@@ -1,5 +1,8 @@
 #include"shader.h"
 #include"common/utils.h"
+#ifdef __AVX2__
+#include<immintrin.h>
+#endif
 
 #define INSIDE(x,y,z,w) ((x)<(w)&&(x)>(-w))&&\
                        ((y)<(w)&&(y)>(-w))&&\
@@ -24,6 +27,61 @@ void Shader::vertexShader(Vertex& v ){
     // }
 }
 
+void Shader::vertexShaderBatch(const VertexStreams& in,std::vector<Vertex>& out,size_t begin,size_t end)const{
+    const glm::mat4& mvp=*mvp_;
+    const glm::mat4& m=*model_mat_;
+    const glm::mat4& nm=*normal_mat_;
+    size_t i=begin;
+
+#ifdef __AVX2__
+    // glm is column-major: row r of M*p is M[0][r]*x+M[1][r]*y+M[2][r]*z+M[3][r]*w
+    auto row=[](const glm::mat4& mat,int r,__m256 x,__m256 y,__m256 z,bool point){
+        __m256 res=_mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(mat[0][r]),x),_mm256_mul_ps(_mm256_set1_ps(mat[1][r]),y));
+        res=_mm256_add_ps(res,_mm256_mul_ps(_mm256_set1_ps(mat[2][r]),z));
+        return point?_mm256_add_ps(res,_mm256_set1_ps(mat[3][r])):res;
+    };
+    alignas(32) float buf[10][8];
+    for(;i+8<=end;i+=8){
+        __m256 px=_mm256_loadu_ps(&in.px[i]);
+        __m256 py=_mm256_loadu_ps(&in.py[i]);
+        __m256 pz=_mm256_loadu_ps(&in.pz[i]);
+        __m256 nx=_mm256_loadu_ps(&in.nx[i]);
+        __m256 ny=_mm256_loadu_ps(&in.ny[i]);
+        __m256 nz=_mm256_loadu_ps(&in.nz[i]);
+
+        for(int r=0;r<4;++r)
+            _mm256_store_ps(buf[r],row(mvp,r,px,py,pz,true));
+        for(int r=0;r<3;++r)
+            _mm256_store_ps(buf[4+r],row(m,r,px,py,pz,true));
+
+        __m256 wnx=row(nm,0,nx,ny,nz,false);
+        __m256 wny=row(nm,1,nx,ny,nz,false);
+        __m256 wnz=row(nm,2,nx,ny,nz,false);
+        __m256 len2=_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(wnx,wnx),_mm256_mul_ps(wny,wny)),_mm256_mul_ps(wnz,wnz));
+        __m256 inv_len=_mm256_div_ps(_mm256_set1_ps(1.0f),_mm256_sqrt_ps(len2));
+        _mm256_store_ps(buf[7],_mm256_mul_ps(wnx,inv_len));
+        _mm256_store_ps(buf[8],_mm256_mul_ps(wny,inv_len));
+        _mm256_store_ps(buf[9],_mm256_mul_ps(wnz,inv_len));
+
+        for(int l=0;l<8;++l){
+            Vertex& v=out[i+l];
+            v.c_pos_=glm::vec4(buf[0][l],buf[1][l],buf[2][l],buf[3][l]);
+            v.w_pos_=glm::vec3(buf[4][l],buf[5][l],buf[6][l]);
+            v.w_norm_=glm::vec3(buf[7][l],buf[8][l],buf[9][l]);
+        }
+    }
+#endif
+
+    for(;i<end;++i){
+        glm::vec4 p(in.px[i],in.py[i],in.pz[i],1.0f);
+        glm::vec4 n(in.nx[i],in.ny[i],in.nz[i],0.0f);
+        Vertex& v=out[i];
+        v.c_pos_=mvp*p;
+        v.w_pos_=m*p;
+        v.w_norm_=glm::normalize(glm::vec3(nm*n));
+    }
+}
+
 void Shader::vertex2Screen(Vertex& v ){
     // perspective division and viewport transformation
     assert(v.c_pos_.w>0.f);
@@ -165,9 +223,10 @@ void Shader::blinnphoneShader(Material& mtl){
     auto& v3=content_.v[2];
 
     // multiple lights shading by blinn-phong shader
-    for(auto light:lights_){
+    // (raw pointers: copying shared_ptrs per fragment makes threads fight over the reference counts)
+    for(const auto& light:lights_){
         if(LightType::Dirction==light->type_){
-            std::shared_ptr<DirLight> ptr=std::dynamic_pointer_cast<DirLight>(light);
+            const DirLight* ptr=dynamic_cast<const DirLight*>(light.get());
             if(ptr){
                 shadeDirectLight(*ptr,content_.normal,camera_->getPosition(),content_.fragpos,mtl); 
             }else{
@@ -176,7 +235,7 @@ void Shader::blinnphoneShader(Material& mtl){
             }
         }else{
             assert(LightType::Point==light->type_);
-            std::shared_ptr<PointLight> ptr=std::dynamic_pointer_cast<PointLight>(light);
+            const PointLight* ptr=dynamic_cast<const PointLight*>(light.get());
             if(ptr){
                 shadePointLight(*ptr,content_.normal,camera_->getPosition(),content_.fragpos,mtl);
             }else{
@@ -58,6 +58,11 @@ public:
     inline void bindLights(const std::vector<std::shared_ptr<Light>>& light){ lights_=light; }
     inline void bindTimer(CPUTimer* t){ timer_=t; }
     inline void bindFragmentHolder(const FragmentHolder& f){content_.bindFragment(f);}
+    // for rasterizers that already know the depth and the perspective-correct barycenter of the fragment
+    inline void bindFragmentBary(float depth,const glm::vec3& bary){
+        content_.depth=depth;
+        content_.vbary=bary;
+    }
 
     void setShaderType(ShaderType st);
 
@@ -94,6 +99,12 @@ public:
      * @param v : the vertex information holder
      */
     void vertexShader(Vertex& v );
+    /**
+     * @brief the same transform as `vertexShader` for vertices [begin,end), reading the SoA streams of the object
+     *        and processing 8 vertices per step with AVX2. Only reads the bound matrices, so disjoint ranges
+     *        can be shaded by different threads with the same Shader.
+     */
+    void vertexShaderBatch(const VertexStreams& in,std::vector<Vertex>& out,size_t begin,size_t end)const;
     void vertex2Screen(Vertex& v );
     void vertex2Screen(Vertex& v,AABB3d& box,AABB3d& screen_box);
 
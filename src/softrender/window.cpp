@@ -321,7 +321,9 @@ void Window::ImGuiSoftRenderWindow() {
 
         ImGui::Dummy(ImVec2(0.0f, 10.0f));
 
-        if (info_->begin_path_tracing)
+        // the rasterizer is idle while path tracing
+        bool disabled = info_->begin_path_tracing || info_->tracer_setting_.interactive_;
+        if (disabled)
             ImGui::BeginDisabled();
 
         // show_tlas
@@ -368,8 +370,8 @@ void Window::ImGuiSoftRenderWindow() {
             ImGui::EndCombo();
         }
 
-        const std::vector<std::string> rasterizeTypes = {"Naive" ,"Bvh_hzb", "Easy_hzb" ,"Scan_convert"};
-        const std::vector<RasterizeType> rasterizeValues = {RasterizeType::Naive,RasterizeType::Bvh_hzb,RasterizeType::Easy_hzb,RasterizeType::Scan_convert};
+        const std::vector<std::string> rasterizeTypes = {"Naive" ,"Bvh_hzb", "Easy_hzb" ,"Scan_convert", "Edge_function", "Visibility_buffer"};
+        const std::vector<RasterizeType> rasterizeValues = {RasterizeType::Naive,RasterizeType::Bvh_hzb,RasterizeType::Easy_hzb,RasterizeType::Scan_convert,RasterizeType::Edge_function,RasterizeType::Visibility_buffer};
         auto findIdx=[&setting,&rasterizeValues](){
             int idx=0;
             while(idx<rasterizeValues.size()){
@@ -429,6 +431,13 @@ void Window::ImGuiSoftRenderWindow() {
         // back_culling
         ImGui::Checkbox("Backface Culling", &setting.back_culling);
 
+        // guard_band
+        ImGui::Checkbox("Guard Band Clipping", &setting.guard_band);
+
+        // hzb_deferred_build & hzb_two_pass_occlusion
+        ImGui::Checkbox("Deferred HZB Build", &setting.hzb_deferred_build);
+        ImGui::Checkbox("Two-pass Occlusion Culling", &setting.hzb_two_pass_occlusion);
+
         // profile_report
         ImGui::Checkbox("Profile Report", &info_->profile_report);
 
@@ -438,9 +447,21 @@ void Window::ImGuiSoftRenderWindow() {
             ImGui::Text("Enable 'Profile Report' to view metrics.");
         }
 
-        
+#ifdef PROFILE_RECORD
+        // scoped profiler: the latest events of each thread, dumped as chrome trace json
+        bool record_trace=Profiler::isEnabled();
+        if (ImGui::Checkbox("Record Trace", &record_trace))
+            Profiler::setEnabled(record_trace);
+        ImGui::SameLine();
+        if (ImGui::Button("Dump Trace"))
+            Profiler::dumpChromeTrace(info_->filename_+"_trace.json");
+        ImGui::SameLine();
+        if (ImGui::Button("Clear Trace"))
+            Profiler::clear();
+#endif
+
 
-        if (info_->begin_path_tracing)
+        if (disabled)
             ImGui::EndDisabled();
 
     
@@ -475,6 +496,86 @@ void Window::ImGuiPathTracerWindow(){
         ImGui::Text("Light Split ");
         ImGui::SameLine();
         ImGui::SliderInt("##Light Split ", (int*)&info_->tracer_setting_.light_split_, 1, 4);
+        ImGui::Text("Light Candidates ");
+        ImGui::SameLine();
+        ImGui::SliderInt("##Light Candidates ", (int*)&info_->tracer_setting_.light_candidates_, 1, 64);
+        ImGui::Checkbox("Reuse Light Samples", &info_->tracer_setting_.light_reuse_);
+        ImGui::Checkbox("Rasterized Primary Hits", &info_->tracer_setting_.raster_primary_);
+        ImGui::Checkbox("Interactive Preview", &info_->tracer_setting_.interactive_);
+        ImGui::Text("Moving Pixel Size ");
+        ImGui::SameLine();
+        ImGui::SliderInt("##Moving Pixel Size ", &info_->tracer_setting_.preview_pixel_scale_, 1, 8);
+        ImGui::Checkbox("Temporal Reuse", &info_->tracer_setting_.temporal_reuse_);
+        ImGui::Text("Max History ");
+        ImGui::SameLine();
+        ImGui::SliderInt("##Max History ", &info_->tracer_setting_.temporal_max_history_, 1, 256);
+        static char env_map[256]="";
+        ImGui::Text("Environment Map ");
+        ImGui::SameLine();
+        if(ImGui::InputText("##Environment Map ", env_map, sizeof(env_map)))
+            info_->tracer_setting_.env_map_=env_map;
+        ImGui::Text("Environment Intensity ");
+        ImGui::SameLine();
+        ImGui::InputFloat("##Environment Intensity ", &info_->tracer_setting_.env_intensity_);
+        ImGui::Text("Environment Rotation ");
+        ImGui::SameLine();
+        ImGui::SliderFloat("##Environment Rotation ", &info_->tracer_setting_.env_rotation_, 0.f, 360.f);
+        ImGui::Checkbox("Denoise", &info_->tracer_setting_.denoise_);
+        ImGui::Text("Denoise Iterations ");
+        ImGui::SameLine();
+        ImGui::SliderInt("##Denoise Iterations ", &info_->tracer_setting_.denoise_iterations_, 1, 8);
+        ImGui::Text("Checkpoint Interval(s) ");
+        ImGui::SameLine();
+        ImGui::InputInt("##Checkpoint Interval ", &info_->tracer_setting_.checkpoint_interval_);
+        ImGui::Text("Checkpoint Pass SPP ");
+        ImGui::SameLine();
+        ImGui::InputScalar("##Checkpoint Pass SPP ", ImGuiDataType_U32, &info_->tracer_setting_.checkpoint_spp_);
+        ImGui::Checkbox("Path Guiding", &info_->tracer_setting_.path_guiding_);
+        ImGui::Text("Guiding Iterations ");
+        ImGui::SameLine();
+        ImGui::SliderInt("##Guiding Iterations ", &info_->tracer_setting_.guiding_iterations_, 1, 8);
+        ImGui::Checkbox("Radiance Cache", &info_->tracer_setting_.radiance_cache_);
+        ImGui::Text("Cache After Bounces ");
+        ImGui::SameLine();
+        ImGui::SliderInt("##Cache After Bounces ", &info_->tracer_setting_.radiance_cache_depth_, 1, 8);
+        ImGui::Checkbox("Russian Roulette Splitting", &info_->tracer_setting_.splitting_);
+        ImGui::Text("Splitting Passes ");
+        ImGui::SameLine();
+        ImGui::SliderInt("##Splitting Passes ", &info_->tracer_setting_.splitting_passes_, 1, 16);
+        const char* integrators[]={"Path Tracing","Photon Caustics","Photon Final Gather","Bidirectional","Metropolis"};
+        int integrator=(int)info_->tracer_setting_.integrator_;
+        ImGui::Text("Integrator ");
+        ImGui::SameLine();
+        if(ImGui::Combo("##Integrator ", &integrator, integrators, IM_ARRAYSIZE(integrators)))
+            info_->tracer_setting_.integrator_=IntegratorType(integrator);
+        ImGui::Text("Photons per Pass ");
+        ImGui::SameLine();
+        ImGui::InputScalar("##Photons per Pass ", ImGuiDataType_U32, &info_->tracer_setting_.photon_num_);
+        ImGui::Text("Photon Radius ");
+        ImGui::SameLine();
+        ImGui::InputFloat("##Photon Radius ", &info_->tracer_setting_.photon_radius_, 0.001f, 0.01f, "%.4f");
+        ImGui::Text("Photon Passes ");
+        ImGui::SameLine();
+        ImGui::SliderInt("##Photon Passes ", &info_->tracer_setting_.photon_passes_, 1, 64);
+        ImGui::Text("Final Gather Rays ");
+        ImGui::SameLine();
+        ImGui::SliderInt("##Final Gather Rays ", &info_->tracer_setting_.photon_gather_rays_, 1, 64);
+        ImGui::Text("MLT Chains ");
+        ImGui::SameLine();
+        ImGui::InputScalar("##MLT Chains ", ImGuiDataType_U32, &info_->tracer_setting_.mlt_chains_);
+        ImGui::Text("MLT Bootstrap Paths ");
+        ImGui::SameLine();
+        ImGui::InputScalar("##MLT Bootstrap Paths ", ImGuiDataType_U32, &info_->tracer_setting_.mlt_bootstrap_);
+        ImGui::Text("MLT Large Step ");
+        ImGui::SameLine();
+        ImGui::SliderFloat("##MLT Large Step ", &info_->tracer_setting_.mlt_large_step_, 0.f, 1.f);
+        if(ImGui::TreeNode("Output AOVs")){
+            for(int i=0;i<AOVBuffer::CHANNEL_NUM;++i){
+                AOVType type=AOVType(1<<i);
+                ImGui::CheckboxFlags(AOVBuffer::getName(type), &info_->tracer_setting_.aov_mask_, (unsigned)type);
+            }
+            ImGui::TreePop();
+        }
 
 
         if (info_->begin_path_tracing)
@@ -491,6 +592,8 @@ void Window::ImGuiPathTracerWindow(){
 
 
         ImGui::Text("· Render Time: %.2f", info_->tracer_setting_.render_time_);
+        if (info_->tracer_setting_.interactive_)
+            ImGui::Text("· Preview Passes: %u / %u", info_->preview_passes_.load(), info_->tracer_setting_.spp_);
 
     }
     ImGui::End();
@@ -522,6 +625,9 @@ void Window::showProfileReport(){
         ImGui::Text("· Back Culled Faces: %d", profile.back_culled_face_num_);
         ImGui::Text("· Clipped Faces: %d", profile.clipped_face_num_);
         ImGui::Text("· HZB Culled Faces: %d", profile.hzb_culled_face_num_);
+        ImGui::Text("· Guard Band Faces: %d", profile.guard_band_face_num_);
+        ImGui::Text("· Geometric Clips: %d (%.3f ms)", profile.geometric_clip_num_, profile.clip_time_us_/1000.0);
+        ImGui::Text("· Leaves Drawn First/Late: %d/%d", profile.prev_visible_leaf_num_, profile.new_visible_leaf_num_);
 
         ImGui::Dummy(ImVec2(0.0f, 10.0f)); 
         ImGui::NextColumn();